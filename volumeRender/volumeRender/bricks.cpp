@@ -0,0 +1,415 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Converts a raw volume to a .bvb file of bricks for out-of-core rendering
+//
+//     ./bricks -xsize=W -ysize=H -zsize=D [-type=uint8] [-compress [-mantissa=N]]
+//              input.raw [output.bvb]
+//
+// The input is x fastest, as initCpuFile() reads it, of voxels of the given
+// type (uint8, uint16, float or half); the output defaults to the input
+// path with .bvb appended.  -compress codes every brick on its own, which
+// on sparse or smooth volumes cuts the bytes the renderer reads several
+// times over; -mantissa=N first rounds float voxels to N of their 23
+// mantissa bits, for more on noisy data.  See volumeRender_bricks.h for
+// the format.
+//
+// The volume is streamed through one layer of bricks at a time, the
+// BRICK_FILE_SIZE + 1 slices it covers, so memory stays at that much
+// whatever the depth; the bricks of a layer are cut out, their value
+// ranges found and they are coded by one thread per core (-threads=N to
+// change that).
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "volumeRender_bricks.h"
+
+static const char *voxelTypeNames[4] = { "uint8", "uint16", "float", "half" };
+
+static float halfValue(unsigned short h)
+{
+    int e = (h >> 10) & 31, m = h & 1023;
+    float v = e == 0 ? ldexpf((float)m, -24) : e == 31 ? (m ? NAN : INFINITY) : ldexpf((float)(m + 1024), e - 25);
+    return h & 0x8000 ? -v : v;
+}
+
+// voxel i of a buffer as the renderer's voxelValue() gives it
+static float voxelValue(const char *data, size_t i, unsigned int type)
+{
+    switch (type)
+    {
+        case 0:
+            return ((const unsigned char *)data)[i];
+
+        case 1:
+            return ((const unsigned short *)data)[i];
+
+        case 2:
+            return ((const float *)data)[i];
+
+        default:
+            return halfValue(((const unsigned short *)data)[i]);
+    }
+}
+
+// reads the slices of brick layer bz, repeating the last slice of the
+// volume past its end
+static bool readLayer(FILE *in, const BrickFileHeader &h, int bz, std::vector<char> &layer)
+{
+    size_t sliceBytes = (size_t)h.width * h.height * h.voxelSize;
+    int z0 = bz * BRICK_FILE_SIZE;
+
+    for (int lz = 0; lz < BRICK_FILE_PITCH; lz++)
+    {
+        int z = z0 + lz < (int)h.depth ? z0 + lz : (int)h.depth - 1;
+        char *slice = &layer[(size_t)lz * sliceBytes];
+
+        if (z < z0 + lz)
+        {
+            memcpy(slice, slice - sliceBytes, sliceBytes);
+            continue;
+        }
+
+        if (fseeko(in, (off_t)z * sliceBytes, SEEK_SET) != 0 || fread(slice, 1, sliceBytes, in) != sliceBytes)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// rounds a float to the nearest with only the top bits of its mantissa,
+// leaving Inf and NaN alone
+static void roundMantissa(char *p, unsigned int bits)
+{
+    unsigned int x, drop = 23 - bits;
+    memcpy(&x, p, sizeof(x));
+
+    if ((x & 0x7f800000u) == 0x7f800000u)
+    {
+        return;
+    }
+
+    unsigned int rounded = (x + (1u << (drop - 1)) - 1 + ((x >> drop) & 1)) & ~((1u << drop) - 1);
+
+    // rounding the largest floats up would make them Inf
+    x = (rounded & 0x7f800000u) == 0x7f800000u ? x & ~((1u << drop) - 1) : rounded;
+    memcpy(p, &x, sizeof(x));
+}
+
+// cuts brick (bx, by) out of a layer into out, and finds its value range
+static void cutBrick(const BrickFileHeader &h, const std::vector<char> &layer, int bx, int by,
+                     char *out, float *range)
+{
+    size_t rowBytes = (size_t)h.width * h.voxelSize;
+    size_t sliceBytes = rowBytes * h.height;
+    size_t voxels = (size_t)BRICK_FILE_PITCH * BRICK_FILE_PITCH * BRICK_FILE_PITCH;
+    float lo = INFINITY, hi = -INFINITY;
+
+    memset(out, 0, (size_t)h.brickBytes);
+
+    for (int lz = 0; lz < BRICK_FILE_PITCH; lz++)
+    {
+        for (int ly = 0; ly < BRICK_FILE_PITCH; ly++)
+        {
+            int y = by * BRICK_FILE_SIZE + ly;
+            y = y < (int)h.height ? y : (int)h.height - 1;
+
+            const char *row = &layer[(size_t)lz * sliceBytes + (size_t)y * rowBytes];
+            char *o = out + ((size_t)lz * BRICK_FILE_PITCH + ly) * BRICK_FILE_PITCH * h.voxelSize;
+
+            for (int lx = 0; lx < BRICK_FILE_PITCH; lx++)
+            {
+                int x = bx * BRICK_FILE_SIZE + lx;
+                x = x < (int)h.width ? x : (int)h.width - 1;
+                memcpy(o + (size_t)lx * h.voxelSize, row + (size_t)x * h.voxelSize, h.voxelSize);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < voxels; i++)
+    {
+        if (h.mantissaBits)
+        {
+            roundMantissa(out + i * sizeof(float), h.mantissaBits);
+        }
+
+        float v = voxelValue(out, i, h.voxelType);
+        lo = fminf(lo, v);
+        hi = fmaxf(hi, v);
+    }
+
+    range[0] = lo;
+    range[1] = hi;
+}
+
+static bool writeBricks(FILE *in, const char *inPath, FILE *out, const char *outPath, int threadCount,
+                        BrickFileHeader &h)
+{
+    bool compressed = h.version == BRICK_FILE_VERSION_COMPRESSED;
+    size_t bricks = (size_t)h.bricksX * h.bricksY * h.bricksZ;
+    std::vector<float> ranges(bricks * 2);
+    std::vector<char> layer((size_t)BRICK_FILE_PITCH * h.width * h.height * h.voxelSize);
+    size_t rowBytes = (size_t)h.bricksX * h.brickBytes;
+    size_t rawBytes = (size_t)BRICK_FILE_PITCH * BRICK_FILE_PITCH * BRICK_FILE_PITCH * h.voxelSize;
+
+    // one row of bricks per thread at a time, and their codes
+    int rowsAtOnce = threadCount < (int)h.bricksY ? threadCount : (int)h.bricksY;
+    std::vector<char> rows(rowsAtOnce * rowBytes);
+    std::vector<BrickFileEntry> entries(compressed ? bricks : 0);
+    std::vector<std::vector<unsigned char> > coded(compressed ? rowsAtOnce * h.bricksX : 0);
+    unsigned long long end = h.brickOffset;
+
+    if (fseeko(out, (off_t)h.brickOffset, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Error writing file '%s'\n", outPath);
+        return false;
+    }
+
+    for (int bz = 0; bz < (int)h.bricksZ; bz++)
+    {
+        if (!readLayer(in, h, bz, layer))
+        {
+            fprintf(stderr, "Error reading '%s': file ends early\n", inPath);
+            return false;
+        }
+
+        for (int by0 = 0; by0 < (int)h.bricksY; by0 += rowsAtOnce)
+        {
+            int rowCount = by0 + rowsAtOnce < (int)h.bricksY ? rowsAtOnce : (int)h.bricksY - by0;
+            std::vector<std::thread> threads;
+
+            for (int r = 0; r < rowCount; r++)
+            {
+                threads.push_back(std::thread([&, r]()
+                {
+                    size_t first = ((size_t)bz * h.bricksY + by0 + r) * h.bricksX;
+                    std::vector<unsigned char> scratch(compressed ? 2 * brickRleBound(rawBytes) : 0);
+
+                    for (int bx = 0; bx < (int)h.bricksX; bx++)
+                    {
+                        char *brick = &rows[r * rowBytes + (size_t)bx * h.brickBytes];
+                        cutBrick(h, layer, bx, by0 + r, brick, &ranges[(first + bx) * 2]);
+
+                        if (compressed)
+                        {
+                            std::vector<unsigned char> &code = coded[r * h.bricksX + bx];
+                            BrickFileEntry &entry = entries[first + bx];
+                            code.resize(brickRleBound(rawBytes));
+                            brickEncode((const unsigned char *)brick, rawBytes, h.voxelSize, &code[0], &scratch[0], entry);
+                            code.resize(entry.bytes);
+                        }
+                    }
+                }));
+            }
+
+            for (size_t t = 0; t < threads.size(); t++)
+            {
+                threads[t].join();
+            }
+
+            if (!compressed)
+            {
+                if (fwrite(&rows[0], 1, rowCount * rowBytes, out) != rowCount * rowBytes)
+                {
+                    fprintf(stderr, "Error writing file '%s'\n", outPath);
+                    return false;
+                }
+
+                continue;
+            }
+
+            // the bricks in order, each where its entry says
+            for (int r = 0; r < rowCount; r++)
+            {
+                size_t first = ((size_t)bz * h.bricksY + by0 + r) * h.bricksX;
+
+                for (int bx = 0; bx < (int)h.bricksX; bx++)
+                {
+                    std::vector<unsigned char> &code = coded[r * h.bricksX + bx];
+                    BrickFileEntry &entry = entries[first + bx];
+
+                    if (entry.codec == BRICK_CODEC_CONSTANT)
+                    {
+                        continue;
+                    }
+
+                    entry.offset = end;
+                    end += code.size();
+
+                    if (fwrite(&code[0], 1, code.size(), out) != code.size())
+                    {
+                        fprintf(stderr, "Error writing file '%s'\n", outPath);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    h.rawMin = INFINITY;
+    h.rawMax = -INFINITY;
+
+    for (size_t i = 0; i < bricks; i++)
+    {
+        h.rawMin = fminf(h.rawMin, ranges[i * 2]);
+        h.rawMax = fmaxf(h.rawMax, ranges[i * 2 + 1]);
+    }
+
+    // the index follows the ranges
+    if (fseeko(out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, out) != 1 ||
+        fwrite(&ranges[0], sizeof(float), ranges.size(), out) != ranges.size() ||
+        (compressed && fwrite(&entries[0], sizeof(BrickFileEntry), entries.size(), out) != entries.size()))
+    {
+        fprintf(stderr, "Error writing file '%s'\n", outPath);
+        return false;
+    }
+
+    if (compressed)
+    {
+        size_t constant = 0;
+
+        for (size_t i = 0; i < bricks; i++)
+        {
+            constant += entries[i].codec == BRICK_CODEC_CONSTANT;
+        }
+
+        printf("Coded %.1f MB of bricks into %.1f MB, %llu of %llu bricks of one value\n",
+               (double)bricks * rawBytes / (1 << 20), (double)(end - h.brickOffset) / (1 << 20),
+               (unsigned long long)constant, (unsigned long long)bricks);
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *paths[2] = { 0, 0 };
+    int pathCount = 0;
+    int threadCount = (int)std::thread::hardware_concurrency();
+    long long size[3] = { 0, 0, 0 };
+    int type = 0;
+    bool compress = false;
+    int mantissaBits = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "-threads=", 9))
+        {
+            threadCount = atoi(argv[i] + 9);
+        }
+        else if (!strcmp(argv[i], "-compress"))
+        {
+            compress = true;
+        }
+        else if (!strncmp(argv[i], "-mantissa=", 10))
+        {
+            mantissaBits = atoi(argv[i] + 10);
+        }
+        else if (!strncmp(argv[i], "-xsize=", 7) || !strncmp(argv[i], "-ysize=", 7) || !strncmp(argv[i], "-zsize=", 7))
+        {
+            size[argv[i][1] - 'x'] = atoll(argv[i] + 7);
+        }
+        else if (!strncmp(argv[i], "-type=", 6))
+        {
+            for (type = 0; type < 4 && strcmp(argv[i] + 6, voxelTypeNames[type]); type++)
+            {
+            }
+        }
+        else if (pathCount < 2)
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            pathCount = 3;
+        }
+    }
+
+    // -mantissa applies to float voxels, and only pays when compressing
+    bool mantissaValid = mantissaBits == 0 || (compress && type == 2 && mantissaBits > 0 && mantissaBits < 23);
+
+    if (pathCount < 1 || pathCount > 2 || type == 4 || !mantissaValid ||
+        size[0] <= 0 || size[1] <= 0 || size[2] <= 0 || size[0] > 1 << 30 || size[1] > 1 << 30 || size[2] > 1 << 30)
+    {
+        fprintf(stderr, "Usage: %s -xsize=W -ysize=H -zsize=D [-type=uint8|uint16|float|half] [-threads=N] "
+                        "[-compress [-mantissa=1..22]] input.raw [output.bvb]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    threadCount = threadCount > 0 ? threadCount : 1;
+
+    BrickFileHeader header;
+    brickFileHeader(header, (unsigned int)size[0], (unsigned int)size[1], (unsigned int)size[2],
+                    type, brickFileVoxelSize[type], compress);
+    header.mantissaBits = mantissaBits;
+
+    FILE *in = fopen(paths[0], "rb");
+    struct stat inStat;
+
+    if (!in || fstat(fileno(in), &inStat) != 0)
+    {
+        fprintf(stderr, "Error opening file '%s'\n", paths[0]);
+
+        if (in) fclose(in);
+
+        return EXIT_FAILURE;
+    }
+
+    if ((unsigned long long)inStat.st_size < (unsigned long long)size[0] * size[1] * size[2] * header.voxelSize)
+    {
+        fprintf(stderr, "'%s' is smaller than %lldx%lldx%lld %s voxels\n", paths[0],
+                size[0], size[1], size[2], voxelTypeNames[type]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    std::string outPath = paths[1] ? std::string(paths[1]) : std::string(paths[0]) + ".bvb";
+    FILE *out = fopen(outPath.c_str(), "wb");
+
+    if (!out)
+    {
+        fprintf(stderr, "Error creating file '%s'\n", outPath.c_str());
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    bool ok = writeBricks(in, paths[0], out, outPath.c_str(), threadCount, header);
+
+    fclose(in);
+
+    if (fclose(out) != 0 && ok)
+    {
+        fprintf(stderr, "Error writing file '%s'\n", outPath.c_str());
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        remove(outPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("Wrote '%s': %ux%ux%u bricks of %d^3 %s voxels\n", outPath.c_str(),
+           header.bricksX, header.bricksY, header.bricksZ, BRICK_FILE_SIZE, voxelTypeNames[type]);
+
+    return EXIT_SUCCESS;
+}
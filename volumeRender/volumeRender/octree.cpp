@@ -0,0 +1,881 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Converts the text listing of an octree to a .boc file
+//
+//     ./octree path/to/input                  (writes path/to/input.boc)
+//     ./octree path/to/input path/to/output.boc
+//     ./octree -collapse=0.001 path/to/input.boc path/to/output.boc
+//
+// See volumeRender_octree.h for both formats.  -threads=N sets the number
+// of parser threads (default: one per core).  -collapse[=tolerance]
+// replaces subtrees whose densities lie within the tolerance (default 0)
+// by single leaves, see Collapser; given a .boc file as input, that is all
+// the tool does.
+//
+// The input is streamed through in blocks of OCTREE_BLOCK_SIZE bytes, so
+// memory stays bounded however large the tree.  Each block is cut into one
+// chunk per thread at line ends, and the chunks are parsed in parallel,
+// each into a list of its nodes and a summary: how many nodes and lines it
+// holds and how it changes the number of nodes the tree still expects.  An
+// exclusive prefix sum over the summaries gives every chunk its place in
+// the output and the number of open nodes it starts with, so checking the
+// structure (every parent needs its eight children, and nothing may follow
+// the last node of the tree) needs one pass over the summaries, not over
+// the nodes.  The nodes then go through an OctreeLevelBuilder in chunk
+// order, which sorts them into one temporary file per level; the output,
+// a version 2 .boc file, is those files joined.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "volumeRender_octree.h"
+
+// bytes of text parsed at a time; the nodes of a block take at most twice
+// as much (a node is at least two characters and four bytes)
+#define OCTREE_BLOCK_SIZE (64 << 20)
+
+////////////////////////////////////////////////////////////////////////////////
+// number parsing
+////////////////////////////////////////////////////////////////////////////////
+
+static const double powersOf10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses the decimal float at [p, end) like from_chars(): no locale, no
+// copy and no allocation, returning where the number ends (p if there is
+// none).  Up to 19 significant digits are gathered into an integer and
+// scaled by powers of ten in double, which is far more precise than a
+// float needs.  Only where that lands within 2^-44 of the halfway point
+// between two floats could the rounding go either way; those numbers go
+// through strtof(), as do hex, inf and longer mantissas, so the result is
+// always the one strtof() gives.
+static const char *parseFloat(const char *p, const char *end, float &value)
+{
+    const char *begin = p;
+    bool negative = false;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    unsigned long long mantissa = 0;
+    int digits = 0;             // significant digits in mantissa
+    int exponent = 0;
+    bool any = false;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        any = true;
+
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            digits = 20;        // too many for the fast path
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            any = true;
+
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+            else
+            {
+                digits = 20;
+            }
+        }
+    }
+
+    if (any && p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool negativeExp = false;
+        int e = 0;
+
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negativeExp = *q == '-';
+            q++;
+        }
+
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+            {
+                e = e < 10000 ? e * 10 + (*q - '0') : e;
+            }
+
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any && digits <= 19)
+    {
+        double d = (double)mantissa;
+
+        // past these the value is 0 or Inf as a float either way
+        exponent = exponent < -400 ? -400 : (exponent > 400 ? 400 : exponent);
+
+        while (mantissa != 0 && exponent < -22)
+        {
+            d /= powersOf10[22];
+            exponent += 22;
+        }
+
+        while (mantissa != 0 && exponent > 22)
+        {
+            d *= powersOf10[22];
+            exponent -= 22;
+        }
+
+        d = exponent < 0 ? d / powersOf10[-exponent] : d * powersOf10[exponent];
+
+        float f = (float)d;
+        float other = nextafterf(f, d > f ? INFINITY : 0.0f);
+        double halfway = 0.5 * ((double)f + (double)other);
+
+        if (d == (double)f || (!isinf(f) && fabs(d - halfway) > ldexp(d, -44)))
+        {
+            value = negative ? -f : f;
+            return p;
+        }
+    }
+
+    // the rare rest, through a terminated copy
+    char token[128];
+    size_t n = 0;
+
+    for (p = begin; p < end && n + 1 < sizeof(token) && *p != '\n' && *p != ' ' && *p != '\t' && *p != '\r'; p++)
+    {
+        token[n++] = *p;
+    }
+
+    token[n] = 0;
+
+    char *tokenEnd;
+    value = strtof(token, &tokenEnd);
+    return begin + (tokenEnd - token);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// chunks
+////////////////////////////////////////////////////////////////////////////////
+
+// what parsing one chunk of text found
+struct Chunk
+{
+    const char *begin, *end;
+    std::vector<float> nodes;       // .boc values, parents as the marker
+    unsigned long long lines;       // up to the error, if any
+    const char *error;
+
+    // Each node takes one of the nodes the tree expects and a parent adds
+    // eight: the tree starts expecting the root and is complete when it
+    // expects nothing.  delta is the change over the chunk, minBefore the
+    // lowest change seen before any of its nodes (relative to the start).
+    long long delta, minBefore;
+};
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parses nodes from chunk.begin until chunk.end, the first error, or
+// maxNodes nodes, whichever comes first.  Lines hold one number each;
+// blank lines are allowed.
+static void parseChunk(Chunk &chunk, size_t maxNodes)
+{
+    const char *p = chunk.begin;
+    long long open = 0;
+
+    chunk.nodes.clear();
+    chunk.lines = 0;
+    chunk.error = 0;
+    chunk.delta = 0;
+    chunk.minBefore = 0;
+
+    while (p < chunk.end && chunk.nodes.size() < maxNodes)
+    {
+        while (p < chunk.end && isBlank(*p)) p++;
+
+        if (p < chunk.end && *p == '\n')
+        {
+            p++;
+            chunk.lines++;
+            continue;
+        }
+
+        if (p == chunk.end) break;
+
+        float value;
+        const char *q = parseFloat(p, chunk.end, value);
+
+        while (q < chunk.end && isBlank(*q)) q++;
+
+        if (q == p || (q < chunk.end && *q != '\n') || value != value)
+        {
+            chunk.error = "not a number";
+            break;
+        }
+
+        chunk.minBefore = open < chunk.minBefore ? open : chunk.minBefore;
+
+        if (value == 2.0f)
+        {
+            chunk.nodes.push_back(octreeParentMarker());
+            open += 7;
+        }
+        else
+        {
+            chunk.nodes.push_back(value);
+            open -= 1;
+        }
+
+        p = q < chunk.end ? q + 1 : q;
+        chunk.lines++;
+    }
+
+    chunk.delta = open;
+}
+
+// the line a node of the chunk is on, counted from the chunk's start
+static unsigned long long lineOfNode(const Chunk &chunk, size_t node)
+{
+    Chunk scan;
+    scan.begin = chunk.begin;
+    scan.end = chunk.end;
+    parseChunk(scan, node + 1);
+    return scan.lines;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// output
+////////////////////////////////////////////////////////////////////////////////
+
+// one temporary file per level for the nodes and leaves the builder has
+// finished, created when the level first has any
+struct LevelFiles
+{
+    FILE *nodes[OCTREE_MAX_DEPTH + 1];
+    FILE *leaves[OCTREE_MAX_DEPTH + 1];
+};
+
+template <typename T>
+static bool spill(std::vector<T> &list, FILE *&fp)
+{
+    if (list.empty()) return true;
+
+    if (!fp && !(fp = tmpfile())) return false;
+
+    bool ok = fwrite(list.data(), sizeof(T), list.size(), fp) == list.size();
+    list.clear();
+    return ok;
+}
+
+// moves the builder's lists to the level files
+static bool spillLevels(OctreeLevelBuilder &builder, LevelFiles &files)
+{
+    bool ok = true;
+
+    for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+    {
+        ok = spill(builder.nodes[level], files.nodes[level]) && ok;
+        ok = spill(builder.leaves[level], files.leaves[level]) && ok;
+    }
+
+    return ok;
+}
+
+static bool pad(FILE *out, unsigned long long &offset, unsigned long long to)
+{
+    for (; offset < to; offset++)
+    {
+        if (fputc(0, out) == EOF) return false;
+    }
+
+    return true;
+}
+
+static void relocate(OctreeFileNode *nodes, size_t count, int level,
+                     const unsigned long long *nodeStart, const unsigned long long *leafStart)
+{
+    OctreeLevelBuilder::relocate(nodes, count, level, nodeStart, leafStart);
+}
+
+static void relocate(float *, size_t, int, const unsigned long long *, const unsigned long long *)
+{
+}
+
+// appends a level file to the output, OCTREE_BLOCK_SIZE bytes at a time;
+// node indices are made absolute on the way
+template <typename T>
+static bool join(FILE *out, FILE *fp, unsigned long long &offset, int level,
+                 const unsigned long long *nodeStart, const unsigned long long *leafStart)
+{
+    if (!fp) return true;
+
+    std::vector<T> buffer(OCTREE_BLOCK_SIZE / sizeof(T));
+    rewind(fp);
+
+    for (;;)
+    {
+        size_t n = fread(buffer.data(), sizeof(T), buffer.size(), fp);
+
+        if (n == 0) break;
+
+        relocate(buffer.data(), n, level, nodeStart, leafStart);
+
+        if (fwrite(buffer.data(), sizeof(T), n, out) != n) return false;
+
+        offset += n * sizeof(T);
+    }
+
+    return !ferror(fp);
+}
+
+// writes the version 2 file: the header, every level's nodes, every
+// level's leaves
+static bool writeTree(FILE *out, const OctreeLevelBuilder &builder, const LevelFiles &files,
+                      const OctreeFileHeader &header)
+{
+    unsigned long long nodeStart[OCTREE_MAX_DEPTH + 1], leafStart[OCTREE_MAX_DEPTH + 1];
+    builder.levelStarts(nodeStart, leafStart);
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1) return false;
+
+    unsigned long long offset = sizeof(header);
+
+    if (!pad(out, offset, header.nodeOffset)) return false;
+
+    for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+    {
+        if (!join<OctreeFileNode>(out, files.nodes[level], offset, level, nodeStart, leafStart)) return false;
+    }
+
+    if (!pad(out, offset, header.leafOffset)) return false;
+
+    for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+    {
+        if (!join<float>(out, files.leaves[level], offset, level, nodeStart, leafStart)) return false;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// building
+////////////////////////////////////////////////////////////////////////////////
+
+static void closeLevels(LevelFiles &files)
+{
+    for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+    {
+        if (files.nodes[level]) fclose(files.nodes[level]);
+        if (files.leaves[level]) fclose(files.leaves[level]);
+    }
+}
+
+// Builds the tree listed in the text at in and writes it to out; false,
+// with a message, if the text is no complete tree or out cannot be written.
+static bool buildTree(FILE *in, const char *inPath, int threadCount, FILE *out, const char *outPath,
+                      OctreeFileHeader &header)
+{
+    OctreeLevelBuilder builder;
+    LevelFiles files;
+    memset(&files, 0, sizeof(files));
+
+    std::vector<char> text(OCTREE_BLOCK_SIZE);
+    std::vector<Chunk> chunks(threadCount);
+    size_t carry = 0;               // bytes of an unfinished line kept for the next block
+    bool eof = false;
+    bool ok = true;
+
+    long long expected = 1;         // nodes the tree still expects, the root at first
+    unsigned long long lineNumber = 0;
+    const char *error = 0;
+
+    while (ok && !error && !eof)
+    {
+        size_t got = fread(&text[carry], 1, text.size() - carry, in);
+        size_t size = carry + got;
+        eof = got < text.size() - carry;
+
+        // only whole lines, unless this is the end of the file
+        size_t parsed = size;
+
+        if (!eof)
+        {
+            while (parsed > 0 && text[parsed - 1] != '\n') parsed--;
+
+            if (parsed == 0)
+            {
+                // a single line filling the whole block is no number
+                error = "not a number";
+                lineNumber++;
+                break;
+            }
+        }
+
+        // cut at line ends, one chunk per thread
+        const char *base = &text[0];
+
+        for (int c = 0; c < threadCount; c++)
+        {
+            size_t from = parsed * c / threadCount;
+            size_t to = parsed * (c + 1) / threadCount;
+
+            while (from > 0 && from < parsed && base[from - 1] != '\n') from++;
+            while (to > 0 && to < parsed && base[to - 1] != '\n') to++;
+
+            chunks[c].begin = base + from;
+            chunks[c].end = base + (to > from ? to : from);
+        }
+
+        std::vector<std::thread> threads;
+
+        for (int c = 1; c < threadCount; c++)
+        {
+            threads.push_back(std::thread(parseChunk, std::ref(chunks[c]), (size_t)-1));
+        }
+
+        parseChunk(chunks[0], (size_t)-1);
+
+        for (size_t t = 0; t < threads.size(); t++)
+        {
+            threads[t].join();
+        }
+
+        // prefix sum over the chunks: the tree must expect a node before
+        // each of them, and the first error ends the input
+        for (int c = 0; c < threadCount && !error; c++)
+        {
+            Chunk &chunk = chunks[c];
+
+            if (expected + chunk.minBefore <= 0)
+            {
+                // some node of this chunk comes after the end of the tree;
+                // find the first one
+                long long e = expected;
+                size_t n = 0;
+
+                while (e > 0)
+                {
+                    e += octreeIsParent(chunk.nodes[n++]) ? 7 : -1;
+                }
+
+                lineNumber += lineOfNode(chunk, n);
+                error = "past the end of the tree";
+                break;
+            }
+
+            // the breadth first order needs the nesting of the parents,
+            // node by node
+            for (size_t n = 0; n < chunk.nodes.size(); n++)
+            {
+                if (!builder.add(chunk.nodes[n]))
+                {
+                    lineNumber += lineOfNode(chunk, n);
+                    error = "tree too deep for the renderer";
+                    break;
+                }
+            }
+
+            if (error) break;
+
+            expected += chunk.delta;
+            lineNumber += chunk.lines;
+
+            if (chunk.error)
+            {
+                lineNumber++;
+                error = chunk.error;
+            }
+        }
+
+        ok = spillLevels(builder, files);
+        carry = size - parsed;
+        memmove(&text[0], &text[parsed], carry);
+    }
+
+    if (!error && ok && expected > 0)
+    {
+        error = "tree ends early";
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "%s, line %llu: %s\n", inPath, lineNumber, error);
+    }
+
+    builder.header(header);
+
+    ok = ok && !error && writeTree(out, builder, files, header);
+    closeLevels(files);
+
+    if (!ok && !error)
+    {
+        fprintf(stderr, "Error writing file '%s'\n", outPath);
+    }
+
+    return ok && !error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// collapsing
+////////////////////////////////////////////////////////////////////////////////
+
+// nodes added between spills of the builder's lists
+#define OCTREE_SPILL_NODES (16 << 20)
+
+// Rewrites a version 2 tree with every parent whose leaves all lie within
+// the tolerance of each other replaced by a single leaf: their mean,
+// weighted by volume, so densities move by at most the tolerance and the
+// mean density along a ray hardly at all.  Subtrees of one value, like
+// empty space, collapse at any tolerance, and tolerance 0 loses nothing.
+// The decisions need no pass of their own, as every parent stores the
+// range of its leaves; the input is walked depth first, which is the
+// order an OctreeLevelBuilder takes, like the text.
+struct Collapser
+{
+    const OctreeFileHeader *header;
+    const OctreeFileNode *nodes;
+    const float *leaves;
+    float tolerance;
+    OctreeLevelBuilder builder;
+    LevelFiles files;
+    unsigned long long added;
+    const char *error;
+
+    // the child's index and kind; children come after their parent in the
+    // breadth first arrays, which also rules out cycles in a broken file
+    bool child(unsigned long long node, int c, unsigned long long &index, bool &parent)
+    {
+        index = octreeChildIndex(nodes[node], c);
+        parent = octreeChildIsParent(nodes[node], c);
+
+        if (parent ? index <= node || index >= header->nodeCount : index >= header->leafCount)
+        {
+            error = "bad child index";
+            return false;
+        }
+
+        return true;
+    }
+
+    double mean(unsigned long long node)
+    {
+        double sum = 0.0;
+
+        for (int c = 0; c < 8 && !error; c++)
+        {
+            unsigned long long index;
+            bool parent;
+
+            if (child(node, c, index, parent))
+            {
+                sum += parent ? mean(index) : leaves[index];
+            }
+        }
+
+        return sum / 8.0;
+    }
+
+    void add(float value)
+    {
+        if (!builder.add(value))
+        {
+            error = "tree too deep";
+        }
+        else if (++added % OCTREE_SPILL_NODES == 0 && !spillLevels(builder, files))
+        {
+            error = "cannot write a temporary file";
+        }
+    }
+
+    void emit(unsigned long long node)
+    {
+        const OctreeFileNode &n = nodes[node];
+
+        if (n.maxValue - n.minValue <= tolerance)
+        {
+            float value = (float)mean(node);
+            add(value);
+            return;
+        }
+
+        add(octreeParentMarker());
+
+        for (int c = 0; c < 8 && !error; c++)
+        {
+            unsigned long long index;
+            bool parent;
+
+            if (!child(node, c, index, parent)) break;
+
+            if (parent)
+            {
+                emit(index);
+            }
+            else
+            {
+                add(leaves[index]);
+            }
+        }
+    }
+};
+
+static void printTreeStats(const char *label, const OctreeFileHeader &header)
+{
+    double kb = (header.leafOffset + header.leafCount * sizeof(float)) / 1024.0;
+
+    printf("  %s %llu nodes, %llu leaves, %u levels, %.1f %s\n", label,
+           header.nodeCount + header.leafCount, header.leafCount, header.depth + 1,
+           kb < 1024.0 ? kb : kb / 1024.0, kb < 1024.0 ? "KB" : "MB");
+}
+
+// Collapses the version 2 tree in the file at in (see Collapser) and writes
+// the result to out; false, with a message, if in is no such tree or out
+// cannot be written.
+static bool collapseTree(FILE *in, const char *inPath, float tolerance, FILE *out, const char *outPath,
+                         OctreeFileHeader &header)
+{
+    struct stat st;
+
+    if (fflush(in) != 0 || fstat(fileno(in), &st) != 0)
+    {
+        fprintf(stderr, "Error reading file '%s'\n", inPath);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *mapping = size > 0 ? mmap(0, size, PROT_READ, MAP_SHARED, fileno(in), 0) : MAP_FAILED;
+
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error reading file '%s'\n", inPath);
+        return false;
+    }
+
+    const OctreeFileHeader &input = *(const OctreeFileHeader *)mapping;
+
+    if (size < sizeof(OctreeFileHeaderV1) || memcmp(input.magic, octreeFileMagic, sizeof(input.magic)) ||
+        input.version != OCTREE_FILE_VERSION || !octreeHeaderValid(input, size))
+    {
+        fprintf(stderr, "%s: not a version %d .boc file\n", inPath, OCTREE_FILE_VERSION);
+        munmap(mapping, size);
+        return false;
+    }
+
+    // the collapser follows the child indices as they are, and reads every
+    // node anyway
+    if (!octreeNodesValid(input, (const OctreeFileNode *)((const char *)mapping + input.nodeOffset)))
+    {
+        fprintf(stderr, "%s: the nodes do not form a tree\n", inPath);
+        munmap(mapping, size);
+        return false;
+    }
+
+    Collapser collapser;
+    collapser.header = &input;
+    collapser.nodes = (const OctreeFileNode *)((const char *)mapping + input.nodeOffset);
+    collapser.leaves = (const float *)((const char *)mapping + input.leafOffset);
+    collapser.tolerance = tolerance;
+    memset(&collapser.files, 0, sizeof(collapser.files));
+    collapser.added = 0;
+    collapser.error = 0;
+
+    if (input.nodeCount > 0)
+    {
+        collapser.emit(0);
+    }
+    else
+    {
+        collapser.add(collapser.leaves[0]);
+    }
+
+    bool ok = !collapser.error && spillLevels(collapser.builder, collapser.files);
+    collapser.builder.header(header);
+
+    if (collapser.error)
+    {
+        fprintf(stderr, "%s: %s\n", inPath, collapser.error);
+    }
+    else
+    {
+        printf("Collapsed subtrees within %g\n", tolerance);
+        printTreeStats("before:", input);
+        printTreeStats("after: ", header);
+
+        ok = ok && writeTree(out, collapser.builder, collapser.files, header);
+
+        if (!ok)
+        {
+            fprintf(stderr, "Error writing file '%s'\n", outPath);
+        }
+    }
+
+    closeLevels(collapser.files);
+    munmap(mapping, size);
+    return ok && !collapser.error;
+}
+
+int main(int argc, char **argv)
+{
+    const char *paths[2] = { 0, 0 };
+    int pathCount = 0;
+    int threadCount = (int)std::thread::hardware_concurrency();
+    bool collapse = false;
+    float tolerance = 0.0f;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "-threads=", 9))
+        {
+            threadCount = atoi(argv[i] + 9);
+        }
+        else if (!strcmp(argv[i], "-collapse") || !strncmp(argv[i], "-collapse=", 10))
+        {
+            collapse = true;
+            tolerance = argv[i][9] ? (float)atof(argv[i] + 10) : 0.0f;
+        }
+        else if (pathCount < 2)
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            pathCount = 3;
+        }
+    }
+
+    if (pathCount < 1 || pathCount > 2 || !(tolerance >= 0.0f))
+    {
+        fprintf(stderr, "Usage: %s [-threads=N] [-collapse[=tolerance]] input [output.boc]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    threadCount = threadCount > 0 ? threadCount : 1;
+
+    FILE *in = fopen(paths[0], "rb");
+
+    if (!in)
+    {
+        fprintf(stderr, "Error opening file '%s'\n", paths[0]);
+        return EXIT_FAILURE;
+    }
+
+    // a .boc file as input is a tree to collapse
+    char magic[sizeof(octreeFileMagic)];
+    bool isTree = fread(magic, sizeof(magic), 1, in) == 1 && !memcmp(magic, octreeFileMagic, sizeof(magic));
+    rewind(in);
+
+    if (isTree && !paths[1])
+    {
+        fprintf(stderr, "Collapsing '%s' needs an output path\n", paths[0]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    std::string outPath = paths[1] ? std::string(paths[1]) : std::string(paths[0]) + ".boc";
+    struct stat inStat, outStat;
+
+    // writing the output would truncate the mapped input
+    if (stat(paths[0], &inStat) == 0 && stat(outPath.c_str(), &outStat) == 0 &&
+        inStat.st_dev == outStat.st_dev && inStat.st_ino == outStat.st_ino)
+    {
+        fprintf(stderr, "The output '%s' is the input\n", outPath.c_str());
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fopen(outPath.c_str(), "wb");
+
+    if (!out)
+    {
+        fprintf(stderr, "Error creating file '%s'\n", outPath.c_str());
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    OctreeFileHeader header;
+    bool ok;
+
+    if (isTree)
+    {
+        ok = collapseTree(in, paths[0], tolerance, out, outPath.c_str(), header);
+    }
+    else if (collapse)
+    {
+        // build into a temporary file, then collapse that
+        FILE *built = tmpfile();
+
+        if (!built)
+        {
+            fprintf(stderr, "Error creating a temporary file\n");
+        }
+
+        ok = built && buildTree(in, paths[0], threadCount, built, "a temporary file", header) &&
+             collapseTree(built, "the built tree", tolerance, out, outPath.c_str(), header);
+
+        if (built) fclose(built);
+    }
+    else
+    {
+        ok = buildTree(in, paths[0], threadCount, out, outPath.c_str(), header);
+    }
+
+    fclose(in);
+
+    if (fclose(out) != 0 && ok)
+    {
+        fprintf(stderr, "Error writing file '%s'\n", outPath.c_str());
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        remove(outPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("Wrote '%s': %llu nodes, %llu leaves, %d levels\n", outPath.c_str(),
+           header.nodeCount + header.leafCount, header.leafCount, (int)header.depth + 1);
+
+    return EXIT_SUCCESS;
+}
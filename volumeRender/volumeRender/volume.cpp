@@ -0,0 +1,194 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Converts a raw volume to a .bvol file, which the renderer maps and
+// renders as it is
+//
+//     ./volume -xsize=W -ysize=H -zsize=D [-type=uint8] [-layout=linear]
+//              [-spacing=X,Y,Z] [-log=FLOOR] [-clamp=LO,HI] [-normalize]
+//              [-convert=TYPE] [-histogram=bins.txt]
+//              input.raw [output.bvol]
+//     ./volume -verify input.bvol
+//
+// The input is x fastest, as initCpuFile() reads it, of voxels of the given
+// type (uint8, uint16, float or half); it is laid out (linear, bricked or
+// morton) by the CPU backend itself, so the file holds exactly what the
+// backend would otherwise build on every start.  -spacing gives the
+// distance between voxels along each axis (default 1,1,1).
+//
+// -log, -clamp, -normalize and -convert preprocess the volume on the way
+// (see initCpuPreprocessedFile()), in this order: log10 of the values, at
+// least FLOOR; clamped to [LO, HI], in log units after -log; scaled to
+// [0, 1]; and stored as TYPE, uint8 and uint16 always normalized first.
+// -histogram writes the histogram of the result, one "value count" line
+// per bin.
+//
+// The output defaults to the input path with .bvol appended.  -verify
+// checks every block of a file against its checksum.  See
+// volumeRender_volume.h for the format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "volumeRender_cpu.h"
+
+// one line per bin, the lowest value of the bin and its count
+static bool writeHistogram(const char *path)
+{
+    unsigned long long bins[CPU_HISTOGRAM_BINS];
+    float lo, hi;
+    FILE *fp = getCpuHistogram(bins, &lo, &hi) ? fopen(path, "w") : 0;
+
+    if (!fp)
+    {
+        printf("Error writing '%s'\n", path);
+        return false;
+    }
+
+    for (int b = 0; b < CPU_HISTOGRAM_BINS; b++)
+    {
+        fprintf(fp, "%g %llu\n", lo + (hi - lo) * b / CPU_HISTOGRAM_BINS, bins[b]);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *paths[2] = { 0, 0 };
+    int pathCount = 0;
+    long long size[3] = { 0, 0, 0 };
+    float spacing[3] = { 1.0f, 1.0f, 1.0f };
+    CpuVoxelType type = CPU_VOXEL_UINT8;
+    CpuVolumeLayout layout = CPU_LAYOUT_LINEAR;
+    CpuPreprocess stages;
+    memset(&stages, 0, sizeof(stages));
+    bool preprocess = false;
+    bool convert = false;
+    const char *histogramPath = 0;
+    bool verify = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-verify"))
+        {
+            verify = true;
+        }
+        else if (!strncmp(argv[i], "-xsize=", 7) || !strncmp(argv[i], "-ysize=", 7) || !strncmp(argv[i], "-zsize=", 7))
+        {
+            size[argv[i][1] - 'x'] = atoll(argv[i] + 7);
+        }
+        else if (!strncmp(argv[i], "-type=", 6))
+        {
+            usage = usage || !getCpuVoxelTypeByName(argv[i] + 6, &type);
+        }
+        else if (!strncmp(argv[i], "-layout=", 8))
+        {
+            const char *name = argv[i] + 8;
+            layout = !strcmp(name, "bricked") ? CPU_LAYOUT_BRICKED :
+                     !strcmp(name, "morton") ? CPU_LAYOUT_MORTON : CPU_LAYOUT_LINEAR;
+            usage = usage || (layout == CPU_LAYOUT_LINEAR && strcmp(name, "linear"));
+        }
+        else if (!strncmp(argv[i], "-spacing=", 9))
+        {
+            usage = usage || sscanf(argv[i] + 9, "%f,%f,%f", &spacing[0], &spacing[1], &spacing[2]) != 3;
+        }
+        else if (!strncmp(argv[i], "-log=", 5))
+        {
+            stages.logScale = preprocess = true;
+            stages.logFloor = (float)atof(argv[i] + 5);
+        }
+        else if (!strncmp(argv[i], "-clamp=", 7))
+        {
+            stages.clamp = preprocess = true;
+            usage = usage || sscanf(argv[i] + 7, "%f,%f", &stages.clampMin, &stages.clampMax) != 2;
+        }
+        else if (!strcmp(argv[i], "-normalize"))
+        {
+            stages.normalize = preprocess = true;
+        }
+        else if (!strncmp(argv[i], "-convert=", 9))
+        {
+            preprocess = convert = true;
+            usage = usage || !getCpuVoxelTypeByName(argv[i] + 9, &stages.type);
+        }
+        else if (!strncmp(argv[i], "-histogram=", 11))
+        {
+            histogramPath = argv[i] + 11;
+        }
+        else if (pathCount < 2)
+        {
+            paths[pathCount++] = argv[i];
+        }
+        else
+        {
+            pathCount = 3;
+        }
+    }
+
+    if (verify)
+    {
+        usage = usage || pathCount != 1;
+    }
+    else
+    {
+        usage = usage || pathCount < 1 || pathCount > 2 ||
+                size[0] <= 0 || size[1] <= 0 || size[2] <= 0 ||
+                size[0] > 1 << 30 || size[1] > 1 << 30 || size[2] > 1 << 30 ||
+                (histogramPath && !preprocess);
+    }
+
+    if (usage)
+    {
+        fprintf(stderr, "Usage: %s -xsize=W -ysize=H -zsize=D [-type=uint8|uint16|float|half] "
+                        "[-layout=linear|bricked|morton] [-spacing=X,Y,Z]\n"
+                        "       [-log=FLOOR] [-clamp=LO,HI] [-normalize] [-convert=uint8|uint16|float|half] "
+                        "[-histogram=bins.txt] input.raw [output.bvol]\n"
+                        "       %s -verify input.bvol\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bool ok;
+
+    if (verify)
+    {
+        ok = initCpuVolumeFile(paths[0], true);
+    }
+    else
+    {
+        std::string outPath = paths[1] ? std::string(paths[1]) : std::string(paths[0]) + ".bvol";
+
+        setCpuVoxelType(type);
+        setCpuVolumeLayout(layout);
+        stages.type = convert ? stages.type : type;
+
+        if (preprocess)
+        {
+            ok = initCpuPreprocessedFile(paths[0], (size_t)size[0], (size_t)size[1], (size_t)size[2], &stages) &&
+                 (!histogramPath || writeHistogram(histogramPath));
+        }
+        else
+        {
+            ok = initCpuFile(paths[0], (size_t)size[0], (size_t)size[1], (size_t)size[2]);
+        }
+
+        ok = ok && saveCpuVolumeFile(outPath.c_str(), spacing);
+    }
+
+    freeCpuBuffers();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -32,6 +32,11 @@
 #include <GL/freeglut.h>
 #endif
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 // CUDA Runtime, Interop, and includes
 #include <cuda_runtime.h>
 #include <cuda_gl_interop.h>
@@ -48,6 +53,10 @@
 #include <helper_functions.h>
 #include <helper_timer.h>
 
+// Host render backend
+#include "volumeRender_cpu.h"
+#include "volumeRender_volume.h"
+
 typedef unsigned int uint;
 typedef unsigned char uchar;
 
@@ -70,8 +79,11 @@ const char *sReference[] =
 const char *sSDKsample = "CUDA 3D Volume Render";
 
 const char *volumeFilename = "dawg.raw";
+const char *octreeFilename = 0;     // .boc file to render instead (oc path), -cpu only
+const char *amrFilename = 0;        // AMR hierarchy to render instead (amr path), -cpu only
+const char *pagedFilename = 0;      // .bvb file to render out of core (ooc path), -cpu only
 cudaExtent volumeSize = make_cudaExtent(32, 32, 32);
-typedef unsigned char VolumeType;
+typedef unsigned char VolumeType;   // the CUDA path; -cpu also reads -type=uint16|float|half
 
 //char *volumeFilename = "mrt16_angio.raw";
 //cudaExtent volumeSize = make_cudaExtent(416, 512, 112);
@@ -90,10 +102,27 @@ float brightness = 1.0f;
 float transferOffset = 0.0f;
 float transferScale = 1.0f;
 bool linearFiltering = true;
+RenderMode renderMode = RENDER_COMPOSITE;   // composite or a projection (-mode, 'm' key)
+bool cpuBackend = false;    // render on the host instead of the GPU (-cpu)
+bool cpuAdaptive = false;   // adaptive step length on the host (-adaptive)
+bool cpuPreint = false;     // pre-integrated transfer function on the host (-preint)
+bool cpuFixed = false;      // fixed point filtering on the host (-fixed)
+bool cpuReproject = false;  // temporal reprojection on the host (-reproject)
+bool cpuPyramid = false;    // a mip pyramid was built on the host (-lod)
+bool cpuLod = false;        // levels of detail on the host (-lod, 'l' key)
+float cpuFrameBudget = 0.0f;    // ms per frame to hold by lowering quality (-fps), 0 = off
+int cpuCompressBits = 0;    // residual bits of a compressed host volume (-compress), 0 = off
+int cpuQuantizeBits = 0;    // bits of a volume quantized per brick on the host (-quantize), 0 = off
+bool cpuQuantizeLog = false;    // ... on a log scale (-quantize=log8|log16)
+bool cpuPreprocess = false; // stages run over the volume as the host loads it (-log, -clamp, -normalize, -convert)
+CpuPreprocess cpuPreprocessStages;
+bool progressive = false;   // refine the image over idle callbacks (-progressive, 'r' key)
+RenderPass renderPass = fullRenderPass;     // what render() draws
 
 GLuint pbo = 0;     // OpenGL pixel buffer object
 GLuint tex = 0;     // OpenGL texture object
 struct cudaGraphicsResource *cuda_pbo_resource; // CUDA Graphics Resource (to transfer PBO)
+uint *h_output = 0; // host image for the CPU backend
 
 StopWatchInterface *timer = 0;
 
@@ -112,6 +141,8 @@ char **pArgv;
 #endif
 
 extern "C" void setTextureFilterMode(bool bLinearFilter);
+extern "C" void setRenderMode(RenderMode mode);
+extern "C" void setRenderPass(RenderPass pass);
 extern "C" void initCuda(void *h_volume, cudaExtent volumeSize);
 extern "C" void freeCudaBuffers();
 extern "C" void render_kernel(dim3 gridSize, dim3 blockSize, uint *d_output, uint imageW, uint imageH,
@@ -119,6 +150,20 @@ extern "C" void render_kernel(dim3 gridSize, dim3 blockSize, uint *d_output, uin
 extern "C" void copyInvViewMatrix(float *invViewMatrix, size_t sizeofMatrix);
 
 void initPixelBuffer();
+int iDivUp(int a, int b);
+
+// hand renderMode to the active backend
+void applyRenderMode()
+{
+    if (cpuBackend)
+    {
+        setCpuRenderMode(renderMode);
+    }
+    else
+    {
+        setRenderMode(renderMode);
+    }
+}
 
 void computeFPS()
 {
@@ -131,6 +176,29 @@ void computeFPS()
         float ifps = 1.f / (sdkGetAverageTimerValue(&timer) / 1000.f);
         sprintf(fps, "Volume Render: %3.1f fps", ifps);
 
+        if (cpuBackend && cpuAdaptive)
+        {
+            CpuFrameStats stats;
+            getCpuFrameStats(&stats);
+            double rays = stats.rays ? (double)stats.rays : 1.0;
+            sprintf(fps, "Volume Render: %3.1f fps, %.1f samples/ray, quality %.2f, est. error %.4f/ray",
+                    ifps, stats.samples / rays, getCpuQuality(), stats.error / rays);
+        }
+        else if (cpuBackend && cpuReproject)
+        {
+            CpuFrameStats stats;
+            getCpuFrameStats(&stats);
+            sprintf(fps, "Volume Render: %3.1f fps, %.0f%% reprojected", ifps,
+                    100.0 * stats.reused / ((double)width * height));
+        }
+        else if (cpuBackend && pagedFilename)
+        {
+            CpuFrameStats stats;
+            getCpuFrameStats(&stats);
+            sprintf(fps, "Volume Render: %3.1f fps, %llu bricks read (%.1f MB)", ifps, stats.bricksRead,
+                    stats.bytesRead / 1048576.0);
+        }
+
         glutSetWindowTitle(fps);
         fpsCount = 0;
 
@@ -139,10 +207,57 @@ void computeFPS()
     }
 }
 
+// render image on the host and upload it into the PBO
+void renderCpu()
+{
+    static StopWatchInterface *frameTimer = 0;
+
+    if (!frameTimer)
+    {
+        sdkCreateTimer(&frameTimer);
+    }
+
+    copyInvViewMatrixCpu(invViewMatrix, sizeof(float)*12);
+
+    sdkResetTimer(&frameTimer);
+    sdkStartTimer(&frameTimer);
+    render_cpu(h_output, width, height, density, brightness, transferOffset, transferScale);
+    sdkStopTimer(&frameTimer);
+
+    // hold the frame budget by lowering the quality when too slow, and
+    // raise it again when there is time to spare; refinement passes are
+    // not frames
+    if (cpuAdaptive && cpuFrameBudget > 0.0f && !progressive)
+    {
+        float ms = sdkGetTimerValue(&frameTimer);
+
+        if (ms > cpuFrameBudget)
+        {
+            setCpuQuality(getCpuQuality() * 0.8f);
+        }
+        else if (ms < 0.7f * cpuFrameBudget)
+        {
+            setCpuQuality(getCpuQuality() * 1.1f);
+        }
+    }
+
+    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+    glBufferSubDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0, width*height*4, h_output);
+    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+}
+
 // render image using CUDA
 void render()
 {
+    if (cpuBackend)
+    {
+        setCpuRenderPass(renderPass);
+        renderCpu();
+        return;
+    }
+
     copyInvViewMatrix(invViewMatrix, sizeof(float4)*3);
+    setRenderPass(renderPass);
 
     // map PBO to get CUDA device pointer
     uint *d_output;
@@ -153,17 +268,108 @@ void render()
                                                          cuda_pbo_resource));
     //printf("CUDA mapped PBO: May access %ld bytes\n", num_bytes);
 
-    // clear image
-    checkCudaErrors(cudaMemset(d_output, 0, width*height*4));
+    // clear image, unless the pass keeps rows of the previous one
+    uint rowEnd = renderPass.rowEnd < height ? renderPass.rowEnd : height;
+
+    if (renderPass.rowBegin == 0 && rowEnd == height)
+    {
+        checkCudaErrors(cudaMemset(d_output, 0, width*height*4));
+    }
+
+    // one thread per ray of the pass
+    uint stride = renderPass.pixelStride;
+    dim3 passGridSize(iDivUp(iDivUp(width, stride), blockSize.x),
+                      iDivUp(iDivUp(rowEnd - renderPass.rowBegin, stride), blockSize.y));
 
     // call CUDA kernel, writing results to PBO
-    render_kernel(gridSize, blockSize, d_output, width, height, density, brightness, transferOffset, transferScale);
+    render_kernel(passGridSize, blockSize, d_output, width, height, density, brightness, transferOffset, transferScale);
 
     getLastCudaError("kernel failed");
 
     checkCudaErrors(cudaGraphicsUnmapResources(1, &cuda_pbo_resource, 0));
 }
 
+// Progressive refinement: after the view or a setting changed, display()
+// draws the coarsest pass at once and every later call the next pass, so
+// the image converges over idle callbacks and a drag only ever waits for
+// the coarse pass.  Passes estimated to take longer than refineBudget are
+// split into bands of rows, one per call.
+const RenderPass refinePasses[] =
+{
+    { 8, 4, 0, 0 },
+    { 4, 2, 0, 0 },
+    { 2, 2, 0, 0 },
+    { 1, 1, 0, 0 },
+};
+const int refinePassCount = sizeof(refinePasses) / sizeof(refinePasses[0]);
+const float refineBudget = 50.0f;   // ms
+
+int refinePass = 0;         // pass in progress, refinePassCount once converged
+uint refineRow = 0;         // first row the pass has not drawn yet
+uint refineRows = 0;        // rows per band of the pass
+float refineRayMs = 0.0f;   // ms per ray-step at full quality, from the last band
+float3 refineRotation, refineTranslation;  // view being refined
+
+void idle();
+
+// start over with the coarsest pass on the next display()
+void restartRefinement()
+{
+    refinePass = 0;
+    refineRow = 0;
+    glutIdleFunc(idle);
+}
+
+// draw the next band of the current refinement pass
+void refine()
+{
+    const RenderPass &pass = refinePasses[refinePass];
+    // work relative to the full quality pass
+    float cost = 1.0f / (pass.pixelStride * pass.pixelStride * pass.stepScale);
+
+    if (refineRow == 0)
+    {
+        // the coarsest pass is never split, nothing could be shown sooner
+        refineRows = height;
+
+        if (refinePass > 0 && refineRayMs > 0.0f)
+        {
+            float passMs = refineRayMs * width * height * cost;
+            uint bands = (uint)ceilf(passMs / refineBudget);
+
+            // whole tiles, so a band has no partial blocks
+            refineRows = (iDivUp(height, bands > 1 ? bands : 1) + 15) & ~15u;
+        }
+    }
+
+    renderPass = pass;
+    renderPass.rowBegin = refineRow;
+    renderPass.rowEnd = refineRow + refineRows < height ? refineRow + refineRows : height;
+
+    StopWatchInterface *bandTimer = 0;
+    sdkCreateTimer(&bandTimer);
+    sdkStartTimer(&bandTimer);
+
+    render();
+
+    if (!cpuBackend)
+    {
+        checkCudaErrors(cudaDeviceSynchronize());
+    }
+
+    sdkStopTimer(&bandTimer);
+    refineRayMs = sdkGetTimerValue(&bandTimer) / (width * (renderPass.rowEnd - renderPass.rowBegin) * cost);
+    sdkDeleteTimer(&bandTimer);
+
+    refineRow = renderPass.rowEnd;
+
+    if (refineRow >= height)
+    {
+        refinePass++;
+        refineRow = 0;
+    }
+}
+
 // display results using OpenGL (called by GLUT)
 void display()
 {
@@ -193,7 +399,28 @@ void display()
     invViewMatrix[10] = modelView[10];
     invViewMatrix[11] = modelView[14];
 
-    render();
+    if (progressive)
+    {
+        // a changed view cancels the refinement of the old one
+        if (memcmp(&viewRotation, &refineRotation, sizeof(float3)) ||
+            memcmp(&viewTranslation, &refineTranslation, sizeof(float3)))
+        {
+            refineRotation = viewRotation;
+            refineTranslation = viewTranslation;
+            restartRefinement();
+        }
+
+        // a converged image stays in the PBO
+        if (refinePass < refinePassCount)
+        {
+            refine();
+        }
+    }
+    else
+    {
+        renderPass = fullRenderPass;
+        render();
+    }
 
     // display results
     glClear(GL_COLOR_BUFFER_BIT);
@@ -244,6 +471,13 @@ void display()
 
 void idle()
 {
+    // nothing left to refine; restartRefinement() resumes
+    if (progressive && refinePass >= refinePassCount)
+    {
+        glutIdleFunc(0);
+        return;
+    }
+
     glutPostRedisplay();
 }
 
@@ -257,7 +491,95 @@ void keyboard(unsigned char key, int x, int y)
 
         case 'f':
             linearFiltering = !linearFiltering;
-            setTextureFilterMode(linearFiltering);
+
+            if (cpuBackend)
+            {
+                setCpuFilterMode(linearFiltering);
+            }
+            else
+            {
+                setTextureFilterMode(linearFiltering);
+            }
+
+            break;
+
+        case 'r':
+            progressive = !progressive;
+            printf("progressive refinement %s\n", progressive ? "on" : "off");
+            break;
+
+        case 'm':
+            renderMode = (RenderMode)((renderMode + 1) % RENDER_MODE_COUNT);
+            applyRenderMode();
+            printf("render mode %s\n", renderModeNames[renderMode]);
+            break;
+
+        case 'a':
+            if (cpuBackend)
+            {
+                cpuAdaptive = !cpuAdaptive;
+                setCpuAdaptiveSampling(cpuAdaptive);
+                printf("adaptive sampling %s, quality = %.2f\n", cpuAdaptive ? "on" : "off", getCpuQuality());
+            }
+
+            break;
+
+        case 'p':
+            if (cpuBackend)
+            {
+                cpuPreint = !cpuPreint;
+                setCpuPreintegration(cpuPreint);
+                printf("pre-integration %s\n", cpuPreint ? "on" : "off");
+            }
+
+            break;
+
+        case 'x':
+            if (cpuBackend)
+            {
+                cpuFixed = !cpuFixed;
+                setCpuFixedPoint(cpuFixed);
+                printf("fixed point filtering %s\n", cpuFixed ? "on" : "off");
+            }
+
+            break;
+
+        case 'l':
+            if (cpuPyramid)
+            {
+                cpuLod = !cpuLod;
+                setCpuLevelOfDetail(cpuLod);
+                printf("levels of detail %s\n", cpuLod ? "on" : "off");
+            }
+
+            break;
+
+        case 't':
+            if (cpuBackend)
+            {
+                cpuReproject = !cpuReproject;
+                setCpuReprojection(cpuReproject);
+                printf("temporal reprojection %s\n", cpuReproject ? "on" : "off");
+            }
+
+            break;
+
+        case '}':
+            if (cpuBackend)
+            {
+                setCpuQuality(getCpuQuality() + 0.05f);
+                printf("quality = %.2f\n", getCpuQuality());
+            }
+
+            break;
+
+        case '{':
+            if (cpuBackend)
+            {
+                setCpuQuality(getCpuQuality() - 0.05f);
+                printf("quality = %.2f\n", getCpuQuality());
+            }
+
             break;
 
         case '+':
@@ -297,6 +619,7 @@ void keyboard(unsigned char key, int x, int y)
     }
 
     printf("density = %.2f, brightness = %.2f, transferOffset = %.2f, transferScale = %.2f\n", density, brightness, transferOffset, transferScale);
+    restartRefinement();
     glutPostRedisplay();
 }
 
@@ -358,6 +681,7 @@ void reshape(int w, int h)
     width = w;
     height = h;
     initPixelBuffer();
+    restartRefinement();
 
     // calculate new grid size
     gridSize = dim3(iDivUp(width, blockSize.x), iDivUp(height, blockSize.y));
@@ -376,11 +700,24 @@ void cleanup()
 {
     sdkDeleteTimer(&timer);
 
-    freeCudaBuffers();
+    if (cpuBackend)
+    {
+        freeCpuBuffers();
+        free(h_output);
+        h_output = 0;
+    }
+    else
+    {
+        freeCudaBuffers();
+    }
 
     if (pbo)
     {
-        cudaGraphicsUnregisterResource(cuda_pbo_resource);
+        if (!cpuBackend)
+        {
+            cudaGraphicsUnregisterResource(cuda_pbo_resource);
+        }
+
         glDeleteBuffersARB(1, &pbo);
         glDeleteTextures(1, &tex);
     }
@@ -408,7 +745,10 @@ void initPixelBuffer()
     if (pbo)
     {
         // unregister this buffer object from CUDA C
-        checkCudaErrors(cudaGraphicsUnregisterResource(cuda_pbo_resource));
+        if (!cpuBackend)
+        {
+            checkCudaErrors(cudaGraphicsUnregisterResource(cuda_pbo_resource));
+        }
 
         // delete old buffer
         glDeleteBuffersARB(1, &pbo);
@@ -421,8 +761,16 @@ void initPixelBuffer()
     glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, width*height*sizeof(GLubyte)*4, 0, GL_STREAM_DRAW_ARB);
     glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
 
-    // register this buffer object with CUDA
-    checkCudaErrors(cudaGraphicsGLRegisterBuffer(&cuda_pbo_resource, pbo, cudaGraphicsMapFlagsWriteDiscard));
+    if (cpuBackend)
+    {
+        // the host image is uploaded into the PBO every frame
+        h_output = (uint *)realloc(h_output, width*height*sizeof(uint));
+    }
+    else
+    {
+        // register this buffer object with CUDA
+        checkCudaErrors(cudaGraphicsGLRegisterBuffer(&cuda_pbo_resource, pbo, cudaGraphicsMapFlagsWriteDiscard));
+    }
 
     // create texture for display
     glGenTextures(1, &tex);
@@ -434,21 +782,35 @@ void initPixelBuffer()
 }
 
 // Load raw data from disk
-void *loadRawFile(char *filename, size_t size)
+// Maps a raw volume file for initCuda(), which then copies it to the
+// device straight from the page cache, without a host buffer in between;
+// unmap it with munmap(data, size).  The CPU backend maps the file itself,
+// see initCpuFile().
+void *mapRawFile(char *filename, size_t size)
 {
-    FILE *fp = fopen(filename, "rb");
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
 
-    if (!fp)
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < size)
     {
         fprintf(stderr, "Error opening file '%s'\n", filename);
+
+        if (fd >= 0) close(fd);
+
         return 0;
     }
 
-    void *data = malloc(size);
-    size_t read = fread(data, 1, size, fp);
-    fclose(fp);
+    void *data = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
 
-    printf("Read '%s', %d bytes\n", filename, read);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Error mapping file '%s'\n", filename);
+        return 0;
+    }
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    printf("Mapped '%s', %zu bytes\n", filename, size);
 
     return data;
 }
@@ -474,9 +836,13 @@ void runSingleTest(const char *ref_file, const char *exec_path)
 {
     bool bTestResult = true;
 
-    uint *d_output;
-    checkCudaErrors(cudaMalloc((void **)&d_output, width*height*sizeof(uint)));
-    checkCudaErrors(cudaMemset(d_output, 0, width*height*sizeof(uint)));
+    uint *d_output = 0;
+
+    if (!cpuBackend)
+    {
+        checkCudaErrors(cudaMalloc((void **)&d_output, width*height*sizeof(uint)));
+        checkCudaErrors(cudaMemset(d_output, 0, width*height*sizeof(uint)));
+    }
 
     float modelView[16] =
     {
@@ -499,12 +865,53 @@ void runSingleTest(const char *ref_file, const char *exec_path)
     invViewMatrix[10] = modelView[10];
     invViewMatrix[11] = modelView[14];
 
-    // call CUDA kernel, writing results to PBO
-    copyInvViewMatrix(invViewMatrix, sizeof(float4)*3);
-
     // Start timer 0 and process n loops on the GPU
     int nIter = 10;
 
+    if (cpuBackend)
+    {
+        unsigned char *h_image = (unsigned char *)malloc(width*height*4);
+        unsigned long long samples = 0;
+
+        copyInvViewMatrixCpu(invViewMatrix, sizeof(float)*12);
+
+        for (int i = -1; i < nIter; i++)
+        {
+            if (i == 0)
+            {
+                sdkStartTimer(&timer);
+            }
+
+            samples = render_cpu((uint *)h_image, width, height, density, brightness, transferOffset, transferScale);
+        }
+
+        sdkStopTimer(&timer);
+        double dAvgTime = sdkGetTimerValue(&timer)/(nIter * 1000.0);
+        printf("volumeRender (CPU), Throughput = %.4f MTexels/s, %.2f MSamples/s, Time = %.5f s, Size = %u Texels, NumThreads = %d, Tile = %u, SIMD = %s\n",
+               (1.0e-6 * width * height)/dAvgTime, (1.0e-6 * samples)/dAvgTime, dAvgTime, (width * height),
+               getCpuThreadCount(), blockSize.x * blockSize.y, getCpuSimdName());
+
+        if (cpuAdaptive)
+        {
+            CpuFrameStats stats;
+            getCpuFrameStats(&stats);
+            double rays = stats.rays ? (double)stats.rays : 1.0;
+            printf("Adaptive sampling: quality = %.2f, %.1f samples/ray, est. error = %.5f/ray\n",
+                   getCpuQuality(), stats.samples / rays, stats.error / rays);
+        }
+
+        sdkSavePPM4ub("volume.ppm", h_image, width, height);
+        bTestResult = sdkComparePPM("volume.ppm", sdkFindFilePath(ref_file, exec_path), MAX_EPSILON_ERROR, THRESHOLD, true);
+
+        free(h_image);
+        cleanup();
+
+        exit(bTestResult ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // call CUDA kernel, writing results to PBO
+    copyInvViewMatrix(invViewMatrix, sizeof(float4)*3);
+
     for (int i = -1; i < nIter; i++)
     {
         if (i == 0)
@@ -560,10 +967,235 @@ main(int argc, char **argv)
         fpsLimit = frameCheckNumber;
     }
 
+    // ./volumeRender oc path/to/input.boc renders an octree, which only the
+    // CPU backend can traverse
+    if (argc > 2 && !strcmp(argv[1], "oc"))
+    {
+        octreeFilename = argv[2];
+
+        if (!checkCmdLineFlag(argc, (const char **)argv, "cpu"))
+        {
+            printf("Octrees are rendered on the host, as with -cpu\n");
+        }
+    }
+
+    // ./volumeRender amr path/to/hierarchy.amr renders the grid patches of
+    // an adaptive mesh refinement run, also on the CPU backend only
+    if (argc > 2 && !strcmp(argv[1], "amr"))
+    {
+        amrFilename = argv[2];
+
+        if (!checkCmdLineFlag(argc, (const char **)argv, "cpu"))
+        {
+            printf("AMR hierarchies are rendered on the host, as with -cpu\n");
+        }
+    }
+
+    // ./volumeRender ooc path/to/volume.bvb [-cache=MB] renders a bricked
+    // volume larger than memory through a brick cache, CPU backend only
+    if (argc > 2 && !strcmp(argv[1], "ooc"))
+    {
+        pagedFilename = argv[2];
+
+        if (!checkCmdLineFlag(argc, (const char **)argv, "cpu"))
+        {
+            printf("Out-of-core volumes are rendered on the host, as with -cpu\n");
+        }
+    }
+
+    if (octreeFilename || amrFilename || pagedFilename || checkCmdLineFlag(argc, (const char **)argv, "cpu"))
+    {
+        cpuBackend = true;
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "threads"))
+        {
+            setCpuThreadCount(getCmdLineArgumentInt(argc, (const char **)argv, "threads"));
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "nosimd"))
+        {
+            setCpuSimd(false);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "noskip"))
+        {
+            setCpuEmptySpaceSkipping(false);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "adaptive"))
+        {
+            cpuAdaptive = true;
+            setCpuAdaptiveSampling(true);
+        }
+
+        char *layout = 0;
+
+        if (getCmdLineArgumentString(argc, (const char **)argv, "layout", &layout))
+        {
+            if (!strcmp(layout, "bricked"))
+            {
+                setCpuVolumeLayout(CPU_LAYOUT_BRICKED);
+            }
+            else if (!strcmp(layout, "morton"))
+            {
+                setCpuVolumeLayout(CPU_LAYOUT_MORTON);
+            }
+            else if (strcmp(layout, "linear"))
+            {
+                printf("Unknown volume layout '%s', using linear\n", layout);
+            }
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "preint"))
+        {
+            cpuPreint = true;
+            setCpuPreintegration(true);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "fixed"))
+        {
+            cpuFixed = true;
+            setCpuFixedPoint(true);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "reproject"))
+        {
+            cpuReproject = true;
+            setCpuReprojection(true);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "lod"))
+        {
+            cpuPyramid = cpuLod = true;
+            setCpuLevelOfDetail(true);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "quality"))
+        {
+            setCpuQuality(getCmdLineArgumentFloat(argc, (const char **)argv, "quality"));
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "fps"))
+        {
+            int fps = getCmdLineArgumentInt(argc, (const char **)argv, "fps");
+            cpuFrameBudget = fps > 0 ? 1000.0f / fps : 0.0f;
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "compress"))
+        {
+            cpuCompressBits = getCmdLineArgumentInt(argc, (const char **)argv, "compress");
+        }
+
+        char *quantize = 0;
+
+        if (getCmdLineArgumentString(argc, (const char **)argv, "quantize", &quantize))
+        {
+            cpuQuantizeLog = !strncmp(quantize, "log", 3);
+            cpuQuantizeBits = atoi(quantize + (cpuQuantizeLog ? 3 : 0));
+        }
+    }
+
+    size_t voxelSize = sizeof(VolumeType);
+    CpuVoxelType voxelType = CPU_VOXEL_UINT8;
+    char *type = 0;
+
+    if (getCmdLineArgumentString(argc, (const char **)argv, "type", &type))
+    {
+        if (!getCpuVoxelTypeByName(type, &voxelType))
+        {
+            printf("Unknown voxel type '%s'\n", type);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!cpuBackend && voxelType != CPU_VOXEL_UINT8)
+        {
+            printf("-type=%s needs -cpu, the CUDA kernel reads uint8 volumes\n", type);
+            exit(EXIT_FAILURE);
+        }
+
+        setCpuVoxelType(voxelType);
+        voxelSize = getCpuVoxelSize(voxelType);
+    }
+
+    if (cpuBackend)
+    {
+        char *arg = 0;
+        memset(&cpuPreprocessStages, 0, sizeof(cpuPreprocessStages));
+        cpuPreprocessStages.type = voxelType;
+
+        if (getCmdLineArgumentString(argc, (const char **)argv, "log", &arg))
+        {
+            cpuPreprocessStages.logScale = cpuPreprocess = true;
+            cpuPreprocessStages.logFloor = (float)atof(arg);
+        }
+
+        if (getCmdLineArgumentString(argc, (const char **)argv, "clamp", &arg))
+        {
+            cpuPreprocessStages.clamp = cpuPreprocess = true;
+
+            if (sscanf(arg, "%f,%f", &cpuPreprocessStages.clampMin, &cpuPreprocessStages.clampMax) != 2)
+            {
+                printf("-clamp=%s needs two values, -clamp=LO,HI\n", arg);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "normalize"))
+        {
+            cpuPreprocessStages.normalize = cpuPreprocess = true;
+        }
+
+        if (getCmdLineArgumentString(argc, (const char **)argv, "convert", &arg))
+        {
+            cpuPreprocess = true;
+
+            if (!getCpuVoxelTypeByName(arg, &cpuPreprocessStages.type))
+            {
+                printf("Unknown voxel type '%s'\n", arg);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // each of these loads the volume into a form of its own
+        if ((cpuPreprocess ? 1 : 0) + (cpuQuantizeBits ? 1 : 0) + (cpuCompressBits ? 1 : 0) > 1)
+        {
+            printf("-compress, -quantize and the preprocessing flags (-log, -clamp, -normalize, -convert) "
+                   "exclude each other\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char *mode = 0;
+
+    if (getCmdLineArgumentString(argc, (const char **)argv, "mode", &mode))
+    {
+        int m = 0;
+
+        while (m < RENDER_MODE_COUNT && strcmp(mode, renderModeNames[m]))
+        {
+            m++;
+        }
+
+        if (m == RENDER_MODE_COUNT)
+        {
+            printf("Unknown render mode '%s'\n", mode);
+            exit(EXIT_FAILURE);
+        }
+
+        renderMode = (RenderMode)m;
+        applyRenderMode();
+    }
+
+    progressive = checkCmdLineFlag(argc, (const char **)argv, "progressive") != 0;
+
     if (ref_file)
     {
         // use command-line specified CUDA device, otherwise use device with highest Gflops/s
-        chooseCudaDevice(argc, (const char **)argv, false);
+        // (batch rendering on the host needs neither OpenGL nor a CUDA device)
+        if (!cpuBackend)
+        {
+            chooseCudaDevice(argc, (const char **)argv, false);
+        }
     }
     else
     {
@@ -572,7 +1204,10 @@ main(int argc, char **argv)
         initGL(&argc, argv);
 
         // use command-line specified CUDA device, otherwise use device with highest Gflops/s
-        chooseCudaDevice(argc, (const char **)argv, true);
+        if (!cpuBackend)
+        {
+            chooseCudaDevice(argc, (const char **)argv, true);
+        }
     }
 
     // parse arguments
@@ -609,27 +1244,179 @@ main(int argc, char **argv)
         volumeSize.depth = n;
     }
 
-    // load volume data
-    char *path = sdkFindFilePath(volumeFilename, argv[0]);
+    if (octreeFilename)
+    {
+        // the tree is rendered as it is, there is no volume to load
+        char *path = sdkFindFilePath(octreeFilename, argv[0]);
+
+        if (path == 0)
+        {
+            printf("Error finding file '%s'\n", octreeFilename);
+            exit(EXIT_FAILURE);
+        }
+
+        if (!initCpuOctree(path, checkCmdLineFlag(argc, (const char **)argv, "verify") != 0))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (amrFilename)
+    {
+        // as is the hierarchy
+        char *path = sdkFindFilePath(amrFilename, argv[0]);
+
+        if (path == 0)
+        {
+            printf("Error finding file '%s'\n", amrFilename);
+            exit(EXIT_FAILURE);
+        }
 
-    if (path == 0)
+        if (!initCpuAmrFile(path))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (pagedFilename)
     {
-        printf("Error finding file '%s'\n", volumeFilename);
-        exit(EXIT_FAILURE);
+        // and the bricks, read as rays reach them
+        char *path = sdkFindFilePath(pagedFilename, argv[0]);
+        size_t cacheMB = 0;
+
+        if (path == 0)
+        {
+            printf("Error finding file '%s'\n", pagedFilename);
+            exit(EXIT_FAILURE);
+        }
+
+        if (checkCmdLineFlag(argc, (const char **)argv, "cache"))
+        {
+            cacheMB = (size_t)getCmdLineArgumentInt(argc, (const char **)argv, "cache");
+        }
+
+        if (!initCpuPagedVolume(path, cacheMB << 20))
+        {
+            exit(EXIT_FAILURE);
+        }
     }
+    else
+    {
+        // load volume data
+        char *path = sdkFindFilePath(volumeFilename, argv[0]);
+
+        if (path == 0)
+        {
+            printf("Error finding file '%s'\n", volumeFilename);
+            exit(EXIT_FAILURE);
+        }
+
+        // a .bvol file says what it holds, whatever -size and -type say
+        VolumeFileHeader header;
+        bool volumeFile = readVolumeFileHeader(path, header);
+        size_t offset = 0;
+
+        if (volumeFile)
+        {
+            volumeSize = make_cudaExtent(header.width, header.height, header.depth);
+            voxelSize = header.voxelSize;
+            offset = (size_t)header.payloadOffset;
+
+            if (!cpuBackend && (header.voxelType != CPU_VOXEL_UINT8 || header.layout != CPU_LAYOUT_LINEAR))
+            {
+                printf("'%s' needs -cpu, the CUDA kernel reads linear uint8 volumes\n", path);
+                exit(EXIT_FAILURE);
+            }
+
+            // it is rendered as it is stored
+            if (cpuPreprocess || cpuQuantizeBits || cpuCompressBits)
+            {
+                printf("'%s' is a .bvol file, -compress, -quantize and the preprocessing flags apply to .raw "
+                       "files only\n", path);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        size_t size = volumeSize.width*volumeSize.height*volumeSize.depth*voxelSize;
 
-    size_t size = volumeSize.width*volumeSize.height*volumeSize.depth*sizeof(VolumeType);
-    void *h_volume = loadRawFile(path, size);
+        if (cpuPyramid)
+        {
+            // the pyramid is cached next to the volume, and rebuilt when the
+            // volume is newer than the cache
+            char cachePath[4096];
+            struct stat volumeStat, cacheStat;
+            snprintf(cachePath, sizeof(cachePath), "%s.mip", path);
+
+            if (stat(path, &volumeStat) == 0 && stat(cachePath, &cacheStat) == 0 &&
+                cacheStat.st_mtime < volumeStat.st_mtime)
+            {
+                remove(cachePath);
+            }
+
+            setCpuPyramidCache(cachePath);
+        }
+
+        if (cpuBackend && volumeFile)
+        {
+            if (!initCpuVolumeFile(path, checkCmdLineFlag(argc, (const char **)argv, "verify") != 0))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (cpuBackend && cpuPreprocess)
+        {
+            if (!initCpuPreprocessedFile(path, volumeSize.width, volumeSize.height, volumeSize.depth,
+                                         &cpuPreprocessStages))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (cpuBackend && cpuQuantizeBits)
+        {
+            if (!initCpuQuantizedFile(path, volumeSize.width, volumeSize.height, volumeSize.depth,
+                                      cpuQuantizeBits, cpuQuantizeLog))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (cpuBackend && cpuCompressBits)
+        {
+            if (!initCpuCompressedFile(path, volumeSize.width, volumeSize.height, volumeSize.depth,
+                                       cpuCompressBits))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (cpuBackend)
+        {
+            if (!initCpuFile(path, volumeSize.width, volumeSize.height, volumeSize.depth))
+            {
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            // the voxels of a .bvol file start past its header
+            void *h_volume = mapRawFile(path, offset + size);
+
+            if (!h_volume)
+            {
+                exit(EXIT_FAILURE);
+            }
 
-    initCuda(h_volume, volumeSize);
-    free(h_volume);
+            initCuda((char *)h_volume + offset, volumeSize);
+            munmap(h_volume, offset + size);
+        }
+    }
 
     sdkCreateTimer(&timer);
 
     printf("Press '+' and '-' to change density (0.01 increments)\n"
            "      ']' and '[' to change brightness\n"
            "      ';' and ''' to modify transfer function offset\n"
-           "      '.' and ',' to modify transfer function scale\n\n");
+           "      '.' and ',' to modify transfer function scale\n"
+           "      'm' to cycle composite, MIP, MinIP and average\n"
+           "      'r' to toggle progressive refinement\n"
+           "      't' to toggle temporal reprojection (-cpu)\n"
+           "      'l' to toggle levels of detail (-cpu -lod)\n\n");
 
     // calculate new grid size
     gridSize = dim3(iDivUp(width, blockSize.x), iDivUp(height, blockSize.y));
@@ -655,6 +1442,10 @@ main(int argc, char **argv)
         glutMainLoop();
     }
 
-    cudaDeviceReset();
+    if (!cpuBackend)
+    {
+        cudaDeviceReset();
+    }
+
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,433 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Host-only benchmark of the CPU backend's volume layouts
+//
+// Renders the same views with every volume layout and reports the frame
+// time, the sample throughput and, where the kernel lets us count them, the
+// cache misses per sample, then which layout to use for this volume.  Needs
+// neither a GPU nor a display:
+//
+//     ./volumeRender_bench                         (256^3 synthetic volume)
+//     ./volumeRender_bench -volume=file.raw -xsize=416 -ysize=512 -zsize=112
+//
+// -frames=N sets the frames per view, -threads=N the worker threads and
+// -type=uint16|float|half the voxel type of the volume (default uint8).
+// -distance=D moves the camera D units out (default 4), and -lod renders
+// with levels of detail, for overview shots of large volumes.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <helper_string.h>
+#include <helper_timer.h>
+
+#include "volumeRender_cpu.h"
+
+typedef unsigned char uchar;
+
+////////////////////////////////////////////////////////////////////////////////
+// cache miss counters
+////////////////////////////////////////////////////////////////////////////////
+
+// the counters are inherited by the worker threads, whose counts are only
+// added to ours once they exit, so the pool is stopped around every reading
+enum Counter
+{
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    NUM_COUNTERS
+};
+
+static int counterFd[NUM_COUNTERS] = { -1, -1 };
+
+static void openCounters()
+{
+#ifdef __linux__
+    const unsigned long long config[NUM_COUNTERS] =
+    {
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL  | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+
+    for (int i = 0; i < NUM_COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = config[i];
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counterFd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+// current count, or -1 if the counter is not available
+static long long readCounter(Counter c)
+{
+#ifdef __linux__
+    long long value;
+
+    if (counterFd[c] >= 0 && read(counterFd[c], &value, sizeof(value)) == sizeof(value))
+    {
+        return value;
+    }
+#endif
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// test data and views
+////////////////////////////////////////////////////////////////////////////////
+
+// float to half precision, round to nearest; enough for values in [0, 1]
+static unsigned short floatToHalf(float f)
+{
+    if (f < 6.1035156e-5f)
+    {
+        return (unsigned short)(f * 16777216.0f + 0.5f);    // denormal
+    }
+
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    bits += 0x00000fff + ((bits >> 13) & 1);
+    return (unsigned short)(((bits >> 23) - 112) << 10 | ((bits >> 13) & 0x3ff));
+}
+
+// stores value v in [0, 1] as voxel i of the given type
+static void storeVoxel(void *vol, CpuVoxelType type, size_t i, float v)
+{
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            ((unsigned short *)vol)[i] = (unsigned short)(v * 65535.0f);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            ((float *)vol)[i] = v;
+            break;
+
+        case CPU_VOXEL_HALF:
+            ((unsigned short *)vol)[i] = floatToHalf(v);
+            break;
+
+        default:
+            ((uchar *)vol)[i] = (uchar)(v * 255.0f);
+            break;
+    }
+}
+
+// a few soft blobs in a faint haze, so that rays sample everywhere
+static void *makeVolume(int w, int h, int d, CpuVoxelType type)
+{
+    void *vol = malloc((size_t)w * h * d * getCpuVoxelSize(type));
+    const float blobs[4][4] =
+    {
+        { 0.30f, 0.35f, 0.40f, 0.20f },
+        { 0.70f, 0.60f, 0.50f, 0.25f },
+        { 0.45f, 0.70f, 0.75f, 0.15f },
+        { 0.60f, 0.25f, 0.30f, 0.18f },
+    };
+
+    for (int z = 0; z < d; z++)
+    {
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                float v = 0.05f;
+
+                for (int b = 0; b < 4; b++)
+                {
+                    float dx = x / (float)w - blobs[b][0];
+                    float dy = y / (float)h - blobs[b][1];
+                    float dz = z / (float)d - blobs[b][2];
+                    float r = sqrtf(dx*dx + dy*dy + dz*dz) / blobs[b][3];
+                    v += r < 1.0f ? 0.8f * (1.0f - r) : 0.0f;
+                }
+
+                storeVoxel(vol, type, ((size_t)z * h + y) * w + x, fminf(v, 1.0f));
+            }
+        }
+    }
+
+    return vol;
+}
+
+struct View
+{
+    const char *name;
+    float rotX, rotY;       // degrees, as viewRotation in volumeRender.cpp
+};
+
+// a sweep around y, where the linear layout goes from best to worst case,
+// plus the two views that leave no axis aligned with the rays
+static const View views[] =
+{
+    { "axis",      0.0f,  0.0f },
+    { "y15",       0.0f, 15.0f },
+    { "y30",       0.0f, 30.0f },
+    { "y45",       0.0f, 45.0f },
+    { "y60",       0.0f, 60.0f },
+    { "y75",       0.0f, 75.0f },
+    { "y90",       0.0f, 90.0f },
+    { "diagonal", 35.3f, 45.0f },
+    { "top",      90.0f,  0.0f },
+};
+
+// camera to world matrix for a camera distance units out, looking at the
+// volume
+static void viewMatrix(const View &view, float distance, float m[12])
+{
+    float ax = view.rotX * (float)M_PI / 180.0f;
+    float ay = view.rotY * (float)M_PI / 180.0f;
+    float cx = cosf(ax), sx = sinf(ax), cy = cosf(ay), sy = sinf(ay);
+
+    // R = Ry * Rx
+    float r[3][3] =
+    {
+        {  cy, sy*sx, sy*cx },
+        { 0.0f,   cx,   -sx },
+        { -sy, cy*sx, cy*cx },
+    };
+
+    for (int i = 0; i < 3; i++)
+    {
+        m[i*4 + 0] = r[i][0];
+        m[i*4 + 1] = r[i][1];
+        m[i*4 + 2] = r[i][2];
+        m[i*4 + 3] = distance * r[i][2];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+int
+main(int argc, char **argv)
+{
+    int w = 256, h = 256, d = 256;
+    int frames = 10;
+    int threads = 0;
+    float distance = 4.0f;
+    const unsigned int imageW = 512, imageH = 512;
+    char *filename = 0;
+
+    if (checkCmdLineFlag(argc, (const char **)argv, "size"))
+    {
+        w = h = d = getCmdLineArgumentInt(argc, (const char **)argv, "size");
+    }
+
+    if (checkCmdLineFlag(argc, (const char **)argv, "xsize")) w = getCmdLineArgumentInt(argc, (const char **)argv, "xsize");
+    if (checkCmdLineFlag(argc, (const char **)argv, "ysize")) h = getCmdLineArgumentInt(argc, (const char **)argv, "ysize");
+    if (checkCmdLineFlag(argc, (const char **)argv, "zsize")) d = getCmdLineArgumentInt(argc, (const char **)argv, "zsize");
+    if (checkCmdLineFlag(argc, (const char **)argv, "frames")) frames = getCmdLineArgumentInt(argc, (const char **)argv, "frames");
+    if (checkCmdLineFlag(argc, (const char **)argv, "threads")) threads = getCmdLineArgumentInt(argc, (const char **)argv, "threads");
+    if (checkCmdLineFlag(argc, (const char **)argv, "distance")) distance = getCmdLineArgumentFloat(argc, (const char **)argv, "distance");
+
+    getCmdLineArgumentString(argc, (const char **)argv, "volume", &filename);
+
+    CpuVoxelType type = CPU_VOXEL_UINT8;
+    char *typeName = 0;
+
+    if (getCmdLineArgumentString(argc, (const char **)argv, "type", &typeName) &&
+        !getCpuVoxelTypeByName(typeName, &type))
+    {
+        fprintf(stderr, "Unknown voxel type '%s'\n", typeName);
+        return EXIT_FAILURE;
+    }
+
+    setCpuVoxelType(type);
+
+    // fixed point filtering, for uint8 and uint16 volumes
+    bool fixedPoint = checkCmdLineFlag(argc, (const char **)argv, "fixed") != 0;
+    setCpuFixedPoint(fixedPoint);
+
+    int mode = RENDER_COMPOSITE;
+    char *modeName = 0;
+
+    if (getCmdLineArgumentString(argc, (const char **)argv, "mode", &modeName))
+    {
+        while (mode < RENDER_MODE_COUNT && strcmp(modeName, renderModeNames[mode]))
+        {
+            mode++;
+        }
+
+        if (mode == RENDER_MODE_COUNT)
+        {
+            fprintf(stderr, "Unknown render mode '%s'\n", modeName);
+            return EXIT_FAILURE;
+        }
+    }
+
+    setCpuRenderMode((RenderMode)mode);
+
+    bool lod = checkCmdLineFlag(argc, (const char **)argv, "lod") != 0;
+    setCpuLevelOfDetail(lod);
+
+    void *h_volume;
+
+    if (filename)
+    {
+        size_t size = (size_t)w * h * d * getCpuVoxelSize(type);
+        FILE *fp = fopen(filename, "rb");
+
+        if (!fp)
+        {
+            fprintf(stderr, "Error opening file '%s'\n", filename);
+            return EXIT_FAILURE;
+        }
+
+        h_volume = malloc(size);
+        size_t read = fread(h_volume, 1, size, fp);
+        fclose(fp);
+
+        if (read != size)
+        {
+            fprintf(stderr, "Error reading file '%s'\n", filename);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        h_volume = makeVolume(w, h, d, type);
+    }
+
+    // before any worker thread exists, so that they all inherit the counters
+    openCounters();
+    setCpuThreadCount(threads);
+
+    const CpuVolumeLayout layouts[] = { CPU_LAYOUT_LINEAR, CPU_LAYOUT_BRICKED, CPU_LAYOUT_MORTON };
+    const int numLayouts = sizeof(layouts) / sizeof(layouts[0]);
+    const int numViews = sizeof(views) / sizeof(views[0]);
+    unsigned int *image = (unsigned int *)malloc(imageW * imageH * sizeof(unsigned int));
+    double times[numLayouts][numViews];
+    const char *names[numLayouts];
+
+    printf("volume %dx%dx%d %s%s, %s%s, distance %.1f, image %ux%u, %d frames per view, %d threads, SIMD = %s\n\n",
+           w, h, d, getCpuVoxelTypeName(), fixedPoint ? " (fixed point)" : "", renderModeNames[mode],
+           lod ? " with levels of detail" : "", distance, imageW, imageH, frames, getCpuThreadCount(), getCpuSimdName());
+    printf("%-8s %-9s %10s %12s %8s %14s %14s\n",
+           "layout", "view", "ms/frame", "MSamples/s", "speedup", "L1D miss/smp", "LLC miss/ksmp");
+
+    StopWatchInterface *timer = 0;
+    sdkCreateTimer(&timer);
+
+    for (int l = 0; l < numLayouts; l++)
+    {
+        setCpuVolumeLayout(layouts[l]);
+        initCpu(h_volume, w, h, d);
+        names[l] = getCpuVolumeLayoutName();
+
+        for (int v = 0; v < numViews; v++)
+        {
+            float m[12];
+            viewMatrix(views[v], distance, m);
+            copyInvViewMatrixCpu(m, sizeof(m));
+
+            // warm up, then restart the pool so the counts below are ours
+            render_cpu(image, imageW, imageH, 0.05f, 1.0f, 0.0f, 1.0f);
+            setCpuThreadCount(threads);
+
+            long long l1 = readCounter(COUNTER_L1D_MISSES);
+            long long llc = readCounter(COUNTER_LLC_MISSES);
+            unsigned long long samples = 0;
+
+            sdkResetTimer(&timer);
+            sdkStartTimer(&timer);
+
+            for (int f = 0; f < frames; f++)
+            {
+                samples += render_cpu(image, imageW, imageH, 0.05f, 1.0f, 0.0f, 1.0f);
+            }
+
+            sdkStopTimer(&timer);
+            setCpuThreadCount(threads);
+
+            double ms = sdkGetTimerValue(&timer) / frames;
+            times[l][v] = ms;
+
+            printf("%-8s %-9s %10.2f %12.1f %7.2fx ", names[l], views[v].name,
+                   ms, samples / (ms * frames * 1000.0), times[0][v] / ms);
+
+            long long l1End = readCounter(COUNTER_L1D_MISSES);
+            long long llcEnd = readCounter(COUNTER_LLC_MISSES);
+
+            if (l1 >= 0 && l1End >= 0) printf("%14.3f ", (l1End - l1) / (double)samples);
+            else                       printf("%14s ", "n/a");
+
+            if (llc >= 0 && llcEnd >= 0) printf("%14.3f\n", (llcEnd - llc) * 1000.0 / samples);
+            else                         printf("%14s\n", "n/a");
+        }
+
+        freeCpuBuffers();
+    }
+
+    // the fastest layout per view, and over all views by the geometric mean
+    // of the frame times, which is what -layout= should be set to
+    printf("\n%-9s %-8s %8s\n", "view", "best", "speedup");
+
+    for (int v = 0; v < numViews; v++)
+    {
+        int best = 0;
+
+        for (int l = 1; l < numLayouts; l++)
+        {
+            if (times[l][v] < times[best][v])
+            {
+                best = l;
+            }
+        }
+
+        printf("%-9s %-8s %7.2fx\n", views[v].name, names[best], times[0][v] / times[best][v]);
+    }
+
+    double mean[numLayouts];
+    int bestLayout = 0;
+
+    for (int l = 0; l < numLayouts; l++)
+    {
+        double logSum = 0.0;
+
+        for (int v = 0; v < numViews; v++)
+        {
+            logSum += log(times[l][v]);
+        }
+
+        mean[l] = exp(logSum / numViews);
+
+        if (mean[l] < mean[bestLayout])
+        {
+            bestLayout = l;
+        }
+    }
+
+    printf("\nrecommended: -layout=%s (%.2f ms/frame geometric mean, %.2fx over linear)\n",
+           names[bestLayout], mean[bestLayout], mean[0] / mean[bestLayout]);
+
+    sdkDeleteTimer(&timer);
+    free(image);
+    free(h_volume);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Bricked volume files (.bvb), shared by the bricks tool and the CPU backend
+//
+// A volume too large for memory is rendered from a file of bricks, read a
+// brick at a time into a cache of fixed size (see CpuPagedVolume).  The
+// volume is cut into BRICK_FILE_SIZE^3 voxel bricks; every brick is stored
+// with one more layer of voxels along +x, +y and +z, copied from its
+// neighbours (or repeated at the volume edge), so a trilinear sample never
+// needs a second brick.  The file holds the header, the value range of
+// every brick (two floats, smallest and largest voxelValue() including the
+// extra layer, so a brick can be judged without reading it), then the
+// bricks, each BRICK_FILE_PITCH^3 voxels x fastest and padded to
+// brickBytes, in x, y, z brick order.  Bricks start on 4 KB boundaries so
+// that each is read by whole pages.  Numbers are in the byte order of the
+// machine that wrote the file.
+//
+// A compressed file (version 2) stores every brick on its own, so that any
+// brick can still be read alone: after the ranges comes an index of one
+// BrickFileEntry per brick, then from brickOffset the bricks, packed back
+// to back in brick order, each in the smallest of the codecs below.  A
+// brick of one value takes no space at all, the value is in its entry;
+// RLE is run length coding of the bytes of the brick; delta codes each
+// voxel as its difference from the one before (as integers, x fastest
+// through the brick, see brickDeltaPlanes()), splits the differences into
+// one plane per byte and run length codes the planes, which suits smooth float and 16 bit data
+// whose high bytes then barely change.  Every codec is lossless; the
+// bricks tool can round float voxels to fewer mantissa bits first
+// (mantissaBits), which leaves the low planes zero.  brickBytes is then
+// the size of a brick once decoded, padded as before.
+
+#ifndef _VOLUMERENDER_BRICKS_H_
+#define _VOLUMERENDER_BRICKS_H_
+
+#include <string.h>
+
+// 128 bytes
+struct BrickFileHeader
+{
+    char magic[4];                  // "BVB" and a NUL
+    unsigned int version;           // 1
+    unsigned int width, height, depth;
+    unsigned int voxelType;         // a CpuVoxelType
+    unsigned int voxelSize;         // bytes per voxel
+    unsigned int brickSize;         // BRICK_FILE_SIZE
+    unsigned int bricksX, bricksY, bricksZ;
+    float rawMin, rawMax;           // range of voxelValue() over the volume
+    unsigned int reserved0;         // 0
+    unsigned long long rangeOffset; // of the brick ranges in the file
+    unsigned long long brickOffset; // of the first brick, a multiple of BRICK_FILE_ALIGN
+    unsigned long long brickBytes;  // from one brick to the next, a multiple of BRICK_FILE_ALIGN
+    unsigned long long indexOffset; // of the brick index of a compressed file, else 0
+    unsigned int mantissaBits;      // float voxels rounded to this many, 0 if not
+    unsigned int reserved[9];       // 0
+};
+
+// 16 bytes, one per brick of a compressed file
+struct BrickFileEntry
+{
+    unsigned long long offset;      // of the coded brick in the file; the voxel of a BRICK_CODEC_CONSTANT brick
+    unsigned int bytes;             // of the coded brick, 0 for BRICK_CODEC_CONSTANT
+    unsigned int codec;             // a BrickCodec
+};
+
+enum BrickCodec
+{
+    BRICK_CODEC_RAW,                // the voxels as they are
+    BRICK_CODEC_CONSTANT,           // every voxel the same, stored in the entry
+    BRICK_CODEC_RLE,                // run length coded bytes
+    BRICK_CODEC_DELTA               // run length coded byte planes of the differences
+};
+
+static const char brickFileMagic[4] = { 'B', 'V', 'B', 0 };
+
+#define BRICK_FILE_VERSION 1
+#define BRICK_FILE_VERSION_COMPRESSED 2
+#define BRICK_FILE_SHIFT   5
+#define BRICK_FILE_SIZE    (1 << BRICK_FILE_SHIFT)
+#define BRICK_FILE_PITCH   (BRICK_FILE_SIZE + 1)   // voxels per brick row, extra layer included
+#define BRICK_FILE_ALIGN   4096
+
+// bytes per voxel of each CpuVoxelType: uint8, uint16, float, half
+static const unsigned int brickFileVoxelSize[4] = { 1, 2, 4, 2 };
+
+inline unsigned long long brickFileAlign(unsigned long long offset)
+{
+    return (offset + BRICK_FILE_ALIGN - 1) / BRICK_FILE_ALIGN * BRICK_FILE_ALIGN;
+}
+
+// fills in a header for a volume, everything but the value range
+inline void brickFileHeader(BrickFileHeader &h, unsigned int width, unsigned int height, unsigned int depth,
+                            unsigned int voxelType, unsigned int voxelSize, bool compressed)
+{
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, brickFileMagic, sizeof(h.magic));
+    h.version = compressed ? BRICK_FILE_VERSION_COMPRESSED : BRICK_FILE_VERSION;
+    h.width = width;
+    h.height = height;
+    h.depth = depth;
+    h.voxelType = voxelType;
+    h.voxelSize = voxelSize;
+    h.brickSize = BRICK_FILE_SIZE;
+    h.bricksX = (width  + BRICK_FILE_SIZE - 1) / BRICK_FILE_SIZE;
+    h.bricksY = (height + BRICK_FILE_SIZE - 1) / BRICK_FILE_SIZE;
+    h.bricksZ = (depth  + BRICK_FILE_SIZE - 1) / BRICK_FILE_SIZE;
+    h.rangeOffset = sizeof(h);
+
+    unsigned long long bricks = (unsigned long long)h.bricksX * h.bricksY * h.bricksZ;
+    h.brickOffset = brickFileAlign(h.rangeOffset + bricks * 2 * sizeof(float));
+
+    if (compressed)
+    {
+        h.indexOffset = h.rangeOffset + bricks * 2 * sizeof(float);
+        h.brickOffset = brickFileAlign(h.indexOffset + bricks * sizeof(BrickFileEntry));
+    }
+
+    h.brickBytes = brickFileAlign((unsigned long long)BRICK_FILE_PITCH * BRICK_FILE_PITCH * BRICK_FILE_PITCH * voxelSize);
+}
+
+// true if a header describes a volume that fits into its file
+inline bool brickFileHeaderValid(const BrickFileHeader &h, unsigned long long fileSize)
+{
+    BrickFileHeader expected;
+
+    bool compressed = h.version == BRICK_FILE_VERSION_COMPRESSED;
+
+    if (fileSize < sizeof(h) || memcmp(h.magic, brickFileMagic, sizeof(h.magic)) ||
+        (h.version != BRICK_FILE_VERSION && !compressed) || h.brickSize != BRICK_FILE_SIZE ||
+        h.width == 0 || h.height == 0 || h.depth == 0 || h.voxelType > 3 ||
+        h.voxelSize != brickFileVoxelSize[h.voxelType])
+    {
+        return false;
+    }
+
+    brickFileHeader(expected, h.width, h.height, h.depth, h.voxelType, h.voxelSize, compressed);
+
+    unsigned long long bricks = (unsigned long long)h.bricksX * h.bricksY * h.bricksZ;
+
+    // the entries of a compressed file are checked as their bricks are read
+    return h.bricksX == expected.bricksX && h.bricksY == expected.bricksY && h.bricksZ == expected.bricksZ &&
+           h.rangeOffset == expected.rangeOffset && h.brickOffset == expected.brickOffset &&
+           h.brickBytes == expected.brickBytes && h.indexOffset == expected.indexOffset &&
+           h.brickOffset <= fileSize && (compressed || bricks <= (fileSize - h.brickOffset) / h.brickBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// brick codecs
+////////////////////////////////////////////////////////////////////////////////
+
+// Run length coding of bytes: a control byte c < 128 is followed by c + 1
+// bytes taken as they are, c >= 128 by one byte repeated c - 125 times
+#define BRICK_RLE_MIN_RUN 3
+#define BRICK_RLE_MAX_RUN (255 - 125)
+
+// largest coded size of n bytes, all taken as they are
+inline size_t brickRleBound(size_t n)
+{
+    return n + (n + 127) / 128;
+}
+
+inline size_t brickRleEncode(const unsigned char *src, size_t n, unsigned char *dst)
+{
+    size_t o = 0, literal = 0, i = 0;
+
+    while (i <= n)
+    {
+        size_t run = 1;
+
+        while (i < n && i + run < n && run < BRICK_RLE_MAX_RUN && src[i + run] == src[i])
+        {
+            run++;
+        }
+
+        if (i == n || run >= BRICK_RLE_MIN_RUN)
+        {
+            // the bytes since the last run go first, 128 at a time
+            while (literal < i)
+            {
+                size_t count = i - literal < 128 ? i - literal : 128;
+                dst[o++] = (unsigned char)(count - 1);
+                memcpy(dst + o, src + literal, count);
+                o += count;
+                literal += count;
+            }
+
+            if (i == n)
+            {
+                break;
+            }
+
+            dst[o++] = (unsigned char)(run + 125);
+            dst[o++] = src[i];
+            literal = i + run;
+        }
+
+        i += run;
+    }
+
+    return o;
+}
+
+// false if src does not decode to exactly n bytes
+inline bool brickRleDecode(const unsigned char *src, size_t srcBytes, unsigned char *dst, size_t n)
+{
+    size_t i = 0, o = 0;
+
+    while (o < n && i < srcBytes)
+    {
+        size_t c = src[i++];
+
+        if (c < 128)
+        {
+            if (c + 1 > srcBytes - i || c + 1 > n - o) return false;
+
+            memcpy(dst + o, src + i, c + 1);
+            i += c + 1;
+            o += c + 1;
+        }
+        else
+        {
+            size_t run = c - 125;
+
+            if (i == srcBytes || run > n - o) return false;
+
+            memset(dst + o, src[i++], run);
+            o += run;
+        }
+    }
+
+    return o == n && i == srcBytes;
+}
+
+// voxel i of a brick of voxelSize byte voxels as an integer, its first
+// byte lowest, and back
+inline unsigned int brickWord(const unsigned char *p, size_t i, unsigned int voxelSize)
+{
+    unsigned int w = 0;
+
+    for (unsigned int k = 0; k < voxelSize; k++)
+    {
+        w |= (unsigned int)p[i * voxelSize + k] << (8 * k);
+    }
+
+    return w;
+}
+
+inline void brickSetWord(unsigned char *p, size_t i, unsigned int voxelSize, unsigned int w)
+{
+    for (unsigned int k = 0; k < voxelSize; k++)
+    {
+        p[i * voxelSize + k] = (unsigned char)(w >> (8 * k));
+    }
+}
+
+// the byte planes of the differences between neighbouring voxels, voxel i
+// of plane k at planes[k * voxels + i].  The differences are taken modulo
+// the voxel's bits and zigzag coded (0, -1, 1, -2, ... to 0, 1, 2, 3, ...)
+// so that small steps down leave the high bytes zero as steps up do.
+inline void brickDeltaPlanes(const unsigned char *src, size_t voxels, unsigned int voxelSize, unsigned char *planes)
+{
+    unsigned int shift = 32 - 8 * voxelSize;
+    unsigned int previous = 0;
+
+    for (size_t i = 0; i < voxels; i++)
+    {
+        unsigned int w = brickWord(src, i, voxelSize);
+        int step = (int)((w - previous) << shift) >> shift;
+        unsigned int d = ((unsigned int)step << 1) ^ (unsigned int)(step >> 31);
+        previous = w;
+
+        for (unsigned int k = 0; k < voxelSize; k++)
+        {
+            planes[k * voxels + i] = (unsigned char)(d >> (8 * k));
+        }
+    }
+}
+
+// the voxel size a template argument, so that the loops over bytes unroll
+template <unsigned int voxelSize>
+inline void brickDeltaSum(const unsigned char *planes, size_t voxels, unsigned char *dst)
+{
+    unsigned int w = 0;
+
+    for (size_t i = 0; i < voxels; i++)
+    {
+        unsigned int d = 0;
+
+        for (unsigned int k = 0; k < voxelSize; k++)
+        {
+            d |= (unsigned int)planes[k * voxels + i] << (8 * k);
+        }
+
+        w += (d >> 1) ^ (0u - (d & 1));
+        brickSetWord(dst, i, voxelSize, w);
+    }
+}
+
+inline void brickDeltaSum(const unsigned char *planes, size_t voxels, unsigned int voxelSize, unsigned char *dst)
+{
+    switch (voxelSize)
+    {
+        case 1:
+            brickDeltaSum<1>(planes, voxels, dst);
+            break;
+
+        case 2:
+            brickDeltaSum<2>(planes, voxels, dst);
+            break;
+
+        default:
+            brickDeltaSum<4>(planes, voxels, dst);
+            break;
+    }
+}
+
+// codes a brick of rawBytes (BRICK_FILE_PITCH^3 voxels) into out, which
+// holds brickRleBound(rawBytes) bytes, in the smallest codec; scratch
+// holds 2 * brickRleBound(rawBytes).  Fills in all of the entry but its
+// offset for the codecs that store data.
+inline void brickEncode(const unsigned char *brick, size_t rawBytes, unsigned int voxelSize,
+                        unsigned char *out, unsigned char *scratch, BrickFileEntry &entry)
+{
+    size_t voxels = rawBytes / voxelSize;
+    size_t i = 1;
+
+    while (i < voxels && !memcmp(brick, brick + i * voxelSize, voxelSize))
+    {
+        i++;
+    }
+
+    if (i == voxels)
+    {
+        entry.offset = 0;
+        memcpy(&entry.offset, brick, voxelSize);
+        entry.bytes = 0;
+        entry.codec = BRICK_CODEC_CONSTANT;
+        return;
+    }
+
+    entry.codec = BRICK_CODEC_RAW;
+    entry.bytes = (unsigned int)rawBytes;
+
+    size_t rle = brickRleEncode(brick, rawBytes, out);
+
+    if (rle < entry.bytes)
+    {
+        entry.codec = BRICK_CODEC_RLE;
+        entry.bytes = (unsigned int)rle;
+    }
+
+    unsigned char *coded = scratch + brickRleBound(rawBytes);
+    brickDeltaPlanes(brick, voxels, voxelSize, scratch);
+    size_t delta = brickRleEncode(scratch, rawBytes, coded);
+
+    if (delta < entry.bytes)
+    {
+        entry.codec = BRICK_CODEC_DELTA;
+        entry.bytes = (unsigned int)delta;
+        memcpy(out, coded, delta);
+    }
+
+    if (entry.codec == BRICK_CODEC_RAW)
+    {
+        memcpy(out, brick, rawBytes);
+    }
+}
+
+// decodes the brick of an entry from its data, src (unused for constant
+// bricks), into rawBytes at dst; scratch holds rawBytes.  false if the data
+// is damaged.
+inline bool brickDecode(const BrickFileEntry &entry, const unsigned char *src, unsigned char *dst,
+                        size_t rawBytes, unsigned int voxelSize, unsigned char *scratch)
+{
+    switch (entry.codec)
+    {
+        case BRICK_CODEC_RAW:
+            if (entry.bytes != rawBytes) return false;
+
+            memcpy(dst, src, rawBytes);
+            return true;
+
+        case BRICK_CODEC_CONSTANT:
+            for (size_t i = 0; i < rawBytes; i += voxelSize)
+            {
+                memcpy(dst + i, &entry.offset, voxelSize);
+            }
+
+            return true;
+
+        case BRICK_CODEC_RLE:
+            return brickRleDecode(src, entry.bytes, dst, rawBytes);
+
+        case BRICK_CODEC_DELTA:
+            if (!brickRleDecode(src, entry.bytes, scratch, rawBytes)) return false;
+
+            brickDeltaSum(scratch, rawBytes / voxelSize, voxelSize, dst);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#endif // #ifndef _VOLUMERENDER_BRICKS_H_
@@ -0,0 +1,1642 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Simple 3D volume renderer, host version
+//
+// Same ray marcher as d_render in volumeRender_kernel.cu.  The image is cut
+// into tiles the size of a CUDA block and the tiles are handed out to a pool
+// of worker threads, one per core.
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "volumeRender_cpu.h"
+#include "volumeRender_cpu_internal.h"
+
+// must match the table in initCuda()
+const vec4 cpuTransferFunc[TRANSFER_FUNC_SIZE] =
+{
+    {  0.0, 0.0, 0.0, 0.0, },
+    {  1.0, 0.0, 0.0, 1.0, },
+    {  1.0, 0.5, 0.0, 1.0, },
+    {  1.0, 1.0, 0.0, 1.0, },
+    {  0.0, 1.0, 0.0, 1.0, },
+    {  0.0, 1.0, 1.0, 1.0, },
+    {  0.0, 0.0, 1.0, 1.0, },
+    {  1.0, 0.0, 1.0, 1.0, },
+    {  0.0, 0.0, 0.0, 0.0, },
+};
+
+static CpuVolume cpuVolume;
+static CpuVolumeLayout cpuLayout = CPU_LAYOUT_LINEAR;
+static CpuVoxelType cpuVoxelType = CPU_VOXEL_UINT8;
+static bool cpuLinearFilter = true;
+static bool cpuUseSimd = true;
+static bool cpuSkipEmptySpace = true;
+static bool cpuAdaptive = false;
+static bool cpuPreintegrate = false;
+static bool cpuFixedPoint = false;
+static RenderMode cpuRenderMode = RENDER_COMPOSITE;
+static RenderPass cpuRenderPass = fullRenderPass;
+static bool cpuReproject = false;
+static CpuReprojectionParams cpuReprojectionParams = { 16, 0.1f, 1.0f, 5.0f };
+static CpuReprojection cpuReprojection;
+static bool cpuLevelOfDetail = false;
+static bool cpuHistogramValid = false;
+static unsigned long long cpuHistogram[CPU_HISTOGRAM_BINS];
+static float cpuHistogramMin, cpuHistogramMax;
+static char *cpuPyramidCache = 0;
+static CpuVolumePyramid cpuPyramid;
+static CpuOctree cpuOctree;
+static CpuAmr cpuAmr;
+static CpuPagedVolume cpuPaged;
+static CpuCompressedVolume cpuCompressed;
+static CpuQuantizedVolume cpuQuantized;
+static float cpuQuality = 1.0f;
+static CpuMacrocells cpuMacrocells;
+static CpuPreintTable cpuPreintTable;
+static CpuTransferTable cpuTransferTable;
+static CpuFrameStats cpuLastFrameStats;
+static float cpuInvViewMatrix[12];
+
+#define TILE_W 16
+#define TILE_H 16
+
+////////////////////////////////////////////////////////////////////////////////
+// worker pool
+////////////////////////////////////////////////////////////////////////////////
+
+static std::vector<std::thread> poolThreads;
+static std::mutex poolMutex;
+static std::condition_variable poolWake;
+static std::condition_variable poolDone;
+static const std::function<void(int)> *poolJob = 0;
+static std::atomic<int> poolNextItem(0);
+static int poolItemCount = 0;
+static int poolBusy = 0;
+static unsigned int poolGeneration = 0;
+static bool poolQuit = false;
+static int poolRequestedThreads = 0;
+static __thread bool poolInsideJob = false;
+
+static void runPoolItems(const std::function<void(int)> &fn, int count)
+{
+    poolInsideJob = true;
+
+    for (int i = poolNextItem.fetch_add(1); i < count; i = poolNextItem.fetch_add(1))
+    {
+        fn(i);
+    }
+
+    poolInsideJob = false;
+}
+
+static void poolWorker()
+{
+    unsigned int seen = 0;
+
+    for (;;)
+    {
+        const std::function<void(int)> *job;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            poolWake.wait(lock, [&] { return poolQuit || poolGeneration != seen; });
+
+            if (poolQuit) return;
+
+            seen = poolGeneration;
+
+            // woke up after the job was already finished by the others
+            if (!poolJob) continue;
+
+            job = poolJob;
+            count = poolItemCount;
+            poolBusy++;
+        }
+
+        runPoolItems(*job, count);
+
+        std::lock_guard<std::mutex> lock(poolMutex);
+
+        if (--poolBusy == 0)
+        {
+            poolDone.notify_all();
+        }
+    }
+}
+
+static void stopPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        poolQuit = true;
+    }
+    poolWake.notify_all();
+
+    for (size_t i = 0; i < poolThreads.size(); i++)
+    {
+        poolThreads[i].join();
+    }
+
+    poolThreads.clear();
+    poolQuit = false;
+}
+
+static void startPool()
+{
+    int n = poolRequestedThreads;
+
+    if (n <= 0)
+    {
+        n = (int)std::thread::hardware_concurrency();
+    }
+
+    // the calling thread is a worker as well
+    for (int i = 1; i < n; i++)
+    {
+        poolThreads.push_back(std::thread(poolWorker));
+    }
+}
+
+void cpuParallelFor(int count, const std::function<void(int)> &fn)
+{
+    if (count <= 0) return;
+
+    if (poolInsideJob || count == 1)
+    {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    static std::mutex callerMutex;
+    std::lock_guard<std::mutex> callerLock(callerMutex);
+
+    if (poolThreads.empty())
+    {
+        startPool();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        poolJob = &fn;
+        poolItemCount = count;
+        poolNextItem = 0;
+        poolGeneration++;
+    }
+    poolWake.notify_all();
+
+    runPoolItems(fn, count);
+
+    // wait for workers still finishing their last item
+    std::unique_lock<std::mutex> lock(poolMutex);
+    poolDone.wait(lock, [] { return poolBusy == 0; });
+    poolJob = 0;
+}
+
+extern "C"
+void setCpuThreadCount(int numThreads)
+{
+    stopPool();
+    poolRequestedThreads = numThreads;
+}
+
+extern "C"
+int getCpuThreadCount()
+{
+    if (poolThreads.empty())
+    {
+        startPool();
+    }
+
+    return (int)poolThreads.size() + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ray marcher
+////////////////////////////////////////////////////////////////////////////////
+
+// sample the volume at (u, v, w), in [0, 1]
+template <typename Voxel, bool linearFilter>
+static float sampleVolume(const CpuVolume &vol, float u, float v, float w)
+{
+    return linearFilter ? sampleVolumeLinear<Voxel>(vol, u, v, w) : sampleVolumeNearest<Voxel>(vol, u, v, w);
+}
+
+// colour and density scaled opacity at (u, v, w), through the transfer
+// function or through the fixed point path and its table
+template <typename Voxel, bool linearFilter>
+static vec4 classifySample(const CpuRenderArgs &args, const CpuVolume &vol, float u, float v, float w, std::false_type)
+{
+    float sample = sampleVolume<Voxel, linearFilter>(vol, u, v, w);
+
+    // lookup in transfer function
+    vec4 col = sampleTransfer((sample-args.transferOffset)*args.transferScale);
+    col.w *= args.density;
+    return col;
+}
+
+template <typename Voxel, bool linearFilter>
+static vec4 classifySample(const CpuRenderArgs &args, const CpuVolume &vol, float u, float v, float w, std::true_type)
+{
+    const CpuTransferTable &table = *args.transferTable;
+    int i = linearFilter ? sampleVolumeLinearFixed<Voxel>(vol, table, u, v, w) :
+                           sampleVolumeNearestFixed<Voxel>(vol, table, u, v, w);
+
+    return make_vec4(table.r[i], table.g[i], table.b[i], table.a[i]);
+}
+
+bool pixelRay(const CpuRenderArgs &args, uint x, uint y, CpuRay &eyeRay, float &tnear, float &tfar)
+{
+    const vec3 boxMin = make_vec3(-1.0f, -1.0f, -1.0f);
+    const vec3 boxMax = make_vec3(1.0f, 1.0f, 1.0f);
+
+    float u = (x / (float) args.imageW)*2.0f-1.0f;
+    float v = (y / (float) args.imageH)*2.0f-1.0f;
+
+    // calculate eye ray in world space
+    eyeRay = eyeRayForPixel(args.invViewMatrix, u, v);
+
+    // find intersection with box
+    int hit = intersectBoxCpu(eyeRay, boxMin, boxMax, &tnear, &tfar);
+
+    if (!hit) return false;
+
+    if (tnear < 0.0f) tnear = 0.0f;     // clamp to near plane
+
+    return true;
+}
+
+// march one eye ray and count it in stats; the template arguments stand in
+// for args.linearFilter, args.adaptive, args.preint != 0 and
+// args.transferTable != 0
+template <typename Voxel, bool linearFilter, bool adaptive, bool preint, bool fixedPoint>
+static void renderPixel(const CpuRenderArgs &args, uint x, uint y, CpuFrameStats &stats)
+{
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    // march along ray from front to back, accumulating color.  Sample i is
+    // taken at tnear + i*tstep; with macrocells, runs of samples inside
+    // empty cells are skipped.  Adaptive marching also steps over up to
+    // stepScale - 1 samples at a time inside a cell, and since the ray then
+    // ends at tfar rather than after maxSteps samples it is not capped.
+    // With pre-integration the steps are PREINT_STEP_SCALE times longer and
+    // each sample after the first closes the segment from the previous one.
+    // With levels of detail the far part of the ray samples coarser levels
+    // and, except with pre-integration, steps over as many samples as the
+    // level asks for.
+    vec4 sum = make_vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    const CpuMacrocells *cells = args.macrocells;
+    const float tstep = preint ? cpuTstep * PREINT_STEP_SCALE : cpuTstep;
+    const int maxSteps = adaptive ? INT_MAX :
+                         preint ? (cpuMaxSteps + PREINT_STEP_SCALE - 1) / PREINT_STEP_SCALE : cpuMaxSteps;
+    bool haveFront = false;
+    float front = 0.0f;
+    CpuCellWalker walker;
+    CpuLodWalker lod;
+    float tCellEnd = INFINITY;
+    int cellStep = 1;
+    float cellRange = 0.0f;
+    float error = 0.0f;
+    int samples = 0;
+    int i = 0;
+
+    lod.init(args.lod, *args.volume);
+
+    // opacity weighted sums of t and t^2 for the reprojection depth
+    const bool trackDepth = args.depth != 0;
+    float tSum = 0.0f, tSqSum = 0.0f;
+
+    if (cells)
+    {
+        walker.init(*cells, eyeRay, tnear);
+        tCellEnd = -INFINITY;       // classify the first cell before sampling
+    }
+
+    while (i < maxSteps)
+    {
+        float t = tnear + i*tstep;
+        float partial = 1.0f;
+        bool last = false;
+
+        if (i > 0 && t > tfar)
+        {
+            if (!preint || !haveFront) break;
+
+            // close the ray with a shorter segment ending at tfar; point
+            // sampling covers this piece with its last, shorter steps
+            partial = clampf((tfar - (t - tstep)) / tstep, 0.0f, 1.0f);
+            t = tfar;
+            last = true;
+        }
+
+        if (!last && t >= tCellEnd)
+        {
+            // catch up with t, then walk over empty cells.  A sample right
+            // on the exit face still belongs to the cell (its apron covers
+            // it), which keeps the last sample of a ray leaving the grid.
+            bool inside = true;
+
+            while (inside && walker.tExit() < t)
+            {
+                inside = walker.step();
+            }
+
+            while (inside && walker.empty(*cells))
+            {
+                inside = walker.step();
+            }
+
+            // nothing visible left along this ray
+            if (!inside) break;
+
+            if (walker.tEntry > t)
+            {
+                // jump to the first sample in the visible cell, or with
+                // pre-integration to the one before it, which starts the
+                // segment that enters the cell
+                int next = (int)ceilf((walker.tEntry - tnear) / tstep);
+
+                if (preint)
+                {
+                    next--;
+                    haveFront = false;
+                }
+
+                i = next > i ? next : i;
+                t = tnear + i*tstep;
+
+                if (i >= maxSteps || t > tfar) break;
+            }
+
+            tCellEnd = walker.tExit();
+
+            if (adaptive)
+            {
+                // coarse refinement passes take at least args.stepScale
+                int key = walker.key(*cells);
+                cellStep = cells->stepScale[key] > args.stepScale ? cells->stepScale[key] : args.stepScale;
+                cellRange = cells->alphaRange[key];
+            }
+        }
+
+        // index of the next sample; a long step stops at the first sample
+        // past the cell so the next cell sets its own step
+        int next = i + 1;
+
+        if (adaptive && cellStep > 1)
+        {
+            int cellLast = (int)ceilf((tCellEnd - tnear) / tstep);
+            next = i + cellStep;
+            next = cellLast < next ? cellLast : next;
+            next = next > i ? next : i + 1;
+        }
+
+        lod.advance(t);
+
+        if (!preint && lod.stepScale > next - i)
+        {
+            next = i + lod.stepScale;
+        }
+
+        const CpuVolume &vol = *lod.volume;
+        vec3 pos = eyeRay.o + eyeRay.d*t;
+
+        // remap position to [0, 1] coordinates
+        float su = pos.x*0.5f+0.5f, sv = pos.y*0.5f+0.5f, sw = pos.z*0.5f+0.5f;
+
+        samples++;
+
+        if (preint)
+        {
+            float sample = sampleVolume<Voxel, linearFilter>(vol, su, sv, sw);
+
+            if (!haveFront)
+            {
+                front = sample;
+                haveFront = true;
+                i = next;
+                continue;
+            }
+
+            // segment colour comes premultiplied
+            vec4 seg = samplePreint(*args.preint, front, sample);
+            front = sample;
+
+            if (last)
+            {
+                float a = 1.0f - powf(1.0f - seg.w, partial);
+                float s = seg.w > 0.0f ? a / seg.w : 0.0f;
+                seg = make_vec4(seg.x*s, seg.y*s, seg.z*s, a);
+            }
+
+            float a = 1.0f - sum.w;
+            sum.x += seg.x*a;
+            sum.y += seg.y*a;
+            sum.z += seg.z*a;
+            sum.w += seg.w*a;
+
+            if (trackDepth)
+            {
+                tSum += t*seg.w*a;
+                tSqSum += t*t*seg.w*a;
+            }
+
+            if (sum.w > cpuOpacityThreshold || last) break;
+
+            i = next;
+            continue;
+        }
+
+        vec4 col = classifySample<Voxel, linearFilter>(args, vol, su, sv, sw, std::integral_constant<bool, fixedPoint>());
+
+        if (next - i > 1)
+        {
+            // this sample stands for a longer segment: correct the opacity
+            // for the step length and book the worst case of what the
+            // skipped samples could have differed by
+            float ratio = (float)(next - i);
+            error += (1.0f - sum.w) * cellRange * (ratio - 1.0f);
+            col.w = 1.0f - powf(1.0f - clampf(col.w, 0.0f, 1.0f), ratio);
+        }
+
+        // pre-multiply alpha
+        col.x *= col.w;
+        col.y *= col.w;
+        col.z *= col.w;
+        // "over" operator for front-to-back blending
+        float a = 1.0f - sum.w;
+        sum.x += col.x*a;
+        sum.y += col.y*a;
+        sum.z += col.z*a;
+        sum.w += col.w*a;
+
+        if (trackDepth)
+        {
+            tSum += t*col.w*a;
+            tSqSum += t*t*col.w*a;
+        }
+
+        // exit early if opaque
+        if (sum.w > cpuOpacityThreshold) break;
+
+        i = next;
+    }
+
+    if (trackDepth)
+    {
+        storeRayDepth(args, y*args.imageW + x, sum.w, tSum, tSqSum);
+    }
+
+    sum.x *= args.brightness;
+    sum.y *= args.brightness;
+    sum.z *= args.brightness;
+    sum.w *= args.brightness;
+
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(sum);
+
+    stats.rays++;
+    stats.samples += samples;
+    stats.error += error;
+}
+
+template <typename Voxel, bool linearFilter, bool adaptive, bool preint, bool fixedPoint>
+struct ScalarEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        for (uint y = y0; y < y1; y += args.pixelStride)
+        {
+            // pixels the ray misses stay black, like the cudaMemset in render();
+            // warpReprojection() has already cleared the masked in ones
+            if (!args.pixelMask)
+            {
+                memset(&args.output[y*args.imageW + x0], 0, (x1 - x0)*sizeof(uint));
+            }
+
+            for (uint x = x0; x < x1; x += args.pixelStride)
+            {
+                if (args.pixelMask && !args.pixelMask[y*args.imageW + x]) continue;
+
+                renderPixel<Voxel, linearFilter, adaptive, preint, fixedPoint>(args, x, y, stats);
+            }
+        }
+    }
+};
+
+// reduce one eye ray to its maximum, minimum or mean sample.  The samples
+// are those renderPixel() takes, minus the ones in macrocells that cannot
+// beat the running maximum (minimum); a maximum that reaches the largest
+// value in the volume ends the ray.  With levels of detail the samples
+// on coarser levels are further apart, and count for as many samples in
+// a mean.  The reprojection depth is where the maximum (minimum) was
+// found; a mean has none.
+template <typename Voxel, bool linearFilter, int mode>
+static void projectPixel(const CpuRenderArgs &args, uint x, uint y, CpuFrameStats &stats)
+{
+    const CpuVolume &vol = *args.volume;
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    const CpuMacrocells *cells = mode == RENDER_AVERAGE ? 0 : args.macrocells;
+    const float valueMin = vol.rawMin * voxelScale<Voxel>();
+    const float valueMax = vol.rawMax * voxelScale<Voxel>();
+    float result = mode == RENDER_MIP ? -INFINITY : mode == RENDER_MINIP ? INFINITY : 0.0f;
+    const float tstep = cpuTstep * args.stepScale;
+    const int maxSteps = (cpuMaxSteps + args.stepScale - 1) / args.stepScale;
+    CpuCellWalker walker;
+    CpuLodWalker lod;
+    float tCellEnd = INFINITY;
+    float tResult = NAN;
+    float weight = 0.0f;
+    int samples = 0;
+    int step = 1;
+
+    lod.init(args.lod, vol);
+
+    if (cells)
+    {
+        walker.init(*cells, eyeRay, tnear);
+        tCellEnd = -INFINITY;
+    }
+
+    for (int i = 0; i < maxSteps; i += step)
+    {
+        float t = tnear + i*tstep;
+
+        if (i > 0 && t > tfar) break;
+
+        if (t >= tCellEnd)
+        {
+            bool inside = true;
+
+            while (inside && walker.tExit() < t)
+            {
+                inside = walker.step();
+            }
+
+            // walk over the cells that cannot change the result
+            while (inside && (mode == RENDER_MIP ? macrocellUpperBound(*cells, walker.key(*cells)) <= result :
+                                                   macrocellLowerBound(*cells, walker.key(*cells)) >= result))
+            {
+                inside = walker.step();
+            }
+
+            if (!inside) break;
+
+            if (walker.tEntry > t)
+            {
+                int next = (int)ceilf((walker.tEntry - tnear) / tstep);
+                i = next > i ? next : i;
+                t = tnear + i*tstep;
+
+                if (i >= maxSteps || t > tfar) break;
+            }
+
+            tCellEnd = walker.tExit();
+        }
+
+        // steps of a level, counted in steps of this pass
+        lod.advance(t);
+        step = lod.stepScale > args.stepScale ? lod.stepScale / args.stepScale : 1;
+
+        vec3 pos = eyeRay.o + eyeRay.d*t;
+        float sample = sampleVolume<Voxel, linearFilter>(*lod.volume, pos.x*0.5f+0.5f, pos.y*0.5f+0.5f, pos.z*0.5f+0.5f);
+        samples++;
+
+        if (mode == RENDER_MIP)
+        {
+            tResult = sample > result ? t : tResult;
+            result = fmaxf(result, sample);
+
+            if (result >= valueMax) break;
+        }
+        else if (mode == RENDER_MINIP)
+        {
+            tResult = sample < result ? t : tResult;
+            result = fminf(result, sample);
+
+            if (result <= valueMin) break;
+        }
+        else
+        {
+            result += sample * step;
+            weight += step;
+        }
+    }
+
+    if (mode == RENDER_AVERAGE)
+    {
+        result /= weight;
+    }
+
+    if (args.depth)
+    {
+        args.depth[y*args.imageW + x] = tResult;
+        args.spread[y*args.imageW + x] = 0.0f;
+    }
+
+    float grey = projectionGrey(args, result);
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(make_vec4(grey, grey, grey, grey));
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+template <typename Voxel, bool linearFilter, int mode>
+struct ScalarProjectionEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        for (uint y = y0; y < y1; y += args.pixelStride)
+        {
+            if (!args.pixelMask)
+            {
+                memset(&args.output[y*args.imageW + x0], 0, (x1 - x0)*sizeof(uint));
+            }
+
+            for (uint x = x0; x < x1; x += args.pixelStride)
+            {
+                if (args.pixelMask && !args.pixelMask[y*args.imageW + x]) continue;
+
+                projectPixel<Voxel, linearFilter, mode>(args, x, y, stats);
+            }
+        }
+    }
+};
+
+void renderTileScalar(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    CpuTileFunc renderTile = args.mode == RENDER_COMPOSITE ? selectEngine<ScalarEngine>(args) :
+                                                              selectProjection<ScalarProjectionEngine>(args);
+    renderTile(args, x0, y0, x1, y1, stats);
+}
+
+bool cpuSupportsAvx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+bool cpuSupportsAvx512()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx512f");
+#else
+    return false;
+#endif
+}
+
+// pick the widest ray packet marcher this machine supports
+static CpuTileFunc selectTileFunc()
+{
+    if (cpuOctree.leaves)
+    {
+        return renderTileOctree;
+    }
+
+    if (cpuAmr.grids)
+    {
+        return renderTileAmr;
+    }
+
+    if (cpuPaged.cache)
+    {
+        return renderTilePaged;
+    }
+
+    if (cpuCompressed.blocks)
+    {
+        return renderTileCompressed;
+    }
+
+    if (cpuQuantized.data)
+    {
+        return renderTileQuantized;
+    }
+
+    if (!cpuUseSimd)
+    {
+        return renderTileScalar;
+    }
+
+    // the packet marcher gathers with 32 bit offsets
+    if (cpuVolume.size >= 0x7fffffff)
+    {
+        return renderTileScalar;
+    }
+
+    if (cpuSupportsAvx512())
+    {
+        return renderTileAvx512;
+    }
+
+    if (cpuSupportsAvx2())
+    {
+        return renderTileAvx2;
+    }
+
+    return renderTileScalar;
+}
+
+// hash of everything besides the view that the pixels of a frame depend on
+static unsigned long long frameSettingsKey(const CpuRenderArgs &args, uint imageW, uint imageH)
+{
+    const float values[] =
+    {
+        args.density, args.brightness, args.transferOffset, args.transferScale, cpuQuality,
+        (float)imageW, (float)imageH, (float)args.mode, (float)cpuLinearFilter, (float)cpuUseSimd,
+        (float)cpuSkipEmptySpace, (float)cpuAdaptive, (float)cpuPreintegrate, (float)cpuFixedPoint,
+        (float)(args.lod != 0), cpuReprojectionParams.minAlpha,
+    };
+    unsigned char bytes[sizeof(values)];
+    unsigned long long hash = 14695981039346656037ull;     // FNV-1a
+    memcpy(bytes, values, sizeof(values));
+
+    for (size_t i = 0; i < sizeof(bytes); i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// copy the first pixel of each block of a coarse pass over its block
+static void fillPixelBlocks(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1)
+{
+    const uint s = args.pixelStride;
+
+    for (uint y = y0; y < y1; y += s)
+    {
+        uint *row = &args.output[y*args.imageW];
+
+        for (uint x = x0; x < x1; x += s)
+        {
+            for (uint bx = x + 1; bx < x + s && bx < x1; bx++)
+            {
+                row[bx] = row[x];
+            }
+        }
+
+        for (uint by = y + 1; by < y + s && by < y1; by++)
+        {
+            memcpy(&args.output[by*args.imageW + x0], &row[x0], (x1 - x0)*sizeof(uint));
+        }
+    }
+}
+
+extern "C"
+unsigned long long render_cpu(uint *h_output, uint imageW, uint imageH,
+                              float density, float brightness,
+                              float transferOffset, float transferScale)
+{
+    // tiles start at rowBegin; blocks of a coarse pass never straddle them
+    uint rowBegin = cpuRenderPass.rowBegin < imageH ? cpuRenderPass.rowBegin : imageH;
+    uint rowEnd = cpuRenderPass.rowEnd < imageH ? cpuRenderPass.rowEnd : imageH;
+    int tilesX = (imageW + TILE_W - 1) / TILE_W;
+    int tilesY = rowEnd > rowBegin ? (rowEnd - rowBegin + TILE_H - 1) / TILE_H : 0;
+    CpuFrameStats stats = { 0, 0, 0.0, 0, 0, 0 };
+    std::mutex statsMutex;
+
+    CpuRenderArgs args;
+    args.output = h_output;
+    args.imageW = imageW;
+    args.imageH = imageH;
+    args.density = density;
+    args.brightness = brightness;
+    args.transferOffset = transferOffset;
+    args.transferScale = transferScale;
+    args.invViewMatrix = cpuInvViewMatrix;
+    args.volume = &cpuVolume;
+    args.macrocells = 0;
+    args.preint = 0;
+    args.transferTable = 0;
+    args.lod = 0;
+    args.octree = cpuOctree.leaves ? &cpuOctree : 0;
+    args.amr = cpuAmr.grids ? &cpuAmr : 0;
+    args.paged = cpuPaged.cache ? &cpuPaged : 0;
+    args.compressed = cpuCompressed.blocks ? &cpuCompressed : 0;
+    args.quantized = cpuQuantized.data ? &cpuQuantized : 0;
+    args.linearFilter = cpuLinearFilter;
+    args.adaptive = false;
+    args.mode = cpuRenderMode;
+    args.pixelStride = cpuRenderPass.pixelStride;
+    args.stepScale = cpuRenderPass.stepScale;
+    args.pixelMask = 0;
+    args.depth = 0;
+    args.spread = 0;
+    args.reuseMinAlpha = cpuReprojectionParams.minAlpha;
+
+    if (args.octree)
+    {
+        // the tree keeps the value range of every subtree itself
+    }
+    else if (args.amr)
+    {
+        // the macrocells cover the volume, not the patches
+    }
+    else if (args.paged)
+    {
+        // the file keeps the value range of every brick itself
+    }
+    else if (args.compressed)
+    {
+        // as the code does of every tile
+    }
+    else if (args.quantized)
+    {
+        // as the quantized volume does of every brick
+    }
+    else if (cpuRenderMode != RENDER_COMPOSITE)
+    {
+        // the projections only need the value ranges of the cells, which do
+        // not depend on the transfer function
+        args.macrocells = cpuSkipEmptySpace ? &cpuMacrocells : 0;
+    }
+    else
+    {
+        // longer steps of a coarse pass go through adaptive marching, which
+        // corrects the opacity for them
+        bool coarse = args.stepScale > 1 && !cpuPreintegrate;
+
+        if (cpuSkipEmptySpace || cpuAdaptive || coarse)
+        {
+            updateMacrocellSummary(cpuMacrocells, transferOffset, transferScale, density, cpuQuality);
+            args.macrocells = &cpuMacrocells;
+            args.adaptive = cpuAdaptive || coarse;
+        }
+
+        // the table is rebuilt on the first frame after the density or
+        // transfer function keys in keyboard() changed it; all cores share
+        // the work
+        if (cpuPreintegrate)
+        {
+            updatePreintTable(cpuPreintTable, transferOffset, transferScale, density);
+            args.preint = &cpuPreintTable;
+            args.adaptive = false;
+        }
+        else if (cpuFixedPoint && fixedPointType(cpuVolume.type))
+        {
+            updateTransferTable(cpuTransferTable, transferOffset, transferScale, density);
+            args.transferTable = &cpuTransferTable;
+        }
+    }
+
+    CpuLod lod;
+
+    if (cpuLevelOfDetail && cpuPyramid.levels > 1 && !args.octree && !args.amr && !args.paged &&
+        !args.compressed && !args.quantized)
+    {
+        setupLod(lod, cpuVolume, cpuPyramid, imageW, imageH, args.pixelStride);
+        args.lod = &lod;
+    }
+
+    // only full frames take part in reprojection; a mean has no depth to
+    // move it by
+    bool reproject = cpuReproject && args.pixelStride == 1 && args.stepScale == 1 &&
+                     rowBegin == 0 && rowEnd == imageH && cpuRenderMode != RENDER_AVERAGE;
+
+    CpuTileFunc renderTile = selectTileFunc();
+
+    if (reproject)
+    {
+        // a ray packet is at most 4x4 pixels, aligned to the tile
+        uint blockSize = renderTile == renderTileScalar || renderTile == renderTileOctree ||
+                         renderTile == renderTileAmr || renderTile == renderTilePaged ||
+                         renderTile == renderTileCompressed || renderTile == renderTileQuantized ? 1 : 4;
+        stats.reused = warpReprojection(cpuReprojection, cpuReprojectionParams,
+                                        frameSettingsKey(args, imageW, imageH), cpuRenderMode, cpuInvViewMatrix,
+                                        h_output, imageW, imageH, blockSize);
+        args.pixelMask = cpuReprojection.holes;
+        args.depth = cpuReprojection.depth;
+        args.spread = cpuReprojection.nextSpread;
+    }
+
+    unsigned long long bricksRead = pagedBricksRead(cpuPaged);
+    unsigned long long bytesRead = pagedBytesRead(cpuPaged);
+
+    if (args.paged)
+    {
+        prefetchPagedVolume(args);
+    }
+
+    cpuParallelFor(tilesX * tilesY, [&](int tile)
+    {
+        uint x0 = (tile % tilesX) * TILE_W;
+        uint y0 = rowBegin + (tile / tilesX) * TILE_H;
+        uint x1 = x0 + TILE_W < imageW ? x0 + TILE_W : imageW;
+        uint y1 = y0 + TILE_H < rowEnd ? y0 + TILE_H : rowEnd;
+
+        CpuFrameStats tileStats = { 0, 0, 0.0, 0, 0, 0 };
+        renderTile(args, x0, y0, x1, y1, tileStats);
+
+        if (args.pixelStride > 1)
+        {
+            fillPixelBlocks(args, x0, y0, x1, y1);
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.rays += tileStats.rays;
+        stats.samples += tileStats.samples;
+        stats.error += tileStats.error;
+    });
+
+    if (reproject)
+    {
+        storeReprojection(cpuReprojection, cpuReprojectionParams, cpuInvViewMatrix, h_output);
+    }
+
+    stats.bricksRead = pagedBricksRead(cpuPaged) - bricksRead;
+    stats.bytesRead = pagedBytesRead(cpuPaged) - bytesRead;
+    cpuLastFrameStats = stats;
+
+    return stats.samples;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// setup
+////////////////////////////////////////////////////////////////////////////////
+
+extern "C"
+void setCpuFilterMode(bool bLinearFilter)
+{
+    cpuLinearFilter = bLinearFilter;
+}
+
+extern "C"
+void setCpuSimd(bool bUseSimd)
+{
+    cpuUseSimd = bUseSimd;
+}
+
+extern "C"
+const char *getCpuSimdName()
+{
+    CpuTileFunc renderTile = selectTileFunc();
+
+    if (renderTile == renderTileAvx512) return "AVX-512";
+
+    if (renderTile == renderTileAvx2) return "AVX2";
+
+    return "scalar";
+}
+
+extern "C"
+void setCpuEmptySpaceSkipping(bool bSkip)
+{
+    cpuSkipEmptySpace = bSkip;
+}
+
+extern "C"
+void setCpuPreintegration(bool bPreint)
+{
+    cpuPreintegrate = bPreint;
+}
+
+extern "C"
+void setCpuFixedPoint(bool bFixedPoint)
+{
+    cpuFixedPoint = bFixedPoint;
+}
+
+extern "C"
+void setCpuRenderMode(RenderMode mode)
+{
+    cpuRenderMode = mode;
+}
+
+extern "C"
+void setCpuRenderPass(RenderPass pass)
+{
+    // a block must fit in a tile
+    uint stride = 1;
+
+    while (stride < pass.pixelStride && stride < TILE_W)
+    {
+        stride *= 2;
+    }
+
+    pass.pixelStride = stride;
+    pass.stepScale = pass.stepScale > 1 ? pass.stepScale : 1;
+    cpuRenderPass = pass;
+}
+
+extern "C"
+void setCpuReprojection(bool bReproject)
+{
+    cpuReproject = bReproject;
+    cpuReprojection.valid = false;
+}
+
+extern "C"
+void setCpuReprojectionParams(const CpuReprojectionParams *params)
+{
+    cpuReprojectionParams = *params;
+    cpuReprojectionParams.maxAge = clampi(params->maxAge, 0, 255);     // ages are bytes
+}
+
+extern "C"
+void getCpuReprojectionParams(CpuReprojectionParams *params)
+{
+    *params = cpuReprojectionParams;
+}
+
+extern "C"
+void setCpuLevelOfDetail(bool bLod)
+{
+    cpuLevelOfDetail = bLod;
+}
+
+extern "C"
+void setCpuPyramidCache(const char *path)
+{
+    free(cpuPyramidCache);
+    cpuPyramidCache = path ? strdup(path) : 0;
+}
+
+extern "C"
+void setCpuAdaptiveSampling(bool bAdaptive)
+{
+    cpuAdaptive = bAdaptive;
+}
+
+extern "C"
+void setCpuQuality(float quality)
+{
+    cpuQuality = clampf(quality, 1.0f / MAX_STEP_SCALE, 1.0f);
+}
+
+extern "C"
+float getCpuQuality()
+{
+    return cpuQuality;
+}
+
+extern "C"
+void getCpuFrameStats(CpuFrameStats *stats)
+{
+    *stats = cpuLastFrameStats;
+}
+
+extern "C"
+void setCpuVolumeLayout(CpuVolumeLayout layout)
+{
+    cpuLayout = layout;
+}
+
+extern "C"
+const char *getCpuVolumeLayoutName()
+{
+    // initCpu() may have fallen back to another layout
+    switch (cpuVolume.data ? cpuVolume.layout : cpuLayout)
+    {
+        case CPU_LAYOUT_BRICKED:
+            return "bricked";
+
+        case CPU_LAYOUT_MORTON:
+            return "morton";
+
+        default:
+            return "linear";
+    }
+}
+
+float voxelTypeScale(CpuVoxelType type)
+{
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            return voxelScale<ushort>();
+
+        case CPU_VOXEL_FLOAT:
+            return voxelScale<float>();
+
+        case CPU_VOXEL_HALF:
+            return voxelScale<CpuHalf>();
+
+        default:
+            return voxelScale<uchar>();
+    }
+}
+
+extern "C"
+void setCpuVoxelType(CpuVoxelType type)
+{
+    cpuVoxelType = type;
+}
+
+extern "C"
+const char *getCpuVoxelTypeName()
+{
+    switch (cpuVoxelType)
+    {
+        case CPU_VOXEL_UINT16:
+            return "uint16";
+
+        case CPU_VOXEL_FLOAT:
+            return "float";
+
+        case CPU_VOXEL_HALF:
+            return "half";
+
+        default:
+            return "uint8";
+    }
+}
+
+extern "C"
+size_t getCpuVoxelSize(CpuVoxelType type)
+{
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            return sizeof(ushort);
+
+        case CPU_VOXEL_FLOAT:
+            return sizeof(float);
+
+        case CPU_VOXEL_HALF:
+            return sizeof(CpuHalf);
+
+        default:
+            return sizeof(uchar);
+    }
+}
+
+extern "C"
+bool getCpuVoxelTypeByName(const char *name, CpuVoxelType *type)
+{
+    const char *names[] = { "uint8", "uint16", "float", "half" };
+    const CpuVoxelType types[] = { CPU_VOXEL_UINT8, CPU_VOXEL_UINT16, CPU_VOXEL_FLOAT, CPU_VOXEL_HALF };
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (!strcmp(name, names[i]))
+        {
+            *type = types[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// drops whatever is rendered in place of cpuVolume, and what is known of
+// the volume rendered, before another takes its place
+static void dropRenderedVolume()
+{
+    freeOctree(cpuOctree);
+    freeAmr(cpuAmr);
+    closePagedVolume(cpuPaged);
+    freeCompressedVolume(cpuCompressed);
+    freeQuantizedVolume(cpuQuantized);
+    cpuReprojection.valid = false;
+    cpuHistogramValid = false;
+}
+
+// everything derived from cpuVolume, once it holds the volume.  h_volume
+// is the volume x fastest, or 0 if there is no such copy; cellRanges, if
+// already known, are those of preprocessVolume().
+static void initCpuVolume(const void *h_volume, const float *cellRanges)
+{
+    cpuLinearFilter = true;
+    dropRenderedVolume();
+
+    if (cellRanges)
+    {
+        buildMacrocellsFromRanges(cpuVolume, cellRanges, cpuMacrocells);
+    }
+    else
+    {
+        buildMacrocells(cpuVolume, cpuMacrocells);
+    }
+
+    freeVolumePyramid(cpuPyramid);
+
+    if (cpuLevelOfDetail)
+    {
+        // the levels are built from a linear copy
+        void *linear = h_volume || cpuVolume.layout == CPU_LAYOUT_LINEAR ? 0 : linearVolumeCopy(cpuVolume);
+        buildVolumePyramid(h_volume ? h_volume : linear ? linear : cpuVolume.data, cpuVolume, cpuPyramid,
+                           cpuPyramidCache);
+        free(linear);
+    }
+
+    float scale = voxelTypeScale(cpuVolume.type);
+    initPreintTable(cpuPreintTable, cpuVolume.rawMin * scale, cpuVolume.rawMax * scale);
+
+    if (fixedPointType(cpuVolume.type))
+    {
+        initTransferTable(cpuTransferTable, cpuVolume);
+    }
+}
+
+extern "C"
+void initCpu(void *h_volume, size_t width, size_t height, size_t depth)
+{
+    freeVolumeLayout(cpuVolume);
+    createVolumeLayout(h_volume, (int)width, (int)height, (int)depth, cpuVoxelType, cpuLayout, cpuVolume);
+    initCpuVolume(h_volume, 0);
+}
+
+extern "C"
+bool initCpuFile(const char *filename, size_t width, size_t height, size_t depth)
+{
+    size_t bytes = width * height * depth * getCpuVoxelSize(cpuVoxelType);
+    size_t mappingSize;
+    const void *mapping = mapVolumeFile(filename, bytes, cpuLayout != CPU_LAYOUT_LINEAR, mappingSize);
+
+    if (!mapping)
+    {
+        return false;
+    }
+
+    freeVolumeLayout(cpuVolume);
+    mapVolumeLayout(mapping, mappingSize, (int)width, (int)height, (int)depth, cpuVoxelType, cpuLayout, 0,
+                    cpuVolume);
+    initCpuVolume(mapping, 0);
+
+    printf("%s '%s', %llu bytes\n", cpuVolume.mapping ? "Mapped" : "Converted", filename,
+           (unsigned long long)bytes);
+
+    if (!cpuVolume.mapping)
+    {
+        unmapVolumeFile(mapping, mappingSize);
+    }
+
+    return true;
+}
+
+extern "C"
+bool initCpuVolumeFile(const char *filename, bool verify)
+{
+    CpuVolume vol;
+    float spacing[3];
+
+    if (!loadVolumeFile(filename, verify, vol, spacing))
+    {
+        return false;
+    }
+
+    freeVolumeLayout(cpuVolume);
+    cpuVolume = vol;
+    cpuVoxelType = cpuVolume.type;
+    cpuLayout = cpuVolume.layout;
+    initCpuVolume(0, 0);
+
+    printf("Mapped '%s', %dx%dx%d %s voxels, %s layout, spacing %g %g %g\n", filename,
+           cpuVolume.width, cpuVolume.height, cpuVolume.depth, getCpuVoxelTypeName(), getCpuVolumeLayoutName(),
+           spacing[0], spacing[1], spacing[2]);
+
+    return true;
+}
+
+extern "C"
+bool saveCpuVolumeFile(const char *filename, const float *spacing)
+{
+    if (!cpuVolume.data || !writeVolumeFile(filename, cpuVolume, spacing))
+    {
+        return false;
+    }
+
+    printf("Wrote '%s', %dx%dx%d %s voxels, %s layout\n", filename, cpuVolume.width, cpuVolume.height, cpuVolume.depth,
+           getCpuVoxelTypeName(), getCpuVolumeLayoutName());
+
+    return true;
+}
+
+extern "C"
+bool initCpuPreprocessedFile(const char *filename, size_t width, size_t height, size_t depth,
+                             const CpuPreprocess *stages)
+{
+    if (!preprocessStagesValid(*stages))
+    {
+        return false;
+    }
+
+    size_t bytes = width * height * depth * getCpuVoxelSize(cpuVoxelType);
+    size_t mappingSize;
+    const void *mapping = mapVolumeFile(filename, bytes, true, mappingSize);
+
+    if (!mapping)
+    {
+        return false;
+    }
+
+    CpuVolume vol;
+    CpuVolumeSummary summary;
+    bool ok = preprocessVolume(mapping, true, (int)width, (int)height, (int)depth, cpuVoxelType, *stages,
+                               cpuLayout, vol, summary);
+    unmapVolumeFile(mapping, mappingSize);
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    freeVolumeLayout(cpuVolume);
+    cpuVolume = vol;
+    cpuVoxelType = stages->type;
+    // the volume is x fastest only in the linear layout
+    initCpuVolume(cpuVolume.layout == CPU_LAYOUT_LINEAR ? cpuVolume.data : 0, summary.cellRanges);
+
+    float scale = voxelTypeScale(cpuVolume.type);
+    memcpy(cpuHistogram, summary.histogram, sizeof(cpuHistogram));
+    cpuHistogramMin = summary.histogramMin * scale;
+    cpuHistogramMax = summary.histogramMax * scale;
+    cpuHistogramValid = true;
+
+    printf("Preprocessed '%s' in %d pass%s, %llu bytes into %llu, %s voxels, values %g .. %g\n", filename,
+           summary.passes, summary.passes > 1 ? "es" : "", (unsigned long long)bytes,
+           (unsigned long long)cpuVolume.size, getCpuVoxelTypeName(), cpuVolume.rawMin * scale,
+           cpuVolume.rawMax * scale);
+
+    freeVolumeSummary(summary);
+    return true;
+}
+
+extern "C"
+bool getCpuHistogram(unsigned long long *bins, float *lo, float *hi)
+{
+    if (!cpuHistogramValid)
+    {
+        return false;
+    }
+
+    memcpy(bins, cpuHistogram, sizeof(cpuHistogram));
+    *lo = cpuHistogramMin;
+    *hi = cpuHistogramMax;
+    return true;
+}
+
+extern "C"
+void freeCpuBuffers()
+{
+    stopPool();
+
+    freeMacrocells(cpuMacrocells);
+    freePreintTable(cpuPreintTable);
+    freeReprojection(cpuReprojection);
+    freeVolumePyramid(cpuPyramid);
+    freeVolumeLayout(cpuVolume);
+    dropRenderedVolume();
+}
+
+extern "C"
+bool initCpuOctree(const char *filename, bool verify)
+{
+    dropRenderedVolume();
+
+    if (!loadOctree(filename, verify, cpuOctree))
+    {
+        return false;
+    }
+
+    printf("%s '%s', %llu nodes, %llu leaves, %d levels\n", cpuOctree.mapping ? "Mapped" : "Read", filename,
+           (unsigned long long)(cpuOctree.nodeCount + cpuOctree.leafCount), (unsigned long long)cpuOctree.leafCount,
+           cpuOctree.depth + 1);
+
+    return true;
+}
+
+static void printAmrSummary(const char *name)
+{
+    unsigned long long cells = 0;
+
+    for (int i = 0; i < cpuAmr.gridCount; i++)
+    {
+        const CpuVolume &vol = cpuAmr.grids[i].volume;
+        cells += (unsigned long long)vol.width * vol.height * vol.depth;
+    }
+
+    printf("%s: %d patches, %d levels, %llu cells\n", name, cpuAmr.gridCount, cpuAmr.levels, cells);
+}
+
+extern "C"
+bool initCpuAmr(const CpuAmrPatch *patches, int count)
+{
+    dropRenderedVolume();
+
+    if (!buildAmr(patches, count, cpuAmr))
+    {
+        return false;
+    }
+
+    printAmrSummary("AMR hierarchy");
+    return true;
+}
+
+extern "C"
+bool initCpuAmrFile(const char *filename)
+{
+    dropRenderedVolume();
+
+    if (!loadAmrFile(filename, cpuAmr))
+    {
+        return false;
+    }
+
+    printAmrSummary(filename);
+    return true;
+}
+
+extern "C"
+bool initCpuPagedVolume(const char *filename, size_t cacheBytes)
+{
+    dropRenderedVolume();
+
+    if (!openPagedVolume(filename, cacheBytes, cpuPaged))
+    {
+        return false;
+    }
+
+    const BrickFileHeader &h = cpuPaged.header;
+    size_t slots = pagedCacheSlots(cpuPaged);
+
+    printf("Opened '%s', %ux%ux%u voxels in %ux%ux%u%s bricks, cache of %llu bricks (%llu MB)\n", filename,
+           h.width, h.height, h.depth, h.bricksX, h.bricksY, h.bricksZ, h.indexOffset ? " compressed" : "",
+           (unsigned long long)slots, (unsigned long long)(slots * h.brickBytes >> 20));
+
+    return true;
+}
+
+// replaces everything there is to render with a code of the volume src
+// holds x fastest
+static void initCompressed(const void *src, bool mapped, size_t width, size_t height, size_t depth, int residualBits)
+{
+    dropRenderedVolume();
+    freeVolumeLayout(cpuVolume);
+    freeVolumePyramid(cpuPyramid);
+
+    compressVolume(src, mapped, (int)width, (int)height, (int)depth, cpuVoxelType, residualBits, cpuCompressed);
+}
+
+static bool compressionBitsValid(int residualBits)
+{
+    if (residualBits != 4 && residualBits != 8)
+    {
+        printf("Error: residuals of %d bits, the code takes 4 or 8\n", residualBits);
+        return false;
+    }
+
+    // a block keeps two floats besides its residuals
+    size_t blockBytes = COMPRESSED_BLOCK_VOXELS * residualBits / 8 + 2 * sizeof(float);
+
+    if (blockBytes >= COMPRESSED_BLOCK_VOXELS * getCpuVoxelSize(cpuVoxelType))
+    {
+        printf("Error: %s voxels with %d bit residuals take more memory coded than as they are\n",
+               getCpuVoxelTypeName(), residualBits);
+        return false;
+    }
+
+    return true;
+}
+
+extern "C"
+bool initCpuCompressed(const void *h_volume, size_t width, size_t height, size_t depth, int residualBits)
+{
+    if (!compressionBitsValid(residualBits))
+    {
+        return false;
+    }
+
+    initCompressed(h_volume, false, width, height, depth, residualBits);
+    return true;
+}
+
+extern "C"
+bool initCpuCompressedFile(const char *filename, size_t width, size_t height, size_t depth, int residualBits)
+{
+    if (!compressionBitsValid(residualBits))
+    {
+        return false;
+    }
+
+    size_t bytes = width * height * depth * getCpuVoxelSize(cpuVoxelType);
+    size_t mappingSize;
+    const void *mapping = mapVolumeFile(filename, bytes, true, mappingSize);
+
+    if (!mapping)
+    {
+        return false;
+    }
+
+    initCompressed(mapping, true, width, height, depth, residualBits);
+    unmapVolumeFile(mapping, mappingSize);
+
+    printf("Compressed '%s', %llu bytes into %llu (%.1fx) with %d bit residuals\n", filename,
+           (unsigned long long)bytes, (unsigned long long)cpuCompressed.bytes,
+           (double)bytes / cpuCompressed.bytes, residualBits);
+
+    return true;
+}
+
+// replaces everything there is to render with the volume src holds x
+// fastest, quantized brick by brick
+static void initQuantized(const void *src, bool mapped, size_t width, size_t height, size_t depth, int bits,
+                          bool logScale)
+{
+    dropRenderedVolume();
+    freeVolumeLayout(cpuVolume);
+    freeVolumePyramid(cpuPyramid);
+
+    quantizeVolume(src, mapped, (int)width, (int)height, (int)depth, cpuVoxelType, bits, logScale, cpuQuantized);
+}
+
+static bool quantizationBitsValid(int bits)
+{
+    if (bits != 8 && bits != 16)
+    {
+        printf("Error: quantizing to %d bits, bricks take 8 or 16\n", bits);
+        return false;
+    }
+
+    return true;
+}
+
+extern "C"
+bool initCpuQuantized(const void *h_volume, size_t width, size_t height, size_t depth, int bits, bool logScale)
+{
+    if (!quantizationBitsValid(bits))
+    {
+        return false;
+    }
+
+    initQuantized(h_volume, false, width, height, depth, bits, logScale);
+    return true;
+}
+
+extern "C"
+bool initCpuQuantizedFile(const char *filename, size_t width, size_t height, size_t depth, int bits, bool logScale)
+{
+    if (!quantizationBitsValid(bits))
+    {
+        return false;
+    }
+
+    size_t bytes = width * height * depth * getCpuVoxelSize(cpuVoxelType);
+    size_t mappingSize;
+    const void *mapping = mapVolumeFile(filename, bytes, true, mappingSize);
+
+    if (!mapping)
+    {
+        return false;
+    }
+
+    initQuantized(mapping, true, width, height, depth, bits, logScale);
+    unmapVolumeFile(mapping, mappingSize);
+
+    float range = cpuQuantized.rawMax - cpuQuantized.rawMin;
+
+    printf("Quantized '%s' to %d bit%s bricks, %llu bytes into %llu (%.1fx)\n", filename, bits,
+           logScale ? " log scale" : "", (unsigned long long)bytes, (unsigned long long)cpuQuantized.bytes,
+           (double)bytes / cpuQuantized.bytes);
+    printf("Largest quantization error %g (%.3g%% of the value range), %.3g%% of the voxel's value\n",
+           cpuQuantized.maxError, range > 0.0f ? 100.0 * cpuQuantized.maxError / range : 0.0,
+           100.0 * cpuQuantized.maxRelativeError);
+
+    return true;
+}
+
+extern "C"
+bool getCpuQuantizationError(float *maxError, float *maxRelativeError)
+{
+    if (!cpuQuantized.data)
+    {
+        return false;
+    }
+
+    *maxError = cpuQuantized.maxError * voxelTypeScale(cpuQuantized.type);
+    *maxRelativeError = cpuQuantized.maxRelativeError;
+    return true;
+}
+
+extern "C"
+void copyInvViewMatrixCpu(float *invViewMatrix, size_t sizeofMatrix)
+{
+    memcpy(cpuInvViewMatrix, invViewMatrix, sizeofMatrix);
+}
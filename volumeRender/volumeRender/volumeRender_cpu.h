@@ -0,0 +1,313 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Host (CPU) volume render backend
+//
+// Mirrors the entry points of volumeRender_kernel.cu so that volumeRender.cpp
+// can drive either backend.  Nothing in here needs a GL or CUDA context, so
+// it can be used on batch nodes without a GPU.
+
+#ifndef _VOLUMERENDER_CPU_H_
+#define _VOLUMERENDER_CPU_H_
+
+#include <stddef.h>
+
+#include "volumeRender_mode.h"
+
+// per-frame counters of the CPU backend, see getCpuFrameStats()
+struct CpuFrameStats
+{
+    unsigned long long rays;        // eye rays that hit the volume
+    unsigned long long samples;     // volume samples taken
+    double error;                   // bound on the opacity error, summed over rays
+    unsigned long long reused;      // pixels carried over from the last frame
+    unsigned long long bricksRead;  // from the file of an out-of-core volume
+    unsigned long long bytesRead;   // of that file, less than the bricks take if it is compressed
+};
+
+// when temporal reprojection may carry a pixel over, see setCpuReprojection()
+struct CpuReprojectionParams
+{
+    int maxAge;             // frames a pixel is carried over before it is marched again
+    float minAlpha;         // least opacity of a pixel worth carrying over
+    float maxError;         // largest estimated parallax error of a carried pixel, in pixels
+    float maxAngle;         // largest view rotation between frames, in degrees
+};
+
+// one grid patch of an adaptive mesh refinement hierarchy, see initCpuAmr()
+struct CpuAmrPatch
+{
+    int level;                      // 0 for the root grids, one more per refinement
+    float boxMin[3], boxMax[3];     // extent, in the [-1, 1]^3 box of the volume
+    int size[3];                    // cells along x, y and z
+    const float *data;              // size[0] * size[1] * size[2] densities, x fastest
+};
+
+// storage order of the host copy of the volume, see setCpuVolumeLayout()
+enum CpuVolumeLayout
+{
+    CPU_LAYOUT_LINEAR,      // x fastest, as loaded
+    CPU_LAYOUT_BRICKED,     // 16^3 bricks with a ghost layer
+    CPU_LAYOUT_MORTON       // Z-order, bits of x, y and z interleaved
+};
+
+// voxel formats initCpu() accepts, see setCpuVoxelType()
+enum CpuVoxelType
+{
+    CPU_VOXEL_UINT8,        // read as value / 255, like the CUDA texture
+    CPU_VOXEL_UINT16,       // read as value / 65535
+    CPU_VOXEL_FLOAT,        // read as is
+    CPU_VOXEL_HALF          // IEEE 754 half precision, read as is
+};
+
+// per-voxel stages of initCpuPreprocessedFile(), applied in this order to
+// the values in the file (integer voxels as stored, not scaled to [0, 1])
+struct CpuPreprocess
+{
+    bool logScale;          // v = log10(max(v, logFloor))
+    float logFloor;         // smallest value taken by the log, at least FLT_MIN
+    bool clamp;             // v = min(max(v, clampMin), clampMax), in the units of the log if there is one
+    float clampMin, clampMax;
+    bool normalize;         // v = (v - lo) / (hi - lo), lo and hi the clamp bounds, or else the range of v
+    CpuVoxelType type;      // of the volume built; uint8 and uint16 always normalize, then round
+                            // v * 255 (65535)
+};
+
+// bins of the histogram initCpuPreprocessedFile() takes, see getCpuHistogram()
+#define CPU_HISTOGRAM_BINS 256
+
+extern "C" void initCpu(void *h_volume, size_t width, size_t height, size_t depth);
+
+// as initCpu(), for the volume in a raw file, without reading it into a
+// buffer first: the file is mapped, and the linear layout renders from the
+// mapping itself while the others are converted from it in one pass,
+// dropping its pages behind them.  Memory then holds one copy of the
+// volume, not two, and loading runs at the speed of the disk.  false, with
+// a message, if the file cannot be mapped or is too small.
+extern "C" bool initCpuFile(const char *filename, size_t width, size_t height, size_t depth);
+
+// as initCpuFile(), for a volume file (.bvol, written by the volume tool,
+// see volumeRender_volume.h).  The file gives the size, voxel type, layout
+// and value range of the volume, and the voxel type and layout set here
+// follow it; the volume is mapped and rendered in place whatever its
+// layout, so loading is reading the header and mapping the file.  With
+// verify every block of the volume is checked against its checksum first.
+// false, with a message, if the file cannot be used or is damaged.
+extern "C" bool initCpuVolumeFile(const char *filename, bool verify);
+
+// writes the volume to a .bvol file in its layout, with the distance
+// between voxels along x, y and z (0 for 1, 1, 1); false, with a message,
+// if it cannot
+extern "C" bool saveCpuVolumeFile(const char *filename, const float *spacing);
+
+// as initCpuFile(), running the stages over every voxel of the raw file
+// (of the type set with setCpuVoxelType()) on the way in, in place of the
+// tools that would each take a pass over it.  One pass on all cores reads
+// the file, runs the stages, writes the volume of stages->type and takes
+// its value range, macrocell ranges and histogram, which loading would
+// otherwise scan the volume for again.  Without clamp bounds the range
+// the stages work in is not known beforehand, and a first pass that only
+// reads finds it.  The voxel type set follows stages->type.  false, with a
+// message, if the stages or the file cannot be used.
+extern "C" bool initCpuPreprocessedFile(const char *filename, size_t width, size_t height, size_t depth,
+                                        const CpuPreprocess *stages);
+
+// histogram of the volume initCpuPreprocessedFile() built: the voxels in
+// each of CPU_HISTOGRAM_BINS equal bins over [*lo, *hi), in the units of
+// the transfer function offset, NaNs not counted; false if the volume did
+// not come from there
+extern "C" bool getCpuHistogram(unsigned long long *bins, float *lo, float *hi);
+extern "C" void freeCpuBuffers();
+extern "C" void setCpuFilterMode(bool bLinearFilter);
+extern "C" void copyInvViewMatrixCpu(float *invViewMatrix, size_t sizeofMatrix);
+
+// renders into a host RGBA8 buffer of imageW*imageH pixels and returns the
+// number of volume samples taken
+extern "C" unsigned long long render_cpu(unsigned int *h_output, unsigned int imageW, unsigned int imageH,
+                                         float density, float brightness,
+                                         float transferOffset, float transferScale);
+
+// march packets of rays with AVX2/AVX-512 when the CPU supports it (default),
+// otherwise one ray at a time; getCpuSimdName() reports the path in use
+extern "C" void setCpuSimd(bool bUseSimd);
+extern "C" const char *getCpuSimdName();
+
+// skip macrocells the transfer function maps to zero opacity (default on)
+extern "C" void setCpuEmptySpaceSkipping(bool bSkip);
+
+// pre-integrated transfer function: each step looks up a whole ray segment
+// in a 2D table built from the transfer function and density, so the ray
+// can take 4x longer steps without losing thin features (default off).
+// Takes precedence over adaptive sampling.
+extern "C" void setCpuPreintegration(bool bPreint);
+
+// fixed point trilinear filtering for uint8 and uint16 volumes: 8 bit
+// weights, integer blending and a 256 entry classified transfer function
+// table (default off).  Within 2/255 of the value range of the float path
+// per sample; pre-integration takes precedence.
+extern "C" void setCpuFixedPoint(bool bFixedPoint);
+
+// composite (default) or one of the projections, see volumeRender_mode.h
+extern "C" void setCpuRenderMode(RenderMode mode);
+
+// pass of progressive refinement for the following render_cpu() calls,
+// see volumeRender_mode.h; rows outside the pass keep their pixels.  A
+// composite pass with stepScale > 1 marches like adaptive sampling with at
+// least stepScale steps per sample (pre-integration keeps its own steps).
+extern "C" void setCpuRenderPass(RenderPass pass);
+
+// temporal reprojection (default off): a full frame first warps the
+// pixels of the previous full frame to the new view, each at the opacity
+// weighted mean depth of its ray, and only marches the pixels nothing valid
+// landed on.  The parallax error of a pixel grows with the spread of its
+// opacity along the ray and with how far the eye moved since it was
+// marched.  Pixels are carried over according to the parameters (the
+// defaults are 16 frames, 0.1, 1 pixel and 5 degrees); any other change of
+// a setting or of the image size starts from a full frame.  Refinement
+// passes neither use nor update the cache.
+extern "C" void setCpuReprojection(bool bReproject);
+extern "C" void setCpuReprojectionParams(const CpuReprojectionParams *params);
+extern "C" void getCpuReprojectionParams(CpuReprojectionParams *params);
+
+// level of detail (default off): initCpu() also builds a mip pyramid of
+// box filtered copies of the volume, each half the size of the one before,
+// and rays sample a coarser level, with longer steps, wherever the
+// footprint of their pixel covers a voxel of that level.  Enable it before
+// initCpu(); afterwards it switches between the pyramid and the volume
+// alone.  With a cache path the pyramid is read from that file if it
+// matches the volume and written there otherwise.
+extern "C" void setCpuLevelOfDetail(bool bLod);
+extern "C" void setCpuPyramidCache(const char *path);
+
+// adaptive marching: steps grow in macrocells where the opacity barely
+// varies, alpha is corrected for the step length and rays are no longer
+// capped at maxSteps.  quality is in (0, 1]; 1 keeps the reference step,
+// lower values allow up to 1/quality times longer steps.
+extern "C" void  setCpuAdaptiveSampling(bool bAdaptive);
+extern "C" void  setCpuQuality(float quality);
+extern "C" float getCpuQuality();
+
+// octree volume (.boc file, see volumeRender_octree.h) to render instead
+// of the one passed to initCpu(), until the next initCpu().  Rays walk the
+// tree and take each leaf they cross as a segment of constant density,
+// stepping over empty or uniform subtrees at once; all render modes are
+// supported, the filter, the marching options, levels of detail and the
+// ray packets do not apply.  Version 2 files are mapped rather than read,
+// so loading takes no time whatever their size.  With verify every node is
+// checked to be part of one tree first, for files from elsewhere.  false,
+// with a message, if the file cannot be read or fails the check.
+extern "C" bool initCpuOctree(const char *filename, bool verify);
+
+// adaptive mesh refinement hierarchy to render instead of the volume passed
+// to initCpu(), until the next initCpu().  Every sample is taken from the
+// finest patch that covers it, found through an index of the patches over
+// the box, and rays step by the reference step scaled to that patch's
+// cells, with the opacity corrected for the step length.  The data of the
+// patches is used in place and must stay valid until then.  All render
+// modes are supported, as is the filter (patches are sampled without
+// ghost cells, clamped at their edges); the marching options, levels of
+// detail and the ray packets do not apply.  false, with a message, if the
+// patches are unusable.
+extern "C" bool initCpuAmr(const CpuAmrPatch *patches, int count);
+
+// as initCpuAmr(), for the hierarchy described by a text file: the domain
+// and one line per patch with the density file it is read from, see
+// loadAmrFile() in volumeRender_cpu_amr.cpp
+extern "C" bool initCpuAmrFile(const char *filename);
+
+// bricked volume file (.bvb, written by the bricks tool, see
+// volumeRender_bricks.h) to render out of core instead of the volume passed
+// to initCpu(), until the next initCpu().  Rays read the bricks they reach
+// into a cache of cacheBytes (0 takes a quarter of physical memory), which
+// drops the least recently used bricks when full, so volumes far larger
+// than memory can be rendered; bricks that cannot change the image are
+// never read.  The image is the one the volume itself would give.  All
+// render modes and both filters are supported; the marching options,
+// levels of detail and the ray packets do not apply.  Compressed files
+// (bricks -compress) are decoded brick by brick as they are read.  false,
+// with a message, if the file cannot be used.
+extern "C" bool initCpuPagedVolume(const char *filename, size_t cacheBytes);
+
+// as initCpu(), but the volume is kept in a fixed rate code, in place of
+// the volume passed to initCpu() until the next initCpu(): every 4^3 block
+// of voxels keeps its smallest value and a step, and every voxel a
+// residual of residualBits bits (4 or 8).  Float volumes then take 5/32 or
+// 9/32 of their size, uint16 volumes 5/16 or 9/16 and uint8 volumes 5/8,
+// so volumes several times larger than memory allows otherwise can be
+// rendered; uint8 volumes with 8 bit residuals would grow.  Integer
+// blocks spanning at most 2^residualBits - 1 levels are exact, any other
+// voxel is within 1/30 (1/510) of the range of its block.  Rays decode
+// the 8^3 voxel tiles they reach into a small cache of each thread and
+// skip tiles that cannot change the image.  All render modes and both
+// filters are supported; the marching options, levels of detail and the
+// ray packets do not apply.  false, with a message, if residualBits is
+// neither 4 nor 8, or is 8 for uint8 voxels.
+extern "C" bool initCpuCompressed(const void *h_volume, size_t width, size_t height, size_t depth,
+                                  int residualBits);
+
+// as initCpuCompressed(), for the volume in a raw file, which is mapped
+// and coded in one pass that drops its pages behind it, so that memory
+// never holds more than the code and a few slices of the file
+extern "C" bool initCpuCompressedFile(const char *filename, size_t width, size_t height, size_t depth,
+                                      int residualBits);
+
+// as initCpu(), but the volume is quantized brick by brick, in place of
+// the volume passed to initCpu() until the next initCpu(): each 16^3 brick
+// maps its values on its own to 8 or 16 bit integers, linearly from its
+// smallest to its largest value or, with logScale, linearly in their
+// logarithm (voxels not above zero become zero).  A float volume then
+// takes 0.30 or 0.60 of its size and keeps its dynamic range, which one
+// mapping for the whole volume would not.  The samples read the integers
+// in place and map them back.  All render modes and both filters are
+// supported; the marching options, levels of detail and the ray packets
+// do not apply.  false, with a message, if bits is neither 8 nor 16.
+extern "C" bool initCpuQuantized(const void *h_volume, size_t width, size_t height, size_t depth, int bits,
+                                 bool logScale);
+
+// as initCpuQuantized(), for the volume in a raw file, which is mapped and
+// quantized in one pass that drops its pages behind it; prints the sizes
+// and the quantization error
+extern "C" bool initCpuQuantizedFile(const char *filename, size_t width, size_t height, size_t depth, int bits,
+                                     bool logScale);
+
+// largest difference over the volume between a voxel and the value the
+// renderer samples in its place, in the units of the transfer function
+// offset, and the largest ratio of that difference to |voxel|, where
+// voxels smaller than 1/1000 of the range of their brick count as that
+// large, so that voxels at or near zero keep the ratio finite; false if
+// the volume is not quantized
+extern "C" bool getCpuQuantizationError(float *maxError, float *maxRelativeError);
+
+// counters of the last render_cpu() call
+extern "C" void getCpuFrameStats(CpuFrameStats *stats);
+
+// layout initCpu() converts the volume to (default CPU_LAYOUT_LINEAR); set it
+// before initCpu().  Bricks and Z-order keep the eight voxels of a trilinear
+// sample close together in memory, which helps oblique rays on large volumes;
+// volumeRender_bench compares them.
+extern "C" void setCpuVolumeLayout(CpuVolumeLayout layout);
+extern "C" const char *getCpuVolumeLayoutName();
+
+// voxel type of the volumes passed to initCpu() (default CPU_VOXEL_UINT8);
+// set it before initCpu().  The renderer is instantiated for every type, so
+// the choice costs nothing per sample.
+extern "C" void        setCpuVoxelType(CpuVoxelType type);
+extern "C" const char *getCpuVoxelTypeName();
+extern "C" size_t      getCpuVoxelSize(CpuVoxelType type);
+
+// type for "uint8", "uint16", "float" or "half"; false if the name is unknown
+extern "C" bool getCpuVoxelTypeByName(const char *name, CpuVoxelType *type);
+
+// number of worker threads used by the CPU backend (0 = all cores)
+extern "C" void setCpuThreadCount(int numThreads);
+extern "C" int  getCpuThreadCount();
+
+#endif // #ifndef _VOLUMERENDER_CPU_H_
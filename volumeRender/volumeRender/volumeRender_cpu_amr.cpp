@@ -0,0 +1,672 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Adaptive mesh refinement hierarchies for the CPU backend
+//
+// Simulation codes that refine their mesh write it as a set of grid
+// patches, each a dense block of cells over a box of the domain, with the
+// patches of every level covering parts of the level below at a finer
+// spacing.  Resampling all of it to the finest spacing costs the finest
+// resolution everywhere; here every patch stays a volume of its own and
+// rays sample, at each point, the finest patch covering it.  A uniform
+// index over the box lists, per cell, the patches overlapping it finest
+// first, so finding that patch is a few box tests.  Rays step by the
+// reference step scaled to the spacing of the patch they are in; a step
+// that would enter a finer patch ends where the ray enters it, and the
+// opacity of every sample is corrected for the length of its step.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// building
+////////////////////////////////////////////////////////////////////////////////
+
+// finer levels first, patches of a level in the order given
+static bool finerLevel(const CpuAmrGrid &a, const CpuAmrGrid &b)
+{
+    return a.level > b.level;
+}
+
+// index cells [c0, c1] a box overlaps along one axis, as amrGridAt() finds them
+static void indexRange(float boxMin, float boxMax, int &c0, int &c1)
+{
+    c0 = clampi((int)((boxMin + 1.0f) * (0.5f * AMR_INDEX_SIZE)), 0, AMR_INDEX_SIZE - 1);
+    c1 = clampi((int)((boxMax + 1.0f) * (0.5f * AMR_INDEX_SIZE)), 0, AMR_INDEX_SIZE - 1);
+}
+
+bool buildAmr(const CpuAmrPatch *patches, int count, CpuAmr &amr)
+{
+    memset(&amr, 0, sizeof(amr));
+
+    if (count <= 0)
+    {
+        printf("Error: no AMR patches\n");
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const CpuAmrPatch &p = patches[i];
+        bool valid = p.level >= 0 && p.data != 0;
+
+        for (int a = 0; a < 3; a++)
+        {
+            valid = valid && p.size[a] > 0 && p.boxMin[a] < p.boxMax[a];
+        }
+
+        if (!valid)
+        {
+            printf("Error: AMR patch %d is empty or has no data\n", i);
+            return false;
+        }
+    }
+
+    amr.grids = (CpuAmrGrid *)calloc(count, sizeof(CpuAmrGrid));
+    amr.cellStart = (uint *)calloc(AMR_INDEX_SIZE * AMR_INDEX_SIZE * AMR_INDEX_SIZE + 1, sizeof(uint));
+
+    if (!amr.grids || !amr.cellStart)
+    {
+        printf("Error: out of memory for %d AMR patches\n", count);
+        freeAmr(amr);
+        return false;
+    }
+
+    amr.gridCount = count;
+    amr.minValue = INFINITY;
+    amr.maxValue = -INFINITY;
+
+    // the reference step goes with the coarsest spacing
+    float coarsestCell = 0.0f;
+
+    for (int i = 0; i < count; i++)
+    {
+        const CpuAmrPatch &p = patches[i];
+        CpuAmrGrid &g = amr.grids[i];
+        CpuVolume &vol = g.volume;
+        size_t cells = (size_t)p.size[0] * p.size[1] * p.size[2];
+
+        vol.data = (const uchar *)p.data;
+        vol.width = p.size[0];
+        vol.height = p.size[1];
+        vol.depth = p.size[2];
+        vol.type = CPU_VOXEL_FLOAT;
+        vol.voxelSize = sizeof(float);
+        vol.layout = CPU_LAYOUT_LINEAR;
+        vol.size = cells * sizeof(float);
+        vol.rawMin = INFINITY;
+        vol.rawMax = -INFINITY;
+
+        for (size_t c = 0; c < cells; c++)
+        {
+            vol.rawMin = fminf(vol.rawMin, p.data[c]);
+            vol.rawMax = fmaxf(vol.rawMax, p.data[c]);
+        }
+
+        g.boxMin = make_vec3(p.boxMin[0], p.boxMin[1], p.boxMin[2]);
+        g.boxMax = make_vec3(p.boxMax[0], p.boxMax[1], p.boxMax[2]);
+        g.findMin = g.boxMin - make_vec3(AMR_BOX_MARGIN, AMR_BOX_MARGIN, AMR_BOX_MARGIN);
+        g.findMax = g.boxMax + make_vec3(AMR_BOX_MARGIN, AMR_BOX_MARGIN, AMR_BOX_MARGIN);
+        g.invExtent = make_vec3(1.0f / (g.boxMax.x - g.boxMin.x), 1.0f / (g.boxMax.y - g.boxMin.y),
+                                1.0f / (g.boxMax.z - g.boxMin.z));
+        g.level = p.level;
+
+        // the finest axis sets the step, as a ray may run along it
+        g.tstep = minf(minf((g.boxMax.x - g.boxMin.x) / vol.width, (g.boxMax.y - g.boxMin.y) / vol.height),
+                       (g.boxMax.z - g.boxMin.z) / vol.depth);
+        coarsestCell = maxf(coarsestCell, g.tstep);
+
+        amr.minValue = fminf(amr.minValue, vol.rawMin);
+        amr.maxValue = fmaxf(amr.maxValue, vol.rawMax);
+        amr.levels = p.level + 1 > amr.levels ? p.level + 1 : amr.levels;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        CpuAmrGrid &g = amr.grids[i];
+        g.tstep = g.tstep == coarsestCell ? cpuTstep : cpuTstep * (g.tstep / coarsestCell);
+    }
+
+    std::stable_sort(amr.grids, amr.grids + count, finerLevel);
+
+    // count the patches per index cell, then list them in sorted order
+    size_t entries = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const CpuAmrGrid &g = amr.grids[i];
+            int x0, x1, y0, y1, z0, z1;
+
+            indexRange(g.findMin.x, g.findMax.x, x0, x1);
+            indexRange(g.findMin.y, g.findMax.y, y0, y1);
+            indexRange(g.findMin.z, g.findMax.z, z0, z1);
+
+            for (int z = z0; z <= z1; z++)
+            for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+            {
+                int cell = (z * AMR_INDEX_SIZE + y) * AMR_INDEX_SIZE + x;
+
+                if (pass == 0)
+                {
+                    amr.cellStart[cell + 1]++;
+                }
+                else
+                {
+                    amr.cellGrids[amr.cellStart[cell]++] = i;
+                }
+            }
+        }
+
+        const int cellCount = AMR_INDEX_SIZE * AMR_INDEX_SIZE * AMR_INDEX_SIZE;
+
+        if (pass == 0)
+        {
+            for (int c = 0; c < cellCount; c++)
+            {
+                amr.cellStart[c + 1] += amr.cellStart[c];
+            }
+
+            entries = amr.cellStart[cellCount];
+            amr.cellGrids = (uint *)malloc((entries ? entries : 1) * sizeof(uint));
+
+            if (!amr.cellGrids)
+            {
+                printf("Error: out of memory for the AMR patch index\n");
+                freeAmr(amr);
+                return false;
+            }
+        }
+        else
+        {
+            // filling moved every start to the next cell's
+            memmove(amr.cellStart + 1, amr.cellStart, cellCount * sizeof(uint));
+            amr.cellStart[0] = 0;
+        }
+    }
+
+    return true;
+}
+
+void freeAmr(CpuAmr &amr)
+{
+    if (amr.owned)
+    {
+        for (int i = 0; i < amr.gridCount; i++)
+        {
+            free(amr.owned[i]);
+        }
+
+        free(amr.owned);
+    }
+
+    free(amr.grids);
+    free(amr.cellStart);
+    free(amr.cellGrids);
+    memset(&amr, 0, sizeof(amr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// loading
+////////////////////////////////////////////////////////////////////////////////
+
+// A hierarchy file is text, one item per line, with # starting a comment:
+//
+//   domain x0 y0 z0 x1 y1 z1
+//   level x0 y0 z0 x1 y1 z1 nx ny nz file [offset]
+//
+// The optional domain line gives the extent of the whole hierarchy, which
+// is stretched over the [-1, 1]^3 box of the volume; it defaults to the
+// unit cube.  Every other line is a patch: its level, its extent in domain
+// coordinates, its cells along x, y and z, and where its densities are, as
+// nx * ny * nz 32 bit floats in the byte order of the machine, x fastest,
+// starting offset bytes into file.  Paths are relative to the hierarchy
+// file, so a simulation dump can be described where it lies.
+bool loadAmrFile(const char *path, CpuAmr &amr)
+{
+    memset(&amr, 0, sizeof(amr));
+
+    FILE *fp = fopen(path, "r");
+
+    if (!fp)
+    {
+        printf("Error opening file '%s'\n", path);
+        return false;
+    }
+
+    std::string dir(path);
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+    float domainMin[3] = { 0.0f, 0.0f, 0.0f }, domainMax[3] = { 1.0f, 1.0f, 1.0f };
+    std::vector<CpuAmrPatch> patches;
+    std::vector<float *> data;
+    const char *error = 0;
+    char line[4096];
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineNumber++;
+
+        char *comment = strchr(line, '#');
+
+        if (comment) *comment = 0;
+
+        char name[4096];
+        float b[6];
+        int level, n[3];
+        unsigned long long offset = 0;
+
+        if (sscanf(line, " %4095s", name) != 1)
+        {
+            continue;
+        }
+
+        if (!strcmp(name, "domain"))
+        {
+            if (sscanf(line, " domain %f %f %f %f %f %f", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6 ||
+                !(b[0] < b[3] && b[1] < b[4] && b[2] < b[5]))
+            {
+                error = "bad domain";
+                break;
+            }
+
+            memcpy(domainMin, b, sizeof(domainMin));
+            memcpy(domainMax, b + 3, sizeof(domainMax));
+            continue;
+        }
+
+        int fields = sscanf(line, "%d %f %f %f %f %f %f %d %d %d %4095s %llu", &level, &b[0], &b[1], &b[2],
+                            &b[3], &b[4], &b[5], &n[0], &n[1], &n[2], name, &offset);
+
+        if (fields < 11 || level < 0 || n[0] <= 0 || n[1] <= 0 || n[2] <= 0)
+        {
+            error = "bad patch";
+            break;
+        }
+
+        size_t cells = (size_t)n[0] * n[1] * n[2];
+        std::string file = name[0] == '/' ? std::string(name) : dir + name;
+        FILE *in = fopen(file.c_str(), "rb");
+        float *values = (float *)malloc(cells * sizeof(float));
+
+        if (!in || !values || fseeko(in, (off_t)offset, SEEK_SET) != 0 ||
+            fread(values, sizeof(float), cells, in) != cells)
+        {
+            printf("Error reading '%s' at offset %llu\n", file.c_str(), offset);
+            error = "patch data missing";
+        }
+
+        if (in) fclose(in);
+
+        if (error)
+        {
+            free(values);
+            break;
+        }
+
+        CpuAmrPatch p;
+        p.level = level;
+        p.data = values;
+
+        for (int a = 0; a < 3; a++)
+        {
+            p.boxMin[a] = (b[a] - domainMin[a]) / (domainMax[a] - domainMin[a]) * 2.0f - 1.0f;
+            p.boxMax[a] = (b[a + 3] - domainMin[a]) / (domainMax[a] - domainMin[a]) * 2.0f - 1.0f;
+            p.size[a] = n[a];
+        }
+
+        patches.push_back(p);
+        data.push_back(values);
+    }
+
+    fclose(fp);
+
+    if (!error && patches.empty())
+    {
+        error = "no patches";
+    }
+
+    if (error || !buildAmr(&patches[0], (int)patches.size(), amr))
+    {
+        if (error)
+        {
+            printf("Error reading AMR hierarchy '%s' line %d: %s\n", path, lineNumber, error);
+        }
+
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            free(data[i]);
+        }
+
+        return false;
+    }
+
+    // the grids were sorted, the data goes with them
+    amr.owned = (float **)calloc(amr.gridCount, sizeof(float *));
+
+    if (!amr.owned)
+    {
+        printf("Error: out of memory for AMR hierarchy '%s'\n", path);
+
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            free(data[i]);
+        }
+
+        freeAmr(amr);
+        return false;
+    }
+
+    for (int i = 0; i < amr.gridCount; i++)
+    {
+        amr.owned[i] = (float *)amr.grids[i].volume.data;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rendering
+////////////////////////////////////////////////////////////////////////////////
+
+// Marches a ray through the hierarchy, one sample per step of the patch
+// it is in.  Samples within a patch are taken at tBase + i * step, as
+// renderPixel() takes them from tnear, so a hierarchy of one patch over
+// the whole box renders like the volume.  The next sample is found ahead
+// of time, since a step that enters a finer patch is cut short there and
+// the current sample stands for the ray up to it.  Points outside all
+// patches have no data and are stepped over by the reference step.
+struct CpuAmrMarcher
+{
+    const CpuAmr *amr;
+    CpuRay ray;
+    float tBase, step;
+    int i;
+    float t;                    // of the current sample
+    int grid;                   // containing it, -1 for none
+    float length;               // of the ray the current sample stands for
+    float tNext;                // of the next sample
+    int nextGrid;
+    bool cut;                   // the step to it was cut short
+
+    void init(const CpuAmr &hierarchy, const CpuRay &eyeRay, float tnear)
+    {
+        amr = &hierarchy;
+        ray = eyeRay;
+        t = tBase = tnear;
+        grid = amrGridAt(*amr, ray.o + ray.d*t);
+        step = gridStep(grid);
+        i = 0;
+        lookAhead();
+    }
+
+    // moves to the next sample, which may lie past the end of the ray
+    void advance()
+    {
+        float nextStep = gridStep(nextGrid);
+
+        if (cut || nextStep != step)
+        {
+            tBase = tNext;
+            step = nextStep;
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+
+        t = tNext;
+        grid = nextGrid;
+        lookAhead();
+    }
+
+    float gridStep(int g) const
+    {
+        return g >= 0 ? amr->grids[g].tstep : cpuTstep;
+    }
+
+    void lookAhead()
+    {
+        tNext = tBase + (i + 1)*step;
+        nextGrid = amrGridAt(*amr, ray.o + ray.d*tNext);
+        cut = false;
+
+        if (nextGrid != grid && nextGrid >= 0 && amr->grids[nextGrid].tstep < step)
+        {
+            const CpuAmrGrid &g = amr->grids[nextGrid];
+            float tEnter, tLeave;
+
+            if (intersectBoxCpu(ray, g.boxMin, g.boxMax, &tEnter, &tLeave) && tEnter > t && tEnter < tNext)
+            {
+                tNext = tEnter;
+                cut = true;
+            }
+        }
+
+        length = cut ? tNext - t : step;
+    }
+};
+
+// density at the current sample, which must be inside a patch
+static float sampleAmr(const CpuRenderArgs &args, const CpuAmrMarcher &marcher)
+{
+    const CpuAmrGrid &g = marcher.amr->grids[marcher.grid];
+    vec3 p = marcher.ray.o + marcher.ray.d*marcher.t;
+    vec3 u = (p - g.boxMin) * g.invExtent;
+
+    return args.linearFilter ? sampleVolumeLinear<float>(g.volume, u.x, u.y, u.z) :
+                               sampleVolumeNearest<float>(g.volume, u.x, u.y, u.z);
+}
+
+// colour of the hierarchy at the current sample, the opacity corrected
+// for the length of ray it stands for
+static vec4 classifyAmrSample(const CpuRenderArgs &args, const CpuAmrMarcher &marcher)
+{
+    float sample = sampleAmr(args, marcher);
+    vec4 col = sampleTransfer((sample - args.transferOffset) * args.transferScale);
+    col.w *= args.density;
+
+    if (marcher.length != cpuTstep)
+    {
+        col.w = 1.0f - powf(1.0f - clampf(col.w, 0.0f, 1.0f), marcher.length / cpuTstep);
+    }
+
+    return col;
+}
+
+// composite one eye ray through the hierarchy; like renderPixel() the ray
+// ends once it is opaque or past tfar
+static void compositeAmrPixel(const CpuRenderArgs &args, uint x, uint y, CpuFrameStats &stats)
+{
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    vec4 sum = make_vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    const bool trackDepth = args.depth != 0;
+    float tSum = 0.0f, tSqSum = 0.0f;
+    int samples = 0;
+    CpuAmrMarcher marcher;
+
+    for (marcher.init(*args.amr, eyeRay, tnear); marcher.t <= tfar; marcher.advance())
+    {
+        if (marcher.grid < 0) continue;
+
+        vec4 col = classifyAmrSample(args, marcher);
+        samples++;
+
+        // pre-multiply alpha
+        col.x *= col.w;
+        col.y *= col.w;
+        col.z *= col.w;
+        // "over" operator for front-to-back blending
+        float a = 1.0f - sum.w;
+        sum.x += col.x*a;
+        sum.y += col.y*a;
+        sum.z += col.z*a;
+        sum.w += col.w*a;
+
+        if (trackDepth)
+        {
+            tSum += marcher.t*col.w*a;
+            tSqSum += marcher.t*marcher.t*col.w*a;
+        }
+
+        // exit early if opaque
+        if (sum.w > cpuOpacityThreshold) break;
+    }
+
+    if (trackDepth)
+    {
+        storeRayDepth(args, y*args.imageW + x, sum.w, tSum, tSqSum);
+    }
+
+    sum.x *= args.brightness;
+    sum.y *= args.brightness;
+    sum.z *= args.brightness;
+    sum.w *= args.brightness;
+
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(sum);
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+// reduce one eye ray to its largest or smallest sample, ending at the
+// largest (smallest) value in the hierarchy, or to the mean along it with
+// every sample weighted by the length of ray it stands for
+template <int mode>
+static void projectAmrPixel(const CpuRenderArgs &args, uint x, uint y, CpuFrameStats &stats)
+{
+    const CpuAmr &amr = *args.amr;
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    float result = mode == RENDER_MIP ? -INFINITY : mode == RENDER_MINIP ? INFINITY : 0.0f;
+    float tResult = NAN;
+    float weight = 0.0f;
+    int samples = 0;
+    CpuAmrMarcher marcher;
+
+    for (marcher.init(amr, eyeRay, tnear); marcher.t <= tfar; marcher.advance())
+    {
+        if (marcher.grid < 0) continue;
+
+        float sample = sampleAmr(args, marcher);
+        samples++;
+
+        if (mode == RENDER_MIP)
+        {
+            tResult = sample > result ? marcher.t : tResult;
+            result = fmaxf(result, sample);
+
+            if (result >= amr.maxValue) break;
+        }
+        else if (mode == RENDER_MINIP)
+        {
+            tResult = sample < result ? marcher.t : tResult;
+            result = fminf(result, sample);
+
+            if (result <= amr.minValue) break;
+        }
+        else
+        {
+            // in reference steps, which a single patch adds up like projectPixel()
+            float w = marcher.length / cpuTstep;
+            result += sample * w;
+            weight += w;
+        }
+    }
+
+    if (mode == RENDER_AVERAGE)
+    {
+        result = weight > 0.0f ? result / weight : 0.0f;
+    }
+
+    if (args.depth)
+    {
+        args.depth[y*args.imageW + x] = tResult;
+        args.spread[y*args.imageW + x] = 0.0f;
+    }
+
+    float grey = projectionGrey(args, result);
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(make_vec4(grey, grey, grey, grey));
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+template <int mode>
+struct AmrEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        for (uint y = y0; y < y1; y += args.pixelStride)
+        {
+            if (!args.pixelMask)
+            {
+                memset(&args.output[y*args.imageW + x0], 0, (x1 - x0)*sizeof(uint));
+            }
+
+            for (uint x = x0; x < x1; x += args.pixelStride)
+            {
+                if (args.pixelMask && !args.pixelMask[y*args.imageW + x]) continue;
+
+                if (mode == RENDER_COMPOSITE)
+                {
+                    compositeAmrPixel(args, x, y, stats);
+                }
+                else
+                {
+                    projectAmrPixel<mode>(args, x, y, stats);
+                }
+            }
+        }
+    }
+};
+
+void renderTileAmr(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    switch (args.mode)
+    {
+        case RENDER_MIP:
+            AmrEngine<RENDER_MIP>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_MINIP:
+            AmrEngine<RENDER_MINIP>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_AVERAGE:
+            AmrEngine<RENDER_AVERAGE>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        default:
+            AmrEngine<RENDER_COMPOSITE>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+    }
+}
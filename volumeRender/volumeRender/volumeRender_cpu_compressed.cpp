@@ -0,0 +1,514 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// In-memory compressed volumes for the CPU backend
+//
+// A volume that barely fits in memory, or does not fit at all, can be
+// held in a fixed rate code instead (compressVolume()).  Every 4^3 block
+// of voxels keeps its smallest value and a step, 8 bytes, and every voxel
+// a residual of 4 or 8 bits, the number of steps it lies above that
+// value.  A float volume then takes 40 or 72 bytes per block where it took
+// 256, a uint16 volume 40 or 72 where it took 128, and a uint8 volume 40
+// where it took 64; 72 would be more, so initCpuCompressed() only gives
+// uint8 volumes 4 bits.  Integer voxels keep an integer step, so blocks
+// spanning at most 15 (255) levels are exact; otherwise a voxel is off by
+// at most half a step, 1/30 (1/510) of the range of its block.
+//
+// Since every block is the same size, a voxel is found from its
+// coordinates alone.  Rays decode the 8^3 voxel tile their samples fall
+// in, with the first voxel layer of its +x, +y and +z neighbours, into a
+// small cache of decoded tiles that each thread keeps for itself, so that
+// no locks are needed; the rays of a screen tile pass through mostly the
+// same tiles, and each of those is decoded about once per screen tile.
+// Tiles that cannot change the image are passed without being decoded, as
+// the paged renderer passes bricks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+#define COMPRESSED_TILE_BLOCKS 8
+#define COMPRESSED_TILE_PITCH  (COMPRESSED_TILE_SIZE + 1)   // voxels per decoded row, the extra layer included
+#define COMPRESSED_TILE_SLICE  (COMPRESSED_TILE_PITCH * COMPRESSED_TILE_PITCH)
+#define COMPRESSED_TILE_VOXELS (COMPRESSED_TILE_PITCH * COMPRESSED_TILE_SLICE)
+#define COMPRESSED_NO_TILE     0xffffffffu
+
+// decoded tiles each thread keeps, 2^COMPRESSED_CACHE_SHIFT of them at
+// 2.8 KB each; enough for the tiles a row of rays of a screen tile passes
+// through, which the next rows mostly pass through again
+#define COMPRESSED_CACHE_SHIFT 10
+
+static std::atomic<unsigned long long> compressedVolumeCount(0);
+
+////////////////////////////////////////////////////////////////////////////////
+// the code
+////////////////////////////////////////////////////////////////////////////////
+
+inline size_t blockBytes(const CpuCompressedVolume &vol)
+{
+    return COMPRESSED_BLOCK_VOXELS * vol.bits / 8;
+}
+
+// the block holding voxel (x, y, z)
+inline size_t compressedBlock(const CpuCompressedVolume &vol, int x, int y, int z)
+{
+    size_t tile = ((size_t)(z >> COMPRESSED_TILE_SHIFT) * vol.tilesY + (y >> COMPRESSED_TILE_SHIFT)) * vol.tilesX +
+                  (x >> COMPRESSED_TILE_SHIFT);
+    int b = (((z >> COMPRESSED_BLOCK_SHIFT) & 1) * 2 + ((y >> COMPRESSED_BLOCK_SHIFT) & 1)) * 2 +
+            ((x >> COMPRESSED_BLOCK_SHIFT) & 1);
+
+    return tile * COMPRESSED_TILE_BLOCKS + b;
+}
+
+// the one expression both the coder and the decoder evaluate, so that the
+// ranges the coder records are those of the decoded voxels
+inline float decodeValue(float lo, float step, int q)
+{
+    return lo + (float)q * step;
+}
+
+inline int blockResidual(const uchar *r, int bits, int i)
+{
+    return bits == 8 ? r[i] : (r[i >> 1] >> ((i & 1) * 4)) & 15;
+}
+
+// codes the blocks of tile (tx, ty, tz) and records the largest decoded
+// value of each in blockMax.  Blocks past the edge of the volume repeat
+// its last voxels.
+template <typename Voxel>
+static void encodeTile(const Voxel *src, const CpuCompressedVolume &vol, int tx, int ty, int tz, float *blockMax)
+{
+    const int levels = (1 << vol.bits) - 1;
+    const size_t bytes = blockBytes(vol);
+    size_t tile = ((size_t)tz * vol.tilesY + ty) * vol.tilesX + tx;
+
+    for (int b = 0; b < COMPRESSED_TILE_BLOCKS; b++)
+    {
+        int x0 = (tx << COMPRESSED_TILE_SHIFT) + (b & 1) * COMPRESSED_BLOCK_SIZE;
+        int y0 = (ty << COMPRESSED_TILE_SHIFT) + ((b >> 1) & 1) * COMPRESSED_BLOCK_SIZE;
+        int z0 = (tz << COMPRESSED_TILE_SHIFT) + (b >> 2) * COMPRESSED_BLOCK_SIZE;
+        float v[COMPRESSED_BLOCK_VOXELS];
+        float lo = INFINITY, hi = -INFINITY;
+
+        for (int i = 0; i < COMPRESSED_BLOCK_VOXELS; i++)
+        {
+            int x = clampi(x0 + (i & 3), 0, vol.width - 1);
+            int y = clampi(y0 + ((i >> 2) & 3), 0, vol.height - 1);
+            int z = clampi(z0 + (i >> 4), 0, vol.depth - 1);
+            v[i] = voxelValue(src[((size_t)z * vol.height + y) * vol.width + x]);
+            lo = fminf(lo, v[i]);
+            hi = fmaxf(hi, v[i]);
+        }
+
+        // a block of NaNs
+        if (!(lo <= hi))
+        {
+            lo = hi = 0.0f;
+        }
+
+        float step = (hi - lo) / levels;
+        step = std::is_integral<Voxel>::value ? ceilf(step) : step;
+
+        size_t block = tile * COMPRESSED_TILE_BLOCKS + b;
+        uchar *r = vol.residuals + block * bytes;
+        int qMax = 0;
+        memset(r, 0, bytes);
+
+        for (int i = 0; i < COMPRESSED_BLOCK_VOXELS; i++)
+        {
+            float f = step > 0.0f ? (v[i] - lo) / step : 0.0f;
+            int q = f > 0.0f ? (int)(fminf(f, (float)levels) + 0.5f) : 0;
+            qMax = std::max(qMax, q);
+
+            if (vol.bits == 8)
+            {
+                r[i] = (uchar)q;
+            }
+            else
+            {
+                r[i >> 1] |= (uchar)(q << ((i & 1) * 4));
+            }
+        }
+
+        vol.blocks[2 * block] = lo;
+        vol.blocks[2 * block + 1] = step;
+        blockMax[block] = decodeValue(lo, step, qMax);
+    }
+}
+
+// the pages of a mapped source go once the code is past them, as in the
+// layout conversions
+static void releaseSource(const void *src, const CpuCompressedVolume &vol, int z, size_t &released)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    z = z < vol.depth ? z : vol.depth;
+    size_t end = (size_t)z * vol.width * vol.height * getCpuVoxelSize(vol.type) / page * page;
+
+    if (end > released)
+    {
+        madvise((uchar *)src + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+}
+
+// one layer of tiles at a time, front to back through the source
+template <typename Voxel>
+static void encodeVolume(const void *src, bool mapped, CpuCompressedVolume &vol, float *blockMax)
+{
+    int layerTiles = vol.tilesX * vol.tilesY;
+    size_t released = 0;
+
+    for (int tz = 0; tz < vol.tilesZ; tz++)
+    {
+        cpuParallelFor(layerTiles, [&](int i)
+        {
+            encodeTile<Voxel>((const Voxel *)src, vol, i % vol.tilesX, i / vol.tilesX, tz, blockMax);
+        });
+
+        if (mapped)
+        {
+            releaseSource(src, vol, (tz + 1) << COMPRESSED_TILE_SHIFT, released);
+        }
+    }
+}
+
+void compressVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type, int bits,
+                    CpuCompressedVolume &vol)
+{
+    memset(&vol, 0, sizeof(vol));
+    vol.width = width;
+    vol.height = height;
+    vol.depth = depth;
+    vol.type = type;
+    vol.bits = bits;
+    vol.tilesX = (width  + COMPRESSED_TILE_SIZE - 1) / COMPRESSED_TILE_SIZE;
+    vol.tilesY = (height + COMPRESSED_TILE_SIZE - 1) / COMPRESSED_TILE_SIZE;
+    vol.tilesZ = (depth  + COMPRESSED_TILE_SIZE - 1) / COMPRESSED_TILE_SIZE;
+    vol.id = ++compressedVolumeCount;
+
+    size_t tiles = (size_t)vol.tilesX * vol.tilesY * vol.tilesZ;
+    size_t blocks = tiles * COMPRESSED_TILE_BLOCKS;
+    vol.blocks = (float *)malloc(blocks * 2 * sizeof(float));
+    vol.residuals = (uchar *)malloc(blocks * blockBytes(vol));
+    vol.tileRanges = (float *)malloc(tiles * 2 * sizeof(float));
+    vol.bytes = blocks * (2 * sizeof(float) + blockBytes(vol)) + tiles * 2 * sizeof(float);
+
+    std::vector<float> blockMax(blocks);
+
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            encodeVolume<ushort>(src, mapped, vol, &blockMax[0]);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            encodeVolume<float>(src, mapped, vol, &blockMax[0]);
+            break;
+
+        case CPU_VOXEL_HALF:
+            encodeVolume<CpuHalf>(src, mapped, vol, &blockMax[0]);
+            break;
+
+        default:
+            encodeVolume<uchar>(src, mapped, vol, &blockMax[0]);
+            break;
+    }
+
+    // the samples in a tile read its voxels and the first layer past it;
+    // the blocks those lie in bound them
+    std::vector<float> layerMin(vol.tilesZ), layerMax(vol.tilesZ);
+
+    cpuParallelFor(vol.tilesZ, [&](int tz)
+    {
+        float zMin = INFINITY, zMax = -INFINITY;
+
+        for (int ty = 0; ty < vol.tilesY; ty++)
+        {
+            for (int tx = 0; tx < vol.tilesX; tx++)
+            {
+                int x0 = tx << COMPRESSED_TILE_SHIFT, x1 = std::min(x0 + COMPRESSED_TILE_SIZE, width - 1);
+                int y0 = ty << COMPRESSED_TILE_SHIFT, y1 = std::min(y0 + COMPRESSED_TILE_SIZE, height - 1);
+                int z0 = tz << COMPRESSED_TILE_SHIFT, z1 = std::min(z0 + COMPRESSED_TILE_SIZE, depth - 1);
+                float lo = INFINITY, hi = -INFINITY;
+
+                for (int z = z0; z <= z1; z += COMPRESSED_BLOCK_SIZE)
+                {
+                    for (int y = y0; y <= y1; y += COMPRESSED_BLOCK_SIZE)
+                    {
+                        for (int x = x0; x <= x1; x += COMPRESSED_BLOCK_SIZE)
+                        {
+                            size_t b = compressedBlock(vol, x, y, z);
+                            lo = fminf(lo, vol.blocks[2 * b]);
+                            hi = fmaxf(hi, blockMax[b]);
+                        }
+                    }
+                }
+
+                size_t tile = ((size_t)tz * vol.tilesY + ty) * vol.tilesX + tx;
+                vol.tileRanges[2 * tile] = lo;
+                vol.tileRanges[2 * tile + 1] = hi;
+                zMin = fminf(zMin, lo);
+                zMax = fmaxf(zMax, hi);
+            }
+        }
+
+        layerMin[tz] = zMin;
+        layerMax[tz] = zMax;
+    });
+
+    vol.rawMin = *std::min_element(layerMin.begin(), layerMin.end());
+    vol.rawMax = *std::max_element(layerMax.begin(), layerMax.end());
+}
+
+void freeCompressedVolume(CpuCompressedVolume &vol)
+{
+    free(vol.blocks);
+    free(vol.residuals);
+    free(vol.tileRanges);
+    memset(&vol, 0, sizeof(vol));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// decoded tiles
+////////////////////////////////////////////////////////////////////////////////
+
+// the voxels of block (bx, by, bz) within [x0, x1) x [y0, y1) x [z0, z1),
+// into out, which holds voxel (ox, oy, oz) at its start
+template <int bits>
+static void decodeBlockPart(const CpuCompressedVolume &vol, int bx, int by, int bz, int x0, int x1, int y0, int y1,
+                            int z0, int z1, float *out, int ox, int oy, int oz)
+{
+    int bx0 = bx << COMPRESSED_BLOCK_SHIFT, by0 = by << COMPRESSED_BLOCK_SHIFT, bz0 = bz << COMPRESSED_BLOCK_SHIFT;
+    size_t block = compressedBlock(vol, bx0, by0, bz0);
+    const float lo = vol.blocks[2 * block], step = vol.blocks[2 * block + 1];
+    const uchar *r = vol.residuals + block * (COMPRESSED_BLOCK_VOXELS * bits / 8);
+
+    x0 = std::max(x0, bx0), x1 = std::min(x1, bx0 + COMPRESSED_BLOCK_SIZE);
+    y0 = std::max(y0, by0), y1 = std::min(y1, by0 + COMPRESSED_BLOCK_SIZE);
+    z0 = std::max(z0, bz0), z1 = std::min(z1, bz0 + COMPRESSED_BLOCK_SIZE);
+
+    if (x1 - x0 == COMPRESSED_BLOCK_SIZE && y1 - y0 == COMPRESSED_BLOCK_SIZE && z1 - z0 == COMPRESSED_BLOCK_SIZE)
+    {
+        // a whole block, in loops of fixed length the compiler unrolls
+        float *o = out + ((z0 - oz) * COMPRESSED_TILE_PITCH + (y0 - oy)) * COMPRESSED_TILE_PITCH + (x0 - ox);
+
+        for (int i = 0; i < COMPRESSED_BLOCK_VOXELS; i += COMPRESSED_BLOCK_SIZE)
+        {
+            float *row = o + ((i >> 4) * COMPRESSED_TILE_PITCH + ((i >> 2) & 3)) * COMPRESSED_TILE_PITCH;
+
+            for (int x = 0; x < COMPRESSED_BLOCK_SIZE; x++)
+            {
+                row[x] = decodeValue(lo, step, blockResidual(r, bits, i + x));
+            }
+        }
+
+        return;
+    }
+
+    for (int z = z0; z < z1; z++)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            float *row = out + ((z - oz) * COMPRESSED_TILE_PITCH + (y - oy)) * COMPRESSED_TILE_PITCH - ox;
+            int i = ((z - bz0) * COMPRESSED_BLOCK_SIZE + (y - by0)) * COMPRESSED_BLOCK_SIZE - bx0;
+
+            for (int x = x0; x < x1; x++)
+            {
+                row[x] = decodeValue(lo, step, blockResidual(r, bits, i + x));
+            }
+        }
+    }
+}
+
+// the voxels of a tile and the layer past it, x fastest with
+// COMPRESSED_TILE_PITCH voxels per row, clamped at the edge of the volume:
+// the parts of the blocks they lie in, then copies of the last voxels for
+// those past the edge
+template <int bits>
+static void decodeTile(const CpuCompressedVolume &vol, uint tile, float *out)
+{
+    int x0 = (int)(tile % vol.tilesX) << COMPRESSED_TILE_SHIFT;
+    int y0 = (int)((tile / vol.tilesX) % vol.tilesY) << COMPRESSED_TILE_SHIFT;
+    int z0 = (int)(tile / ((uint)vol.tilesX * vol.tilesY)) << COMPRESSED_TILE_SHIFT;
+    int x1 = std::min(x0 + COMPRESSED_TILE_PITCH, vol.width);
+    int y1 = std::min(y0 + COMPRESSED_TILE_PITCH, vol.height);
+    int z1 = std::min(z0 + COMPRESSED_TILE_PITCH, vol.depth);
+
+    for (int bz = z0 >> COMPRESSED_BLOCK_SHIFT; bz <= (z1 - 1) >> COMPRESSED_BLOCK_SHIFT; bz++)
+    {
+        for (int by = y0 >> COMPRESSED_BLOCK_SHIFT; by <= (y1 - 1) >> COMPRESSED_BLOCK_SHIFT; by++)
+        {
+            for (int bx = x0 >> COMPRESSED_BLOCK_SHIFT; bx <= (x1 - 1) >> COMPRESSED_BLOCK_SHIFT; bx++)
+            {
+                decodeBlockPart<bits>(vol, bx, by, bz, x0, x1, y0, y1, z0, z1, out, x0, y0, z0);
+            }
+        }
+    }
+
+    int nx = x1 - x0, ny = y1 - y0, nz = z1 - z0;
+
+    for (int z = 0; z < COMPRESSED_TILE_PITCH; z++)
+    {
+        float *slice = out + z * COMPRESSED_TILE_SLICE;
+
+        if (z >= nz)
+        {
+            memcpy(slice, out + (nz - 1) * COMPRESSED_TILE_SLICE, COMPRESSED_TILE_SLICE * sizeof(float));
+            continue;
+        }
+
+        for (int y = 0; y < COMPRESSED_TILE_PITCH; y++)
+        {
+            float *row = slice + y * COMPRESSED_TILE_PITCH;
+
+            if (y >= ny)
+            {
+                memcpy(row, slice + (ny - 1) * COMPRESSED_TILE_PITCH, COMPRESSED_TILE_PITCH * sizeof(float));
+                continue;
+            }
+
+            for (int x = nx; x < COMPRESSED_TILE_PITCH; x++)
+            {
+                row[x] = row[nx - 1];
+            }
+        }
+    }
+}
+
+// the decoded voxels of a tile, from the calling thread's cache.  Tiles
+// map to a slot by a multiplicative hash of their index, which spreads the
+// tiles along any axis over the whole cache.
+static const float *decodedTile(const CpuCompressedVolume &vol, uint tile)
+{
+    static thread_local std::vector<float> data;
+    static thread_local std::vector<uint> tags;
+    static thread_local unsigned long long cached = 0;
+
+    if (cached != vol.id)
+    {
+        data.resize((size_t)COMPRESSED_TILE_VOXELS << COMPRESSED_CACHE_SHIFT);
+        tags.assign((size_t)1 << COMPRESSED_CACHE_SHIFT, COMPRESSED_NO_TILE);
+        cached = vol.id;
+    }
+
+    uint slot = (tile * 2654435761u) >> (32 - COMPRESSED_CACHE_SHIFT);
+    float *out = &data[(size_t)slot * COMPRESSED_TILE_VOXELS];
+
+    if (tags[slot] != tile)
+    {
+        if (vol.bits == 8)
+        {
+            decodeTile<8>(vol, tile, out);
+        }
+        else
+        {
+            decodeTile<4>(vol, tile, out);
+        }
+
+        tags[slot] = tile;
+    }
+
+    return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sampling
+////////////////////////////////////////////////////////////////////////////////
+
+// the decoded voxelValue() at a tap, not yet scaled
+inline float sampleTile(const float *data, const CpuBrickTap &t, bool linearFilter)
+{
+    const float *p00 = data + (t.z0 * COMPRESSED_TILE_PITCH + t.y0) * COMPRESSED_TILE_PITCH + t.x0;
+
+    if (!linearFilter)
+    {
+        return p00[0];
+    }
+
+    int dx = t.x1 - t.x0;
+    const float *p01 = p00 + (t.y1 - t.y0) * COMPRESSED_TILE_PITCH;
+    const float *p10 = p00 + (t.z1 - t.z0) * COMPRESSED_TILE_SLICE;
+    const float *p11 = p10 + (t.y1 - t.y0) * COMPRESSED_TILE_PITCH;
+
+    float c00 = p00[0] + t.ax * (p00[dx] - p00[0]);
+    float c01 = p01[0] + t.ax * (p01[dx] - p01[0]);
+    float c10 = p10[0] + t.ax * (p10[dx] - p10[0]);
+    float c11 = p11[0] + t.ax * (p11[dx] - p11[0]);
+
+    float c0 = c00 + t.ay * (c01 - c00);
+    float c1 = c10 + t.ay * (c11 - c10);
+
+    return c0 + t.az * (c1 - c0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rendering
+////////////////////////////////////////////////////////////////////////////////
+
+// the tiles for renderBrickTile(), decoded into the calling thread's cache
+struct CompressedSource
+{
+    static const int shift = COMPRESSED_TILE_SHIFT;
+
+    struct Brick
+    {
+        const float *data;
+    };
+
+    CpuBrickGrid grid;
+    float scale, rawMin, rawMax;
+    const CpuCompressedVolume *vol;
+
+    void init(const CpuCompressedVolume &v)
+    {
+        CpuBrickGrid g = { { v.width, v.height, v.depth }, { v.tilesX, v.tilesY, v.tilesZ } };
+        grid = g;
+        scale = voxelTypeScale(v.type);
+        rawMin = v.rawMin;
+        rawMax = v.rawMax;
+        vol = &v;
+    }
+
+    void range(uint tile, float &lo, float &hi) const
+    {
+        lo = vol->tileRanges[2 * (size_t)tile];
+        hi = vol->tileRanges[2 * (size_t)tile + 1];
+    }
+
+    void acquire(uint tile, Brick &b) const
+    {
+        b.data = decodedTile(*vol, tile);
+    }
+
+    void release(Brick &) const
+    {
+    }
+
+    float sample(const Brick &b, const CpuBrickTap &tap, bool linearFilter) const
+    {
+        return sampleTile(b.data, tap, linearFilter);
+    }
+};
+
+void renderTileCompressed(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    CompressedSource source;
+    source.init(*args.compressed);
+    renderBrickTile(args, source, x0, y0, x1, y1, stats);
+}
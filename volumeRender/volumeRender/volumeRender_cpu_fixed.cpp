@@ -0,0 +1,61 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Transfer function table for the fixed point path of the CPU backend
+//
+// The fixed point samplers in volumeRender_cpu_internal.h return an index
+// into a table of 256 classified colours that spans the value range of the
+// volume.  For uint8 volumes there is one entry per voxel value, so
+// nearest filtering classifies exactly as the float path does, and linear
+// filtering only adds the rounding described next to sampleVolumeLinearFixed().
+
+#include "volumeRender_cpu_internal.h"
+
+void initTransferTable(CpuTransferTable &table, const CpuVolume &vol)
+{
+    // the fixed domain holds uint8 voxels as 8.8 and uint16 voxels as they
+    // are; rawMin and rawMax are whole voxel values for both
+    int unit = vol.type == CPU_VOXEL_UINT8 ? 256 : 1;
+    float range = (vol.rawMax - vol.rawMin) * unit;
+
+    table.fixedBase = (int)vol.rawMin * unit;
+    table.fixedMul = (int)floorf((TRANSFER_TABLE_SIZE - 1) * 65536.0f / range + 0.5f);
+
+    table.sampleScale = voxelTypeScale(vol.type) / unit;
+
+    // force a fill on the first frame
+    table.tableOffset = table.tableScale = table.tableDensity = NAN;
+}
+
+void updateTransferTable(CpuTransferTable &table, float transferOffset, float transferScale, float density)
+{
+    if (table.tableOffset == transferOffset && table.tableScale == transferScale &&
+        table.tableDensity == density)
+    {
+        return;
+    }
+
+    for (int i = 0; i < TRANSFER_TABLE_SIZE; i++)
+    {
+        // the value transferIndex() rounds to i; for uint8 that is i/255,
+        // exactly as sampleVolumeNearest() computes it
+        float s = (table.fixedBase + i * (65536.0f / table.fixedMul)) * table.sampleScale;
+        vec4 col = sampleTransfer((s - transferOffset) * transferScale);
+        table.r[i] = col.x;
+        table.g[i] = col.y;
+        table.b[i] = col.z;
+        table.a[i] = col.w * density;
+    }
+
+    table.tableOffset = transferOffset;
+    table.tableScale = transferScale;
+    table.tableDensity = density;
+}
@@ -0,0 +1,1865 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Shared pieces of the CPU backend: host vector math, texture emulation
+// and the worker pool.  Only included by the volumeRender_cpu*.cpp files,
+// which are built with the host compiler and never see the CUDA headers.
+
+#ifndef _VOLUMERENDER_CPU_INTERNAL_H_
+#define _VOLUMERENDER_CPU_INTERNAL_H_
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <functional>
+#include <type_traits>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include "volumeRender_cpu.h"
+#include "volumeRender_bricks.h"
+#include "volumeRender_octree.h"
+
+typedef unsigned int   uint;
+typedef unsigned short ushort;
+typedef unsigned char  uchar;
+
+////////////////////////////////////////////////////////////////////////////////
+// host vector types (the subset of helper_math.h that d_render uses)
+////////////////////////////////////////////////////////////////////////////////
+
+struct vec3
+{
+    float x, y, z;
+};
+
+struct vec4
+{
+    float x, y, z, w;
+};
+
+inline vec3 make_vec3(float x, float y, float z)
+{
+    vec3 r = { x, y, z };
+    return r;
+}
+
+inline vec4 make_vec4(float x, float y, float z, float w)
+{
+    vec4 r = { x, y, z, w };
+    return r;
+}
+
+inline vec3 operator+(const vec3 &a, const vec3 &b)
+{
+    return make_vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+inline vec3 operator-(const vec3 &a, const vec3 &b)
+{
+    return make_vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+inline vec3 operator*(const vec3 &a, const vec3 &b)
+{
+    return make_vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+inline vec3 operator*(const vec3 &a, float s)
+{
+    return make_vec3(a.x * s, a.y * s, a.z * s);
+}
+
+inline float dot(const vec3 &a, const vec3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3 normalize(const vec3 &v)
+{
+    return v * (1.0f / sqrtf(dot(v, v)));
+}
+
+inline float clampf(float f, float a, float b)
+{
+    return f < a ? a : (f > b ? b : f);
+}
+
+inline int clampi(int i, int a, int b)
+{
+    return i < a ? a : (i > b ? b : i);
+}
+
+// fminf() and fmaxf(), NaN operands included, without the libm call; the
+// ray setup of the packet marchers runs them per lane inside AVX code, where
+// each call into the SSE library costs a state transition
+inline float minf(float a, float b)
+{
+    return (b < a || a != a) ? b : a;
+}
+
+inline float maxf(float a, float b)
+{
+    return (b > a || a != a) ? b : a;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ray setup, identical to d_render
+////////////////////////////////////////////////////////////////////////////////
+
+struct CpuRay
+{
+    vec3 o;   // origin
+    vec3 d;   // direction
+};
+
+// transform vector by 3x4 row-major matrix (no translation)
+inline vec3 mulDir(const float *M, const vec3 &v)
+{
+    return make_vec3(v.x*M[0] + v.y*M[1] + v.z*M[2],
+                     v.x*M[4] + v.y*M[5] + v.z*M[6],
+                     v.x*M[8] + v.y*M[9] + v.z*M[10]);
+}
+
+// eye ray through pixel (x, y), as computed at the top of d_render
+inline CpuRay eyeRayForPixel(const float *invViewMatrix, float u, float v)
+{
+    CpuRay r;
+    r.o = make_vec3(invViewMatrix[3], invViewMatrix[7], invViewMatrix[11]);
+    r.d = mulDir(invViewMatrix, normalize(make_vec3(u, v, -2.0f)));
+    return r;
+}
+
+// intersect ray with a box, see intersectBox() in volumeRender_kernel.cu
+inline int intersectBoxCpu(const CpuRay &r, const vec3 &boxmin, const vec3 &boxmax, float *tnear, float *tfar)
+{
+    vec3 invR = make_vec3(1.0f / r.d.x, 1.0f / r.d.y, 1.0f / r.d.z);
+    vec3 tbot = invR * (boxmin - r.o);
+    vec3 ttop = invR * (boxmax - r.o);
+
+    vec3 tmin = make_vec3(minf(ttop.x, tbot.x), minf(ttop.y, tbot.y), minf(ttop.z, tbot.z));
+    vec3 tmax = make_vec3(maxf(ttop.x, tbot.x), maxf(ttop.y, tbot.y), maxf(ttop.z, tbot.z));
+
+    float largest_tmin = maxf(maxf(tmin.x, tmin.y), maxf(tmin.x, tmin.z));
+    float smallest_tmax = minf(minf(tmax.x, tmax.y), minf(tmax.x, tmax.z));
+
+    *tnear = largest_tmin;
+    *tfar = smallest_tmax;
+
+    return smallest_tmax > largest_tmin;
+}
+
+// same packing as rgbaFloatToInt() in the kernel
+inline uint rgbaFloatToIntCpu(vec4 rgba)
+{
+    rgba.x = clampf(rgba.x, 0.0f, 1.0f);
+    rgba.y = clampf(rgba.y, 0.0f, 1.0f);
+    rgba.z = clampf(rgba.z, 0.0f, 1.0f);
+    rgba.w = clampf(rgba.w, 0.0f, 1.0f);
+    return (uint(rgba.w*255)<<24) | (uint(rgba.z*255)<<16) | (uint(rgba.y*255)<<8) | uint(rgba.x*255);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// voxel types
+////////////////////////////////////////////////////////////////////////////////
+
+// IEEE 754 half precision voxel
+struct CpuHalf
+{
+    ushort bits;
+};
+
+// exact conversion without F16C: rebias the exponent, renormalize
+// denormals through a float subtraction and keep Inf/NaN
+inline float halfToFloat(ushort h)
+{
+    const uint shiftedExp = 0x7c00u << 13;
+    const uint magic = 113u << 23;
+    uint o = (h & 0x7fffu) << 13;
+    uint exp = o & shiftedExp;
+    float f;
+
+    o += (127u - 15u) << 23;
+
+    if (exp == shiftedExp)
+    {
+        o += (128u - 16u) << 23;
+    }
+    else if (exp == 0)
+    {
+        float m;
+        o += 1u << 23;
+        memcpy(&f, &o, sizeof(f));
+        memcpy(&m, &magic, sizeof(m));
+        f -= m;
+        memcpy(&o, &f, sizeof(o));
+    }
+
+    o |= (uint)(h & 0x8000u) << 16;
+    memcpy(&f, &o, sizeof(f));
+    return f;
+}
+
+// IEEE 754 half precision, rounded to the nearest even
+inline ushort floatToHalf(float f)
+{
+    uint x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint sign = (x >> 16) & 0x8000u;
+    uint mag = x & 0x7fffffffu;
+
+    // Inf and NaN, keeping NaN quiet
+    if (mag >= 0x7f800000u)
+    {
+        return (ushort)(sign | 0x7c00u | (mag > 0x7f800000u ? 0x200u : 0u));
+    }
+
+    // 65520 and up round to Inf
+    if (mag >= 0x477ff000u)
+    {
+        return (ushort)(sign | 0x7c00u);
+    }
+
+    // denormals: adding 0.5 leaves the multiple of 2^-24 in the mantissa
+    if (mag < 0x38800000u)
+    {
+        float a;
+        memcpy(&a, &mag, sizeof(a));
+        a += 0.5f;
+        memcpy(&mag, &a, sizeof(mag));
+        return (ushort)(sign | (mag - 0x3f000000u));
+    }
+
+    mag -= (127u - 15u) << 23;
+    mag += 0xfffu + ((mag >> 13) & 1u);
+    return (ushort)(sign | (mag >> 13));
+}
+
+// raw value of a voxel; the samplers scale it by voxelScale(), which maps
+// the integer types to [0, 1] like cudaReadModeNormalizedFloat and leaves
+// the floating point types as they are
+inline float voxelValue(uchar v)   { return v; }
+inline float voxelValue(ushort v)  { return v; }
+inline float voxelValue(float v)   { return v; }
+inline float voxelValue(CpuHalf v) { return halfToFloat(v.bits); }
+
+template <typename Voxel> inline float voxelScale()  { return 1.0f; }
+template <> inline float voxelScale<uchar>()         { return 1.0f / 255.0f; }
+template <> inline float voxelScale<ushort>()        { return 1.0f / 65535.0f; }
+
+// voxel types that have a fixed point sampling path, see voxelFixed()
+template <typename Voxel> struct FixedPointVoxel     { static const bool value = false; };
+template <> struct FixedPointVoxel<uchar>            { static const bool value = true; };
+template <> struct FixedPointVoxel<ushort>           { static const bool value = true; };
+
+inline bool fixedPointType(CpuVoxelType type)
+{
+    return type == CPU_VOXEL_UINT8 || type == CPU_VOXEL_UINT16;
+}
+
+// voxelScale() of a runtime type
+float voxelTypeScale(CpuVoxelType type);
+
+////////////////////////////////////////////////////////////////////////////////
+// texture emulation
+////////////////////////////////////////////////////////////////////////////////
+
+// bricked layout: the volume is cut into BRICK_SIZE^3 voxel bricks, stored
+// one after the other in x, y, z brick order.  Each brick also holds a copy
+// of the first voxel layer of its +x, +y and +z neighbours (clamped at the
+// volume edge), so the eight taps of a trilinear sample never leave the brick.
+#define BRICK_SHIFT 4
+#define BRICK_SIZE  (1 << BRICK_SHIFT)
+#define BRICK_MASK  (BRICK_SIZE - 1)
+#define BRICK_PITCH (BRICK_SIZE + 1)    // voxels per brick row, ghost included
+#define BRICK_SLICE (BRICK_PITCH * BRICK_PITCH)
+#define BRICK_VOXELS ((BRICK_PITCH * BRICK_SLICE + 63) & ~63)  // cache line aligned
+
+// Morton layout: the offset of a voxel interleaves the bits of x, y and z
+// (x lowest), each axis padded to a power of two; once the shorter axes run
+// out of bits the longer ones continue alone.  mortonMask[a] holds the offset
+// bits of axis a, and mortonTable[a][i] is i deposited into that mask.
+// Offsets are 32 bit, so the padded volume is limited to 4G voxels.
+
+// host copy of the volume.  Offsets in the layouts count voxels, not bytes.
+struct CpuVolume
+{
+    const uchar *data;
+    int width, height, depth;
+    CpuVoxelType type;
+    int voxelSize;                      // bytes per voxel
+    float rawMin, rawMax;               // range of voxelValue() over the volume
+    CpuVolumeLayout layout;
+    int bricksX, bricksY, bricksZ;      // CPU_LAYOUT_BRICKED only
+    unsigned long long mortonMask[3];   // CPU_LAYOUT_MORTON only
+    const uint *mortonTable[3];         // CPU_LAYOUT_MORTON only
+    size_t size;                        // bytes in data, not counting padding
+    const void *mapping;                // data lies in this mapping of the volume's file, 0 if allocated
+    size_t mappingSize;                 // bytes in mapping
+};
+
+// converts an x fastest volume to the given layout and finds its value
+// range (volumeRender_cpu_layout.cpp)
+void createVolumeLayout(const void *src, int width, int height, int depth, CpuVoxelType type,
+                        CpuVolumeLayout layout, CpuVolume &vol);
+void freeVolumeLayout(CpuVolume &vol);
+
+// maps the first bytes of a raw volume file read-only, followed by
+// CPU_VOLUME_PADDING zero bytes, advised for one pass through (sequential)
+// or for rendering in place; 0, with a message, if it cannot
+const void *mapVolumeFile(const char *path, size_t bytes, bool sequential, size_t &mappingSize);
+void unmapVolumeFile(const void *mapping, size_t mappingSize);
+
+// as createVolumeLayout() from a mapVolumeFile() mapping.  The linear
+// layout takes the mapping over and renders from it (vol.mappingSize is
+// set); the others are converted from it, dropping its pages as they go,
+// and leave it to the caller, still valid.  A valueRange (smallest and
+// largest voxelValue()) already known is taken instead of scanning for it.
+void mapVolumeLayout(const void *mapping, size_t mappingSize, int width, int height, int depth,
+                     CpuVoxelType type, CpuVolumeLayout layout, const float *valueRange, CpuVolume &vol);
+
+// maps a .bvol file (see volumeRender_volume.h), its layout and value range
+// as stored, and with verify checks the checksum of every block first;
+// false, with a message, if the file is not one this build can render
+bool loadVolumeFile(const char *path, bool verify, CpuVolume &vol, float *spacing);
+
+// writes vol to a .bvol file in its layout
+bool writeVolumeFile(const char *path, const CpuVolume &vol, const float *spacing);
+
+// a malloc()ed x fastest copy of a volume in any layout
+void *linearVolumeCopy(const CpuVolume &vol);
+
+// coordinate i of axis a deposited into the Morton offset bits of that axis
+inline size_t mortonDeposit(const CpuVolume &vol, int a, int i)
+{
+#if defined(__BMI2__) && defined(__x86_64__)
+    return _pdep_u64((unsigned long long)i, vol.mortonMask[a]);
+#else
+    return vol.mortonTable[a][i];
+#endif
+}
+
+inline size_t brickedOffset(const CpuVolume &vol, int x, int y, int z)
+{
+    size_t brick = ((size_t)(z >> BRICK_SHIFT) * vol.bricksY + (y >> BRICK_SHIFT)) * vol.bricksX + (x >> BRICK_SHIFT);
+    return brick * BRICK_VOXELS + ((z & BRICK_MASK) * BRICK_PITCH + (y & BRICK_MASK)) * BRICK_PITCH + (x & BRICK_MASK);
+}
+
+// offset of voxel (x, y, z), which must be inside the volume
+inline size_t voxelOffset(const CpuVolume &vol, int x, int y, int z)
+{
+    if (vol.layout == CPU_LAYOUT_BRICKED)
+    {
+        return brickedOffset(vol, x, y, z);
+    }
+
+    if (vol.layout == CPU_LAYOUT_MORTON)
+    {
+        return mortonDeposit(vol, 0, x) | mortonDeposit(vol, 1, y) | mortonDeposit(vol, 2, z);
+    }
+
+    return ((size_t)z * vol.height + y) * vol.width + x;
+}
+
+// base voxel of a trilinear footprint [x0, x1] x [y0, y1] x [z0, z1].  Every
+// layout puts the other taps at fixed per-axis distances dx, dy and dz from
+// the base voxel (0 where the tap is clamped).
+template <typename Voxel>
+inline const Voxel *trilinearTaps(const CpuVolume &vol, int x0, int x1, int y0, int y1, int z0, int z1,
+                                  size_t &dx, size_t &dy, size_t &dz)
+{
+    const Voxel *data = (const Voxel *)vol.data;
+    const Voxel *p00;
+
+    if (vol.layout == CPU_LAYOUT_MORTON)
+    {
+        size_t mx = mortonDeposit(vol, 0, x0), my = mortonDeposit(vol, 1, y0), mz = mortonDeposit(vol, 2, z0);
+        dx = mortonDeposit(vol, 0, x1) - mx;
+        dy = mortonDeposit(vol, 1, y1) - my;
+        dz = mortonDeposit(vol, 2, z1) - mz;
+        p00 = data + (mx | my | mz);
+    }
+    else if (vol.layout == CPU_LAYOUT_BRICKED)
+    {
+        dx = x1 - x0;
+        dy = (y1 - y0) * BRICK_PITCH;
+        dz = (z1 - z0) * BRICK_SLICE;
+        p00 = data + brickedOffset(vol, x0, y0, z0);
+    }
+    else
+    {
+        dx = x1 - x0;
+        dy = (y1 - y0) * (size_t)vol.width;
+        dz = (z1 - z0) * (size_t)vol.width * vol.height;
+        p00 = data + ((size_t)z0 * vol.height + y0) * vol.width + x0;
+    }
+
+    return p00;
+}
+
+// 3D texture fetch with normalized coordinates, clamp addressing and
+// cudaReadModeNormalizedFloat, like tex3D(tex, ...) in d_render
+template <typename Voxel>
+inline float sampleVolumeLinear(const CpuVolume &vol, float u, float v, float w)
+{
+    float x = u * vol.width  - 0.5f;
+    float y = v * vol.height - 0.5f;
+    float z = w * vol.depth  - 0.5f;
+
+    float fx = floorf(x), fy = floorf(y), fz = floorf(z);
+    float ax = x - fx, ay = y - fy, az = z - fz;
+    int ix = (int)fx, iy = (int)fy, iz = (int)fz;
+
+    int x0 = clampi(ix, 0, vol.width  - 1), x1 = clampi(ix + 1, 0, vol.width  - 1);
+    int y0 = clampi(iy, 0, vol.height - 1), y1 = clampi(iy + 1, 0, vol.height - 1);
+    int z0 = clampi(iz, 0, vol.depth  - 1), z1 = clampi(iz + 1, 0, vol.depth  - 1);
+
+    size_t dx, dy, dz;
+    const Voxel *p00 = trilinearTaps<Voxel>(vol, x0, x1, y0, y1, z0, z1, dx, dy, dz);
+    const Voxel *p01 = p00 + dy;
+    const Voxel *p10 = p00 + dz;
+    const Voxel *p11 = p10 + dy;
+
+    float v000 = voxelValue(p00[0]), v001 = voxelValue(p00[dx]);
+    float v010 = voxelValue(p01[0]), v011 = voxelValue(p01[dx]);
+    float v100 = voxelValue(p10[0]), v101 = voxelValue(p10[dx]);
+    float v110 = voxelValue(p11[0]), v111 = voxelValue(p11[dx]);
+
+    float c00 = v000 + ax * (v001 - v000);
+    float c01 = v010 + ax * (v011 - v010);
+    float c10 = v100 + ax * (v101 - v100);
+    float c11 = v110 + ax * (v111 - v110);
+
+    float c0 = c00 + ay * (c01 - c00);
+    float c1 = c10 + ay * (c11 - c10);
+
+    return (c0 + az * (c1 - c0)) * voxelScale<Voxel>();
+}
+
+template <typename Voxel>
+inline float sampleVolumeNearest(const CpuVolume &vol, float u, float v, float w)
+{
+    int x = clampi((int)floorf(u * vol.width),  0, vol.width  - 1);
+    int y = clampi((int)floorf(v * vol.height), 0, vol.height - 1);
+    int z = clampi((int)floorf(w * vol.depth),  0, vol.depth  - 1);
+
+    return voxelValue(((const Voxel *)vol.data)[voxelOffset(vol, x, y, z)]) * voxelScale<Voxel>();
+}
+
+// the transfer function table shared by both backends
+#define TRANSFER_FUNC_SIZE 9
+extern const vec4 cpuTransferFunc[TRANSFER_FUNC_SIZE];
+
+// 1D texture fetch with normalized coordinates, clamp addressing and
+// linear filtering, like tex1D(transferTex, ...) in d_render
+inline vec4 sampleTransfer(float c)
+{
+    float x = c * TRANSFER_FUNC_SIZE - 0.5f;
+    float fx = floorf(x);
+    float a = x - fx;
+    int i = (int)fx;
+    const vec4 &t0 = cpuTransferFunc[clampi(i, 0, TRANSFER_FUNC_SIZE - 1)];
+    const vec4 &t1 = cpuTransferFunc[clampi(i + 1, 0, TRANSFER_FUNC_SIZE - 1)];
+
+    return make_vec4(t0.x + a * (t1.x - t0.x),
+                     t0.y + a * (t1.y - t0.y),
+                     t0.z + a * (t1.z - t0.z),
+                     t0.w + a * (t1.w - t0.w));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// fixed point sampling for 8 and 16 bit volumes (volumeRender_cpu_fixed.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// The trilinear weights are rounded to 8 fractional bits and the taps are
+// blended in integer arithmetic, in a 16 bit domain that holds uint8
+// voxels as 8.8 fixed point and uint16 voxels as they are.  Each of the
+// three stages computes p + (((q - p) * w + 128) >> 8), and the result
+// indexes a 256 entry table of classified colours, so neither the voxels
+// nor the transfer function go through float.
+//
+// Error against sampleVolumeLinear() + sampleTransfer(): with d the
+// largest difference between neighbouring voxels, rounding the weights
+// costs at most d/512 per stage, rounding the y and z stages 1/512 of a
+// uint8 level (x, y and z: 1/2 of a uint16 value), and the table half of
+// one of its 256 steps.  For uint8 volumes a sample is therefore within
+// 3d/512 + 0.51 levels, under 2 levels even across a jump from 0 to 255.
+
+// 256 entry transfer function table for the fixed point path
+#define TRANSFER_TABLE_SIZE 256
+
+struct CpuTransferTable
+{
+    // colour and density scaled opacity, entries evenly spaced over the
+    // value range of the volume
+    float r[TRANSFER_TABLE_SIZE], g[TRANSFER_TABLE_SIZE];
+    float b[TRANSFER_TABLE_SIZE], a[TRANSFER_TABLE_SIZE];
+    int fixedBase, fixedMul;        // fixed domain value to entry, see transferIndex()
+    float sampleScale;              // fixed domain value to sample value
+    float tableOffset, tableScale, tableDensity;
+};
+
+// sets up the table for the value range of an 8 or 16 bit volume
+void initTransferTable(CpuTransferTable &table, const CpuVolume &vol);
+
+// refills the table if the transfer function mapping or density changed
+void updateTransferTable(CpuTransferTable &table, float transferOffset, float transferScale, float density);
+
+// voxel in the fixed domain
+inline int voxelFixed(uchar v)  { return v << 8; }
+inline int voxelFixed(ushort v) { return v; }
+
+// fixed domain value to 8 fractional bits: 1/unit of a voxel step
+template <typename Voxel> inline int fixedUnit() { return sizeof(Voxel) == 1 ? 256 : 1; }
+
+inline int lerpFixed(int p, int q, int w)
+{
+    return p + (((q - p) * w + 128) >> 8);
+}
+
+// nearest table entry of a fixed domain value
+inline int transferIndex(const CpuTransferTable &table, int f)
+{
+    return clampi(((f - table.fixedBase) * table.fixedMul + 32768) >> 16, 0, TRANSFER_TABLE_SIZE - 1);
+}
+
+// fixed point version of sampleVolumeLinear(), returns the table entry.
+// The texel coordinates come from one fmaf() each, so that the packet
+// marcher, which uses FMA, gets bit identical weights.
+template <typename Voxel>
+inline int sampleVolumeLinearFixed(const CpuVolume &vol, const CpuTransferTable &table, float u, float v, float w)
+{
+    // (u * width - 0.5) * 256, rounded to the nearest 1/256 of a voxel
+    int x = (int)floorf(clampf(fmaf(u, vol.width  * 256.0f, -127.5f), -256.0f, vol.width  * 256.0f));
+    int y = (int)floorf(clampf(fmaf(v, vol.height * 256.0f, -127.5f), -256.0f, vol.height * 256.0f));
+    int z = (int)floorf(clampf(fmaf(w, vol.depth  * 256.0f, -127.5f), -256.0f, vol.depth  * 256.0f));
+    int ix = x >> 8, iy = y >> 8, iz = z >> 8;
+    int wx = x & 255, wy = y & 255, wz = z & 255;
+
+    int x0 = clampi(ix, 0, vol.width  - 1), x1 = clampi(ix + 1, 0, vol.width  - 1);
+    int y0 = clampi(iy, 0, vol.height - 1), y1 = clampi(iy + 1, 0, vol.height - 1);
+    int z0 = clampi(iz, 0, vol.depth  - 1), z1 = clampi(iz + 1, 0, vol.depth  - 1);
+
+    size_t dx, dy, dz;
+    const Voxel *p00 = trilinearTaps<Voxel>(vol, x0, x1, y0, y1, z0, z1, dx, dy, dz);
+    const Voxel *p01 = p00 + dy;
+    const Voxel *p10 = p00 + dz;
+    const Voxel *p11 = p10 + dy;
+
+    int c00 = lerpFixed(voxelFixed(p00[0]), voxelFixed(p00[dx]), wx);
+    int c01 = lerpFixed(voxelFixed(p01[0]), voxelFixed(p01[dx]), wx);
+    int c10 = lerpFixed(voxelFixed(p10[0]), voxelFixed(p10[dx]), wx);
+    int c11 = lerpFixed(voxelFixed(p11[0]), voxelFixed(p11[dx]), wx);
+
+    int c0 = lerpFixed(c00, c01, wy);
+    int c1 = lerpFixed(c10, c11, wy);
+
+    return transferIndex(table, lerpFixed(c0, c1, wz));
+}
+
+// the voxel sampleVolumeNearest() picks, as a table entry
+template <typename Voxel>
+inline int sampleVolumeNearestFixed(const CpuVolume &vol, const CpuTransferTable &table, float u, float v, float w)
+{
+    int x = clampi((int)floorf(u * vol.width),  0, vol.width  - 1);
+    int y = clampi((int)floorf(v * vol.height), 0, vol.height - 1);
+    int z = clampi((int)floorf(w * vol.depth),  0, vol.depth  - 1);
+
+    return transferIndex(table, voxelFixed(((const Voxel *)vol.data)[voxelOffset(vol, x, y, z)]));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// macrocells for empty space skipping (volumeRender_cpu_macrocell.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// edge length of a macrocell in voxels
+#define MACROCELL_SIZE 8
+
+// coarse min/max grid over the volume.  The value range of a cell includes a
+// one voxel apron, so it bounds every trilinear sample taken inside the
+// cell.  Whether a range can produce any opacity depends on the transfer
+// function; that is kept in separate 256x256 tables indexed by (min, max),
+// which are all that needs rebuilding when the transfer function changes.
+// Wider voxel types are binned into 256 steps over the volume's value
+// range, rounding the min down and the max up.
+struct CpuMacrocells
+{
+    int cellsX, cellsY, cellsZ;
+    float scaleX, scaleY, scaleZ;   // world units to cells
+    uchar *minMax;                  // min, max bin pair per cell, x fastest
+    float sampleMin, sampleMax;     // sampled values of bins 0 and 255
+    float binStep, binMargin;       // sampled value per bin, rounding allowance
+
+    // summary tables, indexed by min*256 + max
+    uchar *visible;                 // nonzero if the range may be visible
+    uchar *stepScale;               // step multiplier for adaptive marching
+    float *alphaRange;              // spread of density scaled opacity over the range
+    float summaryOffset, summaryScale, summaryDensity, summaryQuality;
+};
+
+// longest adaptive step, in multiples of the reference step
+#define MAX_STEP_SCALE 16
+
+void buildMacrocells(const CpuVolume &vol, CpuMacrocells &cells);
+
+// as buildMacrocells(), from the smallest and largest voxelValue() of every
+// cell, apron included, found while the volume was written
+void buildMacrocellsFromRanges(const CpuVolume &vol, const float *cellRanges, CpuMacrocells &cells);
+void freeMacrocells(CpuMacrocells &cells);
+
+// rebuilds the summary tables if the transfer function mapping, the density
+// or the adaptive quality changed
+void updateMacrocellSummary(CpuMacrocells &cells, float transferOffset, float transferScale,
+                            float density, float quality);
+
+// index of a cell's value range into the summary tables
+inline int macrocellKey(const CpuMacrocells &cells, int cx, int cy, int cz)
+{
+    const uchar *mm = &cells.minMax[2 * (((size_t)cz * cells.cellsY + cy) * cells.cellsX + cx)];
+    return mm[0] * 256 + mm[1];
+}
+
+inline bool macrocellEmpty(const CpuMacrocells &cells, int cx, int cy, int cz)
+{
+    return !cells.visible[macrocellKey(cells, cx, cy, cz)];
+}
+
+// bounds on every sample taken inside a cell with this key, widened a
+// little so that rounding in the marcher cannot step outside them
+inline float macrocellLowerBound(const CpuMacrocells &cells, int key)
+{
+    return cells.sampleMin + (key >> 8) * cells.binStep - cells.binMargin;
+}
+
+inline float macrocellUpperBound(const CpuMacrocells &cells, int key)
+{
+    return cells.sampleMin + (key & 255) * cells.binStep + cells.binMargin;
+}
+
+// 3D-DDA over the macrocell grid (Amanatides & Woo), walking the cells a
+// ray passes through in front to back order
+struct CpuCellWalker
+{
+    int c[3];           // current cell
+    int stepDir[3];     // +1 / -1 per axis
+    int limit[3];       // cell count per axis
+    float tMax[3];      // ray parameter of the next cell face per axis
+    float tDelta[3];    // ray parameter across one cell per axis
+    float tEntry;       // ray parameter where the current cell was entered
+
+    // start in the cell containing the ray at t
+    void init(const CpuMacrocells &cells, const CpuRay &ray, float t)
+    {
+        const float o[3] = { ray.o.x, ray.o.y, ray.o.z };
+        const float d[3] = { ray.d.x, ray.d.y, ray.d.z };
+        const float scale[3] = { cells.scaleX, cells.scaleY, cells.scaleZ };
+        limit[0] = cells.cellsX;
+        limit[1] = cells.cellsY;
+        limit[2] = cells.cellsZ;
+        tEntry = t;
+
+        for (int a = 0; a < 3; a++)
+        {
+            float g = clampf((o[a] + d[a]*t + 1.0f) * scale[a], 0.0f, (float)(limit[a] - 1));
+            c[a] = (int)g;
+
+            if (d[a] > 0.0f)
+            {
+                stepDir[a] = 1;
+                tDelta[a] = 1.0f / (d[a] * scale[a]);
+                tMax[a] = ((c[a] + 1) / scale[a] - 1.0f - o[a]) / d[a];
+            }
+            else if (d[a] < 0.0f)
+            {
+                stepDir[a] = -1;
+                tDelta[a] = -1.0f / (d[a] * scale[a]);
+                tMax[a] = (c[a] / scale[a] - 1.0f - o[a]) / d[a];
+            }
+            else
+            {
+                stepDir[a] = 0;
+                tDelta[a] = INFINITY;
+                tMax[a] = INFINITY;
+            }
+        }
+    }
+
+    float tExit() const
+    {
+        return fminf(tMax[0], fminf(tMax[1], tMax[2]));
+    }
+
+    // move to the next cell along the ray; false once the ray leaves the grid
+    bool step()
+    {
+        int a = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+        c[a] += stepDir[a];
+        tEntry = tMax[a];
+        tMax[a] += tDelta[a];
+
+        return c[a] >= 0 && c[a] < limit[a];
+    }
+
+    bool empty(const CpuMacrocells &cells) const
+    {
+        return macrocellEmpty(cells, c[0], c[1], c[2]);
+    }
+
+    int key(const CpuMacrocells &cells) const
+    {
+        return macrocellKey(cells, c[0], c[1], c[2]);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// pre-integrated transfer function (volumeRender_cpu_preint.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// entries per axis of the pre-integration table
+#define PREINT_SIZE 256
+
+// ray step with pre-integration, in multiples of the reference step
+#define PREINT_STEP_SCALE 4
+
+// colour and opacity of a ray segment whose scalar value runs linearly from
+// the front sample sf to the back sample sb, for segments PREINT_STEP_SCALE
+// reference steps long.  Colour is premultiplied by opacity.  Stored as
+// separate channels so the packet marcher can gather them.  The table
+// covers the volume's value range: with s' = (s - valueMin) * valueScale in
+// [0, 1], entry (sf, sb) is at sf'*(PREINT_SIZE-1) rows and
+// sb'*(PREINT_SIZE-1) columns.
+struct CpuPreintTable
+{
+    float *r, *g, *b, *a;
+    float valueMin, valueScale;
+    float tableOffset, tableScale, tableDensity;
+};
+
+// valueMin and valueMax are the extremes of the sampled values
+void initPreintTable(CpuPreintTable &table, float valueMin, float valueMax);
+void freePreintTable(CpuPreintTable &table);
+
+// rebuilds the table if the transfer function mapping or density changed
+void updatePreintTable(CpuPreintTable &table, float transferOffset, float transferScale, float density);
+
+// bilinear fetch of the segment from sample sf to sample sb
+inline vec4 samplePreint(const CpuPreintTable &table, float sf, float sb)
+{
+    float x = clampf((sb - table.valueMin) * table.valueScale, 0.0f, 1.0f) * (PREINT_SIZE - 1);
+    float y = clampf((sf - table.valueMin) * table.valueScale, 0.0f, 1.0f) * (PREINT_SIZE - 1);
+    int ix = clampi((int)x, 0, PREINT_SIZE - 2);
+    int iy = clampi((int)y, 0, PREINT_SIZE - 2);
+    float ax = x - ix, ay = y - iy;
+    int i00 = iy * PREINT_SIZE + ix, i10 = i00 + PREINT_SIZE;
+    const float *ch[4] = { table.r, table.g, table.b, table.a };
+    float out[4];
+
+    for (int k = 0; k < 4; k++)
+    {
+        float c0 = ch[k][i00] + ax * (ch[k][i00 + 1] - ch[k][i00]);
+        float c1 = ch[k][i10] + ax * (ch[k][i10 + 1] - ch[k][i10]);
+        out[k] = c0 + ay * (c1 - c0);
+    }
+
+    return make_vec4(out[0], out[1], out[2], out[3]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// mip pyramid and level of detail (volumeRender_cpu_pyramid.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// levels of a pyramid, the volume included: enough for 32768 voxels per axis
+#define CPU_MAX_LOD_LEVELS 16
+
+// box filtered copies of the volume, each half as large as the one before
+// along every axis (rounded up) down to a single voxel, in the layout and
+// voxel type of the volume.  Normalized coordinates address the same point
+// on every level, so a sampler only needs to be handed another CpuVolume.
+struct CpuVolumePyramid
+{
+    int levels;                             // 0 if not built, else 1 + coarser levels
+    CpuVolume level[CPU_MAX_LOD_LEVELS];    // level[0] is unused, it is the volume
+};
+
+// builds the coarser levels of vol from src, its voxels x fastest.  With a
+// cachePath the levels are read from there if the file matches the volume,
+// and written there otherwise.
+void buildVolumePyramid(const void *src, const CpuVolume &vol, CpuVolumePyramid &pyramid, const char *cachePath);
+void freeVolumePyramid(CpuVolumePyramid &pyramid);
+
+// the levels of detail of one frame.  A ray samples level l from the
+// distance tLevel[l] on, where the footprint of its pixel has grown to a
+// voxel of that level, and there takes steps of stepScale[l] reference
+// steps, about half a voxel of the level.
+struct CpuLod
+{
+    int levels;
+    const CpuVolume *volume[CPU_MAX_LOD_LEVELS];
+    float tLevel[CPU_MAX_LOD_LEVELS];
+    int stepScale[CPU_MAX_LOD_LEVELS];
+};
+
+// pixelStride is the spacing of the rays in pixels, see RenderPass
+void setupLod(CpuLod &lod, const CpuVolume &vol, const CpuVolumePyramid &pyramid,
+              uint imageW, uint imageH, uint pixelStride);
+
+// level of detail along a ray, moving front to back.  Without a CpuLod the
+// ray stays on the volume at the reference step.
+struct CpuLodWalker
+{
+    const CpuLod *lod;
+    const CpuVolume *volume;    // level to sample
+    int level;
+    int stepScale;
+    float tNext;                // where the next level starts
+
+    void init(const CpuLod *l, const CpuVolume &vol)
+    {
+        lod = l;
+        volume = &vol;
+        level = 0;
+        stepScale = 1;
+        tNext = lod && lod->levels > 1 ? lod->tLevel[1] : INFINITY;
+    }
+
+    // move on to the level for t; levels never get finer along a ray
+    void advance(float t)
+    {
+        while (t >= tNext)
+        {
+            level++;
+            volume = lod->volume[level];
+            stepScale = lod->stepScale[level];
+            tNext = level + 1 < lod->levels ? lod->tLevel[level + 1] : INFINITY;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// octree volumes (volumeRender_cpu_octree.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// An octree in the layout of a version 2 .boc file (see
+// volumeRender_octree.h): parents and leaf densities in two breadth first
+// arrays.  Version 2 files are mapped and used in place; version 1 files
+// are converted into allocated arrays.
+struct CpuOctree
+{
+    const OctreeFileNode *nodes;
+    const float *leaves;
+    size_t nodeCount;
+    size_t leafCount;
+    int depth;                  // levels below the root
+    float minValue, maxValue;   // over the whole tree
+    void *mapping;              // the mapped file, 0 if the arrays are allocated
+    size_t mappingSize;
+};
+
+// false, with a message, if the file cannot be read or is not a complete
+// tree; with verify every node of a version 2 file is checked first
+bool loadOctree(const char *path, bool verify, CpuOctree &tree);
+void freeOctree(CpuOctree &tree);
+
+// Parametric octree traversal (Revelles et al.), walking the nodes a ray
+// passes through in front to back order.  The ray is mirrored onto
+// positive directions, so the child it enters first only depends on which
+// of the parent's mid-planes lie behind the entry point, and the next
+// sibling on the axis it leaves the current child by.  The caller either
+// descends into the current node or skips it with all its children;
+// nodes the ray leaves before tMin are never visited.  A parent whose
+// range is a single value counts as a leaf.
+struct CpuOctreeWalker
+{
+    struct Frame
+    {
+        float t0[3], t1[3];     // ray parameters of the node's slabs, per axis
+        size_t node;            // in tree->nodes, or tree->leaves if parent is false
+        bool parent;
+        int child;              // position among its siblings, mirrored
+    };
+
+    const CpuOctree *tree;
+    Frame stack[OCTREE_MAX_DEPTH + 1];
+    int level;                  // of the current node, -1 once the ray has left the tree
+    int mirror;                 // bit a set if the ray runs backwards along axis a
+    float tMin;
+    float tEntry, tExit;        // extent of the current node along the ray
+
+    void init(const CpuOctree &octree, const CpuRay &ray, float t)
+    {
+        const float o[3] = { ray.o.x, ray.o.y, ray.o.z };
+        const float d[3] = { ray.d.x, ray.d.y, ray.d.z };
+        Frame &root = stack[0];
+
+        tree = &octree;
+        mirror = 0;
+        tMin = t;
+
+        for (int a = 0; a < 3; a++)
+        {
+            // the root is centred on the origin, so mirroring negates;
+            // rays parallel to an axis get a direction tiny enough to
+            // never reach the next plane
+            float oa = d[a] < 0.0f ? -o[a] : o[a];
+            float da = fabsf(d[a]) > 1e-12f ? fabsf(d[a]) : 1e-12f;
+            mirror |= d[a] < 0.0f ? 1 << a : 0;
+            root.t0[a] = (-1.0f - oa) / da;
+            root.t1[a] = (1.0f - oa) / da;
+        }
+
+        root.node = 0;
+        root.parent = octree.nodeCount > 0;
+        root.child = 0;
+        level = 0;
+        update();
+
+        if (tEntry >= tExit)
+        {
+            level = -1;
+        }
+
+        settle();
+    }
+
+    bool valid() const
+    {
+        return level >= 0;
+    }
+
+    // value range of the current node; a leaf if it is a single value
+    void range(float &minValue, float &maxValue) const
+    {
+        // a select rather than a branch, which would be mispredicted at
+        // every change between parents and leaves
+        const Frame &f = stack[level];
+        const float *value = f.parent ? &tree->nodes[f.node].minValue : &tree->leaves[f.node];
+        minValue = value[0];
+        maxValue = value[f.parent];
+    }
+
+    // move to the first child of the current node the ray passes through.
+    // A leaf, which only gets here if its value is NaN, or a parent as
+    // deep as the header says the tree goes can only be passed.
+    void descend()
+    {
+        const Frame &f = stack[level];
+
+        if (!f.parent || level >= tree->depth)
+        {
+            skip();
+            return;
+        }
+
+        float tEnter = maxf(maxf(f.t0[0], f.t0[1]), f.t0[2]);
+        int c = 0;
+
+        for (int a = 0; a < 3; a++)
+        {
+            c |= 0.5f * (f.t0[a] + f.t1[a]) < tEnter ? 1 << a : 0;
+        }
+
+        bool inTree = enterChild(stack[level + 1], f, c);
+        level++;
+        update();
+
+        if (!inTree)
+        {
+            next();
+        }
+
+        settle();
+    }
+
+    // move past the current node and everything below it
+    void skip()
+    {
+        next();
+        settle();
+    }
+
+    void update()
+    {
+        const Frame &f = stack[level];
+        tEntry = maxf(maxf(f.t0[0], f.t0[1]), f.t0[2]);
+        tExit = minf(minf(f.t1[0], f.t1[1]), f.t1[2]);
+    }
+
+    // false if the file puts the child outside its arrays, or a parent
+    // child not after its parent as the breadth first order does; the
+    // walker then passes it as if it were empty, and never follows an
+    // index the file gives without this check
+    bool enterChild(Frame &f, const Frame &parent, int c)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float tm = 0.5f * (parent.t0[a] + parent.t1[a]);
+            f.t0[a] = c & (1 << a) ? tm : parent.t0[a];
+            f.t1[a] = c & (1 << a) ? parent.t1[a] : tm;
+        }
+
+        const OctreeFileNode &node = tree->nodes[parent.node];
+        unsigned long long index = octreeChildIndex(node, c ^ mirror);
+        f.node = (size_t)index;
+        f.parent = octreeChildIsParent(node, c ^ mirror);
+        f.child = c;
+
+        return f.parent ? index > parent.node && index < tree->nodeCount : index < tree->leafCount;
+    }
+
+    // the next sibling through the face the ray leaves by, or the next
+    // sibling of a parent if that face is the parent's as well
+    void next()
+    {
+        while (level > 0)
+        {
+            const Frame &f = stack[level];
+            int a = f.t1[0] < f.t1[1] ? (f.t1[0] < f.t1[2] ? 0 : 2) : (f.t1[1] < f.t1[2] ? 1 : 2);
+
+            if (f.child & (1 << a))
+            {
+                level--;
+                continue;
+            }
+
+            bool inTree = enterChild(stack[level], stack[level - 1], f.child | (1 << a));
+            update();
+
+            if (inTree)
+            {
+                return;
+            }
+        }
+
+        level = -1;
+    }
+
+    void settle()
+    {
+        while (level >= 0 && tExit <= tMin)
+        {
+            next();
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// AMR hierarchies (volumeRender_cpu_amr.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// cells of the patch index along each axis of the box
+#define AMR_INDEX_SIZE 32
+
+// how far a point may lie outside a patch and still be found in it, for
+// samples on a face that rounding moved off it (clamping covers them)
+#define AMR_BOX_MARGIN 1e-5f
+
+// a patch, as a float volume of its own over its part of the box
+struct CpuAmrGrid
+{
+    CpuVolume volume;           // x fastest, data not owned unless in CpuAmr::owned
+    vec3 boxMin, boxMax;
+    vec3 findMin, findMax;      // the box grown by AMR_BOX_MARGIN, for amrGridAt()
+    vec3 invExtent;             // 1 / (boxMax - boxMin)
+    int level;
+    float tstep;                // ray step inside the patch
+};
+
+// The grids are sorted finest first, and every cell of the index lists the
+// grids overlapping it in that order, so the first of them that contains
+// a point is the finest there.
+struct CpuAmr
+{
+    CpuAmrGrid *grids;
+    int gridCount;
+    int levels;
+    uint *cellStart;            // AMR_INDEX_SIZE^3 + 1 offsets into cellGrids
+    uint *cellGrids;
+    float minValue, maxValue;   // over all patches
+    float **owned;              // data loaded by loadAmrFile(), one per grid, else 0
+};
+
+// false, with a message, if the patches are unusable
+bool buildAmr(const CpuAmrPatch *patches, int count, CpuAmr &amr);
+// reads the text description of a hierarchy and its data, then buildAmr()
+bool loadAmrFile(const char *path, CpuAmr &amr);
+void freeAmr(CpuAmr &amr);
+
+// the finest grid containing p, or -1 outside all of them
+inline int amrGridAt(const CpuAmr &amr, const vec3 &p)
+{
+    int x = clampi((int)((p.x + 1.0f) * (0.5f * AMR_INDEX_SIZE)), 0, AMR_INDEX_SIZE - 1);
+    int y = clampi((int)((p.y + 1.0f) * (0.5f * AMR_INDEX_SIZE)), 0, AMR_INDEX_SIZE - 1);
+    int z = clampi((int)((p.z + 1.0f) * (0.5f * AMR_INDEX_SIZE)), 0, AMR_INDEX_SIZE - 1);
+    int cell = (z * AMR_INDEX_SIZE + y) * AMR_INDEX_SIZE + x;
+
+    for (uint i = amr.cellStart[cell]; i < amr.cellStart[cell + 1]; i++)
+    {
+        const CpuAmrGrid &g = amr.grids[amr.cellGrids[i]];
+
+        if (p.x >= g.findMin.x && p.x <= g.findMax.x &&
+            p.y >= g.findMin.y && p.y <= g.findMax.y &&
+            p.z >= g.findMin.z && p.z <= g.findMax.z)
+        {
+            return (int)amr.cellGrids[i];
+        }
+    }
+
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// out-of-core volumes (volumeRender_cpu_paged.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+struct CpuBrickCache;
+
+// A .bvb file (see volumeRender_bricks.h) rendered without ever holding it
+// in memory: the header and the brick ranges are mapped, and the bricks
+// rays reach are read into a cache of fixed size, the least recently used
+// ones giving way.
+struct CpuPagedVolume
+{
+    BrickFileHeader header;
+    const float *ranges;        // smallest and largest voxelValue() of every brick
+    void *mapping;              // the header and the ranges
+    size_t mappingSize;
+    CpuBrickCache *cache;       // 0 if no file is open
+};
+
+// cacheBytes 0 takes a quarter of the physical memory; false, with a
+// message, if the file cannot be used
+bool openPagedVolume(const char *path, size_t cacheBytes, CpuPagedVolume &vol);
+void closePagedVolume(CpuPagedVolume &vol);
+
+// bricks the cache holds, and bricks and bytes read from the file so far
+size_t pagedCacheSlots(const CpuPagedVolume &vol);
+unsigned long long pagedBricksRead(const CpuPagedVolume &vol);
+unsigned long long pagedBytesRead(const CpuPagedVolume &vol);
+
+////////////////////////////////////////////////////////////////////////////////
+// compressed volumes (volumeRender_cpu_compressed.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// voxels along a block of the fixed rate code, and along a tile, the unit
+// rays decode blocks in; a tile is 2^3 blocks
+#define COMPRESSED_BLOCK_SHIFT 2
+#define COMPRESSED_BLOCK_SIZE  (1 << COMPRESSED_BLOCK_SHIFT)
+#define COMPRESSED_BLOCK_VOXELS (COMPRESSED_BLOCK_SIZE * COMPRESSED_BLOCK_SIZE * COMPRESSED_BLOCK_SIZE)
+#define COMPRESSED_TILE_SHIFT  3
+#define COMPRESSED_TILE_SIZE   (1 << COMPRESSED_TILE_SHIFT)
+
+// A volume held in memory in a fixed rate code: every 4^3 block of voxels
+// keeps its smallest value and a step, and each voxel is that value plus a
+// residual of bits bits times the step.  The blocks of a tile are stored
+// together, tiles in x, y, z order, so any voxel is found from its
+// coordinates alone.
+struct CpuCompressedVolume
+{
+    int width, height, depth;
+    CpuVoxelType type;
+    int bits;                       // per residual, 4 or 8
+    float rawMin, rawMax;           // range of the decoded voxelValue()s
+    int tilesX, tilesY, tilesZ;
+    float *blocks;                  // smallest value and step of every block
+    uchar *residuals;               // COMPRESSED_BLOCK_VOXELS * bits / 8 bytes per block
+    float *tileRanges;              // smallest and largest decoded value the samples in a tile read
+    size_t bytes;                   // held by the three arrays
+    unsigned long long id;          // tells the decoded tile caches of the threads apart
+};
+
+// codes a volume, x fastest, with residuals of bits bits (4 or 8); a
+// mapped source lets its pages go as the code gets past them
+void compressVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type, int bits,
+                    CpuCompressedVolume &vol);
+void freeCompressedVolume(CpuCompressedVolume &vol);
+
+////////////////////////////////////////////////////////////////////////////////
+// quantized volumes (volumeRender_cpu_quantized.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// A volume in the bricks of the bricked layout, ghost layer included, each
+// voxel an 8 or 16 bit value q that the two floats a, b of its brick map
+// back to a + q*b, or on the log scale to 2^(a + q*b) for q > 0 and to 0
+// for q = 0.
+struct CpuQuantizedVolume
+{
+    int width, height, depth;
+    CpuVoxelType type;              // of the volume quantized
+    int bits;                       // per voxel, 8 or 16
+    bool logScale;
+    float rawMin, rawMax;           // range of the dequantized voxelValue()s
+    int bricksX, bricksY, bricksZ;
+    uchar *data;                    // BRICK_VOXELS values of bits bits per brick
+    float *params;                  // a and b of every brick
+    float *brickRanges;             // smallest and largest dequantized value in a brick
+    float maxError;                 // largest |dequantized - voxelValue()| over the finite voxels
+    float maxRelativeError;         // the same divided by |voxelValue()|, see getCpuQuantizationError()
+    size_t bytes;                   // held by the three arrays
+};
+
+// quantizes a volume, x fastest, to bits bits (8 or 16) per voxel; a
+// mapped source lets its pages go as the bricks get past them
+void quantizeVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type, int bits,
+                    bool logScale, CpuQuantizedVolume &vol);
+void freeQuantizedVolume(CpuQuantizedVolume &vol);
+
+////////////////////////////////////////////////////////////////////////////////
+// preprocessing on load (volumeRender_cpu_preprocess.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// what the preprocessing pass finds on its way, besides the volume
+struct CpuVolumeSummary
+{
+    float *cellRanges;              // smallest and largest voxelValue() of every macrocell, apron included
+    unsigned long long histogram[CPU_HISTOGRAM_BINS];
+    float histogramMin, histogramMax;   // voxelValue()s the bins span
+    int passes;                     // over the source, 2 if its range had to be found first
+};
+
+// false, with a message, if the stages cannot run
+bool preprocessStagesValid(const CpuPreprocess &stages);
+
+// runs the stages over a volume, x fastest, of the given type, into vol of
+// stages.type in the given layout; a mapped source lets its pages go as
+// the pass gets past them.  false, with a message, if there is no memory
+// for the volume.
+bool preprocessVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type,
+                      const CpuPreprocess &stages, CpuVolumeLayout layout, CpuVolume &vol,
+                      CpuVolumeSummary &summary);
+void freeVolumeSummary(CpuVolumeSummary &summary);
+
+////////////////////////////////////////////////////////////////////////////////
+// tile renderers
+////////////////////////////////////////////////////////////////////////////////
+
+// marching constants, as in d_render
+const int   cpuMaxSteps = 500;
+const float cpuTstep = 0.01f;
+const float cpuOpacityThreshold = 0.95f;
+
+// per-frame state shared by all tiles of a render_cpu() call
+struct CpuRenderArgs
+{
+    uint *output;
+    uint imageW, imageH;
+    float density, brightness;
+    float transferOffset, transferScale;
+    const float *invViewMatrix;
+    const CpuVolume *volume;
+    const CpuMacrocells *macrocells;    // 0 disables empty space skipping
+    const CpuPreintTable *preint;       // 0 samples the transfer function per point
+    const CpuTransferTable *transferTable;  // fixed point path for 8/16 bit voxels, not with preint
+    const CpuLod *lod;                  // 0 samples the volume alone
+    const CpuOctree *octree;            // 0 renders the volume, else this tree in its place
+    const CpuAmr *amr;                  // 0 renders the volume, else these patches in its place
+    const CpuPagedVolume *paged;        // 0 renders the volume, else this file in its place
+    const CpuCompressedVolume *compressed;  // 0 renders the volume, else this code of one in its place
+    const CpuQuantizedVolume *quantized;    // 0 renders the volume, else this quantized one in its place
+    bool linearFilter;
+    bool adaptive;                      // adaptive steps, needs macrocells, not with preint
+    RenderMode mode;                    // anything but RENDER_COMPOSITE uses the projection marcher
+    uint pixelStride;                   // one ray per pixelStride^2 block, see RenderPass
+    int stepScale;                      // least reference steps per sample, 1 outside refinement
+    const uchar *pixelMask;             // 0 marches every pixel, else only those nonzero here
+    float *depth, *spread;              // 0, or where each ray that hits stores its depth
+    float reuseMinAlpha;                // see storeRayDepth()
+};
+
+// bytes allocated past the end of the volume so that the packet marcher can
+// gather 32 bits at any voxel address and at the voxel after it
+#define CPU_VOLUME_PADDING 8
+
+// renders pixels [x0, x1) x [y0, y1) and adds its counters to stats; with
+// args.pixelStride > 1 only the first pixel of each block, counted from
+// (x0, y0).  With args.pixelMask the masked out pixels are left alone.
+typedef void (*CpuTileFunc)(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// Both marchers are templates over the voxel type, the filter, the
+// transfer function mode (point sampled, adaptive or pre-integrated) and
+// the fixed point path, so none of these is tested per sample.
+// selectEngine() picks the instantiation
+// Engine<Voxel, linearFilter, adaptive, preint, fixedPoint>::renderTile that
+// matches a frame; fixedPoint is only ever true for the integer types.
+template <template <typename, bool, bool, bool, bool> class Engine, typename Voxel, bool linearFilter>
+inline CpuTileFunc selectEngineMode(const CpuRenderArgs &args)
+{
+    const bool fixedPoint = FixedPointVoxel<Voxel>::value;
+
+    if (args.preint)
+    {
+        return Engine<Voxel, linearFilter, false, true, false>::renderTile;
+    }
+
+    if (args.transferTable)
+    {
+        return args.adaptive ? Engine<Voxel, linearFilter, true, false, fixedPoint>::renderTile :
+                               Engine<Voxel, linearFilter, false, false, fixedPoint>::renderTile;
+    }
+
+    if (args.adaptive)
+    {
+        return Engine<Voxel, linearFilter, true, false, false>::renderTile;
+    }
+
+    return Engine<Voxel, linearFilter, false, false, false>::renderTile;
+}
+
+template <template <typename, bool, bool, bool, bool> class Engine, typename Voxel>
+inline CpuTileFunc selectEngineFilter(const CpuRenderArgs &args)
+{
+    return args.linearFilter ? selectEngineMode<Engine, Voxel, true>(args) :
+                               selectEngineMode<Engine, Voxel, false>(args);
+}
+
+template <template <typename, bool, bool, bool, bool> class Engine>
+inline CpuTileFunc selectEngine(const CpuRenderArgs &args)
+{
+    switch (args.volume->type)
+    {
+        case CPU_VOXEL_UINT16:
+            return selectEngineFilter<Engine, ushort>(args);
+
+        case CPU_VOXEL_FLOAT:
+            return selectEngineFilter<Engine, float>(args);
+
+        case CPU_VOXEL_HALF:
+            return selectEngineFilter<Engine, CpuHalf>(args);
+
+        default:
+            return selectEngineFilter<Engine, uchar>(args);
+    }
+}
+
+// The projection modes reduce each ray to one value and have a marcher of
+// their own, Engine<Voxel, linearFilter, mode>::renderTile.  With macrocells
+// it skips the cells whose value bounds cannot change the result.
+template <template <typename, bool, int> class Engine, typename Voxel, bool linearFilter>
+inline CpuTileFunc selectProjectionMode(const CpuRenderArgs &args)
+{
+    switch (args.mode)
+    {
+        case RENDER_MINIP:
+            return Engine<Voxel, linearFilter, RENDER_MINIP>::renderTile;
+
+        case RENDER_AVERAGE:
+            return Engine<Voxel, linearFilter, RENDER_AVERAGE>::renderTile;
+
+        default:
+            return Engine<Voxel, linearFilter, RENDER_MIP>::renderTile;
+    }
+}
+
+template <template <typename, bool, int> class Engine, typename Voxel>
+inline CpuTileFunc selectProjectionFilter(const CpuRenderArgs &args)
+{
+    return args.linearFilter ? selectProjectionMode<Engine, Voxel, true>(args) :
+                               selectProjectionMode<Engine, Voxel, false>(args);
+}
+
+template <template <typename, bool, int> class Engine>
+inline CpuTileFunc selectProjection(const CpuRenderArgs &args)
+{
+    switch (args.volume->type)
+    {
+        case CPU_VOXEL_UINT16:
+            return selectProjectionFilter<Engine, ushort>(args);
+
+        case CPU_VOXEL_FLOAT:
+            return selectProjectionFilter<Engine, float>(args);
+
+        case CPU_VOXEL_HALF:
+            return selectProjectionFilter<Engine, CpuHalf>(args);
+
+        default:
+            return selectProjectionFilter<Engine, uchar>(args);
+    }
+}
+
+// depth of pixel i for temporal reprojection, from the opacity weighted
+// sums of t and t^2 along a composited ray: the mean and the standard
+// deviation, or NAN if the ray is too transparent to stand for its colour
+inline void storeRayDepth(const CpuRenderArgs &args, size_t i, float alpha, float tSum, float tSqSum)
+{
+    if (!(alpha >= args.reuseMinAlpha) || alpha <= 0.0f)
+    {
+        args.depth[i] = NAN;
+        return;
+    }
+
+    float mean = tSum / alpha;
+    float variance = tSqSum / alpha - mean*mean;
+
+    args.depth[i] = mean;
+    args.spread[i] = sqrtf(variance > 0.0f ? variance : 0.0f);
+}
+
+// grey level of a projected value, windowed like the transfer function
+inline float projectionGrey(const CpuRenderArgs &args, float value)
+{
+    return clampf((value - args.transferOffset) * args.transferScale, 0.0f, 1.0f) * args.brightness;
+}
+
+// The values the transfer function maps to zero opacity, as intervals of
+// density.  sampleTransfer() blends two neighbouring table entries, so a
+// run of transparent entries makes the values between them transparent,
+// and a run at either end of the table everything beyond it as well.
+struct CpuTransparency
+{
+    int count;
+    float lo[TRANSFER_FUNC_SIZE], hi[TRANSFER_FUNC_SIZE];
+
+    void init(const CpuRenderArgs &args)
+    {
+        count = 0;
+
+        for (int i = 0; i < TRANSFER_FUNC_SIZE; )
+        {
+            int j = i;
+
+            while (j < TRANSFER_FUNC_SIZE && cpuTransferFunc[j].w <= 0.0f)
+            {
+                j++;
+            }
+
+            // a single entry inside the table is only hit exactly
+            if (j > i && (j - i > 1 || i == 0 || j == TRANSFER_FUNC_SIZE))
+            {
+                // entry k sits at transfer coordinate (k + 0.5) / size
+                float c0 = i == 0 ? -INFINITY : (i + 0.5f) / TRANSFER_FUNC_SIZE;
+                float c1 = j == TRANSFER_FUNC_SIZE ? INFINITY : (j - 0.5f) / TRANSFER_FUNC_SIZE;
+                float v0 = c0 / args.transferScale + args.transferOffset;
+                float v1 = c1 / args.transferScale + args.transferOffset;
+                lo[count] = minf(v0, v1);
+                hi[count] = maxf(v0, v1);
+                count++;
+            }
+
+            i = j + 1;
+        }
+    }
+
+    // true if no value in [minValue, maxValue] gets any opacity
+    bool empty(float minValue, float maxValue) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (minValue >= lo[i] && maxValue <= hi[i])
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+// eye ray of pixel (x, y) and where it enters and leaves the volume;
+// false if it misses
+bool pixelRay(const CpuRenderArgs &args, uint x, uint y, CpuRay &eyeRay, float &tnear, float &tfar);
+
+////////////////////////////////////////////////////////////////////////////////
+// brick marcher, shared by the paged, compressed and quantized volumes
+////////////////////////////////////////////////////////////////////////////////
+
+// a volume of size[] voxels cut into bricks[] bricks of 2^shift voxels
+// along each axis, x fastest; a brick is read with the extra layer of
+// voxels its trilinear taps reach past it
+struct CpuBrickGrid
+{
+    int size[3];
+    int bricks[3];
+};
+
+// where a sample at (u, v, w) reads the volume: the brick holding its base
+// voxel and the taps within it, found exactly as sampleVolumeLinear() and
+// sampleVolumeNearest() find them in the whole volume
+struct CpuBrickTap
+{
+    uint brick;
+    int x0, x1, y0, y1, z0, z1;     // in the brick, the extra layer included
+    float ax, ay, az;
+};
+
+template <int shift>
+inline void brickTap(const CpuBrickGrid &grid, float u, float v, float w, bool linearFilter, CpuBrickTap &tap)
+{
+    const float uvw[3] = { u, v, w };
+    int c0[3], c1[3], b[3];
+    float a[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (linearFilter)
+        {
+            float x = uvw[i] * grid.size[i] - 0.5f;
+            float fx = floorf(x);
+            a[i] = x - fx;
+            c0[i] = clampi((int)fx, 0, grid.size[i] - 1);
+            c1[i] = clampi((int)fx + 1, 0, grid.size[i] - 1);
+        }
+        else
+        {
+            a[i] = 0.0f;
+            c0[i] = c1[i] = clampi((int)floorf(uvw[i] * grid.size[i]), 0, grid.size[i] - 1);
+        }
+
+        b[i] = c0[i] >> shift;
+    }
+
+    tap.brick = ((uint)b[2] * grid.bricks[1] + b[1]) * grid.bricks[0] + b[0];
+    tap.x0 = c0[0] - (b[0] << shift);
+    tap.x1 = c1[0] - (b[0] << shift);
+    tap.y0 = c0[1] - (b[1] << shift);
+    tap.y1 = c1[1] - (b[1] << shift);
+    tap.z0 = c0[2] - (b[2] << shift);
+    tap.z1 = c1[2] - (b[2] << shift);
+    tap.ax = a[0];
+    tap.ay = a[1];
+    tap.az = a[2];
+}
+
+// where a ray leaves the part of the box whose samples read brick
+template <int shift>
+inline float brickExit(const CpuBrickGrid &grid, const CpuRay &ray, uint brick, bool linearFilter)
+{
+    uint b[3] = { brick % grid.bricks[0], (brick / grid.bricks[0]) % grid.bricks[1],
+                  brick / ((uint)grid.bricks[0] * grid.bricks[1]) };
+    float lo[3], hi[3];
+
+    // a linear sample's base voxel is half a voxel behind it
+    float offset = linearFilter ? 0.5f : 0.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        float size = (float)grid.size[i];
+        lo[i] = b[i] == 0 ? -1.0f : ((b[i] << shift) + offset) / size * 2.0f - 1.0f;
+        hi[i] = b[i] + 1 == (uint)grid.bricks[i] ? 1.0f : (((b[i] + 1) << shift) + offset) / size * 2.0f - 1.0f;
+    }
+
+    float tEnter, tExit;
+    intersectBoxCpu(ray, make_vec3(lo[0], lo[1], lo[2]), make_vec3(hi[0], hi[1], hi[2]), &tEnter, &tExit);
+    return tExit;
+}
+
+// March one eye ray like renderPixel() (projectPixel() for the other
+// modes): sample i at tnear + i*tstep, up to the same number of steps.
+// Whenever the samples move into another brick, that brick is judged by
+// its range, and either read or passed up to the first sample beyond it.
+// A coarse pass steps args.stepScale times further, with the opacity
+// corrected for it.
+//
+// Source is what the bricks come from:
+//   grid, Source::shift     the bricks, see CpuBrickGrid
+//   scale, rawMin, rawMax   voxelTypeScale() and the range of the values
+//   range(brick, lo, hi)    the smallest and largest value the samples
+//                           in a brick read
+//   acquire(brick, data)    makes a brick readable through a Source::Brick
+//   release(data)           and lets it go again
+//   sample(data, tap, linearFilter)
+//                           the value at a tap, not yet scaled
+// The values are voxelValue()s, or what the source holds in their place.
+template <int mode, typename Source>
+inline void renderBrickPixel(const CpuRenderArgs &args, const Source &source, const CpuTransparency &transparent,
+                             uint x, uint y, CpuFrameStats &stats)
+{
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    const float scale = source.scale;
+    const float valueMin = source.rawMin * scale;
+    const float valueMax = source.rawMax * scale;
+    const float tstep = cpuTstep * args.stepScale;
+    const int maxSteps = (cpuMaxSteps + args.stepScale - 1) / args.stepScale;
+    const bool trackDepth = args.depth != 0;
+
+    vec4 sum = make_vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    float tSum = 0.0f, tSqSum = 0.0f;
+    float result = mode == RENDER_MIP ? -INFINITY : mode == RENDER_MINIP ? INFINITY : 0.0f;
+    float tResult = NAN;
+    float weight = 0.0f;
+    int samples = 0;
+
+    uint brick = 0xffffffffu;
+    typename Source::Brick data;
+    bool held = false;
+
+    for (int i = 0; i < maxSteps; i++)
+    {
+        float t = tnear + i*tstep;
+
+        if (i > 0 && t > tfar) break;
+
+        vec3 pos = eyeRay.o + eyeRay.d*t;
+        CpuBrickTap tap;
+        brickTap<Source::shift>(source.grid, pos.x*0.5f+0.5f, pos.y*0.5f+0.5f, pos.z*0.5f+0.5f,
+                                args.linearFilter, tap);
+
+        if (tap.brick != brick)
+        {
+            if (held)
+            {
+                source.release(data);
+                held = false;
+            }
+
+            brick = tap.brick;
+
+            float lo, hi;
+            source.range(brick, lo, hi);
+            lo *= scale;
+            hi *= scale;
+
+            if (mode == RENDER_COMPOSITE ? transparent.empty(lo, hi) :
+                mode == RENDER_MIP ? hi <= result :
+                mode == RENDER_MINIP ? lo >= result : false)
+            {
+                // samples left in the brick read nothing; a sample that
+                // rounding still puts in it finds it not held
+                int next = (int)ceilf((brickExit<Source::shift>(source.grid, eyeRay, brick, args.linearFilter) -
+                                       tnear) / tstep);
+                i = next - 1 > i ? next - 1 : i;
+                continue;
+            }
+
+            source.acquire(brick, data);
+            held = true;
+        }
+
+        if (!held) continue;
+
+        float sample = source.sample(data, tap, args.linearFilter) * scale;
+        samples++;
+
+        if (mode == RENDER_MIP)
+        {
+            tResult = sample > result ? t : tResult;
+            result = fmaxf(result, sample);
+
+            if (result >= valueMax) break;
+        }
+        else if (mode == RENDER_MINIP)
+        {
+            tResult = sample < result ? t : tResult;
+            result = fminf(result, sample);
+
+            if (result <= valueMin) break;
+        }
+        else if (mode == RENDER_AVERAGE)
+        {
+            result += sample;
+            weight += 1.0f;
+        }
+        else
+        {
+            vec4 col = sampleTransfer((sample - args.transferOffset) * args.transferScale);
+            col.w *= args.density;
+
+            if (args.stepScale > 1)
+            {
+                col.w = 1.0f - powf(1.0f - clampf(col.w, 0.0f, 1.0f), (float)args.stepScale);
+            }
+
+            // pre-multiply alpha
+            col.x *= col.w;
+            col.y *= col.w;
+            col.z *= col.w;
+            // "over" operator for front-to-back blending
+            float a = 1.0f - sum.w;
+            sum.x += col.x*a;
+            sum.y += col.y*a;
+            sum.z += col.z*a;
+            sum.w += col.w*a;
+
+            if (trackDepth)
+            {
+                tSum += t*col.w*a;
+                tSqSum += t*t*col.w*a;
+            }
+
+            // exit early if opaque
+            if (sum.w > cpuOpacityThreshold) break;
+        }
+    }
+
+    if (held)
+    {
+        source.release(data);
+    }
+
+    if (mode == RENDER_COMPOSITE)
+    {
+        if (trackDepth)
+        {
+            storeRayDepth(args, y*args.imageW + x, sum.w, tSum, tSqSum);
+        }
+
+        sum.x *= args.brightness;
+        sum.y *= args.brightness;
+        sum.z *= args.brightness;
+        sum.w *= args.brightness;
+
+        args.output[y*args.imageW + x] = rgbaFloatToIntCpu(sum);
+    }
+    else
+    {
+        if (mode == RENDER_AVERAGE)
+        {
+            result = weight > 0.0f ? result / weight : 0.0f;
+        }
+
+        if (args.depth)
+        {
+            args.depth[y*args.imageW + x] = tResult;
+            args.spread[y*args.imageW + x] = 0.0f;
+        }
+
+        float grey = projectionGrey(args, result);
+        args.output[y*args.imageW + x] = rgbaFloatToIntCpu(make_vec4(grey, grey, grey, grey));
+    }
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+template <int mode, typename Source>
+inline void renderBrickTileMode(const CpuRenderArgs &args, const Source &source, uint x0, uint y0, uint x1, uint y1,
+                                CpuFrameStats &stats)
+{
+    CpuTransparency transparent;
+    transparent.init(args);
+
+    for (uint y = y0; y < y1; y += args.pixelStride)
+    {
+        if (!args.pixelMask)
+        {
+            memset(&args.output[y*args.imageW + x0], 0, (x1 - x0)*sizeof(uint));
+        }
+
+        for (uint x = x0; x < x1; x += args.pixelStride)
+        {
+            if (args.pixelMask && !args.pixelMask[y*args.imageW + x]) continue;
+
+            renderBrickPixel<mode>(args, source, transparent, x, y, stats);
+        }
+    }
+}
+
+// renders a tile of a bricked source, one ray at a time
+template <typename Source>
+inline void renderBrickTile(const CpuRenderArgs &args, const Source &source, uint x0, uint y0, uint x1, uint y1,
+                            CpuFrameStats &stats)
+{
+    switch (args.mode)
+    {
+        case RENDER_MIP:
+            renderBrickTileMode<RENDER_MIP>(args, source, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_MINIP:
+            renderBrickTileMode<RENDER_MINIP>(args, source, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_AVERAGE:
+            renderBrickTileMode<RENDER_AVERAGE>(args, source, x0, y0, x1, y1, stats);
+            break;
+
+        default:
+            renderBrickTileMode<RENDER_COMPOSITE>(args, source, x0, y0, x1, y1, stats);
+            break;
+    }
+}
+
+void renderTileScalar(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// args.octree one ray at a time (volumeRender_cpu_octree.cpp)
+void renderTileOctree(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// args.amr one ray at a time (volumeRender_cpu_amr.cpp)
+void renderTileAmr(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// args.paged one ray at a time (volumeRender_cpu_paged.cpp)
+void renderTilePaged(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// args.compressed one ray at a time (volumeRender_cpu_compressed.cpp)
+void renderTileCompressed(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// args.quantized one ray at a time (volumeRender_cpu_quantized.cpp)
+void renderTileQuantized(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+// asks the system to read ahead the bricks of args.paged that the view
+// reaches first, as far as the cache holds them
+void prefetchPagedVolume(const CpuRenderArgs &args);
+
+// ray packet versions in volumeRender_cpu_simd.cpp, built once per instruction
+// set; only call them after checking cpuSupportsAvx2() / cpuSupportsAvx512()
+void renderTileAvx2(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+void renderTileAvx512(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats);
+
+bool cpuSupportsAvx2();
+bool cpuSupportsAvx512();
+
+////////////////////////////////////////////////////////////////////////////////
+// temporal reprojection (volumeRender_cpu_reproject.cpp)
+////////////////////////////////////////////////////////////////////////////////
+
+// The last full frame and the view it was rendered from.  Each pixel keeps
+// the world position of its representative point (x is NAN where there is
+// none), the spread of its opacity around that point along the ray, the
+// parallax error gathered while it was carried over and for how many
+// frames it was.  The warp fills the output and the next* buffers of a new
+// frame and marks the pixels left to march in holes, which the marchers
+// take as their pixelMask, writing depth and nextSpread.
+struct CpuReprojection
+{
+    uint imageW, imageH;
+    uint *color;
+    vec3 *point, *nextPoint;
+    float *spread, *nextSpread;
+    float *drift, *nextDrift;       // in pixels
+    uchar *age, *nextAge;
+    float *depth;                   // distance from the new eye
+    unsigned long long *winner;     // point that landed on each pixel, see warpReprojection()
+    uchar *holes;
+    float invViewMatrix[12];
+    unsigned long long key;         // hash of the settings the frame was rendered with
+    bool valid;
+};
+
+void freeReprojection(CpuReprojection &rp);
+
+// sets up output, rp.holes and the buffers of the new frame for the view
+// invViewMatrix, rendered in mode, and returns the number of pixels carried
+// over; everything is a hole if the cache cannot be used for this frame.  Holes come in
+// whole blockSize^2 blocks, the pixels a ray packet covers, since the
+// packet costs as much for one of them as for all.
+unsigned long long warpReprojection(CpuReprojection &rp, const CpuReprojectionParams &params,
+                                    unsigned long long key, RenderMode mode, const float *invViewMatrix,
+                                    uint *output, uint imageW, uint imageH, uint blockSize);
+
+// keeps the frame in output, whose holes have been marched, as the source
+// of the next warp
+void storeReprojection(CpuReprojection &rp, const CpuReprojectionParams &params,
+                       const float *invViewMatrix, const uint *output);
+
+////////////////////////////////////////////////////////////////////////////////
+// worker pool
+////////////////////////////////////////////////////////////////////////////////
+
+// runs fn(0) ... fn(count-1) across the worker pool and returns once all
+// items are done; the calling thread takes part.  Nested calls run serially.
+void cpuParallelFor(int count, const std::function<void(int)> &fn);
+
+#endif // #ifndef _VOLUMERENDER_CPU_INTERNAL_H_
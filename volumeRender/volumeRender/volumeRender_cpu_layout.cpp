@@ -0,0 +1,745 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Volume storage layouts for the CPU backend
+//
+// Raw volume files hold the volume x fastest.  A ray that is not
+// aligned with x then touches a new cache line, and for large volumes a new
+// page, on almost every tap.  The bricked layout keeps each 16^3 block of
+// voxels in one contiguous 4.9 KB run, so neighbouring rays of a tile keep
+// reusing the same few bricks.  The Morton (Z-order) layout gets a similar
+// locality at every scale at once, at the price of a bit interleave per
+// address and of padding each axis to a power of two.
+//
+// The conversions only move voxels around, so they are instantiated per
+// voxel size rather than per voxel type.
+//
+// A volume can also come straight from its file (mapVolumeFile()): the
+// linear layout then renders from the mapping, and the others are
+// converted from it, so there is never a second full-size copy in memory.
+// A .bvol file (volumeRender_volume.h) holds the volume already in its
+// layout, with its value range, and is rendered from its mapping whatever
+// the layout.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+#include "volumeRender_volume.h"
+
+// Converting a mapped file, the pages of the slices before z are let go
+// once the conversion is past them, so that the file is not held in memory
+// next to the volume; they are read again should anything need them.  Only
+// whole pages of the file go, never the copy of its last partial page.
+static void releaseSlices(const void *src, const CpuVolume &vol, int z, bool mapped, size_t &released)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    z = z < vol.depth ? z : vol.depth;
+    size_t end = (size_t)z * vol.width * vol.height * vol.voxelSize / page * page;
+
+    if (mapped && end > released)
+    {
+        madvise((uchar *)src + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+}
+
+// one layer of bricks at a time, front to back through the source
+template <typename Word>
+static void convertToBricked(const Word *src, Word *dst, const CpuVolume &vol, bool mapped)
+{
+    int layerBricks = vol.bricksX * vol.bricksY;
+    size_t released = 0;
+
+    for (int bz = 0; bz < vol.bricksZ; bz++)
+    {
+        cpuParallelFor(layerBricks, [&](int i)
+        {
+            int bx = i % vol.bricksX;
+            int by = i / vol.bricksX;
+            size_t brick = (size_t)bz * layerBricks + i;
+            Word *out = dst + brick * BRICK_VOXELS;
+
+            for (int lz = 0; lz < BRICK_PITCH; lz++)
+            {
+                int z = clampi(bz * BRICK_SIZE + lz, 0, vol.depth - 1);
+
+                for (int ly = 0; ly < BRICK_PITCH; ly++)
+                {
+                    int y = clampi(by * BRICK_SIZE + ly, 0, vol.height - 1);
+                    const Word *row = src + ((size_t)z * vol.height + y) * vol.width;
+                    Word *o = out + (lz * BRICK_PITCH + ly) * BRICK_PITCH;
+                    int x0 = bx * BRICK_SIZE;
+
+                    if (x0 + BRICK_PITCH <= vol.width)
+                    {
+                        memcpy(o, row + x0, BRICK_PITCH * sizeof(Word));
+                    }
+                    else
+                    {
+                        for (int lx = 0; lx < BRICK_PITCH; lx++)
+                        {
+                            o[lx] = row[clampi(x0 + lx, 0, vol.width - 1)];
+                        }
+                    }
+                }
+            }
+        });
+
+        // the next layer starts at its first slice
+        releaseSlices(src, vol, (bz + 1) * BRICK_SIZE, mapped, released);
+    }
+}
+
+// bits needed for coordinates 0 ... n-1
+static int coordinateBits(int n)
+{
+    int bits = 0;
+
+    while ((1 << bits) < n)
+    {
+        bits++;
+    }
+
+    return bits;
+}
+
+// software pdep, only used to fill the tables
+static unsigned long long depositBits(unsigned long long v, unsigned long long mask)
+{
+    unsigned long long r = 0;
+
+    for (unsigned long long bit = 1; mask; bit <<= 1)
+    {
+        unsigned long long lowest = mask & (~mask + 1);
+
+        if (v & bit)
+        {
+            r |= lowest;
+        }
+
+        mask &= mask - 1;
+    }
+
+    return r;
+}
+
+// sets up the masks and tables, returns the number of offset bits
+static int initMorton(CpuVolume &vol)
+{
+    const int size[3] = { vol.width, vol.height, vol.depth };
+    int bits[3], total = 0;
+
+    for (int a = 0; a < 3; a++)
+    {
+        bits[a] = coordinateBits(size[a]);
+        vol.mortonMask[a] = 0;
+    }
+
+    // round robin over the axes that still have bits at each level
+    for (int level = 0; level < 32; level++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (level < bits[a])
+            {
+                vol.mortonMask[a] |= 1ull << total++;
+            }
+        }
+    }
+
+    for (int a = 0; a < 3; a++)
+    {
+        uint *table = (uint *)malloc(size[a] * sizeof(uint));
+
+        for (int i = 0; i < size[a]; i++)
+        {
+            table[i] = (uint)depositBits(i, vol.mortonMask[a]);
+        }
+
+        vol.mortonTable[a] = table;
+    }
+
+    return total;
+}
+
+// slices a batch of MORTON_BATCH at a time, front to back through the source
+#define MORTON_BATCH 16
+
+template <typename Word>
+static void convertToMorton(const Word *src, Word *dst, const CpuVolume &vol, bool mapped)
+{
+    size_t released = 0;
+
+    for (int z0 = 0; z0 < vol.depth; z0 += MORTON_BATCH)
+    {
+        int slices = z0 + MORTON_BATCH < vol.depth ? MORTON_BATCH : vol.depth - z0;
+
+        // every row lands on its own set of offsets
+        cpuParallelFor(slices * vol.height, [&](int i)
+        {
+            int z = z0 + i / vol.height;
+            int y = i % vol.height;
+            const Word *row = src + ((size_t)z * vol.height + y) * vol.width;
+            uint myz = vol.mortonTable[2][z] | vol.mortonTable[1][y];
+
+            for (int x = 0; x < vol.width; x++)
+            {
+                dst[myz | vol.mortonTable[0][x]] = row[x];
+            }
+        });
+
+        releaseSlices(src, vol, z0 + slices, mapped, released);
+    }
+}
+
+template <typename Word>
+static void convertLayout(const void *src, uchar *dst, const CpuVolume &vol, bool mapped)
+{
+    if (vol.layout == CPU_LAYOUT_BRICKED)
+    {
+        convertToBricked((const Word *)src, (Word *)dst, vol, mapped);
+    }
+    else
+    {
+        convertToMorton((const Word *)src, (Word *)dst, vol, mapped);
+    }
+}
+
+// smallest and largest finite voxelValue(), scanned in count runs of
+// runSize voxels (z slices, or bricks); an infinity would leave no finite
+// scale to bin the macrocell ranges or the preintegration table by
+template <typename Voxel>
+static void findValueRange(const void *src, int count, size_t runSize, CpuVolume &vol)
+{
+    std::vector<float> runMin(count), runMax(count);
+
+    cpuParallelFor(count, [&](int r)
+    {
+        const Voxel *run = (const Voxel *)src + r * runSize;
+        float lo = INFINITY, hi = -INFINITY;
+
+        for (size_t i = 0; i < runSize; i++)
+        {
+            float v = voxelValue(run[i]);
+            // v - v is NaN for infinities and NaNs
+            bool finite = v - v == 0.0f;
+            lo = finite && v < lo ? v : lo;
+            hi = finite && v > hi ? v : hi;
+        }
+
+        runMin[r] = lo;
+        runMax[r] = hi;
+    });
+
+    vol.rawMin = INFINITY;
+    vol.rawMax = -INFINITY;
+
+    for (int r = 0; r < count; r++)
+    {
+        vol.rawMin = fminf(vol.rawMin, runMin[r]);
+        vol.rawMax = fmaxf(vol.rawMax, runMax[r]);
+    }
+
+    // keep the range usable as a divisor, also for a volume without a
+    // finite value
+    if (!(vol.rawMax > vol.rawMin))
+    {
+        vol.rawMin = vol.rawMin <= vol.rawMax ? vol.rawMin : 0.0f;
+        vol.rawMax = vol.rawMin + 1.0f;
+    }
+}
+
+// shape, layout and size of a volume, without its data
+static void setupVolume(int width, int height, int depth, CpuVoxelType type, CpuVolumeLayout layout, CpuVolume &vol)
+{
+    vol.data = 0;
+    vol.mapping = 0;
+    vol.mappingSize = 0;
+    vol.width = width;
+    vol.height = height;
+    vol.depth = depth;
+    vol.type = type;
+    vol.voxelSize = (int)getCpuVoxelSize(type);
+    vol.layout = layout;
+    vol.bricksX = (width  + BRICK_SIZE - 1) / BRICK_SIZE;
+    vol.bricksY = (height + BRICK_SIZE - 1) / BRICK_SIZE;
+    vol.bricksZ = (depth  + BRICK_SIZE - 1) / BRICK_SIZE;
+    vol.mortonTable[0] = vol.mortonTable[1] = vol.mortonTable[2] = 0;
+
+    if (layout == CPU_LAYOUT_MORTON)
+    {
+        int bits = initMorton(vol);
+
+        if (bits > 32)
+        {
+            printf("Volume too large for the Morton layout, using linear\n");
+            freeVolumeLayout(vol);
+            vol.layout = layout = CPU_LAYOUT_LINEAR;
+        }
+        else
+        {
+            vol.size = (size_t)1 << bits;
+        }
+    }
+
+    if (layout == CPU_LAYOUT_BRICKED)
+    {
+        vol.size = (size_t)vol.bricksX * vol.bricksY * vol.bricksZ * BRICK_VOXELS;
+    }
+    else if (layout == CPU_LAYOUT_LINEAR)
+    {
+        vol.size = (size_t)width * height * depth;
+    }
+
+    vol.size *= vol.voxelSize;
+}
+
+// uint8 voxels fill the macrocell bins one to one; wider types often use
+// only part of their range (12 bit scanners, simulation units), so their
+// bins and pre-integration table cover the values actually present.  The
+// linear and bricked layouts hold the voxels of src and nothing else, and
+// are scanned instead, as they are in memory by now; a Morton volume
+// holds padding as well.
+static void findVolumeRange(const void *src, CpuVolume &vol)
+{
+    const void *scan = src;
+    int count = vol.depth;
+    size_t runSize = (size_t)vol.width * vol.height;
+
+    if (vol.layout == CPU_LAYOUT_BRICKED)
+    {
+        scan = vol.data;
+        count = vol.bricksX * vol.bricksY * vol.bricksZ;
+        runSize = BRICK_VOXELS;
+    }
+    else if (vol.layout == CPU_LAYOUT_LINEAR)
+    {
+        scan = vol.data;
+    }
+
+    switch (vol.type)
+    {
+        case CPU_VOXEL_UINT16:
+            findValueRange<ushort>(scan, count, runSize, vol);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            findValueRange<float>(scan, count, runSize, vol);
+            break;
+
+        case CPU_VOXEL_HALF:
+            findValueRange<CpuHalf>(scan, count, runSize, vol);
+            break;
+
+        default:
+            vol.rawMin = 0.0f;
+            vol.rawMax = 255.0f;
+            break;
+    }
+}
+
+// the range given, or else the one found
+static void setVolumeRange(const void *src, const float *valueRange, CpuVolume &vol)
+{
+    if (!valueRange)
+    {
+        findVolumeRange(src, vol);
+        return;
+    }
+
+    vol.rawMin = valueRange[0];
+    vol.rawMax = valueRange[1];
+}
+
+static void convertVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type,
+                          CpuVolumeLayout layout, const float *valueRange, CpuVolume &vol)
+{
+    setupVolume(width, height, depth, type, layout, vol);
+
+    uchar *data = (uchar *)malloc(vol.size + CPU_VOLUME_PADDING);
+    memset(data + vol.size, 0, CPU_VOLUME_PADDING);
+
+    if (vol.layout == CPU_LAYOUT_LINEAR)
+    {
+        memcpy(data, src, vol.size);
+    }
+    else
+    {
+        // the padding past each axis of a Morton volume is never sampled,
+        // clear it anyway
+        if (vol.size != (size_t)width * height * depth * vol.voxelSize)
+        {
+            memset(data, 0, vol.size);
+        }
+
+        switch (vol.voxelSize)
+        {
+            case 1:
+                convertLayout<uchar>(src, data, vol, mapped);
+                break;
+
+            case 2:
+                convertLayout<ushort>(src, data, vol, mapped);
+                break;
+
+            default:
+                convertLayout<uint>(src, data, vol, mapped);
+                break;
+        }
+    }
+
+    vol.data = data;
+    setVolumeRange(src, valueRange, vol);
+}
+
+void createVolumeLayout(const void *src, int width, int height, int depth, CpuVoxelType type,
+                        CpuVolumeLayout layout, CpuVolume &vol)
+{
+    convertVolume(src, false, width, height, depth, type, layout, 0, vol);
+}
+
+void mapVolumeLayout(const void *mapping, size_t mappingSize, int width, int height, int depth,
+                     CpuVoxelType type, CpuVolumeLayout layout, const float *valueRange, CpuVolume &vol)
+{
+    if (layout != CPU_LAYOUT_LINEAR)
+    {
+        convertVolume(mapping, true, width, height, depth, type, layout, valueRange, vol);
+        return;
+    }
+
+    setupVolume(width, height, depth, type, CPU_LAYOUT_LINEAR, vol);
+    vol.data = (const uchar *)mapping;
+    vol.mapping = mapping;
+    vol.mappingSize = mappingSize;
+    setVolumeRange(mapping, valueRange, vol);
+}
+
+const void *mapVolumeFile(const char *path, size_t bytes, bool sequential, size_t &mappingSize)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("Error opening file '%s'\n", path);
+
+        if (fd >= 0) close(fd);
+
+        return 0;
+    }
+
+    if ((unsigned long long)st.st_size < bytes)
+    {
+        printf("Error reading '%s': %llu bytes, the volume needs %llu\n", path,
+               (unsigned long long)st.st_size, (unsigned long long)bytes);
+        close(fd);
+        return 0;
+    }
+
+    // The whole pages of the volume are mapped from the file over anonymous
+    // memory, whose zeros then make the padding; the last partial page is
+    // read into it, so that nothing past the volume in the file shows there
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t filePages = bytes / page * page;
+    mappingSize = (bytes + CPU_VOLUME_PADDING + page - 1) / page * page;
+
+    uchar *mapping = (uchar *)mmap(0, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = mapping != MAP_FAILED;
+
+    if (ok && filePages > 0)
+    {
+        ok = mmap(mapping, filePages, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+    }
+
+    if (ok && bytes > filePages)
+    {
+        ok = pread(fd, mapping + filePages, bytes - filePages, (off_t)filePages) == (ssize_t)(bytes - filePages);
+    }
+
+    close(fd);
+
+    if (!ok)
+    {
+        printf("Error mapping file '%s'\n", path);
+
+        if (mapping != MAP_FAILED) munmap(mapping, mappingSize);
+
+        return 0;
+    }
+
+    // a conversion reads the file through once and may drop the pages
+    // behind it; a volume rendered in place wants all of it
+    madvise(mapping, filePages, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+
+    return mapping;
+}
+
+void unmapVolumeFile(const void *mapping, size_t mappingSize)
+{
+    munmap((void *)mapping, mappingSize);
+}
+
+// bytes of the payload covered by checksum i
+static size_t checksumBlock(const VolumeFileHeader &h, unsigned int i)
+{
+    unsigned long long first = (unsigned long long)i * h.blockBytes;
+    return (size_t)(h.payloadBytes - first < h.blockBytes ? h.payloadBytes - first : h.blockBytes);
+}
+
+// checks every block of a mapped file in parallel; prints where the first
+// damaged one is, and false, if any is
+static bool verifyVolumeFile(const char *path, const VolumeFileHeader &h, const uchar *file)
+{
+    const unsigned long long *checksums = (const unsigned long long *)(file + h.checksumOffset);
+    const uchar *payload = file + h.payloadOffset;
+    std::vector<uchar> damaged(h.checksumCount);
+
+    cpuParallelFor((int)h.checksumCount, [&](int i)
+    {
+        damaged[i] = volumeFileChecksum(payload + (size_t)i * h.blockBytes, checksumBlock(h, i)) != checksums[i];
+    });
+
+    unsigned int count = 0, first = 0;
+
+    for (unsigned int i = h.checksumCount; i-- > 0; )
+    {
+        count += damaged[i];
+        first = damaged[i] ? i : first;
+    }
+
+    if (count == 0)
+    {
+        return true;
+    }
+
+    printf("'%s' is damaged: %u of %u blocks do not match their checksums, the first at byte %llu of the volume",
+           path, count, h.checksumCount, (unsigned long long)first * h.blockBytes);
+
+    if (h.layout == CPU_LAYOUT_BRICKED && h.blockBytes == (unsigned long long)BRICK_VOXELS * h.voxelSize)
+    {
+        unsigned int bricksX = (h.width + BRICK_SIZE - 1) / BRICK_SIZE;
+        unsigned int bricksY = (h.height + BRICK_SIZE - 1) / BRICK_SIZE;
+        printf(", brick (%u, %u, %u)", first % bricksX, first / bricksX % bricksY, first / bricksX / bricksY);
+    }
+
+    printf("\n");
+
+    return false;
+}
+
+bool loadVolumeFile(const char *path, bool verify, CpuVolume &vol, float *spacing)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    VolumeFileHeader h;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+    {
+        printf("Error opening file '%s'\n", path);
+
+        if (fd >= 0) close(fd);
+
+        return false;
+    }
+
+    if (!volumeFileHeaderValid(h, (unsigned long long)st.st_size))
+    {
+        printf("Error reading '%s': not a volume file, or cut short\n", path);
+        close(fd);
+        return false;
+    }
+
+    // the payload has to be laid out as this build would lay it out
+    setupVolume((int)h.width, (int)h.height, (int)h.depth, (CpuVoxelType)h.voxelType, (CpuVolumeLayout)h.layout, vol);
+
+    if (vol.layout != (CpuVolumeLayout)h.layout || vol.size != h.payloadBytes ||
+        h.brickSize != (h.layout == CPU_LAYOUT_BRICKED ? BRICK_SIZE : 0u))
+    {
+        printf("Error reading '%s': its layout does not match this build's\n", path);
+        freeVolumeLayout(vol);
+        close(fd);
+        return false;
+    }
+
+    size_t mappingSize = (size_t)st.st_size;
+    void *mapping = mmap(0, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        printf("Error mapping file '%s'\n", path);
+        freeVolumeLayout(vol);
+        return false;
+    }
+
+    const uchar *file = (const uchar *)mapping;
+
+    if (verify && !verifyVolumeFile(path, h, file))
+    {
+        munmap(mapping, mappingSize);
+        freeVolumeLayout(vol);
+        return false;
+    }
+
+    // the checksums are not needed to render, the voxels soon will be
+    madvise((uchar *)mapping + h.payloadOffset, (size_t)h.payloadBytes, MADV_WILLNEED);
+
+    vol.data = file + h.payloadOffset;
+    vol.mapping = mapping;
+    vol.mappingSize = mappingSize;
+    vol.rawMin = h.rawMin;
+    vol.rawMax = h.rawMax;
+
+    for (int a = 0; a < 3; a++)
+    {
+        spacing[a] = h.spacing[a];
+    }
+
+    return true;
+}
+
+bool writeVolumeFile(const char *path, const CpuVolume &vol, const float *spacing)
+{
+    VolumeFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, volumeFileMagic, sizeof(h.magic));
+    h.version = VOLUME_FILE_VERSION;
+    h.width = vol.width;
+    h.height = vol.height;
+    h.depth = vol.depth;
+    h.voxelType = vol.type;
+    h.voxelSize = vol.voxelSize;
+    h.layout = vol.layout;
+    h.brickSize = vol.layout == CPU_LAYOUT_BRICKED ? BRICK_SIZE : 0;
+    h.rawMin = vol.rawMin;
+    h.rawMax = vol.rawMax;
+    h.payloadBytes = vol.size;
+    h.blockBytes = vol.layout == CPU_LAYOUT_BRICKED ? (unsigned long long)BRICK_VOXELS * vol.voxelSize : VOLUME_FILE_BLOCK;
+
+    for (int a = 0; a < 3; a++)
+    {
+        h.spacing[a] = spacing ? spacing[a] : 1.0f;
+    }
+
+    volumeFileOffsets(h);
+
+    std::vector<unsigned long long> checksums(h.checksumCount);
+
+    cpuParallelFor((int)h.checksumCount, [&](int i)
+    {
+        checksums[i] = volumeFileChecksum(vol.data + (size_t)i * h.blockBytes, checksumBlock(h, i));
+    });
+
+    // written next to the file and renamed once complete, as the pyramid
+    // cache is
+    static const uchar zeros[VOLUME_FILE_ALIGN] = { 0 };
+    size_t gap = (size_t)(h.payloadOffset - h.checksumOffset) - checksums.size() * sizeof(checksums[0]);
+    std::string partPath = std::string(path) + ".part";
+    FILE *fp = fopen(partPath.c_str(), "wb");
+
+    bool ok = fp && fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              fwrite(&checksums[0], sizeof(checksums[0]), checksums.size(), fp) == checksums.size() &&
+              fwrite(zeros, 1, gap, fp) == gap &&
+              fwrite(vol.data, 1, vol.size, fp) == vol.size &&
+              fwrite(zeros, 1, VOLUME_FILE_TAIL, fp) == VOLUME_FILE_TAIL;
+
+    if (fp)
+    {
+        ok = fclose(fp) == 0 && ok;
+    }
+
+    if (!ok || rename(partPath.c_str(), path))
+    {
+        printf("Error writing file '%s'\n", path);
+        remove(partPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Word>
+static void copyToLinear(const CpuVolume &vol, Word *dst)
+{
+    const Word *src = (const Word *)vol.data;
+
+    cpuParallelFor(vol.height * vol.depth, [&](int row)
+    {
+        int y = row % vol.height;
+        int z = row / vol.height;
+        Word *out = dst + (size_t)row * vol.width;
+
+        for (int x = 0; x < vol.width; x++)
+        {
+            out[x] = src[voxelOffset(vol, x, y, z)];
+        }
+    });
+}
+
+void *linearVolumeCopy(const CpuVolume &vol)
+{
+    size_t bytes = (size_t)vol.width * vol.height * vol.depth * vol.voxelSize;
+    void *dst = malloc(bytes);
+
+    if (vol.layout == CPU_LAYOUT_LINEAR)
+    {
+        memcpy(dst, vol.data, bytes);
+        return dst;
+    }
+
+    switch (vol.voxelSize)
+    {
+        case 1:
+            copyToLinear(vol, (uchar *)dst);
+            break;
+
+        case 2:
+            copyToLinear(vol, (ushort *)dst);
+            break;
+
+        default:
+            copyToLinear(vol, (uint *)dst);
+            break;
+    }
+
+    return dst;
+}
+
+void freeVolumeLayout(CpuVolume &vol)
+{
+    if (vol.mapping)
+    {
+        unmapVolumeFile(vol.mapping, vol.mappingSize);
+    }
+    else
+    {
+        free((void *)vol.data);
+    }
+
+    vol.data = 0;
+    vol.mapping = 0;
+    vol.mappingSize = 0;
+
+    for (int a = 0; a < 3; a++)
+    {
+        free((void *)vol.mortonTable[a]);
+        vol.mortonTable[a] = 0;
+    }
+}
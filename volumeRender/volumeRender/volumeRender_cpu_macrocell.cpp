@@ -0,0 +1,284 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Macrocell grid for empty space skipping in the CPU backend
+//
+// The volume is covered by MACROCELL_SIZE^3 voxel cells holding the min and
+// max voxel value of the cell plus a one voxel apron.  A ray walks from cell
+// to cell (see CpuCellWalker) and jumps over every cell whose value range
+// maps to zero opacity under the current transfer function.  Skipped samples
+// would have added nothing to the "over" blend, so the image is unchanged.
+//
+// The same (min, max) tables also drive adaptive marching: where the opacity
+// can only vary a little inside a cell the ray may take longer steps there,
+// trading a bounded amount of opacity error for fewer samples.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "volumeRender_cpu_internal.h"
+
+// bins of the value range [vmin, vmax] of cell i
+static void storeCellRange(const CpuVolume &vol, CpuMacrocells &cells, size_t i, float vmin, float vmax)
+{
+    float binScale = 255.0f / (vol.rawMax - vol.rawMin);
+
+    // a cell of NaNs only is left visible
+    if (!(vmin <= vmax))
+    {
+        vmin = vol.rawMin;
+        vmax = vol.rawMax;
+    }
+
+    // the range holds finite values only; infinities take its end bins
+    vmin = clampf(vmin, vol.rawMin, vol.rawMax);
+    vmax = clampf(vmax, vol.rawMin, vol.rawMax);
+
+    uchar *mm = &cells.minMax[2 * i];
+    mm[0] = (uchar)clampi((int)floorf((vmin - vol.rawMin) * binScale), 0, 255);
+    mm[1] = (uchar)clampi((int)ceilf((vmax - vol.rawMin) * binScale), 0, 255);
+}
+
+// min and max bin of every cell
+template <typename Voxel>
+static void findCellRanges(const CpuVolume &vol, CpuMacrocells &cells)
+{
+    const Voxel *data = (const Voxel *)vol.data;
+
+    cpuParallelFor(cells.cellsY * cells.cellsZ, [&](int row)
+    {
+        int cy = row % cells.cellsY;
+        int cz = row / cells.cellsY;
+
+        int y0 = clampi(cy * MACROCELL_SIZE - 1, 0, vol.height - 1);
+        int y1 = clampi((cy + 1) * MACROCELL_SIZE, 0, vol.height - 1);
+        int z0 = clampi(cz * MACROCELL_SIZE - 1, 0, vol.depth - 1);
+        int z1 = clampi((cz + 1) * MACROCELL_SIZE, 0, vol.depth - 1);
+
+        for (int cx = 0; cx < cells.cellsX; cx++)
+        {
+            int x0 = clampi(cx * MACROCELL_SIZE - 1, 0, vol.width - 1);
+            int x1 = clampi((cx + 1) * MACROCELL_SIZE, 0, vol.width - 1);
+            float vmin = INFINITY, vmax = -INFINITY;
+
+            for (int z = z0; z <= z1; z++)
+            {
+                for (int y = y0; y <= y1; y++)
+                {
+                    // comparisons pass over NaNs like fminf() and fmaxf(),
+                    // and let a linear row vectorize
+                    if (vol.layout == CPU_LAYOUT_LINEAR)
+                    {
+                        const Voxel *row = data + voxelOffset(vol, 0, y, z);
+
+                        for (int x = x0; x <= x1; x++)
+                        {
+                            float v = voxelValue(row[x]);
+                            vmin = v < vmin ? v : vmin;
+                            vmax = v > vmax ? v : vmax;
+                        }
+
+                        continue;
+                    }
+
+                    for (int x = x0; x <= x1; x++)
+                    {
+                        float v = voxelValue(data[voxelOffset(vol, x, y, z)]);
+                        vmin = v < vmin ? v : vmin;
+                        vmax = v > vmax ? v : vmax;
+                    }
+                }
+            }
+
+            storeCellRange(vol, cells, ((size_t)cz * cells.cellsY + cy) * cells.cellsX + cx, vmin, vmax);
+        }
+    });
+}
+
+// the grid and its tables, with no cell ranges yet
+static void setupMacrocells(const CpuVolume &vol, CpuMacrocells &cells)
+{
+    cells.cellsX = (vol.width  + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+    cells.cellsY = (vol.height + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+    cells.cellsZ = (vol.depth  + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+
+    // world space [-1, 1] covers the whole volume
+    cells.scaleX = vol.width  / (2.0f * MACROCELL_SIZE);
+    cells.scaleY = vol.height / (2.0f * MACROCELL_SIZE);
+    cells.scaleZ = vol.depth  / (2.0f * MACROCELL_SIZE);
+
+    size_t numCells = (size_t)cells.cellsX * cells.cellsY * cells.cellsZ;
+    // padded so the packet marcher can gather 32 bits at any entry
+    cells.minMax = (uchar *)calloc(numCells * 2 + 4, 1);
+    cells.visible = (uchar *)calloc(256 * 256 + 4, 1);
+    cells.stepScale = (uchar *)calloc(256 * 256 + 4, 1);
+    cells.alphaRange = (float *)calloc(256 * 256, sizeof(float));
+
+    // force a summary rebuild on the first frame
+    cells.summaryOffset = cells.summaryScale = NAN;
+    cells.summaryDensity = cells.summaryQuality = NAN;
+
+    float scale = voxelTypeScale(vol.type);
+    cells.sampleMin = vol.rawMin * scale;
+    cells.sampleMax = vol.rawMax * scale;
+    cells.binStep = (cells.sampleMax - cells.sampleMin) / 255.0f;
+    cells.binMargin = 0.01f * cells.binStep;
+}
+
+void buildMacrocells(const CpuVolume &vol, CpuMacrocells &cells)
+{
+    setupMacrocells(vol, cells);
+
+    switch (vol.type)
+    {
+        case CPU_VOXEL_UINT16:
+            findCellRanges<ushort>(vol, cells);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            findCellRanges<float>(vol, cells);
+            break;
+
+        case CPU_VOXEL_HALF:
+            findCellRanges<CpuHalf>(vol, cells);
+            break;
+
+        default:
+            findCellRanges<uchar>(vol, cells);
+            break;
+    }
+}
+
+void buildMacrocellsFromRanges(const CpuVolume &vol, const float *cellRanges, CpuMacrocells &cells)
+{
+    setupMacrocells(vol, cells);
+
+    size_t numCells = (size_t)cells.cellsX * cells.cellsY * cells.cellsZ;
+
+    for (size_t i = 0; i < numCells; i++)
+    {
+        storeCellRange(vol, cells, i, cellRanges[2 * i], cellRanges[2 * i + 1]);
+    }
+}
+
+void freeMacrocells(CpuMacrocells &cells)
+{
+    free(cells.minMax);
+    free(cells.visible);
+    free(cells.stepScale);
+    free(cells.alphaRange);
+    cells.minMax = 0;
+    cells.visible = 0;
+    cells.stepScale = 0;
+    cells.alphaRange = 0;
+}
+
+// opacity of the linearly filtered transfer function at texel coordinate x
+static float transferAlphaAt(float x)
+{
+    float fx = floorf(x);
+    float a = x - fx;
+    int i = (int)fx;
+    float a0 = cpuTransferFunc[clampi(i, 0, TRANSFER_FUNC_SIZE - 1)].w;
+    float a1 = cpuTransferFunc[clampi(i + 1, 0, TRANSFER_FUNC_SIZE - 1)].w;
+
+    return a0 + a * (a1 - a0);
+}
+
+// smallest and largest opacity sampleTransfer() returns for any c in
+// [c0, c1]; the function is piecewise linear, so only the ends and the knots
+// in between need checking
+static void transferAlphaRange(float c0, float c1, float &minA, float &maxA)
+{
+    if (c0 > c1)
+    {
+        float t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    float x0 = clampf(c0 * TRANSFER_FUNC_SIZE - 0.5f, -1.0f, (float)TRANSFER_FUNC_SIZE);
+    float x1 = clampf(c1 * TRANSFER_FUNC_SIZE - 0.5f, -1.0f, (float)TRANSFER_FUNC_SIZE);
+    float a0 = transferAlphaAt(x0);
+    float a1 = transferAlphaAt(x1);
+    minA = fminf(a0, a1);
+    maxA = fmaxf(a0, a1);
+    int k0 = clampi((int)ceilf(x0), 0, TRANSFER_FUNC_SIZE - 1);
+    int k1 = clampi((int)floorf(x1), 0, TRANSFER_FUNC_SIZE - 1);
+
+    for (int k = k0; k <= k1; k++)
+    {
+        minA = fminf(minA, cpuTransferFunc[k].w);
+        maxA = fmaxf(maxA, cpuTransferFunc[k].w);
+    }
+}
+
+void updateMacrocellSummary(CpuMacrocells &cells, float transferOffset, float transferScale,
+                            float density, float quality)
+{
+    if (cells.summaryOffset == transferOffset && cells.summaryScale == transferScale &&
+        cells.summaryDensity == density && cells.summaryQuality == quality)
+    {
+        return;
+    }
+
+    // widen each range a little so rounding in the marcher can never turn a
+    // skipped sample visible
+    const float binRange = cells.sampleMax - cells.sampleMin;
+    const float margin = 0.01f / 255.0f * binRange;
+
+    // a cell allows m times the reference step if the opacity cannot vary
+    // by more than the tolerance over it; quality 1 never lengthens a step
+    int maxScale = clampi((int)(1.0f / quality + 0.5f), 1, MAX_STEP_SCALE);
+    float tolerance = 0.05f * (1.0f / quality - 1.0f);
+
+    cpuParallelFor(256, [&](int vmin)
+    {
+        uchar *row = &cells.visible[vmin * 256];
+        uchar *rowScale = &cells.stepScale[vmin * 256];
+        float *rowRange = &cells.alphaRange[vmin * 256];
+
+        for (int vmax = 0; vmax < 256; vmax++)
+        {
+            if (vmax < vmin)
+            {
+                row[vmax] = 0;
+                rowScale[vmax] = 1;
+                rowRange[vmax] = 0.0f;
+                continue;
+            }
+
+            float s0 = cells.sampleMin + vmin / 255.0f * binRange;
+            float s1 = cells.sampleMin + vmax / 255.0f * binRange;
+            float c0 = (s0 - margin - transferOffset) * transferScale;
+            float c1 = (s1 + margin - transferOffset) * transferScale;
+            float minA, maxA;
+            transferAlphaRange(c0, c1, minA, maxA);
+
+            float range = (maxA - minA) * density;
+            int m = maxScale;
+
+            if (range > 0.0f)
+            {
+                m = clampi((int)fminf(1.0f + tolerance / range, (float)maxScale), 1, maxScale);
+            }
+
+            row[vmax] = maxA > 0.0f;
+            rowScale[vmax] = (uchar)m;
+            rowRange[vmax] = range;
+        }
+    });
+
+    cells.summaryOffset = transferOffset;
+    cells.summaryScale = transferScale;
+    cells.summaryDensity = density;
+    cells.summaryQuality = quality;
+}
@@ -0,0 +1,439 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Octree volumes for the CPU backend
+//
+// An adaptive octree resampled to a dense grid costs the finest cell size
+// everywhere.  Here the rays walk the tree itself (see CpuOctreeWalker)
+// and treat every leaf they pass through as a segment of constant
+// density: compositing integrates it in one step, with the opacity of
+// as many reference steps as fit into the segment, and the projections
+// take its value once (weighted by its length for the mean).  Subtrees
+// that cannot contribute are passed in one jump, found from the value
+// range kept with every node: for compositing those the transfer function
+// gives no opacity anywhere, for maximum (minimum) projections those that
+// cannot beat the running result.  Subtrees of a single value are leaves.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "volumeRender_cpu_internal.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// loading
+////////////////////////////////////////////////////////////////////////////////
+
+static bool octreeError(const char *path, const char *error, CpuOctree &tree)
+{
+    printf("Error reading octree '%s': %s\n", path, error);
+    freeOctree(tree);
+    return false;
+}
+
+// converts the depth first floats of a version 1 file into allocated
+// version 2 arrays
+static const char *convertOctreeV1(const float *values, size_t count, CpuOctree &tree)
+{
+    OctreeLevelBuilder builder;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (builder.complete())
+        {
+            return "nodes past the end of the tree";
+        }
+
+        if (values[i] != values[i] && !octreeIsParent(values[i]))
+        {
+            return "leaf is not a number";
+        }
+
+        if (!builder.add(values[i]))
+        {
+            return "tree too deep";
+        }
+    }
+
+    if (!builder.complete())
+    {
+        return "tree ends early";
+    }
+
+    OctreeFileHeader header;
+    unsigned long long nodeStart[OCTREE_MAX_DEPTH + 1], leafStart[OCTREE_MAX_DEPTH + 1];
+    builder.header(header);
+    builder.levelStarts(nodeStart, leafStart);
+
+    OctreeFileNode *nodes = (OctreeFileNode *)malloc((size_t)header.nodeCount * sizeof(OctreeFileNode));
+    float *leaves = (float *)malloc((size_t)header.leafCount * sizeof(float));
+    tree.nodes = nodes;
+    tree.leaves = leaves;
+
+    if ((!nodes && header.nodeCount) || !leaves)
+    {
+        return "out of memory";
+    }
+
+    for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+    {
+        OctreeFileNode *n = nodes + nodeStart[level];
+        std::copy(builder.nodes[level].begin(), builder.nodes[level].end(), n);
+        OctreeLevelBuilder::relocate(n, builder.nodes[level].size(), level, nodeStart, leafStart);
+        std::copy(builder.leaves[level].begin(), builder.leaves[level].end(), leaves + leafStart[level]);
+    }
+
+    tree.nodeCount = (size_t)header.nodeCount;
+    tree.leafCount = (size_t)header.leafCount;
+    tree.depth = (int)header.depth;
+    return 0;
+}
+
+// Version 2 files are used in place, so loading only checks the header;
+// the pages of the node and leaf arrays are read as rays first reach
+// them, and processes rendering the same file share them.  The walker
+// bounds every index it takes from the nodes, so a damaged file cannot
+// make it read outside the arrays, but one whose nodes share children
+// can make a ray visit far more cells than the tree has; verify reads
+// the whole node array once and rejects such files.
+bool loadOctree(const char *path, bool verify, CpuOctree &tree)
+{
+    memset(&tree, 0, sizeof(tree));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("Error opening file '%s'\n", path);
+
+        if (fd >= 0) close(fd);
+
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *mapping = size > 0 ? mmap(0, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return octreeError(path, size > 0 ? "cannot map the file" : "not a .boc file", tree);
+    }
+
+    tree.mapping = mapping;
+    tree.mappingSize = size;
+
+    const char *bytes = (const char *)mapping;
+    const OctreeFileHeader &header = *(const OctreeFileHeader *)mapping;
+
+    if (size < sizeof(OctreeFileHeaderV1) || memcmp(header.magic, octreeFileMagic, sizeof(header.magic)))
+    {
+        return octreeError(path, "not a .boc file", tree);
+    }
+
+    if (header.version == 1)
+    {
+        const OctreeFileHeaderV1 &v1 = *(const OctreeFileHeaderV1 *)mapping;
+
+        if (v1.nodeCount == 0 || v1.nodeCount > (size - sizeof(v1)) / sizeof(float))
+        {
+            return octreeError(path, "file ends early", tree);
+        }
+
+        const char *error = convertOctreeV1((const float *)(bytes + sizeof(v1)), (size_t)v1.nodeCount, tree);
+
+        // from here on the tree owns allocated arrays, not the file
+        munmap(mapping, size);
+        tree.mapping = 0;
+        tree.mappingSize = 0;
+
+        if (error)
+        {
+            return octreeError(path, error, tree);
+        }
+    }
+    else if (header.version == OCTREE_FILE_VERSION)
+    {
+        if (!octreeHeaderValid(header, size))
+        {
+            return octreeError(path, "bad header", tree);
+        }
+
+        if (verify && !octreeNodesValid(header, (const OctreeFileNode *)(bytes + header.nodeOffset)))
+        {
+            return octreeError(path, "the nodes do not form a tree", tree);
+        }
+
+        tree.nodes = (const OctreeFileNode *)(bytes + header.nodeOffset);
+        tree.leaves = (const float *)(bytes + header.leafOffset);
+        tree.nodeCount = (size_t)header.nodeCount;
+        tree.leafCount = (size_t)header.leafCount;
+        tree.depth = (int)header.depth;
+    }
+    else
+    {
+        return octreeError(path, "unknown version", tree);
+    }
+
+    tree.minValue = tree.nodeCount ? tree.nodes[0].minValue : tree.leaves[0];
+    tree.maxValue = tree.nodeCount ? tree.nodes[0].maxValue : tree.leaves[0];
+    return true;
+}
+
+void freeOctree(CpuOctree &tree)
+{
+    if (tree.mapping)
+    {
+        munmap(tree.mapping, tree.mappingSize);
+    }
+    else
+    {
+        free((void *)tree.nodes);
+        free((void *)tree.leaves);
+    }
+
+    memset(&tree, 0, sizeof(tree));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rendering
+////////////////////////////////////////////////////////////////////////////////
+
+// composite one eye ray through the tree.  A leaf the ray crosses over a
+// length L has the colour of its density and the opacity of L / tstep
+// reference samples; like renderPixel() the ray ends once it is opaque.
+static void compositeOctreePixel(const CpuRenderArgs &args, const CpuTransparency &transparent,
+                                 uint x, uint y, CpuFrameStats &stats)
+{
+    const CpuOctree &tree = *args.octree;
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    vec4 sum = make_vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    const bool trackDepth = args.depth != 0;
+    float tSum = 0.0f, tSqSum = 0.0f;
+    int samples = 0;
+    CpuOctreeWalker walker;
+
+    for (walker.init(tree, eyeRay, tnear); walker.valid(); )
+    {
+        float minValue, maxValue;
+        walker.range(minValue, maxValue);
+
+        if (transparent.empty(minValue, maxValue))
+        {
+            walker.skip();
+            continue;
+        }
+
+        if (minValue != maxValue)
+        {
+            walker.descend();
+            continue;
+        }
+
+        float value = minValue;
+        float t0 = maxf(walker.tEntry, tnear);
+        float t1 = minf(walker.tExit, tfar);
+        walker.skip();
+
+        if (!(t1 > t0)) continue;
+
+        vec4 col = sampleTransfer((value - args.transferOffset) * args.transferScale);
+        float alpha = clampf(col.w * args.density, 0.0f, 1.0f);
+        samples++;
+
+        col.w = 1.0f - powf(1.0f - alpha, (t1 - t0) / cpuTstep);
+        col.x *= col.w;
+        col.y *= col.w;
+        col.z *= col.w;
+
+        float a = 1.0f - sum.w;
+        sum.x += col.x*a;
+        sum.y += col.y*a;
+        sum.z += col.z*a;
+        sum.w += col.w*a;
+
+        if (trackDepth)
+        {
+            float t = 0.5f * (t0 + t1);
+            tSum += t*col.w*a;
+            tSqSum += t*t*col.w*a;
+        }
+
+        if (sum.w > cpuOpacityThreshold) break;
+    }
+
+    if (trackDepth)
+    {
+        storeRayDepth(args, y*args.imageW + x, sum.w, tSum, tSqSum);
+    }
+
+    sum.x *= args.brightness;
+    sum.y *= args.brightness;
+    sum.z *= args.brightness;
+    sum.w *= args.brightness;
+
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(sum);
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+// reduce one eye ray to the largest or smallest leaf it passes through, or
+// to the mean density along it.  A maximum (minimum) skips the subtrees
+// whose range cannot beat it and ends at the largest (smallest) value in
+// the tree; the reprojection depth is where that leaf was entered.
+template <int mode>
+static void projectOctreePixel(const CpuRenderArgs &args, uint x, uint y, CpuFrameStats &stats)
+{
+    const CpuOctree &tree = *args.octree;
+    CpuRay eyeRay;
+    float tnear, tfar;
+
+    if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) return;
+
+    const float valueMin = tree.minValue;
+    const float valueMax = tree.maxValue;
+    float result = mode == RENDER_MIP ? -INFINITY : mode == RENDER_MINIP ? INFINITY : 0.0f;
+    float tResult = NAN;
+    float length = 0.0f;
+    int samples = 0;
+    CpuOctreeWalker walker;
+
+    for (walker.init(tree, eyeRay, tnear); walker.valid(); )
+    {
+        float minValue, maxValue;
+        walker.range(minValue, maxValue);
+
+        if (mode == RENDER_MIP ? maxValue <= result :
+            mode == RENDER_MINIP ? minValue >= result : false)
+        {
+            walker.skip();
+            continue;
+        }
+
+        if (minValue != maxValue)
+        {
+            walker.descend();
+            continue;
+        }
+
+        float value = minValue;
+        float t0 = maxf(walker.tEntry, tnear);
+        float t1 = minf(walker.tExit, tfar);
+        walker.skip();
+
+        if (!(t1 > t0)) continue;
+
+        samples++;
+
+        if (mode == RENDER_MIP)
+        {
+            result = value;
+            tResult = t0;
+
+            if (result >= valueMax) break;
+        }
+        else if (mode == RENDER_MINIP)
+        {
+            result = value;
+            tResult = t0;
+
+            if (result <= valueMin) break;
+        }
+        else
+        {
+            result += value * (t1 - t0);
+            length += t1 - t0;
+        }
+    }
+
+    if (mode == RENDER_AVERAGE)
+    {
+        result = length > 0.0f ? result / length : 0.0f;
+    }
+
+    if (args.depth)
+    {
+        args.depth[y*args.imageW + x] = tResult;
+        args.spread[y*args.imageW + x] = 0.0f;
+    }
+
+    float grey = projectionGrey(args, result);
+    args.output[y*args.imageW + x] = rgbaFloatToIntCpu(make_vec4(grey, grey, grey, grey));
+
+    stats.rays++;
+    stats.samples += samples;
+}
+
+template <int mode>
+struct OctreeEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        CpuTransparency transparent;
+        transparent.init(args);
+
+        for (uint y = y0; y < y1; y += args.pixelStride)
+        {
+            if (!args.pixelMask)
+            {
+                memset(&args.output[y*args.imageW + x0], 0, (x1 - x0)*sizeof(uint));
+            }
+
+            for (uint x = x0; x < x1; x += args.pixelStride)
+            {
+                if (args.pixelMask && !args.pixelMask[y*args.imageW + x]) continue;
+
+                if (mode == RENDER_COMPOSITE)
+                {
+                    compositeOctreePixel(args, transparent, x, y, stats);
+                }
+                else
+                {
+                    projectOctreePixel<mode>(args, x, y, stats);
+                }
+            }
+        }
+    }
+};
+
+void renderTileOctree(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    switch (args.mode)
+    {
+        case RENDER_MIP:
+            OctreeEngine<RENDER_MIP>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_MINIP:
+            OctreeEngine<RENDER_MINIP>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        case RENDER_AVERAGE:
+            OctreeEngine<RENDER_AVERAGE>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+
+        default:
+            OctreeEngine<RENDER_COMPOSITE>::renderTile(args, x0, y0, x1, y1, stats);
+            break;
+    }
+}
@@ -0,0 +1,652 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Out-of-core volumes for the CPU backend
+//
+// initCpu() needs the whole volume in memory.  A .bvb file instead
+// keeps it on disk in bricks (see volumeRender_bricks.h), and rays read
+// the bricks they reach into a cache of a fixed number of slots; when it
+// is full, a brick not used for a while gives way (the clock algorithm,
+// which approximates least recently used order without a shared list to
+// update on every access).  Memory is then the cache, plus a slot index of
+// four bytes per brick and the mapped brick ranges, whatever the size of
+// the volume.
+//
+// Every ray takes the samples the dense renderer takes, in the same order,
+// so it renders the same image; a brick is pinned while a ray samples it.
+// Bricks that cannot contribute are passed without being read: for
+// compositing those the transfer function leaves transparent, for maximum
+// (minimum) projections those that cannot beat the running result.  Before
+// a frame with a new view, a sparse set of rays walks the bricks it will
+// need, and the nearest of those not cached are handed to the system to
+// read ahead, so most reads the rays then make are served from memory.
+//
+// The bricks of a compressed file are decoded by the thread whose ray
+// missed them, straight into the cache slot, so every worker decodes at
+// once; bricks of one value are filled in from the index without reading
+// the file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+// pins of a slot whose brick is being replaced; far enough below zero
+// that the transient pins of threads backing off never reach it
+#define PAGED_EVICTING (INT_MIN / 2)
+#define PAGED_NO_BRICK 0xffffffffu
+
+// one ray in PAGED_PREFETCH_STRIDE^2 pixels walks the bricks for prefetching
+#define PAGED_PREFETCH_STRIDE 16
+
+////////////////////////////////////////////////////////////////////////////////
+// brick cache
+////////////////////////////////////////////////////////////////////////////////
+
+struct CpuBrickSlot
+{
+    std::atomic<int> pins;          // rays sampling the brick, or PAGED_EVICTING and up
+    std::atomic<uint> brick;        // held, or PAGED_NO_BRICK
+    std::atomic<bool> used;         // since the clock hand last passed
+};
+
+struct CpuBrickCache
+{
+    int file;
+    unsigned long long fileSize;
+    size_t brickBytes;
+    unsigned long long brickOffset;
+    const BrickFileEntry *index;    // of a compressed file, else 0
+    size_t rawBytes;                // of a decoded brick, BRICK_FILE_PITCH^3 voxels
+    uint voxelSize;
+    size_t brickCount;
+    size_t slotCount;
+    uchar *data;                    // slotCount * brickBytes
+    CpuBrickSlot *slots;
+    std::atomic<int> *brickSlot;    // per brick, its slot or -1
+    std::mutex missMutex;           // guards the clock hand and changes of brickSlot
+    size_t hand;
+    std::atomic<unsigned long long> bricksRead;
+    std::atomic<unsigned long long> bytesRead;
+    std::atomic<bool> readFailed;
+    float prefetchKey[16];          // view and transfer function of the last prefetch
+};
+
+// a slot to replace, with its pins set to PAGED_EVICTING, or -1 if rays
+// have pinned them all; missMutex held.  Slots in use keep their brick,
+// and a slot used since the hand last passed gets another round.
+static int evictSlot(CpuBrickCache &c)
+{
+    for (size_t n = 0; n < 2 * c.slotCount; n++)
+    {
+        size_t s = c.hand;
+        CpuBrickSlot &slot = c.slots[s];
+        c.hand = c.hand + 1 < c.slotCount ? c.hand + 1 : 0;
+
+        int expected = 0;
+
+        if (slot.pins.load(std::memory_order_relaxed) == 0 && !slot.used.exchange(false, std::memory_order_relaxed) &&
+            slot.pins.compare_exchange_strong(expected, PAGED_EVICTING, std::memory_order_acquire))
+        {
+            return (int)s;
+        }
+    }
+
+    return -1;
+}
+
+// false if the file ends or fails first
+static bool readFile(CpuBrickCache &c, unsigned long long offset, size_t bytes, uchar *dst)
+{
+    size_t done = 0;
+
+    while (done < bytes)
+    {
+        ssize_t n = pread(c.file, dst + done, bytes - done, (off_t)(offset + done));
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        done += (size_t)n;
+    }
+
+    c.bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+    return true;
+}
+
+// a brick that cannot be read or decoded is left zero
+static void readBrick(CpuBrickCache &c, uint brick, uchar *dst)
+{
+    bool ok;
+
+    if (!c.index)
+    {
+        ok = readFile(c, c.brickOffset + (unsigned long long)brick * c.brickBytes, c.brickBytes, dst);
+    }
+    else
+    {
+        const BrickFileEntry &entry = c.index[brick];
+        static thread_local std::vector<uchar> coded, scratch;
+        coded.resize(std::max<size_t>(entry.bytes, 1));
+        scratch.resize(c.rawBytes);
+
+        ok = entry.codec == BRICK_CODEC_CONSTANT ||
+             (entry.offset >= c.brickOffset && entry.offset <= c.fileSize && entry.bytes <= c.fileSize - entry.offset &&
+              readFile(c, entry.offset, entry.bytes, &coded[0]));
+        ok = ok && brickDecode(entry, &coded[0], dst, c.rawBytes, c.voxelSize, &scratch[0]);
+    }
+
+    if (!ok)
+    {
+        if (!c.readFailed.exchange(true))
+        {
+            printf("Error reading brick %u of the volume file\n", brick);
+        }
+
+        memset(dst, 0, c.brickBytes);
+    }
+}
+
+// the data of a brick, read if it is not cached, pinned in slot until
+// releaseBrick()
+static const uchar *acquireBrick(CpuBrickCache &c, uint brick, int &slot)
+{
+    for (;;)
+    {
+        int s = c.brickSlot[brick].load(std::memory_order_acquire);
+
+        if (s >= 0)
+        {
+            CpuBrickSlot &cached = c.slots[s];
+
+            // a slot being replaced has negative pins; back off and retry
+            if (cached.pins.fetch_add(1, std::memory_order_acquire) >= 0 &&
+                cached.brick.load(std::memory_order_relaxed) == brick)
+            {
+                cached.used.store(true, std::memory_order_relaxed);
+                slot = s;
+                return c.data + (size_t)s * c.brickBytes;
+            }
+
+            cached.pins.fetch_sub(1, std::memory_order_release);
+        }
+
+        std::unique_lock<std::mutex> lock(c.missMutex);
+
+        if (c.brickSlot[brick].load(std::memory_order_relaxed) >= 0)
+        {
+            // another ray is reading it
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+
+        s = evictSlot(c);
+
+        if (s < 0)
+        {
+            // more threads than slots: read the brick for this ray alone
+            lock.unlock();
+
+            static thread_local std::vector<uchar> own;
+            own.resize(c.brickBytes);
+            readBrick(c, brick, &own[0]);
+            c.bricksRead.fetch_add(1, std::memory_order_relaxed);
+            slot = -1;
+            return &own[0];
+        }
+
+        uint old = c.slots[s].brick.load(std::memory_order_relaxed);
+
+        if (old != PAGED_NO_BRICK)
+        {
+            c.brickSlot[old].store(-1, std::memory_order_relaxed);
+        }
+
+        c.slots[s].brick.store(brick, std::memory_order_relaxed);
+        c.brickSlot[brick].store(s, std::memory_order_release);
+        lock.unlock();
+
+        uchar *data = c.data + (size_t)s * c.brickBytes;
+        readBrick(c, brick, data);
+        c.bricksRead.fetch_add(1, std::memory_order_relaxed);
+
+        // publish the data, pinned once for this ray; threads that backed
+        // off in the meantime leave their pins balanced
+        c.slots[s].used.store(true, std::memory_order_relaxed);
+        c.slots[s].pins.fetch_add(1 - PAGED_EVICTING, std::memory_order_release);
+        slot = s;
+        return data;
+    }
+}
+
+static void releaseBrick(CpuBrickCache &c, int slot)
+{
+    if (slot >= 0)
+    {
+        c.slots[slot].pins.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// loading
+////////////////////////////////////////////////////////////////////////////////
+
+static bool pagedError(const char *path, const char *error, CpuPagedVolume &vol)
+{
+    printf("Error reading volume '%s': %s\n", path, error);
+    closePagedVolume(vol);
+    return false;
+}
+
+bool openPagedVolume(const char *path, size_t cacheBytes, CpuPagedVolume &vol)
+{
+    memset(&vol, 0, sizeof(vol));
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    BrickFileHeader header;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("Error opening file '%s'\n", path);
+
+        if (fd >= 0) close(fd);
+
+        return false;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        !brickFileHeaderValid(header, (unsigned long long)st.st_size))
+    {
+        close(fd);
+        return pagedError(path, "not a .bvb file", vol);
+    }
+
+    size_t brickCount = (size_t)header.bricksX * header.bricksY * header.bricksZ;
+
+    if (brickCount >= PAGED_NO_BRICK)
+    {
+        close(fd);
+        return pagedError(path, "too many bricks", vol);
+    }
+
+    vol.header = header;
+    vol.mappingSize = (size_t)header.brickOffset;
+    vol.mapping = mmap(0, vol.mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (vol.mapping == MAP_FAILED)
+    {
+        vol.mapping = 0;
+        close(fd);
+        return pagedError(path, "cannot map the brick ranges", vol);
+    }
+
+    vol.ranges = (const float *)((const char *)vol.mapping + header.rangeOffset);
+
+    if (cacheBytes == 0)
+    {
+        cacheBytes = (size_t)sysconf(_SC_PHYS_PAGES) / 4 * (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    // every thread pins one brick at a time; a few slots per core keep
+    // threads from reading bricks for themselves (see acquireBrick())
+    size_t minSlots = 4 * (size_t)std::max(1u, std::thread::hardware_concurrency());
+    size_t slotCount = std::min(std::max(cacheBytes / (size_t)header.brickBytes, minSlots), brickCount);
+
+    CpuBrickCache *c = new CpuBrickCache;
+    vol.cache = c;
+    c->file = fd;
+    c->fileSize = (unsigned long long)st.st_size;
+    c->brickBytes = (size_t)header.brickBytes;
+    c->brickOffset = header.brickOffset;
+    c->index = header.indexOffset ? (const BrickFileEntry *)((const char *)vol.mapping + header.indexOffset) : 0;
+    c->rawBytes = (size_t)BRICK_FILE_PITCH * BRICK_FILE_PITCH * BRICK_FILE_PITCH * header.voxelSize;
+    c->voxelSize = header.voxelSize;
+    c->brickCount = brickCount;
+    c->slotCount = slotCount;
+    c->data = (uchar *)malloc(slotCount * c->brickBytes);
+    c->slots = new CpuBrickSlot[slotCount];
+    c->brickSlot = new std::atomic<int>[brickCount];
+    c->hand = 0;
+    c->bricksRead = 0;
+    c->bytesRead = 0;
+    c->readFailed = false;
+    memset(c->prefetchKey, 0, sizeof(c->prefetchKey));
+
+    if (!c->data)
+    {
+        return pagedError(path, "out of memory for the brick cache", vol);
+    }
+
+    for (size_t s = 0; s < slotCount; s++)
+    {
+        c->slots[s].pins = 0;
+        c->slots[s].brick = PAGED_NO_BRICK;
+        c->slots[s].used = false;
+    }
+
+    for (size_t b = 0; b < brickCount; b++)
+    {
+        c->brickSlot[b] = -1;
+    }
+
+    return true;
+}
+
+void closePagedVolume(CpuPagedVolume &vol)
+{
+    if (vol.cache)
+    {
+        close(vol.cache->file);
+        free(vol.cache->data);
+        delete[] vol.cache->slots;
+        delete[] vol.cache->brickSlot;
+        delete vol.cache;
+    }
+
+    if (vol.mapping)
+    {
+        munmap(vol.mapping, vol.mappingSize);
+    }
+
+    memset(&vol, 0, sizeof(vol));
+}
+
+size_t pagedCacheSlots(const CpuPagedVolume &vol)
+{
+    return vol.cache ? vol.cache->slotCount : 0;
+}
+
+unsigned long long pagedBricksRead(const CpuPagedVolume &vol)
+{
+    return vol.cache ? vol.cache->bricksRead.load() : 0;
+}
+
+unsigned long long pagedBytesRead(const CpuPagedVolume &vol)
+{
+    return vol.cache ? vol.cache->bytesRead.load() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sampling
+////////////////////////////////////////////////////////////////////////////////
+
+// the bricks of the file, as the brick marcher sees them
+inline CpuBrickGrid pagedGrid(const BrickFileHeader &h)
+{
+    CpuBrickGrid grid = { { (int)h.width, (int)h.height, (int)h.depth },
+                          { (int)h.bricksX, (int)h.bricksY, (int)h.bricksZ } };
+    return grid;
+}
+
+// the voxelValue() at a tap, not yet scaled
+template <typename Voxel>
+inline float sampleBrick(const uchar *data, const CpuBrickTap &t, bool linearFilter)
+{
+    const Voxel *p00 = (const Voxel *)data + (t.z0 * BRICK_FILE_PITCH + t.y0) * BRICK_FILE_PITCH + t.x0;
+
+    if (!linearFilter)
+    {
+        return voxelValue(p00[0]);
+    }
+
+    size_t dx = t.x1 - t.x0;
+    const Voxel *p01 = p00 + (t.y1 - t.y0) * BRICK_FILE_PITCH;
+    const Voxel *p10 = p00 + (t.z1 - t.z0) * BRICK_FILE_PITCH * BRICK_FILE_PITCH;
+    const Voxel *p11 = p10 + (t.y1 - t.y0) * BRICK_FILE_PITCH;
+
+    float v000 = voxelValue(p00[0]), v001 = voxelValue(p00[dx]);
+    float v010 = voxelValue(p01[0]), v011 = voxelValue(p01[dx]);
+    float v100 = voxelValue(p10[0]), v101 = voxelValue(p10[dx]);
+    float v110 = voxelValue(p11[0]), v111 = voxelValue(p11[dx]);
+
+    float c00 = v000 + t.ax * (v001 - v000);
+    float c01 = v010 + t.ax * (v011 - v010);
+    float c10 = v100 + t.ax * (v101 - v100);
+    float c11 = v110 + t.ax * (v111 - v110);
+
+    float c0 = c00 + t.ay * (c01 - c00);
+    float c1 = c10 + t.ay * (c11 - c10);
+
+    return c0 + t.az * (c1 - c0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rendering
+////////////////////////////////////////////////////////////////////////////////
+
+// the file's bricks for renderBrickTile(), read through the cache and held
+// in their slots while a ray samples them
+template <typename Voxel>
+struct PagedSource
+{
+    static const int shift = BRICK_FILE_SHIFT;
+
+    struct Brick
+    {
+        const uchar *data;
+        int slot;
+    };
+
+    CpuBrickGrid grid;
+    float scale, rawMin, rawMax;
+    const float *ranges;
+    CpuBrickCache *cache;
+
+    void init(const CpuPagedVolume &vol)
+    {
+        grid = pagedGrid(vol.header);
+        scale = voxelScale<Voxel>();
+        rawMin = vol.header.rawMin;
+        rawMax = vol.header.rawMax;
+        ranges = vol.ranges;
+        cache = vol.cache;
+    }
+
+    void range(uint brick, float &lo, float &hi) const
+    {
+        lo = ranges[2 * (size_t)brick];
+        hi = ranges[2 * (size_t)brick + 1];
+    }
+
+    void acquire(uint brick, Brick &b) const
+    {
+        b.data = acquireBrick(*cache, brick, b.slot);
+    }
+
+    void release(Brick &b) const
+    {
+        releaseBrick(*cache, b.slot);
+    }
+
+    float sample(const Brick &b, const CpuBrickTap &tap, bool linearFilter) const
+    {
+        return sampleBrick<Voxel>(b.data, tap, linearFilter);
+    }
+};
+
+template <typename Voxel>
+static void renderTilePagedVoxel(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1,
+                                 CpuFrameStats &stats)
+{
+    PagedSource<Voxel> source;
+    source.init(*args.paged);
+    renderBrickTile(args, source, x0, y0, x1, y1, stats);
+}
+
+void renderTilePaged(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    switch (args.paged->header.voxelType)
+    {
+        case CPU_VOXEL_UINT16:
+            renderTilePagedVoxel<ushort>(args, x0, y0, x1, y1, stats);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            renderTilePagedVoxel<float>(args, x0, y0, x1, y1, stats);
+            break;
+
+        case CPU_VOXEL_HALF:
+            renderTilePagedVoxel<CpuHalf>(args, x0, y0, x1, y1, stats);
+            break;
+
+        default:
+            renderTilePagedVoxel<uchar>(args, x0, y0, x1, y1, stats);
+            break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// prefetching
+////////////////////////////////////////////////////////////////////////////////
+
+// The bricks a sparse grid of rays reaches, nearest first: each ray walks
+// the volume in steps of half a brick, skipping bricks the transfer
+// function leaves transparent when compositing, and the bricks are sorted
+// by the depth at which a ray first reached them.  Those not cached are
+// handed to the system to read in the background, as many as the cache
+// holds.  Only a change of view or transfer function starts a prefetch.
+void prefetchPagedVolume(const CpuRenderArgs &args)
+{
+#ifdef POSIX_FADV_WILLNEED
+    const CpuPagedVolume &vol = *args.paged;
+    const BrickFileHeader &h = vol.header;
+    CpuBrickCache &cache = *vol.cache;
+
+    float key[16];
+    memcpy(key, args.invViewMatrix, 12 * sizeof(float));
+    key[12] = args.transferOffset;
+    key[13] = args.transferScale;
+    key[14] = (float)args.mode;
+    key[15] = (float)args.imageW * args.imageH;
+
+    if (!memcmp(key, cache.prefetchKey, sizeof(key)))
+    {
+        return;
+    }
+
+    memcpy(cache.prefetchKey, key, sizeof(key));
+
+    CpuTransparency transparent;
+    transparent.init(args);
+
+    const float scale = voxelTypeScale((CpuVoxelType)h.voxelType);
+    const CpuBrickGrid grid = pagedGrid(h);
+    const float longest = (float)std::max(h.width, std::max(h.height, h.depth));
+    const float step = BRICK_FILE_SIZE / longest;
+    const int rowsY = (args.imageH + PAGED_PREFETCH_STRIDE - 1) / PAGED_PREFETCH_STRIDE;
+    std::vector<std::vector<std::pair<float, uint> > > rows(rowsY);
+
+    cpuParallelFor(rowsY, [&](int row)
+    {
+        uint y = row * PAGED_PREFETCH_STRIDE + PAGED_PREFETCH_STRIDE / 2;
+        y = y < args.imageH ? y : args.imageH - 1;
+
+        for (uint x = PAGED_PREFETCH_STRIDE / 2; x < args.imageW; x += PAGED_PREFETCH_STRIDE)
+        {
+            CpuRay eyeRay;
+            float tnear, tfar;
+
+            if (!pixelRay(args, x, y, eyeRay, tnear, tfar)) continue;
+
+            uint last = PAGED_NO_BRICK;
+
+            for (float t = tnear; t <= tfar; t += step)
+            {
+                vec3 pos = eyeRay.o + eyeRay.d*t;
+                CpuBrickTap tap;
+                brickTap<BRICK_FILE_SHIFT>(grid, pos.x*0.5f+0.5f, pos.y*0.5f+0.5f, pos.z*0.5f+0.5f, true, tap);
+
+                if (tap.brick == last) continue;
+
+                last = tap.brick;
+
+                if (args.mode == RENDER_COMPOSITE &&
+                    transparent.empty(vol.ranges[2 * (size_t)last] * scale, vol.ranges[2 * (size_t)last + 1] * scale))
+                {
+                    continue;
+                }
+
+                rows[row].push_back(std::make_pair(t, last));
+            }
+        }
+    });
+
+    std::vector<std::pair<float, uint> > wanted;
+
+    for (int row = 0; row < rowsY; row++)
+    {
+        wanted.insert(wanted.end(), rows[row].begin(), rows[row].end());
+    }
+
+    std::sort(wanted.begin(), wanted.end());
+
+    // keep the first time each brick comes up
+    std::vector<uint> bricks;
+    bricks.reserve(wanted.size());
+
+    for (size_t i = 0; i < wanted.size(); i++)
+    {
+        bricks.push_back(wanted[i].second);
+    }
+
+    std::vector<uint> sorted(bricks);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    std::vector<bool> issued(sorted.size(), false);
+    size_t count = 0;
+
+    for (size_t i = 0; i < bricks.size() && count < cache.slotCount; i++)
+    {
+        size_t k = std::lower_bound(sorted.begin(), sorted.end(), bricks[i]) - sorted.begin();
+
+        if (issued[k]) continue;
+
+        issued[k] = true;
+        count++;
+
+        if (cache.brickSlot[bricks[i]].load(std::memory_order_relaxed) >= 0)
+        {
+            continue;
+        }
+
+        if (!cache.index)
+        {
+            posix_fadvise(cache.file, (off_t)(cache.brickOffset + (unsigned long long)bricks[i] * cache.brickBytes),
+                          (off_t)cache.brickBytes, POSIX_FADV_WILLNEED);
+        }
+        else if (cache.index[bricks[i]].bytes > 0)
+        {
+            posix_fadvise(cache.file, (off_t)cache.index[bricks[i]].offset, (off_t)cache.index[bricks[i]].bytes,
+                          POSIX_FADV_WILLNEED);
+        }
+    }
+#endif
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Pre-integrated transfer function for the CPU backend
+//
+// Point sampling the transfer function misses features narrower than a
+// step, which is why d_render needs such a small tstep.  Assuming the scalar
+// value varies linearly between two samples, the colour and opacity of the
+// whole segment only depend on the front and back value, so they can be
+// integrated once per transfer function into a 2D table and the ray can
+// take several times longer steps.  Self-attenuation inside a segment is
+// ignored: the colour is the opacity weighted mean colour over the segment.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+// sub-samples per table entry for the running integrals
+#define PREINT_SUBSAMPLES 8
+
+void initPreintTable(CpuPreintTable &table, float valueMin, float valueMax)
+{
+    table.valueMin = valueMin;
+    table.valueScale = 1.0f / (valueMax - valueMin);
+
+    size_t n = (size_t)PREINT_SIZE * PREINT_SIZE;
+    table.r = (float *)calloc(n, sizeof(float));
+    table.g = (float *)calloc(n, sizeof(float));
+    table.b = (float *)calloc(n, sizeof(float));
+    table.a = (float *)calloc(n, sizeof(float));
+
+    // force a rebuild on the first frame
+    table.tableOffset = table.tableScale = table.tableDensity = NAN;
+}
+
+void freePreintTable(CpuPreintTable &table)
+{
+    free(table.r);
+    free(table.g);
+    free(table.b);
+    free(table.a);
+    table.r = table.g = table.b = table.a = 0;
+}
+
+void updatePreintTable(CpuPreintTable &table, float transferOffset, float transferScale, float density)
+{
+    if (table.tableOffset == transferOffset && table.tableScale == transferScale &&
+        table.tableDensity == density)
+    {
+        return;
+    }
+
+    // extinction per reference step and colour at scalar value s, so that a
+    // zero length segment reproduces the point sampled "over" blend
+    struct Point
+    {
+        double tau, r, g, b;
+    };
+
+    const int n = (PREINT_SIZE - 1) * PREINT_SUBSAMPLES + 1;
+    const float valueRange = 1.0f / table.valueScale;
+    std::vector<Point> point(n);
+
+    cpuParallelFor(n, [&](int i)
+    {
+        float s = table.valueMin + i / (float)(n - 1) * valueRange;
+        vec4 col = sampleTransfer((s - transferOffset) * transferScale);
+        float alpha = clampf(col.w * density, 0.0f, 0.9999f);
+        point[i].tau = -log(1.0 - alpha);
+        point[i].r = col.x;
+        point[i].g = col.y;
+        point[i].b = col.z;
+    });
+
+    // running integrals of tau and colour*tau over s (trapezoid rule)
+    std::vector<Point> sum(n);
+    sum[0].tau = sum[0].r = sum[0].g = sum[0].b = 0.0;
+
+    for (int i = 1; i < n; i++)
+    {
+        const Point &p0 = point[i - 1], &p1 = point[i];
+        double h = 0.5 / (n - 1);
+        sum[i].tau = sum[i - 1].tau + h * (p0.tau + p1.tau);
+        sum[i].r = sum[i - 1].r + h * (p0.r * p0.tau + p1.r * p1.tau);
+        sum[i].g = sum[i - 1].g + h * (p0.g * p0.tau + p1.g * p1.tau);
+        sum[i].b = sum[i - 1].b + h * (p0.b * p0.tau + p1.b * p1.tau);
+    }
+
+    cpuParallelFor(PREINT_SIZE, [&](int front)
+    {
+        for (int back = 0; back < PREINT_SIZE; back++)
+        {
+            int i0 = front * PREINT_SUBSAMPLES;
+            int i1 = back * PREINT_SUBSAMPLES;
+            double tau, r, g, b;
+
+            if (i0 == i1)
+            {
+                tau = point[i0].tau;
+                r = point[i0].r;
+                g = point[i0].g;
+                b = point[i0].b;
+            }
+            else
+            {
+                // mean over the segment; the signs cancel when back < front
+                double ds = (i1 - i0) / (double)(n - 1);
+                double dTau = sum[i1].tau - sum[i0].tau;
+                tau = dTau / ds;
+                r = g = b = 0.0;
+
+                if (fabs(dTau) > 1e-12)
+                {
+                    r = (sum[i1].r - sum[i0].r) / dTau;
+                    g = (sum[i1].g - sum[i0].g) / dTau;
+                    b = (sum[i1].b - sum[i0].b) / dTau;
+                }
+            }
+
+            double alpha = 1.0 - exp(-tau * PREINT_STEP_SCALE);
+            size_t k = (size_t)front * PREINT_SIZE + back;
+            table.r[k] = (float)(r * alpha);
+            table.g[k] = (float)(g * alpha);
+            table.b[k] = (float)(b * alpha);
+            table.a[k] = (float)alpha;
+        }
+    });
+
+    table.tableOffset = transferOffset;
+    table.tableScale = transferScale;
+    table.tableDensity = density;
+}
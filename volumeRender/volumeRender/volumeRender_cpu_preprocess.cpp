@@ -0,0 +1,571 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Preprocessing of a volume on load for the CPU backend
+//
+// Simulation and scanner volumes often need a log transform (densities
+// spanning decades), a clamp to the values of interest, normalizing and a
+// conversion to a smaller voxel type before they render well.  Run as
+// separate tools every stage reads and writes the whole volume, and
+// loading then scans the result again for its value range and macrocells.
+// Here the voxels go through all the stages a row at a time, in a float
+// buffer that stays in L1, with branch-free loops the compiler vectorizes,
+// and are written out once.  The histogram and the value ranges of the
+// row's macrocells are taken from the same buffer before it is left.
+//
+// The slices of a batch run on all cores, each into a macrocell table and
+// a histogram of its own, which are folded into the volume's after the
+// batch.  A mapped source lets the pages of a batch go once it is done.
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+// slices run at once
+#define PREPROCESS_BATCH 32
+
+// the stages as the row loops run them
+struct PreprocessKernel
+{
+    bool logScale;
+    float logFloor;
+    bool clamp;
+    float clampMin, clampMax;
+    bool normalize;
+    float offset, scale;                    // v = (v - offset) * scale
+    float levels;                           // integer types round v * levels, 0 for the others
+    float histogramMin, histogramScale;     // bin = (v - histogramMin) * histogramScale
+};
+
+// log10(x) of a normal x > 0 to a few ulp, the logf() of Cephes without
+// its branches and calls, so that the loop around it vectorizes (with
+// -fno-trapping-math, see the Makefile)
+static inline float fastLog10(float x)
+{
+    uint bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    // x = m * 2^e, m in [0.5, 1)
+    float e = (float)((int)(bits >> 23) - 126);
+    bits = (bits & 0x807fffffu) | 0x3f000000u;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    // t = m - 1 in [sqrt(0.5) - 1, sqrt(2) - 1)
+    bool low = m < 0.707106781f;
+    float t = low ? m + m - 1.0f : m - 1.0f;
+    e = low ? e - 1.0f : e;
+
+    float z = t * t;
+    float y = 7.0376836292e-2f;
+    y = y * t - 1.1514610310e-1f;
+    y = y * t + 1.1676998740e-1f;
+    y = y * t - 1.2420140846e-1f;
+    y = y * t + 1.4249322787e-1f;
+    y = y * t - 1.6668057665e-1f;
+    y = y * t + 2.0000714765e-1f;
+    y = y * t - 2.4999993993e-1f;
+    y = y * t + 3.3333331174e-1f;
+    y *= t * z;
+    y += -2.12194440e-4f * e;
+    y += -0.5f * z;
+
+    return (t + y + 0.693359375f * e) * 0.4342944819f;
+}
+
+template <typename Voxel>
+static void loadRow(const Voxel *src, float *row, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        row[i] = voxelValue(src[i]);
+    }
+}
+
+// NaNs pass the stages as NaNs, and are rounded to 0 by the integer types.
+// The parameters are copied first: as members of k they could alias row,
+// and a load that may alias a store keeps a loop from vectorizing.
+static void runStages(float *row, int n, const PreprocessKernel &k)
+{
+    const float logFloor = k.logFloor, clampMin = k.clampMin, clampMax = k.clampMax;
+    const float offset = k.offset, scale = k.scale, levels = k.levels;
+
+    if (k.logScale)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float v = std::max(row[i], logFloor);
+            row[i] = v < INFINITY ? fastLog10(v) : v;
+        }
+    }
+
+    if (k.clamp)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            row[i] = std::min(std::max(row[i], clampMin), clampMax);
+        }
+    }
+
+    if (k.normalize)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            row[i] = (row[i] - offset) * scale;
+        }
+    }
+
+    if (levels > 0.0f)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float q = row[i] * levels + 0.5f;
+            q = q > 0.0f ? q : 0.0f;
+            row[i] = (float)(int)std::min(q, levels);
+        }
+    }
+}
+
+// a half row is read back into row, so that the statistics are those of
+// the voxels stored
+static void storeRow(float *row, int n, CpuVoxelType type, void *dst)
+{
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            for (int i = 0; i < n; i++)
+            {
+                ((ushort *)dst)[i] = (ushort)(int)row[i];
+            }
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            memcpy(dst, row, n * sizeof(float));
+            break;
+
+        case CPU_VOXEL_HALF:
+            for (int i = 0; i < n; i++)
+            {
+                ushort h = floatToHalf(row[i]);
+                ((ushort *)dst)[i] = h;
+                row[i] = halfToFloat(h);
+            }
+            break;
+
+        default:
+            for (int i = 0; i < n; i++)
+            {
+                ((uchar *)dst)[i] = (uchar)(int)row[i];
+            }
+            break;
+    }
+}
+
+// first and last of the count cells along an axis whose range, apron
+// included, takes voxel c
+static inline void cellsOfVoxel(int c, int count, int &c0, int &c1)
+{
+    c0 = std::max((c - 1) / MACROCELL_SIZE, 0);
+    c1 = std::min((c + 1) / MACROCELL_SIZE, count - 1);
+}
+
+// widens the count (min, max) pairs of table to those of ranges
+static void widenRanges(float *table, const float *ranges, int count)
+{
+    for (int i = 0; i < 2 * count; i += 2)
+    {
+        table[i] = ranges[i] < table[i] ? ranges[i] : table[i];
+        table[i + 1] = ranges[i + 1] > table[i + 1] ? ranges[i + 1] : table[i + 1];
+    }
+}
+
+// the bins of a row, NaNs in the one past the last, in a loop that
+// vectorizes; then counted into four histograms in turn, so that a run of
+// one value does not wait on a single counter
+static void countRow(const float *row, int n, const PreprocessKernel &k, int *bins,
+                     unsigned long long (*counts)[CPU_HISTOGRAM_BINS + 1])
+{
+    const float lo = k.histogramMin, scale = k.histogramScale, last = CPU_HISTOGRAM_BINS - 1;
+
+    for (int i = 0; i < n; i++)
+    {
+        float b = std::min(std::max((row[i] - lo) * scale, 0.0f), last);
+        bins[i] = (int)(row[i] == row[i] ? b : (float)CPU_HISTOGRAM_BINS);
+    }
+
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        counts[0][bins[i]]++;
+        counts[1][bins[i + 1]]++;
+        counts[2][bins[i + 2]]++;
+        counts[3][bins[i + 3]]++;
+    }
+
+    for (; i < n; i++)
+    {
+        counts[0][bins[i]]++;
+    }
+}
+
+// widens the smallest and largest value of every column to those of row;
+// comparisons pass over NaNs
+static void widenColumns(float *colMin, float *colMax, const float *row, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        float v = row[i];
+        colMin[i] = v < colMin[i] ? v : colMin[i];
+        colMax[i] = v > colMax[i] ? v : colMax[i];
+    }
+}
+
+// one slice through the stages into dst, with its histogram and the
+// ranges of the cells (cy * cellsX + cx) its voxels fall in.  The rows
+// widen the column ranges of the one or two layers of cells they fall in,
+// and the columns are gathered into cells once the slice is done.
+template <typename Voxel>
+static void preprocessSlice(const Voxel *src, uchar *dst, int width, int height, CpuVoxelType type,
+                            const PreprocessKernel &k, int cellsX, int cellsY, float *ranges,
+                            unsigned long long *histogram)
+{
+    std::vector<float> row(width), columns(2 * (size_t)cellsY * width);
+    std::vector<int> bins(width);
+    std::vector<unsigned long long> counts(4 * (CPU_HISTOGRAM_BINS + 1));
+    unsigned long long (*count)[CPU_HISTOGRAM_BINS + 1] = (unsigned long long (*)[CPU_HISTOGRAM_BINS + 1])&counts[0];
+    size_t rowBytes = (size_t)width * getCpuVoxelSize(type);
+
+    for (int cy = 0; cy < cellsY; cy++)
+    {
+        std::fill(&columns[2 * cy * width], &columns[(2 * cy + 1) * width], INFINITY);
+        std::fill(&columns[(2 * cy + 1) * width], &columns[(2 * cy + 2) * width], -INFINITY);
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        loadRow(src + (size_t)y * width, &row[0], width);
+        runStages(&row[0], width, k);
+        storeRow(&row[0], width, type, dst + y * rowBytes);
+        countRow(&row[0], width, k, &bins[0], count);
+
+        int cy0, cy1;
+        cellsOfVoxel(y, cellsY, cy0, cy1);
+
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            widenColumns(&columns[2 * cy * width], &columns[(2 * cy + 1) * width], &row[0], width);
+        }
+    }
+
+    for (int b = 0; b < CPU_HISTOGRAM_BINS; b++)
+    {
+        histogram[b] = count[0][b] + count[1][b] + count[2][b] + count[3][b];
+    }
+
+    for (int cy = 0; cy < cellsY; cy++)
+    {
+        const float *colMin = &columns[2 * cy * width];
+        const float *colMax = colMin + width;
+
+        for (int cx = 0; cx < cellsX; cx++)
+        {
+            int x0 = std::max(cx * MACROCELL_SIZE - 1, 0);
+            int x1 = std::min((cx + 1) * MACROCELL_SIZE, width - 1);
+            float lo = INFINITY, hi = -INFINITY;
+
+            for (int x = x0; x <= x1; x++)
+            {
+                lo = colMin[x] < lo ? colMin[x] : lo;
+                hi = colMax[x] > hi ? colMax[x] : hi;
+            }
+
+            ranges[2 * (cy * cellsX + cx)] = lo;
+            ranges[2 * (cy * cellsX + cx) + 1] = hi;
+        }
+    }
+}
+
+// lets the pages of a mapped source before slice z go, see releaseSlices()
+// in volumeRender_cpu_layout.cpp
+static void releaseSource(const void *src, bool mapped, size_t sliceBytes, int z, size_t &released)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = (size_t)z * sliceBytes / page * page;
+
+    if (mapped && end > released)
+    {
+        madvise((uchar *)src + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+}
+
+// smallest and largest finite voxelValue(), [0, 1] if there is none
+template <typename Voxel>
+static void findFiniteRange(const Voxel *src, bool mapped, int width, int height, int depth, float &lo, float &hi)
+{
+    size_t sliceVoxels = (size_t)width * height;
+    float sliceMin[PREPROCESS_BATCH], sliceMax[PREPROCESS_BATCH];
+    size_t released = 0;
+
+    lo = INFINITY;
+    hi = -INFINITY;
+
+    for (int z0 = 0; z0 < depth; z0 += PREPROCESS_BATCH)
+    {
+        int slices = std::min(PREPROCESS_BATCH, depth - z0);
+
+        cpuParallelFor(slices, [&](int s)
+        {
+            const Voxel *slice = src + (z0 + s) * sliceVoxels;
+            float smin = INFINITY, smax = -INFINITY;
+
+            for (size_t i = 0; i < sliceVoxels; i++)
+            {
+                float v = voxelValue(slice[i]);
+                // v - v is NaN for infinities and NaNs
+                bool finite = v - v == 0.0f;
+                smin = finite && v < smin ? v : smin;
+                smax = finite && v > smax ? v : smax;
+            }
+
+            sliceMin[s] = smin;
+            sliceMax[s] = smax;
+        });
+
+        for (int s = 0; s < slices; s++)
+        {
+            lo = std::min(lo, sliceMin[s]);
+            hi = std::max(hi, sliceMax[s]);
+        }
+
+        releaseSource(src, mapped, sliceVoxels * sizeof(Voxel), z0 + slices, released);
+    }
+
+    if (lo > hi)
+    {
+        lo = 0.0f;
+        hi = 1.0f;
+    }
+}
+
+template <typename Voxel>
+static void runPreprocess(const Voxel *src, bool mapped, int width, int height, int depth,
+                          const CpuPreprocess &stages, uchar *out, CpuVolumeSummary &summary)
+{
+    PreprocessKernel k;
+    k.logScale = stages.logScale;
+    k.logFloor = stages.logFloor;
+    k.clamp = stages.clamp;
+    k.clampMin = stages.clampMin;
+    k.clampMax = stages.clampMax;
+    k.levels = stages.type == CPU_VOXEL_UINT8 ? 255.0f : stages.type == CPU_VOXEL_UINT16 ? 65535.0f : 0.0f;
+    k.normalize = stages.normalize || k.levels > 0.0f;
+
+    // the range the values leave the clamp in, found with a first pass if
+    // there is no clamp to give it
+    float lo = stages.clampMin, hi = stages.clampMax;
+    summary.passes = 1;
+
+    if (!stages.clamp)
+    {
+        findFiniteRange(src, mapped, width, height, depth, lo, hi);
+        summary.passes = 2;
+
+        if (stages.logScale)
+        {
+            lo = fastLog10(std::max(lo, stages.logFloor));
+            hi = fastLog10(std::max(hi, stages.logFloor));
+        }
+    }
+
+    k.offset = k.normalize ? lo : 0.0f;
+    k.scale = k.normalize && hi > lo ? 1.0f / (hi - lo) : 1.0f;
+
+    // integer bins hold whole values, the others span what the stages leave
+    if (k.levels > 0.0f)
+    {
+        summary.histogramMin = 0.0f;
+        summary.histogramMax = k.levels + 1.0f;
+    }
+    else if (k.normalize)
+    {
+        summary.histogramMin = 0.0f;
+        summary.histogramMax = 1.0f;
+    }
+    else
+    {
+        summary.histogramMin = lo;
+        summary.histogramMax = hi > lo ? hi : lo + 1.0f;
+    }
+
+    k.histogramMin = summary.histogramMin;
+    k.histogramScale = CPU_HISTOGRAM_BINS / (summary.histogramMax - summary.histogramMin);
+
+    int cellsX = (width  + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+    int cellsY = (height + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+    int cellsZ = (depth  + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+    size_t layerCells = (size_t)cellsX * cellsY;
+    size_t numCells = layerCells * cellsZ;
+
+    summary.cellRanges = (float *)malloc(numCells * 2 * sizeof(float));
+
+    for (size_t i = 0; i < numCells; i++)
+    {
+        summary.cellRanges[2 * i] = INFINITY;
+        summary.cellRanges[2 * i + 1] = -INFINITY;
+    }
+
+    memset(summary.histogram, 0, sizeof(summary.histogram));
+
+    std::vector<float> tables(PREPROCESS_BATCH * layerCells * 2);
+    std::vector<unsigned long long> histograms(PREPROCESS_BATCH * CPU_HISTOGRAM_BINS);
+    size_t sliceVoxels = (size_t)width * height;
+    size_t outSlice = sliceVoxels * getCpuVoxelSize(stages.type);
+    size_t released = 0;
+
+    for (int z0 = 0; z0 < depth; z0 += PREPROCESS_BATCH)
+    {
+        int slices = std::min(PREPROCESS_BATCH, depth - z0);
+
+        cpuParallelFor(slices, [&](int s)
+        {
+            preprocessSlice(src + (z0 + s) * sliceVoxels, out + (z0 + s) * outSlice, width, height, stages.type,
+                            k, cellsX, cellsY, &tables[s * layerCells * 2], &histograms[s * CPU_HISTOGRAM_BINS]);
+        });
+
+        // a slice falls in one or two layers of cells, as a row does
+        cpuParallelFor(cellsY, [&](int cy)
+        {
+            for (int s = 0; s < slices; s++)
+            {
+                int cz0, cz1;
+                cellsOfVoxel(z0 + s, cellsZ, cz0, cz1);
+
+                for (int cz = cz0; cz <= cz1; cz++)
+                {
+                    widenRanges(summary.cellRanges + 2 * (cz * layerCells + cy * cellsX),
+                                &tables[s * layerCells * 2 + 2 * cy * cellsX], cellsX);
+                }
+            }
+        });
+
+        for (int s = 0; s < slices; s++)
+        {
+            for (int b = 0; b < CPU_HISTOGRAM_BINS; b++)
+            {
+                summary.histogram[b] += histograms[s * CPU_HISTOGRAM_BINS + b];
+            }
+        }
+
+        releaseSource(src, mapped, sliceVoxels * sizeof(Voxel), z0 + slices, released);
+    }
+}
+
+bool preprocessStagesValid(const CpuPreprocess &stages)
+{
+    if (stages.logScale && !(stages.logFloor >= FLT_MIN))
+    {
+        printf("Error: the log floor must be at least %g\n", FLT_MIN);
+        return false;
+    }
+
+    if (stages.clamp && !(stages.clampMin < stages.clampMax))
+    {
+        printf("Error: the clamp range %g .. %g is empty\n", stages.clampMin, stages.clampMax);
+        return false;
+    }
+
+    return true;
+}
+
+bool preprocessVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type,
+                      const CpuPreprocess &stages, CpuVolumeLayout layout, CpuVolume &vol,
+                      CpuVolumeSummary &summary)
+{
+    // written x fastest into memory laid out like a mapped file, which
+    // mapVolumeLayout() then takes over or converts
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = (size_t)width * height * depth * getCpuVoxelSize(stages.type);
+    size_t outSize = (bytes + CPU_VOLUME_PADDING + page - 1) / page * page;
+    uchar *out = (uchar *)mmap(0, outSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (out == MAP_FAILED)
+    {
+        printf("Error allocating %llu bytes for the volume\n", (unsigned long long)outSize);
+        return false;
+    }
+
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            runPreprocess((const ushort *)src, mapped, width, height, depth, stages, out, summary);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            runPreprocess((const float *)src, mapped, width, height, depth, stages, out, summary);
+            break;
+
+        case CPU_VOXEL_HALF:
+            runPreprocess((const CpuHalf *)src, mapped, width, height, depth, stages, out, summary);
+            break;
+
+        default:
+            runPreprocess((const uchar *)src, mapped, width, height, depth, stages, out, summary);
+            break;
+    }
+
+    // the volume's range from its cells, as findVolumeRange() would scan it
+    size_t numCells = (size_t)((width  + MACROCELL_SIZE - 1) / MACROCELL_SIZE) *
+                      ((height + MACROCELL_SIZE - 1) / MACROCELL_SIZE) *
+                      ((depth  + MACROCELL_SIZE - 1) / MACROCELL_SIZE);
+    float range[2] = { INFINITY, -INFINITY };
+
+    for (size_t i = 0; i < numCells; i++)
+    {
+        range[0] = std::min(range[0], summary.cellRanges[2 * i]);
+        range[1] = std::max(range[1], summary.cellRanges[2 * i + 1]);
+    }
+
+    if (stages.type == CPU_VOXEL_UINT8)
+    {
+        range[0] = 0.0f;
+        range[1] = 255.0f;
+    }
+    else if (!(range[1] > range[0]))
+    {
+        range[0] = range[0] > -INFINITY && range[0] < INFINITY ? range[0] : 0.0f;
+        range[1] = range[0] + 1.0f;
+    }
+
+    mapVolumeLayout(out, outSize, width, height, depth, stages.type, layout, range, vol);
+
+    if (vol.mapping != out)
+    {
+        unmapVolumeFile(out, outSize);
+    }
+
+    return true;
+}
+
+void freeVolumeSummary(CpuVolumeSummary &summary)
+{
+    free(summary.cellRanges);
+    summary.cellRanges = 0;
+}
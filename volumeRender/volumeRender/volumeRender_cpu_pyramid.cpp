@@ -0,0 +1,291 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Mip pyramid and level of detail for the CPU backend
+//
+// A zoomed out view still marches the full resolution volume: each pixel's
+// ray takes samples voxels apart while neighbouring rays are many voxels
+// apart, so the image aliases and every sample is a cache miss.  The
+// pyramid holds box filtered copies of the volume at 1/2, 1/4, ... of its
+// size.  Along a ray the footprint of the pixel grows linearly with the
+// distance from the eye; once it covers a voxel of level l the ray samples
+// level l, with steps of about half a voxel of that level.  Distant parts
+// of the volume are then read from a level small enough to stay in cache.
+//
+// Each level is built from the one before in one parallel pass.  Since that
+// pass still reads the whole volume, the levels can be cached in a file
+// next to it (about 1/7 of the volume's size) and read back on the next run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "volumeRender_cpu_internal.h"
+
+// mean of the eight voxels of a 2x2x2 block, rounded to the nearest for
+// the integer types
+inline uchar boxMean(const uchar *v)
+{
+    int s = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+    return (uchar)((s + 4) >> 3);
+}
+
+inline ushort boxMean(const ushort *v)
+{
+    int s = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+    return (ushort)((s + 4) >> 3);
+}
+
+inline float boxMean(const float *v)
+{
+    return ((v[0] + v[1]) + (v[2] + v[3]) + (v[4] + v[5]) + (v[6] + v[7])) * 0.125f;
+}
+
+inline CpuHalf boxMean(const CpuHalf *v)
+{
+    float f[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        f[i] = halfToFloat(v[i].bits);
+    }
+
+    CpuHalf h = { floatToHalf(boxMean(f)) };
+    return h;
+}
+
+// one level from the level before, both x fastest; an odd voxel at the
+// end of an axis is averaged with itself
+template <typename Voxel>
+static void downsample(const Voxel *src, int w, int h, int d, Voxel *dst, int dw, int dh, int dd)
+{
+    cpuParallelFor(dh * dd, [&](int row)
+    {
+        int y = row % dh;
+        int z = row / dh;
+        int y0 = 2 * y, y1 = clampi(2 * y + 1, 0, h - 1);
+        int z0 = 2 * z, z1 = clampi(2 * z + 1, 0, d - 1);
+        const Voxel *r00 = src + ((size_t)z0 * h + y0) * w;
+        const Voxel *r01 = src + ((size_t)z0 * h + y1) * w;
+        const Voxel *r10 = src + ((size_t)z1 * h + y0) * w;
+        const Voxel *r11 = src + ((size_t)z1 * h + y1) * w;
+        Voxel *out = dst + (size_t)row * dw;
+
+        for (int x = 0; x < dw; x++)
+        {
+            int x0 = 2 * x, x1 = clampi(2 * x + 1, 0, w - 1);
+            Voxel taps[8] = { r00[x0], r00[x1], r01[x0], r01[x1], r10[x0], r10[x1], r11[x0], r11[x1] };
+            out[x] = boxMean(taps);
+        }
+    });
+}
+
+static void downsampleLevel(CpuVoxelType type, const void *src, int w, int h, int d,
+                            void *dst, int dw, int dh, int dd)
+{
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            downsample((const ushort *)src, w, h, d, (ushort *)dst, dw, dh, dd);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            downsample((const float *)src, w, h, d, (float *)dst, dw, dh, dd);
+            break;
+
+        case CPU_VOXEL_HALF:
+            downsample((const CpuHalf *)src, w, h, d, (CpuHalf *)dst, dw, dh, dd);
+            break;
+
+        default:
+            downsample((const uchar *)src, w, h, d, (uchar *)dst, dw, dh, dd);
+            break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cache file
+////////////////////////////////////////////////////////////////////////////////
+
+// The header is followed by levels 1 ... levels-1, x fastest.  A cache
+// belongs to a volume of the same size and type whose fingerprint, a hash
+// of 64K bytes spread over the volume, matches; callers that know where
+// the volume came from should also drop caches older than the volume.
+struct PyramidCacheHeader
+{
+    char magic[8];
+    int width, height, depth;
+    int type;
+    int levels;
+    int reserved;
+    unsigned long long fingerprint;
+};
+
+static const char pyramidCacheMagic[8] = { 'V', 'R', 'P', 'Y', 'R', 'A', 'M', '1' };
+
+static unsigned long long volumeFingerprint(const void *src, size_t bytes)
+{
+    const uchar *p = (const uchar *)src;
+    size_t stride = bytes > 65536 ? bytes / 65536 : 1;
+    unsigned long long hash = 14695981039346656037ull;     // FNV-1a
+
+    for (size_t i = 0; i < bytes; i += stride)
+    {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// reads the levels into linear[1 ...]; false if the file is missing, does
+// not match header or is cut short
+static bool readPyramidCache(const char *path, const PyramidCacheHeader &header,
+                             uchar **linear, const size_t *levelSize)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp) return false;
+
+    PyramidCacheHeader stored;
+    bool ok = fread(&stored, sizeof(stored), 1, fp) == 1 && !memcmp(&stored, &header, sizeof(header));
+
+    for (int l = 1; ok && l < header.levels; l++)
+    {
+        linear[l] = (uchar *)malloc(levelSize[l]);
+        ok = fread(linear[l], 1, levelSize[l], fp) == levelSize[l];
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pyramid
+////////////////////////////////////////////////////////////////////////////////
+
+void buildVolumePyramid(const void *src, const CpuVolume &vol, CpuVolumePyramid &pyramid, const char *cachePath)
+{
+    int dims[CPU_MAX_LOD_LEVELS][3];
+    size_t levelSize[CPU_MAX_LOD_LEVELS];
+    uchar *linear[CPU_MAX_LOD_LEVELS] = { 0 };
+    int levels = 1;
+
+    dims[0][0] = vol.width;
+    dims[0][1] = vol.height;
+    dims[0][2] = vol.depth;
+    levelSize[0] = (size_t)vol.width * vol.height * vol.depth * vol.voxelSize;
+    linear[0] = (uchar *)src;
+
+    while (levels < CPU_MAX_LOD_LEVELS && (dims[levels-1][0] > 1 || dims[levels-1][1] > 1 || dims[levels-1][2] > 1))
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            dims[levels][a] = (dims[levels-1][a] + 1) / 2;
+        }
+
+        levelSize[levels] = (size_t)dims[levels][0] * dims[levels][1] * dims[levels][2] * vol.voxelSize;
+        levels++;
+    }
+
+    PyramidCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, pyramidCacheMagic, sizeof(header.magic));
+    header.width = vol.width;
+    header.height = vol.height;
+    header.depth = vol.depth;
+    header.type = vol.type;
+    header.levels = levels;
+    header.fingerprint = volumeFingerprint(src, levelSize[0]);
+
+    bool cached = cachePath && readPyramidCache(cachePath, header, linear, levelSize);
+
+    if (!cached)
+    {
+        // written next to the cache and renamed once complete, so that an
+        // interrupted run never leaves a truncated cache behind
+        std::string partPath = cachePath ? std::string(cachePath) + ".part" : std::string();
+        FILE *fp = cachePath ? fopen(partPath.c_str(), "wb") : 0;
+        bool written = fp && fwrite(&header, sizeof(header), 1, fp) == 1;
+
+        for (int l = 1; l < levels; l++)
+        {
+            if (!linear[l])
+            {
+                linear[l] = (uchar *)malloc(levelSize[l]);
+            }
+
+            downsampleLevel(vol.type, linear[l-1], dims[l-1][0], dims[l-1][1], dims[l-1][2],
+                            linear[l], dims[l][0], dims[l][1], dims[l][2]);
+            written = written && fwrite(linear[l], 1, levelSize[l], fp) == levelSize[l];
+        }
+
+        if (fp)
+        {
+            written = fclose(fp) == 0 && written;
+        }
+
+        if (cachePath && (!written || rename(partPath.c_str(), cachePath)))
+        {
+            printf("Could not write the volume pyramid cache '%s'\n", cachePath);
+            remove(partPath.c_str());
+        }
+    }
+
+    pyramid.levels = levels;
+
+    for (int l = 1; l < levels; l++)
+    {
+        createVolumeLayout(linear[l], dims[l][0], dims[l][1], dims[l][2], vol.type, vol.layout, pyramid.level[l]);
+        free(linear[l]);
+    }
+}
+
+void freeVolumePyramid(CpuVolumePyramid &pyramid)
+{
+    for (int l = 1; l < pyramid.levels; l++)
+    {
+        freeVolumeLayout(pyramid.level[l]);
+    }
+
+    pyramid.levels = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// level selection
+////////////////////////////////////////////////////////////////////////////////
+
+void setupLod(CpuLod &lod, const CpuVolume &vol, const CpuVolumePyramid &pyramid,
+              uint imageW, uint imageH, uint pixelStride)
+{
+    // neighbouring rays are 2/imageW apart on the image plane at distance 2
+    // (see pixelRay()), so at distance t a ray stands for t*pixelAngle
+    float pixelAngle = (float)pixelStride / (imageW < imageH ? imageW : imageH);
+
+    lod.levels = pyramid.levels > 1 ? pyramid.levels : 1;
+    lod.volume[0] = &vol;
+    lod.tLevel[0] = 0.0f;
+    lod.stepScale[0] = 1;
+
+    for (int l = 1; l < lod.levels; l++)
+    {
+        // the volume spans [-1, 1], the longest axis has the smallest voxels
+        const CpuVolume &level = pyramid.level[l];
+        int n = level.width > level.height ? level.width : level.height;
+        n = n > level.depth ? n : level.depth;
+        float voxel = 2.0f / n;
+
+        lod.volume[l] = &level;
+        lod.tLevel[l] = voxel / pixelAngle;
+        lod.stepScale[l] = clampi((int)(0.5f * voxel / cpuTstep), 1, MAX_STEP_SCALE);
+    }
+}
@@ -0,0 +1,449 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Volumes quantized brick by brick for the CPU backend
+//
+// A float field of wide dynamic range does not survive one global mapping
+// to 8 or 16 bits, but a 16^3 brick of it usually spans a small part of
+// that range.  quantizeVolume() cuts the volume into the bricks of the
+// bricked layout, ghost layer included, and maps each brick's values on
+// its own: q = 0 .. 2^bits - 1 stands for a + q*b, or, with the log
+// scale, for 2^(a + q*b), q = 0 then standing for zero.  A float volume
+// takes about 0.3 or 0.6 of its size and is sampled in place, with no
+// decoding: the taps of a trilinear sample never leave their brick, so on
+// the linear scale the eight values q are blended and mapped once.
+//
+// The coder measures what it loses, the largest difference between a
+// voxel and what the renderer reads in its place, over the whole volume.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "volumeRender_cpu_internal.h"
+
+// the relative error of a voxel is measured against at least this fraction
+// of its brick's range, so that voxels at or near zero do not make it
+// infinite
+#define QUANTIZED_RELATIVE_FLOOR 1e-3f
+
+////////////////////////////////////////////////////////////////////////////////
+// quantization
+////////////////////////////////////////////////////////////////////////////////
+
+// the one expression both the coder and the sampler evaluate, so that the
+// ranges and errors the coder records are those of what is sampled
+template <bool logScale>
+inline float dequantize(const float *param, float q)
+{
+    if (logScale)
+    {
+        return q > 0.0f ? exp2f(param[0] + q * param[1]) : 0.0f;
+    }
+
+    return param[0] + q * param[1];
+}
+
+inline size_t quantizedBrickBytes(const CpuQuantizedVolume &vol)
+{
+    return (size_t)BRICK_VOXELS * vol.bits / 8;
+}
+
+// the brick's map: a and b of dequantize() for the values v.  Non-finite
+// values do not count; on the log scale neither do those not above zero,
+// which become zero.
+template <typename Voxel>
+static void brickParams(const float *v, int count, int levels, bool logScale, float *param)
+{
+    float lo = INFINITY, hi = -INFINITY;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (isfinite(v[i]) && (!logScale || v[i] > 0.0f))
+        {
+            lo = std::min(lo, v[i]);
+            hi = std::max(hi, v[i]);
+        }
+    }
+
+    if (!(lo <= hi))
+    {
+        // nothing to keep
+        param[0] = logScale ? -INFINITY : 0.0f;
+        param[1] = 0.0f;
+    }
+    else if (logScale)
+    {
+        // q = 1 .. levels spans log2(lo) .. log2(hi)
+        float l0 = log2f(lo), l1 = log2f(hi);
+        float step = levels > 1 ? (l1 - l0) / (levels - 1) : 0.0f;
+        param[0] = l0 - step;
+        param[1] = step;
+    }
+    else
+    {
+        // integer voxels keep an integer step, so that bricks spanning at
+        // most levels values are exact
+        float step = (hi - lo) / levels;
+        param[0] = lo;
+        param[1] = std::is_integral<Voxel>::value ? ceilf(step) : step;
+    }
+}
+
+// invStep is 1 / param[1], or 0 where param[1] is 0
+template <bool logScale>
+inline int quantize(const float *param, float invStep, int levels, float v)
+{
+    float f;
+
+    if (logScale)
+    {
+        if (!(v > 0.0f) || param[0] == -INFINITY)
+        {
+            return 0;
+        }
+
+        f = invStep > 0.0f ? (log2f(v) - param[0]) * invStep : 1.0f;
+        f = std::max(f, 1.0f);
+    }
+    else
+    {
+        f = (v - param[0]) * invStep;
+    }
+
+    // NaN goes to 0
+    return f > 0.0f ? (int)(std::min(f, (float)levels) + 0.5f) : 0;
+}
+
+// what quantizing one brick cost and what it holds
+struct QuantizedBrickStats
+{
+    float maxError, maxRelativeError;
+    float lo, hi;
+};
+
+// quantizes brick (bx, by, bz) and its ghost layer, which repeats the last
+// voxels of the volume past its edge
+template <typename Voxel, typename Quant, bool logScale>
+static void quantizeBrick(const Voxel *src, const CpuQuantizedVolume &vol, int bx, int by, int bz,
+                          QuantizedBrickStats &bs)
+{
+    const int levels = (1 << vol.bits) - 1;
+    const int count = BRICK_PITCH * BRICK_SLICE;
+    size_t brick = ((size_t)bz * vol.bricksY + by) * vol.bricksX + bx;
+    float v[BRICK_PITCH * BRICK_SLICE];
+    int i = 0;
+
+    for (int z = 0; z < BRICK_PITCH; z++)
+    {
+        int sz = clampi((bz << BRICK_SHIFT) + z, 0, vol.depth - 1);
+
+        for (int y = 0; y < BRICK_PITCH; y++)
+        {
+            int sy = clampi((by << BRICK_SHIFT) + y, 0, vol.height - 1);
+            const Voxel *row = src + ((size_t)sz * vol.height + sy) * vol.width;
+
+            for (int x = 0; x < BRICK_PITCH; x++)
+            {
+                v[i++] = voxelValue(row[clampi((bx << BRICK_SHIFT) + x, 0, vol.width - 1)]);
+            }
+        }
+    }
+
+    float *param = vol.params + 2 * brick;
+    brickParams<Voxel>(v, count, levels, logScale, param);
+
+    Quant *dst = (Quant *)(vol.data + brick * quantizedBrickBytes(vol));
+    float invStep = param[1] > 0.0f ? 1.0f / param[1] : 0.0f;
+    float lo = INFINITY, hi = -INFINITY;
+
+    for (i = 0; i < count; i++)
+    {
+        if (isfinite(v[i]))
+        {
+            lo = std::min(lo, v[i]);
+            hi = std::max(hi, v[i]);
+        }
+    }
+
+    // 0 only if the finite voxels are all one value; zero is then exact
+    float minMagnitude = lo < hi ? (hi - lo) * QUANTIZED_RELATIVE_FLOOR : 0.0f;
+    bs.maxError = bs.maxRelativeError = 0.0f;
+    bs.lo = INFINITY;
+    bs.hi = -INFINITY;
+
+    for (i = 0; i < count; i++)
+    {
+        int q = quantize<logScale>(param, invStep, levels, v[i]);
+        float d = dequantize<logScale>(param, (float)q);
+        dst[i] = (Quant)q;
+
+        // nothing here is NaN, so std::min() and std::max() do, without
+        // the calls fminf() and fmaxf() cost
+        bs.lo = std::min(bs.lo, d);
+        bs.hi = std::max(bs.hi, d);
+
+        // non-finite voxels have no error to speak of; the division is
+        // only needed where the relative error grows
+        float e = isfinite(v[i]) ? fabsf(d - v[i]) : 0.0f;
+        float magnitude = std::max(fabsf(v[i]), minMagnitude);
+        bs.maxError = std::max(bs.maxError, e);
+
+        if (e > bs.maxRelativeError * magnitude)
+        {
+            bs.maxRelativeError = e / magnitude;
+        }
+    }
+
+    memset(dst + count, 0, (BRICK_VOXELS - count) * sizeof(Quant));
+}
+
+// the pages of a mapped source go once the bricks are past them, as in the
+// layout conversions
+static void releaseQuantizedSource(const void *src, const CpuQuantizedVolume &vol, int z, size_t &released)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    z = z < vol.depth ? z : vol.depth;
+    size_t end = (size_t)z * vol.width * vol.height * getCpuVoxelSize(vol.type) / page * page;
+
+    if (end > released)
+    {
+        madvise((uchar *)src + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+}
+
+// one layer of bricks at a time, front to back through the source
+template <typename Voxel, typename Quant, bool logScale>
+static void quantizeBricks(const void *src, bool mapped, CpuQuantizedVolume &vol, QuantizedBrickStats *bs)
+{
+    int layerBricks = vol.bricksX * vol.bricksY;
+    size_t released = 0;
+
+    for (int bz = 0; bz < vol.bricksZ; bz++)
+    {
+        cpuParallelFor(layerBricks, [&](int i)
+        {
+            quantizeBrick<Voxel, Quant, logScale>((const Voxel *)src, vol, i % vol.bricksX, i / vol.bricksX, bz,
+                                                  bs[(size_t)bz * layerBricks + i]);
+        });
+
+        if (mapped)
+        {
+            releaseQuantizedSource(src, vol, (bz + 1) << BRICK_SHIFT, released);
+        }
+    }
+}
+
+template <typename Voxel>
+static void quantizeType(const void *src, bool mapped, CpuQuantizedVolume &vol, QuantizedBrickStats *bs)
+{
+    if (vol.bits == 16)
+    {
+        if (vol.logScale) quantizeBricks<Voxel, ushort, true>(src, mapped, vol, bs);
+        else              quantizeBricks<Voxel, ushort, false>(src, mapped, vol, bs);
+    }
+    else
+    {
+        if (vol.logScale) quantizeBricks<Voxel, uchar, true>(src, mapped, vol, bs);
+        else              quantizeBricks<Voxel, uchar, false>(src, mapped, vol, bs);
+    }
+}
+
+void quantizeVolume(const void *src, bool mapped, int width, int height, int depth, CpuVoxelType type, int bits,
+                    bool logScale, CpuQuantizedVolume &vol)
+{
+    memset(&vol, 0, sizeof(vol));
+    vol.width = width;
+    vol.height = height;
+    vol.depth = depth;
+    vol.type = type;
+    vol.bits = bits;
+    vol.logScale = logScale;
+    vol.bricksX = (width  + BRICK_SIZE - 1) / BRICK_SIZE;
+    vol.bricksY = (height + BRICK_SIZE - 1) / BRICK_SIZE;
+    vol.bricksZ = (depth  + BRICK_SIZE - 1) / BRICK_SIZE;
+
+    size_t bricks = (size_t)vol.bricksX * vol.bricksY * vol.bricksZ;
+    vol.data = (uchar *)malloc(bricks * quantizedBrickBytes(vol));
+    vol.params = (float *)malloc(bricks * 2 * sizeof(float));
+    vol.brickRanges = (float *)malloc(bricks * 2 * sizeof(float));
+    vol.bytes = bricks * (quantizedBrickBytes(vol) + 4 * sizeof(float));
+
+    std::vector<QuantizedBrickStats> bs(bricks);
+
+    switch (type)
+    {
+        case CPU_VOXEL_UINT16:
+            quantizeType<ushort>(src, mapped, vol, &bs[0]);
+            break;
+
+        case CPU_VOXEL_FLOAT:
+            quantizeType<float>(src, mapped, vol, &bs[0]);
+            break;
+
+        case CPU_VOXEL_HALF:
+            quantizeType<CpuHalf>(src, mapped, vol, &bs[0]);
+            break;
+
+        default:
+            quantizeType<uchar>(src, mapped, vol, &bs[0]);
+            break;
+    }
+
+    vol.rawMin = INFINITY;
+    vol.rawMax = -INFINITY;
+
+    for (size_t b = 0; b < bricks; b++)
+    {
+        vol.brickRanges[2 * b] = bs[b].lo;
+        vol.brickRanges[2 * b + 1] = bs[b].hi;
+        vol.rawMin = fminf(vol.rawMin, bs[b].lo);
+        vol.rawMax = fmaxf(vol.rawMax, bs[b].hi);
+        vol.maxError = fmaxf(vol.maxError, bs[b].maxError);
+        vol.maxRelativeError = fmaxf(vol.maxRelativeError, bs[b].maxRelativeError);
+    }
+}
+
+void freeQuantizedVolume(CpuQuantizedVolume &vol)
+{
+    free(vol.data);
+    free(vol.params);
+    free(vol.brickRanges);
+    memset(&vol, 0, sizeof(vol));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sampling
+////////////////////////////////////////////////////////////////////////////////
+
+// a tap as the blend takes it: dequantized on the log scale, where the map
+// does not commute with the blend, and as it is on the linear scale
+template <bool logScale>
+inline float tapValue(const float *param, float q)
+{
+    return logScale ? dequantize<true>(param, q) : q;
+}
+
+// the dequantized voxelValue() at a tap, not yet scaled
+template <typename Quant, bool logScale>
+inline float sampleBrick(const Quant *data, const float *param, const CpuBrickTap &t, bool linearFilter)
+{
+    const Quant *p00 = data + (t.z0 * BRICK_PITCH + t.y0) * BRICK_PITCH + t.x0;
+
+    if (!linearFilter)
+    {
+        return dequantize<logScale>(param, (float)p00[0]);
+    }
+
+    int dx = t.x1 - t.x0;
+    const Quant *p01 = p00 + (t.y1 - t.y0) * BRICK_PITCH;
+    const Quant *p10 = p00 + (t.z1 - t.z0) * BRICK_SLICE;
+    const Quant *p11 = p10 + (t.y1 - t.y0) * BRICK_PITCH;
+
+    float v000 = tapValue<logScale>(param, p00[0]), v001 = tapValue<logScale>(param, p00[dx]);
+    float v010 = tapValue<logScale>(param, p01[0]), v011 = tapValue<logScale>(param, p01[dx]);
+    float v100 = tapValue<logScale>(param, p10[0]), v101 = tapValue<logScale>(param, p10[dx]);
+    float v110 = tapValue<logScale>(param, p11[0]), v111 = tapValue<logScale>(param, p11[dx]);
+
+    float c00 = v000 + t.ax * (v001 - v000);
+    float c01 = v010 + t.ax * (v011 - v010);
+    float c10 = v100 + t.ax * (v101 - v100);
+    float c11 = v110 + t.ax * (v111 - v110);
+
+    float c0 = c00 + t.ay * (c01 - c00);
+    float c1 = c10 + t.ay * (c11 - c10);
+    float c = c0 + t.az * (c1 - c0);
+
+    return logScale ? c : dequantize<false>(param, c);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// rendering
+////////////////////////////////////////////////////////////////////////////////
+
+// the bricks for renderBrickTile(), sampled where they lie
+template <typename Quant, bool logScale>
+struct QuantizedSource
+{
+    static const int shift = BRICK_SHIFT;
+
+    struct Brick
+    {
+        const Quant *data;
+        const float *param;
+    };
+
+    CpuBrickGrid grid;
+    float scale, rawMin, rawMax;
+    const CpuQuantizedVolume *vol;
+
+    void init(const CpuQuantizedVolume &v)
+    {
+        CpuBrickGrid g = { { v.width, v.height, v.depth }, { v.bricksX, v.bricksY, v.bricksZ } };
+        grid = g;
+        scale = voxelTypeScale(v.type);
+        rawMin = v.rawMin;
+        rawMax = v.rawMax;
+        vol = &v;
+    }
+
+    void range(uint brick, float &lo, float &hi) const
+    {
+        lo = vol->brickRanges[2 * (size_t)brick];
+        hi = vol->brickRanges[2 * (size_t)brick + 1];
+    }
+
+    void acquire(uint brick, Brick &b) const
+    {
+        b.data = (const Quant *)vol->data + (size_t)brick * BRICK_VOXELS;
+        b.param = vol->params + 2 * (size_t)brick;
+    }
+
+    void release(Brick &) const
+    {
+    }
+
+    float sample(const Brick &b, const CpuBrickTap &tap, bool linearFilter) const
+    {
+        return sampleBrick<Quant, logScale>(b.data, b.param, tap, linearFilter);
+    }
+};
+
+template <typename Quant, bool logScale>
+static void renderTileQuantizedScale(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1,
+                                     CpuFrameStats &stats)
+{
+    QuantizedSource<Quant, logScale> source;
+    source.init(*args.quantized);
+    renderBrickTile(args, source, x0, y0, x1, y1, stats);
+}
+
+void renderTileQuantized(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    const CpuQuantizedVolume &vol = *args.quantized;
+
+    if (vol.bits == 16)
+    {
+        if (vol.logScale) renderTileQuantizedScale<ushort, true>(args, x0, y0, x1, y1, stats);
+        else              renderTileQuantizedScale<ushort, false>(args, x0, y0, x1, y1, stats);
+    }
+    else
+    {
+        if (vol.logScale) renderTileQuantizedScale<uchar, true>(args, x0, y0, x1, y1, stats);
+        else              renderTileQuantizedScale<uchar, false>(args, x0, y0, x1, y1, stats);
+    }
+}
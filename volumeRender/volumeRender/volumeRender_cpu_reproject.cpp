@@ -0,0 +1,374 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Temporal reprojection for the CPU backend
+//
+// While the view is dragged, consecutive frames differ by a fraction of a
+// degree and most pixels could be taken from the last one.  Each pixel of
+// a full frame keeps one point along its ray, at the opacity weighted mean
+// depth (see storeRayDepth()).  The next frame projects these points into
+// its own view, keeps the nearest where several land on one pixel, and
+// marches only what is left: the pixels no point landed on (disocclusions,
+// cracks where the image is stretched, the background), pixels in a crack
+// of a nearer surface, and whatever was too old, too transparent or too
+// far off to carry.
+//
+// A pixel whose opacity is spread along its ray is only right from the eye
+// it was marched from; moving the eye by e shifts the parts of the ray a
+// distance s in front of and behind the point by about e*s/t^2 radians
+// against each other, t being the distance from the eye, and the image
+// spans about imageW pixels per radian.  That estimate, summed over the
+// frames a pixel is carried, is what maxError limits.  Pure rotation about
+// the eye moves nothing against anything else.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "volumeRender_cpu_internal.h"
+
+void freeReprojection(CpuReprojection &rp)
+{
+    free(rp.color);
+    free(rp.point);
+    free(rp.nextPoint);
+    free(rp.spread);
+    free(rp.nextSpread);
+    free(rp.drift);
+    free(rp.nextDrift);
+    free(rp.age);
+    free(rp.nextAge);
+    free(rp.depth);
+    free(rp.winner);
+    free(rp.holes);
+    memset(&rp, 0, sizeof(rp));
+}
+
+static void allocReprojection(CpuReprojection &rp, uint imageW, uint imageH)
+{
+    freeReprojection(rp);
+
+    size_t n = (size_t)imageW * imageH;
+    rp.color = (uint *)malloc(n * sizeof(uint));
+    rp.point = (vec3 *)malloc(n * sizeof(vec3));
+    rp.nextPoint = (vec3 *)malloc(n * sizeof(vec3));
+    rp.spread = (float *)malloc(n * sizeof(float));
+    rp.nextSpread = (float *)malloc(n * sizeof(float));
+    rp.drift = (float *)malloc(n * sizeof(float));
+    rp.nextDrift = (float *)malloc(n * sizeof(float));
+    rp.age = (uchar *)malloc(n);
+    rp.nextAge = (uchar *)malloc(n);
+    rp.depth = (float *)malloc(n * sizeof(float));
+    rp.winner = (unsigned long long *)malloc(n * sizeof(unsigned long long));
+    rp.holes = (uchar *)malloc(n);
+    rp.imageW = imageW;
+    rp.imageH = imageH;
+}
+
+// rotation between two views in degrees; the upper 3x3 of both matrices is
+// orthonormal, so cos(angle) = (trace(A^T B) - 1) / 2
+static float viewAngle(const float *a, const float *b)
+{
+    float trace = 0.0f;
+
+    for (int r = 0; r < 3; r++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            trace += a[r*4 + c] * b[r*4 + c];
+        }
+    }
+
+    return acosf(clampf((trace - 1.0f) * 0.5f, -1.0f, 1.0f)) * (180.0f / (float)M_PI);
+}
+
+// a carried pixel whose neighbours on both sides, left and right or above
+// and below, are nearer by more than this plus twice its spread sits in a
+// crack of a nearer surface and shows what is behind it
+#define CRACK_DEPTH 0.05f
+
+// a pixel nothing landed on whose neighbours on both sides landed (at about
+// the same depth, when compositing) is a crack where the image got
+// stretched; it takes the mean of the two (step 1 for left and right,
+// imageW for above and below) rather than a ray, which for a ray packet
+// would cost as much as all the pixels around it
+static bool crackBetween(const CpuReprojection &rp, size_t i, size_t step, bool composite)
+{
+    float a = rp.depth[i - step], b = rp.depth[i + step];
+    return a < INFINITY && b < INFINITY && (!composite || fabsf(a - b) <= CRACK_DEPTH);
+}
+
+static void fillCrack(CpuReprojection &rp, uint *output, size_t i, size_t step)
+{
+    size_t a = i - step, b = i + step;
+    uint ca = output[a], cb = output[b];
+
+    // bytewise mean, rounded up
+    output[i] = (ca | cb) - (((ca ^ cb) & 0xfefefefeu) >> 1);
+    rp.depth[i] = 0.5f * (rp.depth[a] + rp.depth[b]);
+    rp.nextPoint[i] = (rp.nextPoint[a] + rp.nextPoint[b]) * 0.5f;
+    rp.nextSpread[i] = maxf(rp.nextSpread[a], rp.nextSpread[b]);
+    rp.nextDrift[i] = maxf(rp.nextDrift[a], rp.nextDrift[b]);
+    rp.nextAge[i] = rp.nextAge[a] > rp.nextAge[b] ? rp.nextAge[a] : rp.nextAge[b];
+}
+
+// pixels left to march: those nothing landed on, and when compositing the
+// ones in a crack of a nearer surface
+static bool warpHole(const CpuReprojection &rp, uint x, uint y, bool composite)
+{
+    const uint w = rp.imageW;
+    size_t i = (size_t)y * w + x;
+
+    if (!(rp.depth[i] < INFINITY)) return true;
+
+    if (!composite) return false;
+
+    float t = rp.depth[i] - CRACK_DEPTH - 2.0f * rp.nextSpread[i];
+
+    if (x > 0 && x + 1 < w && rp.depth[i - 1] < t && rp.depth[i + 1] < t) return true;
+
+    return y > 0 && y + 1 < rp.imageH && rp.depth[i - w] < t && rp.depth[i + w] < t;
+}
+
+static void atomicMin(unsigned long long *p, unsigned long long v)
+{
+    unsigned long long cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (v < cur && !__atomic_compare_exchange_n(p, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+unsigned long long warpReprojection(CpuReprojection &rp, const CpuReprojectionParams &params,
+                                    unsigned long long key, RenderMode mode, const float *invViewMatrix,
+                                    uint *output, uint imageW, uint imageH, uint blockSize)
+{
+    const size_t n = (size_t)imageW * imageH;
+    const bool composite = mode == RENDER_COMPOSITE;
+
+    if (rp.imageW != imageW || rp.imageH != imageH)
+    {
+        allocReprojection(rp, imageW, imageH);
+    }
+
+    bool usable = rp.valid && rp.key == key && params.maxAge > 0 &&
+                  viewAngle(rp.invViewMatrix, invViewMatrix) <= params.maxAngle;
+
+    rp.key = key;
+    rp.valid = false;   // until storeReprojection()
+
+    // the points go the other way through the camera transform
+    // eyeRayForPixel() applies: the transpose of the rotation takes them to
+    // camera space, where pixel (x, y) looks along normalize(u, v, -2)
+    const float *m = invViewMatrix;
+    const vec3 eye = make_vec3(m[3], m[7], m[11]);
+    const vec3 eyeMove = eye - make_vec3(rp.invViewMatrix[3], rp.invViewMatrix[7], rp.invViewMatrix[11]);
+    const float parallax = sqrtf(dot(eyeMove, eyeMove)) * imageW;
+    const int chunks = (int)((n + 4095) / 4096);
+
+    // every point that may be carried claims the pixel it lands on with a
+    // key whose high half ranks it: the nearest point when compositing,
+    // the brightest (darkest) for a maximum (minimum) projection.  The low
+    // half is the source pixel, which also keeps the result independent of
+    // the order the threads come in.
+    cpuParallelFor(chunks, [&](int c)
+    {
+        memset(&rp.winner[(size_t)c * 4096], 0xff, ((size_t)(c + 1) * 4096 < n ? 4096 : n - (size_t)c * 4096) * sizeof(unsigned long long));
+    });
+
+    cpuParallelFor(usable ? chunks : 0, [&](int c)
+    {
+        size_t end = (size_t)(c + 1) * 4096 < n ? (size_t)(c + 1) * 4096 : n;
+
+        for (size_t i = (size_t)c * 4096; i < end; i++)
+        {
+            vec3 p = rp.point[i] - eye;
+
+            if (p.x != p.x || rp.age[i] >= params.maxAge) continue;
+
+            vec3 q = make_vec3(m[0]*p.x + m[4]*p.y + m[8]*p.z,
+                               m[1]*p.x + m[5]*p.y + m[9]*p.z,
+                               m[2]*p.x + m[6]*p.y + m[10]*p.z);
+
+            if (q.z >= 0.0f) continue;
+
+            float fx = floorf((1.0f - 2.0f * q.x / q.z) * 0.5f * imageW + 0.5f);
+            float fy = floorf((1.0f - 2.0f * q.y / q.z) * 0.5f * imageH + 0.5f);
+
+            if (fx < 0.0f || fy < 0.0f || fx >= (float)imageW || fy >= (float)imageH) continue;
+
+            float t2 = dot(q, q);
+
+            if (rp.drift[i] + rp.spread[i] * parallax / t2 > params.maxError) continue;
+
+            uint rank, grey = rp.color[i] & 0xff;
+
+            if (composite)
+            {
+                memcpy(&rank, &t2, sizeof(rank));   // positive floats order as their bits
+            }
+            else
+            {
+                rank = mode == RENDER_MIP ? 255 - grey : grey;
+            }
+
+            atomicMin(&rp.winner[(size_t)fy * imageW + (size_t)fx], (unsigned long long)rank << 32 | i);
+        }
+    });
+
+    cpuParallelFor(chunks, [&](int c)
+    {
+        size_t end = (size_t)(c + 1) * 4096 < n ? (size_t)(c + 1) * 4096 : n;
+
+        for (size_t j = (size_t)c * 4096; j < end; j++)
+        {
+            if (rp.winner[j] == ~0ull)
+            {
+                rp.depth[j] = INFINITY;
+                continue;
+            }
+
+            size_t i = (size_t)(rp.winner[j] & 0xffffffffu);
+            vec3 p = rp.point[i] - eye;
+            float t2 = dot(p, p);
+
+            rp.depth[j] = sqrtf(t2);
+            rp.nextPoint[j] = rp.point[i];
+            rp.nextSpread[j] = rp.spread[i];
+            rp.nextDrift[j] = rp.drift[i] + rp.spread[i] * parallax / t2;
+            rp.nextAge[j] = rp.age[i] + 1;
+            output[j] = rp.color[i];
+        }
+    });
+
+    // cracks in the warped image are found first, so that filling them
+    // cannot feed into the test of their neighbours
+    cpuParallelFor((int)imageH, [&](int yi)
+    {
+        uint y = (uint)yi;
+
+        for (uint x = 0; x < imageW; x++)
+        {
+            size_t i = (size_t)y * imageW + x;
+            uchar crack = 0;
+
+            if (usable && !(rp.depth[i] < INFINITY))
+            {
+                if (x > 0 && x + 1 < imageW && crackBetween(rp, i, 1, composite))
+                {
+                    crack = 1;
+                }
+                else if (y > 0 && y + 1 < imageH && crackBetween(rp, i, imageW, composite))
+                {
+                    crack = 2;
+                }
+            }
+
+            rp.holes[i] = crack;
+        }
+    });
+
+    cpuParallelFor((int)imageH, [&](int y)
+    {
+        for (size_t i = (size_t)y * imageW; i < (size_t)(y + 1) * imageW; i++)
+        {
+            if (rp.holes[i])
+            {
+                fillCrack(rp, output, i, rp.holes[i] == 1 ? 1 : imageW);
+            }
+        }
+    });
+
+    // a block with any hole in it is marched whole, and its pixels start
+    // over together; the marchers only write the holes whose ray hits
+    // something, so the rest are cleared here
+    std::atomic<unsigned long long> reused(0);
+
+    cpuParallelFor((int)((imageH + blockSize - 1) / blockSize), [&](int by)
+    {
+        uint y0 = by * blockSize, y1 = y0 + blockSize < imageH ? y0 + blockSize : imageH;
+        unsigned long long rowReused = 0;
+
+        for (uint x0 = 0; x0 < imageW; x0 += blockSize)
+        {
+            uint x1 = x0 + blockSize < imageW ? x0 + blockSize : imageW;
+            bool hole = false;
+
+            for (uint y = y0; y < y1 && !hole; y++)
+            {
+                for (uint x = x0; x < x1 && !hole; x++)
+                {
+                    hole = warpHole(rp, x, y, composite);
+                }
+            }
+
+            for (uint y = y0; y < y1; y++)
+            {
+                for (uint x = x0; x < x1; x++)
+                {
+                    size_t i = (size_t)y * imageW + x;
+                    rp.holes[i] = hole;
+
+                    if (hole)
+                    {
+                        output[i] = 0;
+                        rp.depth[i] = NAN;
+                    }
+                }
+            }
+
+            rowReused += hole ? 0 : (x1 - x0) * (y1 - y0);
+        }
+
+        reused += rowReused;
+    });
+
+    return reused;
+}
+
+void storeReprojection(CpuReprojection &rp, const CpuReprojectionParams &params,
+                       const float *invViewMatrix, const uint *output)
+{
+    const uint maxAge = params.maxAge > 1 ? params.maxAge : 1;
+
+    // points of the marched pixels, which start at scattered ages so that
+    // they do not all expire in the same frame; the same per 4x4 block,
+    // which is what a ray packet covers
+    cpuParallelFor((int)rp.imageH, [&](int yi)
+    {
+        uint y = (uint)yi;
+
+        for (uint x = 0; x < rp.imageW; x++)
+        {
+            size_t i = (size_t)y * rp.imageW + x;
+
+            if (!rp.holes[i]) continue;
+
+            float t = rp.depth[i];
+            CpuRay ray = eyeRayForPixel(invViewMatrix, (x / (float)rp.imageW)*2.0f-1.0f,
+                                                       (y / (float)rp.imageH)*2.0f-1.0f);
+
+            rp.nextPoint[i] = t == t ? ray.o + ray.d*t : make_vec3(NAN, NAN, NAN);
+            rp.nextDrift[i] = 0.0f;
+            rp.nextAge[i] = (uchar)((((x >> 2) * 73856093u) ^ ((y >> 2) * 19349663u)) % maxAge);
+        }
+    });
+
+    memcpy(rp.color, output, (size_t)rp.imageW * rp.imageH * sizeof(uint));
+    std::swap(rp.point, rp.nextPoint);
+    std::swap(rp.spread, rp.nextSpread);
+    std::swap(rp.drift, rp.nextDrift);
+    std::swap(rp.age, rp.nextAge);
+    memcpy(rp.invViewMatrix, invViewMatrix, sizeof(rp.invViewMatrix));
+    rp.valid = true;
+}
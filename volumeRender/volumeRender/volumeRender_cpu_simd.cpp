@@ -0,0 +1,1216 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Ray packet version of the CPU ray marcher
+//
+// This file is compiled twice, once with -DCPU_SIMD_AVX2 -mavx2 -mfma and
+// once with -DCPU_SIMD_AVX512 -mavx512f, and volumeRender_cpu.cpp picks the
+// widest version the CPU runs.  Each vector lane marches one ray of a small
+// block of neighbouring pixels (4x2 for AVX2, 4x4 for AVX-512); lanes whose
+// ray missed the box, left it or became opaque are masked off until the
+// whole packet is done.
+//
+// With adaptive marching each lane also carries the step multiplier of its
+// current macrocell, so lanes advance by different numbers of samples.
+// With pre-integration each lane keeps its previous sample as the front of
+// the next segment.  With levels of detail the whole packet samples the
+// level of its nearest lane, which the lanes of a few neighbouring pixels
+// almost always share.
+
+#include <string.h>
+
+#include "volumeRender_cpu_internal.h"
+
+#if defined(CPU_SIMD_AVX512)
+#define SIMD_TILE_FUNC renderTileAvx512
+#elif defined(CPU_SIMD_AVX2)
+#define SIMD_TILE_FUNC renderTileAvx2
+#else
+#error "build with -DCPU_SIMD_AVX2 or -DCPU_SIMD_AVX512"
+#endif
+
+#if (defined(CPU_SIMD_AVX512) && defined(__AVX512F__)) || (defined(CPU_SIMD_AVX2) && defined(__AVX2__) && defined(__FMA__))
+
+#include <immintrin.h>
+
+// everything up to SIMD_TILE_FUNC is compiled once per instruction set under
+// the same names, so keep it out of the other object's sight: the linker
+// would otherwise keep one copy of each engine for both
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// vector wrappers, so the marcher below is written once for both widths
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(CPU_SIMD_AVX512)
+
+#define SIMD_WIDTH 16
+#define PACKET_W   4
+#define PACKET_H   4
+
+typedef __m512    vfloat;
+typedef __m512i   vint;
+typedef __mmask16 vmask;
+
+inline vfloat vset1(float f)                        { return _mm512_set1_ps(f); }
+inline vfloat vload(const float *p)                 { return _mm512_loadu_ps(p); }
+inline void   vstore(float *p, vfloat a)            { _mm512_storeu_ps(p, a); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c)  { return _mm512_fmadd_ps(a, b, c); }
+inline vfloat vmin(vfloat a, vfloat b)              { return _mm512_min_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b)              { return _mm512_max_ps(a, b); }
+inline vfloat vfloor(vfloat a)                      { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+inline vfloat vceil(vfloat a)                       { return _mm512_roundscale_ps(a, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+inline vint   vtoint(vfloat a)                      { return _mm512_cvttps_epi32(a); }
+inline vfloat vtofloat(vint a)                      { return _mm512_cvtepi32_ps(a); }
+
+inline vint   vset1i(int i)                         { return _mm512_set1_epi32(i); }
+inline vint   vaddi(vint a, vint b)                 { return _mm512_add_epi32(a, b); }
+inline vint   vsubi(vint a, vint b)                 { return _mm512_sub_epi32(a, b); }
+inline vint   vmuli(vint a, vint b)                 { return _mm512_mullo_epi32(a, b); }
+inline vint   vmini(vint a, vint b)                 { return _mm512_min_epi32(a, b); }
+inline vint   vmaxi(vint a, vint b)                 { return _mm512_max_epi32(a, b); }
+inline vint   vandi(vint a, vint b)                 { return _mm512_and_si512(a, b); }
+inline vint   vsrli(vint a, int n)                  { return _mm512_srli_epi32(a, n); }
+inline vint   vsrai(vint a, int n)                  { return _mm512_srai_epi32(a, n); }
+inline vint   vslli(vint a, int n)                  { return _mm512_slli_epi32(a, n); }
+inline vint   vori(vint a, vint b)                  { return _mm512_or_si512(a, b); }
+inline void   vstorei(int *p, vint a)               { _mm512_storeu_si512(p, a); }
+
+inline vmask  vlt(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline vmask  vgt(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+inline vmask  vge(vfloat a, vfloat b)               { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+inline vmask  vmand(vmask a, vmask b)               { return a & b; }
+inline vmask  vmandnot(vmask a, vmask b)            { return a & ~b; }     // a && !b
+inline vmask  vmor(vmask a, vmask b)                { return a | b; }
+inline bool   vany(vmask m)                         { return m != 0; }
+inline int    vcount(vmask m)                       { return __builtin_popcount(m); }
+inline int    vmovemask(vmask m)                    { return (int)m; }
+inline vmask  vmaskfrombits(int bits)               { return (vmask)bits; }
+inline vfloat vselect(vmask m, vfloat a, vfloat b)  { return _mm512_mask_blend_ps(m, b, a); }   // m ? a : b
+inline vmask  veqi(vint a, vint b)                  { return _mm512_cmpeq_epi32_mask(a, b); }
+inline vfloat vasfloat(vint a)                      { return _mm512_castsi512_ps(a); }
+inline vint   vasint(vfloat a)                      { return _mm512_castps_si512(a); }
+
+// 32 bit loads from byte offsets into the volume
+inline vint   vgatherbytes(const uchar *base, vint offset) { return _mm512_i32gather_epi32(offset, base, 1); }
+inline vfloat vgatherf(const float *base, vint idx)        { return _mm512_i32gather_ps(idx, base, 4); }
+
+// table[idx] for a table of 16 floats
+inline vfloat vlookup16(const float *table, vint idx)
+{
+    return _mm512_permutexvar_ps(idx, _mm512_loadu_ps(table));
+}
+
+#else // CPU_SIMD_AVX2
+
+#define SIMD_WIDTH 8
+#define PACKET_W   4
+#define PACKET_H   2
+
+typedef __m256  vfloat;
+typedef __m256i vint;
+typedef __m256  vmask;
+
+inline vfloat vset1(float f)                        { return _mm256_set1_ps(f); }
+inline vfloat vload(const float *p)                 { return _mm256_loadu_ps(p); }
+inline void   vstore(float *p, vfloat a)            { _mm256_storeu_ps(p, a); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c)  { return _mm256_fmadd_ps(a, b, c); }
+inline vfloat vmin(vfloat a, vfloat b)              { return _mm256_min_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b)              { return _mm256_max_ps(a, b); }
+inline vfloat vfloor(vfloat a)                      { return _mm256_floor_ps(a); }
+inline vfloat vceil(vfloat a)                       { return _mm256_ceil_ps(a); }
+inline vint   vtoint(vfloat a)                      { return _mm256_cvttps_epi32(a); }
+inline vfloat vtofloat(vint a)                      { return _mm256_cvtepi32_ps(a); }
+
+inline vint   vset1i(int i)                         { return _mm256_set1_epi32(i); }
+inline vint   vaddi(vint a, vint b)                 { return _mm256_add_epi32(a, b); }
+inline vint   vsubi(vint a, vint b)                 { return _mm256_sub_epi32(a, b); }
+inline vint   vmuli(vint a, vint b)                 { return _mm256_mullo_epi32(a, b); }
+inline vint   vmini(vint a, vint b)                 { return _mm256_min_epi32(a, b); }
+inline vint   vmaxi(vint a, vint b)                 { return _mm256_max_epi32(a, b); }
+inline vint   vandi(vint a, vint b)                 { return _mm256_and_si256(a, b); }
+inline vint   vsrli(vint a, int n)                  { return _mm256_srli_epi32(a, n); }
+inline vint   vsrai(vint a, int n)                  { return _mm256_srai_epi32(a, n); }
+inline vint   vslli(vint a, int n)                  { return _mm256_slli_epi32(a, n); }
+inline vint   vori(vint a, vint b)                  { return _mm256_or_si256(a, b); }
+inline void   vstorei(int *p, vint a)               { _mm256_storeu_si256((__m256i *)p, a); }
+
+inline vmask  vlt(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vmask  vgt(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline vmask  vge(vfloat a, vfloat b)               { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline vmask  vmand(vmask a, vmask b)               { return _mm256_and_ps(a, b); }
+inline vmask  vmandnot(vmask a, vmask b)            { return _mm256_andnot_ps(b, a); }   // a && !b
+inline vmask  vmor(vmask a, vmask b)                { return _mm256_or_ps(a, b); }
+inline bool   vany(vmask m)                         { return _mm256_movemask_ps(m) != 0; }
+inline int    vcount(vmask m)                       { return __builtin_popcount(_mm256_movemask_ps(m)); }
+inline int    vmovemask(vmask m)                    { return _mm256_movemask_ps(m); }
+inline vfloat vselect(vmask m, vfloat a, vfloat b)  { return _mm256_blendv_ps(b, a, m); }    // m ? a : b
+inline vmask  veqi(vint a, vint b)                  { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+inline vfloat vasfloat(vint a)                      { return _mm256_castsi256_ps(a); }
+inline vint   vasint(vfloat a)                      { return _mm256_castps_si256(a); }
+
+inline vmask vmaskfrombits(int bits)
+{
+    const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i b = _mm256_and_si256(_mm256_set1_epi32(bits), lanes);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(b, lanes));
+}
+
+// 32 bit loads from byte offsets into the volume
+inline vint   vgatherbytes(const uchar *base, vint offset) { return _mm256_i32gather_epi32((const int *)base, offset, 1); }
+inline vfloat vgatherf(const float *base, vint idx)        { return _mm256_i32gather_ps(base, idx, 4); }
+
+// table[idx] for a table of 16 floats
+inline vfloat vlookup16(const float *table, vint idx)
+{
+    return _mm256_i32gather_ps(table, idx, 4);
+}
+
+#endif
+
+// +, - and * on vfloat come from the GCC/Clang vector extensions
+
+////////////////////////////////////////////////////////////////////////////////
+// vectorized texture fetches
+////////////////////////////////////////////////////////////////////////////////
+
+// transfer function as structure of arrays, padded to 16 entries
+struct TransferSoA
+{
+    float r[16], g[16], b[16], a[16];
+};
+
+static TransferSoA makeTransferSoA()
+{
+    TransferSoA t;
+    memset(&t, 0, sizeof(t));
+
+    for (int i = 0; i < TRANSFER_FUNC_SIZE; i++)
+    {
+        t.r[i] = cpuTransferFunc[i].x;
+        t.g[i] = cpuTransferFunc[i].y;
+        t.b[i] = cpuTransferFunc[i].z;
+        t.a[i] = cpuTransferFunc[i].w;
+    }
+
+    return t;
+}
+
+static const TransferSoA transferSoA = makeTransferSoA();
+
+// halfToFloat() for the low 16 bits of each lane
+inline vfloat vhalftofloat(vint h)
+{
+    vint shiftedExp = vset1i(0x7c00 << 13);
+    vint o = vslli(vandi(h, vset1i(0x7fff)), 13);
+    vint exp = vandi(o, shiftedExp);
+    o = vaddi(o, vset1i((127 - 15) << 23));
+
+    vfloat infNan = vasfloat(vaddi(o, vset1i((128 - 16) << 23)));
+    vfloat denormal = vasfloat(vaddi(o, vset1i(1 << 23))) - vasfloat(vset1i(113 << 23));
+    vfloat f = vselect(veqi(exp, shiftedExp), infNan, vasfloat(o));
+    f = vselect(veqi(exp, vset1i(0)), denormal, f);
+
+    return vasfloat(vori(vasint(f), vslli(vandi(h, vset1i(0x8000)), 16)));
+}
+
+// voxelValue() of the voxels at offsets i
+inline vfloat vfetch(const uchar *data, vint i)
+{
+    return vtofloat(vandi(vgatherbytes(data, i), vset1i(0xff)));
+}
+
+inline vfloat vfetch(const ushort *data, vint i)
+{
+    return vtofloat(vandi(vgatherbytes((const uchar *)data, vaddi(i, i)), vset1i(0xffff)));
+}
+
+inline vfloat vfetch(const float *data, vint i)
+{
+    return vgatherf(data, i);
+}
+
+inline vfloat vfetch(const CpuHalf *data, vint i)
+{
+    return vhalftofloat(vgatherbytes((const uchar *)data, vaddi(i, i)));
+}
+
+// voxelValue() of the voxels at offsets i and i + 1; one 32 bit gather
+// covers both for the types narrower than 32 bits
+inline void vfetchpair(const uchar *data, vint i, vfloat &a, vfloat &b)
+{
+    vint g = vgatherbytes(data, i);
+    a = vtofloat(vandi(g, vset1i(0xff)));
+    b = vtofloat(vandi(vsrli(g, 8), vset1i(0xff)));
+}
+
+inline void vfetchpair(const ushort *data, vint i, vfloat &a, vfloat &b)
+{
+    vint g = vgatherbytes((const uchar *)data, vaddi(i, i));
+    a = vtofloat(vandi(g, vset1i(0xffff)));
+    b = vtofloat(vsrli(g, 16));
+}
+
+inline void vfetchpair(const float *data, vint i, vfloat &a, vfloat &b)
+{
+    a = vgatherf(data, i);
+    b = vgatherf(data + 1, i);
+}
+
+inline void vfetchpair(const CpuHalf *data, vint i, vfloat &a, vfloat &b)
+{
+    vint g = vgatherbytes((const uchar *)data, vaddi(i, i));
+    a = vhalftofloat(g);
+    b = vhalftofloat(vsrli(g, 16));
+}
+
+// brickedOffset() for a whole packet
+inline vint brickedOffsetV(const CpuVolume &vol, vint x, vint y, vint z)
+{
+    vint mask = vset1i(BRICK_MASK);
+    vint brick = vaddi(vmuli(vaddi(vmuli(vsrli(z, BRICK_SHIFT), vset1i(vol.bricksY)), vsrli(y, BRICK_SHIFT)),
+                             vset1i(vol.bricksX)), vsrli(x, BRICK_SHIFT));
+    vint local = vaddi(vmuli(vaddi(vmuli(vandi(z, mask), vset1i(BRICK_PITCH)), vandi(y, mask)), vset1i(BRICK_PITCH)),
+                       vandi(x, mask));
+
+    return vaddi(vmuli(brick, vset1i(BRICK_VOXELS)), local);
+}
+
+// Morton bits of coordinates i along axis a, from the deposit tables
+inline vint mortonDepositV(const CpuVolume &vol, int a, vint i)
+{
+    return vgatherbytes((const uchar *)vol.mortonTable[a], vslli(i, 2));
+}
+
+// offset of voxel (x, y, z) in any layout
+inline vint voxelOffsetV(const CpuVolume &vol, vint x, vint y, vint z)
+{
+    if (vol.layout == CPU_LAYOUT_BRICKED)
+    {
+        return brickedOffsetV(vol, x, y, z);
+    }
+
+    if (vol.layout == CPU_LAYOUT_MORTON)
+    {
+        return vori(vori(mortonDepositV(vol, 0, x), mortonDepositV(vol, 1, y)), mortonDepositV(vol, 2, z));
+    }
+
+    return vaddi(vaddi(vmuli(z, vset1i(vol.width * vol.height)), vmuli(y, vset1i(vol.width))), x);
+}
+
+// the eight taps of a Morton ordered volume, x neighbours are not adjacent
+template <typename Voxel>
+inline vfloat sampleVolumeMortonV(const CpuVolume &vol, vint x0, vint y0, vint y1, vint z0, vint z1,
+                                  vfloat ax, vfloat ay, vfloat az)
+{
+    vint x1 = vmini(vaddi(x0, vset1i(1)), vset1i(vol.width - 1));
+    vint mx0 = mortonDepositV(vol, 0, x0), mx1 = mortonDepositV(vol, 0, x1);
+    vint my0 = mortonDepositV(vol, 1, y0), my1 = mortonDepositV(vol, 1, y1);
+    vint mz0 = mortonDepositV(vol, 2, z0), mz1 = mortonDepositV(vol, 2, z1);
+    vint r00 = vori(my0, mz0), r01 = vori(my1, mz0);
+    vint r10 = vori(my0, mz1), r11 = vori(my1, mz1);
+
+    const Voxel *data = (const Voxel *)vol.data;
+    vfloat a00 = vfetch(data, vori(r00, mx0)), b00 = vfetch(data, vori(r00, mx1));
+    vfloat a01 = vfetch(data, vori(r01, mx0)), b01 = vfetch(data, vori(r01, mx1));
+    vfloat a10 = vfetch(data, vori(r10, mx0)), b10 = vfetch(data, vori(r10, mx1));
+    vfloat a11 = vfetch(data, vori(r11, mx0)), b11 = vfetch(data, vori(r11, mx1));
+
+    vfloat c00 = vfmadd(ax, b00 - a00, a00);
+    vfloat c01 = vfmadd(ax, b01 - a01, a01);
+    vfloat c10 = vfmadd(ax, b10 - a10, a10);
+    vfloat c11 = vfmadd(ax, b11 - a11, a11);
+
+    vfloat c0 = vfmadd(ay, c01 - c00, c00);
+    vfloat c1 = vfmadd(ay, c11 - c10, c10);
+
+    return vfmadd(az, c1 - c0, c0) * vset1(voxelScale<Voxel>());
+}
+
+// trilinear fetch, see sampleVolumeLinear().  In the linear and bricked
+// layouts the two x neighbours are adjacent, so each of the four (y, z)
+// rows costs one 32 bit gather for voxels up to 16 bits.
+template <typename Voxel>
+inline vfloat sampleVolumeLinearV(const CpuVolume &vol, vfloat u, vfloat v, vfloat w)
+{
+    vfloat x = vfmadd(u, vset1((float)vol.width),  vset1(-0.5f));
+    vfloat y = vfmadd(v, vset1((float)vol.height), vset1(-0.5f));
+    vfloat z = vfmadd(w, vset1((float)vol.depth),  vset1(-0.5f));
+
+    vfloat fx = vfloor(x), fy = vfloor(y), fz = vfloor(z);
+    vfloat ax = x - fx, ay = y - fy, az = z - fz;
+
+    // outside [0, width-1) both x taps clamp to the same voxel
+    vmask xEdge = vmor(vlt(fx, vset1(0.0f)), vge(fx, vset1((float)(vol.width - 1))));
+    ax = vselect(xEdge, vset1(0.0f), ax);
+
+    vint zero = vset1i(0);
+    vint ix = vmini(vmaxi(vtoint(vmax(fx, vset1(-1.0f))), zero), vset1i(vol.width - 1));
+    vint iy = vtoint(vmin(vmax(fy, vset1(-1.0f)), vset1((float)vol.height)));
+    vint iz = vtoint(vmin(vmax(fz, vset1(-1.0f)), vset1((float)vol.depth)));
+
+    vint hmax = vset1i(vol.height - 1), dmax = vset1i(vol.depth - 1);
+    vint y0 = vmini(vmaxi(iy, zero), hmax), y1 = vmini(vmaxi(vaddi(iy, vset1i(1)), zero), hmax);
+    vint z0 = vmini(vmaxi(iz, zero), dmax), z1 = vmini(vmaxi(vaddi(iz, vset1i(1)), zero), dmax);
+
+    if (vol.layout == CPU_LAYOUT_MORTON)
+    {
+        return sampleVolumeMortonV<Voxel>(vol, ix, y0, y1, z0, z1, ax, ay, az);
+    }
+
+    // the other rows are one row / slice on, or none where clamped
+    bool bricked = vol.layout == CPU_LAYOUT_BRICKED;
+    vint sy = vset1i(bricked ? BRICK_PITCH : vol.width);
+    vint sz = vset1i(bricked ? BRICK_SLICE : vol.width * vol.height);
+    vint r00 = voxelOffsetV(vol, ix, y0, z0);
+    vint dy = vmuli(vsubi(y1, y0), sy);
+    vint dz = vmuli(vsubi(z1, z0), sz);
+    vint r01 = vaddi(r00, dy);
+    vint r10 = vaddi(r00, dz);
+    vint r11 = vaddi(r10, dy);
+
+    const Voxel *data = (const Voxel *)vol.data;
+    vfloat a00, b00, a01, b01, a10, b10, a11, b11;
+    vfetchpair(data, r00, a00, b00);
+    vfetchpair(data, r01, a01, b01);
+    vfetchpair(data, r10, a10, b10);
+    vfetchpair(data, r11, a11, b11);
+
+    vfloat c00 = vfmadd(ax, b00 - a00, a00);
+    vfloat c01 = vfmadd(ax, b01 - a01, a01);
+    vfloat c10 = vfmadd(ax, b10 - a10, a10);
+    vfloat c11 = vfmadd(ax, b11 - a11, a11);
+
+    vfloat c0 = vfmadd(ay, c01 - c00, c00);
+    vfloat c1 = vfmadd(ay, c11 - c10, c10);
+
+    return vfmadd(az, c1 - c0, c0) * vset1(voxelScale<Voxel>());
+}
+
+template <typename Voxel>
+inline vfloat sampleVolumeNearestV(const CpuVolume &vol, vfloat u, vfloat v, vfloat w)
+{
+    // clamp in float first so huge coordinates cannot overflow the conversion
+    vfloat fx = vfloor(vmin(vmax(u * vset1((float)vol.width),  vset1(0.0f)), vset1((float)(vol.width  - 1))));
+    vfloat fy = vfloor(vmin(vmax(v * vset1((float)vol.height), vset1(0.0f)), vset1((float)(vol.height - 1))));
+    vfloat fz = vfloor(vmin(vmax(w * vset1((float)vol.depth),  vset1(0.0f)), vset1((float)(vol.depth  - 1))));
+
+    vint offset = voxelOffsetV(vol, vtoint(fx), vtoint(fy), vtoint(fz));
+
+    return vfetch((const Voxel *)vol.data, offset) * vset1(voxelScale<Voxel>());
+}
+
+// voxelFixed() of the voxels at offsets i
+inline vint vfetchfixed(const uchar *data, vint i)
+{
+    return vslli(vandi(vgatherbytes(data, i), vset1i(0xff)), 8);
+}
+
+inline vint vfetchfixed(const ushort *data, vint i)
+{
+    return vandi(vgatherbytes((const uchar *)data, vaddi(i, i)), vset1i(0xffff));
+}
+
+// voxelFixed() of the voxels at offsets i and i + 1
+inline void vfetchpairfixed(const uchar *data, vint i, vint &a, vint &b)
+{
+    vint g = vgatherbytes(data, i);
+    a = vslli(vandi(g, vset1i(0xff)), 8);
+    b = vandi(g, vset1i(0xff00));
+}
+
+inline void vfetchpairfixed(const ushort *data, vint i, vint &a, vint &b)
+{
+    vint g = vgatherbytes((const uchar *)data, vaddi(i, i));
+    a = vandi(g, vset1i(0xffff));
+    b = vsrli(g, 16);
+}
+
+// lerpFixed() for a whole packet
+inline vint vlerpfixed(vint p, vint q, vint w)
+{
+    return vaddi(p, vsrai(vaddi(vmuli(vsubi(q, p), w), vset1i(128)), 8));
+}
+
+// transferIndex() for a whole packet
+inline vint transferIndexV(const CpuTransferTable &table, vint f)
+{
+    vint i = vsrai(vaddi(vmuli(vsubi(f, vset1i(table.fixedBase)), vset1i(table.fixedMul)), vset1i(32768)), 16);
+
+    return vmini(vmaxi(i, vset1i(0)), vset1i(TRANSFER_TABLE_SIZE - 1));
+}
+
+// fixed point trilinear fetch, see sampleVolumeLinearFixed(); bit identical
+// to it for the same coordinates
+template <typename Voxel>
+inline vint sampleVolumeLinearFixedV(const CpuVolume &vol, const CpuTransferTable &table, vfloat u, vfloat v, vfloat w)
+{
+    vfloat offset = vset1(-127.5f), lo = vset1(-256.0f);
+    vfloat fx = vfloor(vmin(vmax(vfmadd(u, vset1(vol.width  * 256.0f), offset), lo), vset1(vol.width  * 256.0f)));
+    vfloat fy = vfloor(vmin(vmax(vfmadd(v, vset1(vol.height * 256.0f), offset), lo), vset1(vol.height * 256.0f)));
+    vfloat fz = vfloor(vmin(vmax(vfmadd(w, vset1(vol.depth  * 256.0f), offset), lo), vset1(vol.depth  * 256.0f)));
+    vint x = vtoint(fx), y = vtoint(fy), z = vtoint(fz);
+    vint fraction = vset1i(255);
+    vint wx = vandi(x, fraction), wy = vandi(y, fraction), wz = vandi(z, fraction);
+
+    // outside [0, width-1) both x taps clamp to the same voxel
+    vmask xEdge = vmor(vlt(fx, vset1(0.0f)), vge(fx, vset1((vol.width - 1) * 256.0f)));
+    wx = vasint(vselect(xEdge, vset1(0.0f), vasfloat(wx)));
+
+    vint zero = vset1i(0), one = vset1i(1);
+    vint iy = vsrai(y, 8), iz = vsrai(z, 8);
+    vint hmax = vset1i(vol.height - 1), dmax = vset1i(vol.depth - 1);
+    vint x0 = vmini(vmaxi(vsrai(x, 8), zero), vset1i(vol.width - 1));
+    vint y0 = vmini(vmaxi(iy, zero), hmax), y1 = vmini(vmaxi(vaddi(iy, one), zero), hmax);
+    vint z0 = vmini(vmaxi(iz, zero), dmax), z1 = vmini(vmaxi(vaddi(iz, one), zero), dmax);
+
+    const Voxel *data = (const Voxel *)vol.data;
+    vint a00, b00, a01, b01, a10, b10, a11, b11;
+
+    if (vol.layout == CPU_LAYOUT_MORTON)
+    {
+        vint x1 = vmini(vaddi(x0, one), vset1i(vol.width - 1));
+        vint mx0 = mortonDepositV(vol, 0, x0), mx1 = mortonDepositV(vol, 0, x1);
+        vint my0 = mortonDepositV(vol, 1, y0), my1 = mortonDepositV(vol, 1, y1);
+        vint mz0 = mortonDepositV(vol, 2, z0), mz1 = mortonDepositV(vol, 2, z1);
+        vint r00 = vori(my0, mz0), r01 = vori(my1, mz0);
+        vint r10 = vori(my0, mz1), r11 = vori(my1, mz1);
+
+        a00 = vfetchfixed(data, vori(r00, mx0)), b00 = vfetchfixed(data, vori(r00, mx1));
+        a01 = vfetchfixed(data, vori(r01, mx0)), b01 = vfetchfixed(data, vori(r01, mx1));
+        a10 = vfetchfixed(data, vori(r10, mx0)), b10 = vfetchfixed(data, vori(r10, mx1));
+        a11 = vfetchfixed(data, vori(r11, mx0)), b11 = vfetchfixed(data, vori(r11, mx1));
+    }
+    else
+    {
+        bool bricked = vol.layout == CPU_LAYOUT_BRICKED;
+        vint sy = vset1i(bricked ? BRICK_PITCH : vol.width);
+        vint sz = vset1i(bricked ? BRICK_SLICE : vol.width * vol.height);
+        vint r00 = voxelOffsetV(vol, x0, y0, z0);
+        vint dy = vmuli(vsubi(y1, y0), sy);
+        vint dz = vmuli(vsubi(z1, z0), sz);
+        vint r01 = vaddi(r00, dy);
+        vint r10 = vaddi(r00, dz);
+        vint r11 = vaddi(r10, dy);
+
+        vfetchpairfixed(data, r00, a00, b00);
+        vfetchpairfixed(data, r01, a01, b01);
+        vfetchpairfixed(data, r10, a10, b10);
+        vfetchpairfixed(data, r11, a11, b11);
+    }
+
+    vint c00 = vlerpfixed(a00, b00, wx);
+    vint c01 = vlerpfixed(a01, b01, wx);
+    vint c10 = vlerpfixed(a10, b10, wx);
+    vint c11 = vlerpfixed(a11, b11, wx);
+
+    vint c0 = vlerpfixed(c00, c01, wy);
+    vint c1 = vlerpfixed(c10, c11, wy);
+
+    return transferIndexV(table, vlerpfixed(c0, c1, wz));
+}
+
+template <typename Voxel>
+inline vint sampleVolumeNearestFixedV(const CpuVolume &vol, const CpuTransferTable &table, vfloat u, vfloat v, vfloat w)
+{
+    vfloat fx = vfloor(vmin(vmax(u * vset1((float)vol.width),  vset1(0.0f)), vset1((float)(vol.width  - 1))));
+    vfloat fy = vfloor(vmin(vmax(v * vset1((float)vol.height), vset1(0.0f)), vset1((float)(vol.height - 1))));
+    vfloat fz = vfloor(vmin(vmax(w * vset1((float)vol.depth),  vset1(0.0f)), vset1((float)(vol.depth  - 1))));
+
+    vint offset = voxelOffsetV(vol, vtoint(fx), vtoint(fy), vtoint(fz));
+
+    return transferIndexV(table, vfetchfixed((const Voxel *)vol.data, offset));
+}
+
+// linear transfer function fetch, see sampleTransfer()
+inline void sampleTransferV(vfloat c, vfloat &r, vfloat &g, vfloat &b, vfloat &a)
+{
+    vfloat x = vfmadd(c, vset1((float)TRANSFER_FUNC_SIZE), vset1(-0.5f));
+    x = vmin(vmax(x, vset1(-1.0f)), vset1((float)TRANSFER_FUNC_SIZE));
+    vfloat fx = vfloor(x);
+    vfloat t = x - fx;
+    vint i = vtoint(fx);
+    vint i0 = vmini(vmaxi(i, vset1i(0)), vset1i(TRANSFER_FUNC_SIZE - 1));
+    vint i1 = vmini(vmaxi(vaddi(i, vset1i(1)), vset1i(0)), vset1i(TRANSFER_FUNC_SIZE - 1));
+
+    vfloat r0 = vlookup16(transferSoA.r, i0), r1 = vlookup16(transferSoA.r, i1);
+    vfloat g0 = vlookup16(transferSoA.g, i0), g1 = vlookup16(transferSoA.g, i1);
+    vfloat b0 = vlookup16(transferSoA.b, i0), b1 = vlookup16(transferSoA.b, i1);
+    vfloat a0 = vlookup16(transferSoA.a, i0), a1 = vlookup16(transferSoA.a, i1);
+
+    r = vfmadd(t, r1 - r0, r0);
+    g = vfmadd(t, g1 - g0, g0);
+    b = vfmadd(t, b1 - b0, b0);
+    a = vfmadd(t, a1 - a0, a0);
+}
+
+template <typename Voxel, bool linearFilter>
+inline vfloat sampleVolumeV(const CpuVolume &vol, vfloat u, vfloat v, vfloat w)
+{
+    return linearFilter ? sampleVolumeLinearV<Voxel>(vol, u, v, w) : sampleVolumeNearestV<Voxel>(vol, u, v, w);
+}
+
+// classifySample() for a whole packet
+template <typename Voxel, bool linearFilter>
+inline void classifyV(const CpuRenderArgs &args, const CpuVolume &vol, vfloat u, vfloat v, vfloat w,
+                      vfloat &r, vfloat &g, vfloat &b, vfloat &a, std::false_type)
+{
+    vfloat sample = sampleVolumeV<Voxel, linearFilter>(vol, u, v, w);
+
+    sampleTransferV((sample - vset1(args.transferOffset)) * vset1(args.transferScale), r, g, b, a);
+    a = a * vset1(args.density);
+}
+
+template <typename Voxel, bool linearFilter>
+inline void classifyV(const CpuRenderArgs &args, const CpuVolume &vol, vfloat u, vfloat v, vfloat w,
+                      vfloat &r, vfloat &g, vfloat &b, vfloat &a, std::true_type)
+{
+    const CpuTransferTable &table = *args.transferTable;
+    vint i = linearFilter ? sampleVolumeLinearFixedV<Voxel>(vol, table, u, v, w) :
+                            sampleVolumeNearestFixedV<Voxel>(vol, table, u, v, w);
+
+    r = vgatherf(table.r, i);
+    g = vgatherf(table.g, i);
+    b = vgatherf(table.b, i);
+    a = vgatherf(table.a, i);
+}
+
+// rgbaFloatToInt() for a whole packet
+inline vint rgbaFloatToIntV(vfloat r, vfloat g, vfloat b, vfloat a)
+{
+    vfloat zero = vset1(0.0f), one = vset1(1.0f), s = vset1(255.0f);
+    vint ir = vtoint(vmin(vmax(r, zero), one) * s);
+    vint ig = vtoint(vmin(vmax(g, zero), one) * s);
+    vint ib = vtoint(vmin(vmax(b, zero), one) * s);
+    vint ia = vtoint(vmin(vmax(a, zero), one) * s);
+
+    return vori(vori(vslli(ia, 24), vslli(ib, 16)), vori(vslli(ig, 8), ir));
+}
+
+// distance along each lane's ray to the face of its macrocell on one axis
+inline vfloat cellFaceDistance(vfloat o, vfloat d, vfloat t, float scale, int cells, vint &c)
+{
+    vfloat zero = vset1(0.0f);
+    vfloat g = vmin(vmax((vfmadd(d, t, o) + vset1(1.0f)) * vset1(scale), zero), vset1((float)(cells - 1)));
+    vfloat fc = vfloor(g);
+    c = vtoint(fc);
+
+    // the face ahead is cell+1 moving forward, cell moving backward
+    vfloat face = (fc + vselect(vgt(d, zero), vset1(1.0f), zero)) * vset1(1.0f / scale) - vset1(1.0f);
+    vfloat dist = (face - o) / d;
+
+    return vselect(vmor(vlt(d, zero), vgt(d, zero)), dist, vset1(INFINITY));
+}
+
+// samplePreint() for a whole packet: 4 taps x 4 channels of gathers
+inline void samplePreintV(const CpuPreintTable &table, vfloat sf, vfloat sb,
+                          vfloat &r, vfloat &g, vfloat &b, vfloat &a)
+{
+    vfloat zero = vset1(0.0f), one = vset1(1.0f), last = vset1((float)(PREINT_SIZE - 1));
+    vfloat valueMin = vset1(table.valueMin), valueScale = vset1(table.valueScale);
+    vfloat x = vmin(vmax((sb - valueMin) * valueScale, zero), one) * last;
+    vfloat y = vmin(vmax((sf - valueMin) * valueScale, zero), one) * last;
+    vfloat fx = vmin(vfloor(x), vset1((float)(PREINT_SIZE - 2)));
+    vfloat fy = vmin(vfloor(y), vset1((float)(PREINT_SIZE - 2)));
+    vfloat ax = x - fx, ay = y - fy;
+
+    vint i00 = vaddi(vmuli(vtoint(fy), vset1i(PREINT_SIZE)), vtoint(fx));
+    vint i01 = vaddi(i00, vset1i(1));
+    vint i10 = vaddi(i00, vset1i(PREINT_SIZE));
+    vint i11 = vaddi(i10, vset1i(1));
+
+    const float *ch[4] = { table.r, table.g, table.b, table.a };
+    vfloat out[4];
+
+    for (int k = 0; k < 4; k++)
+    {
+        vfloat c00 = vgatherf(ch[k], i00), c01 = vgatherf(ch[k], i01);
+        vfloat c10 = vgatherf(ch[k], i10), c11 = vgatherf(ch[k], i11);
+        vfloat c0 = vfmadd(ax, c01 - c00, c00);
+        vfloat c1 = vfmadd(ax, c11 - c10, c10);
+        out[k] = vfmadd(ay, c1 - c0, c0);
+    }
+
+    r = out[0];
+    g = out[1];
+    b = out[2];
+    a = out[3];
+}
+
+// b^n for integer n in [1, 2*MAX_STEP_SCALE), by repeated squaring
+inline vfloat vpowi(vfloat b, vint n)
+{
+    vfloat r = vset1(1.0f);
+
+    for (int bit = 1; bit < 2 * MAX_STEP_SCALE; bit <<= 1)
+    {
+        vmask set = vgt(vtofloat(vandi(n, vset1i(bit))), vset1(0.0f));
+        r = vselect(set, r * b, r);
+        b = b * b;
+    }
+
+    return r;
+}
+
+// packet version of the macrocell lookup: returns the index of the value
+// range of each lane's cell at t into the summary tables, and in tExit where
+// each lane's ray leaves its cell
+inline vint macrocellKeyV(const CpuMacrocells &cells, const vec3 &o, vfloat dx, vfloat dy, vfloat dz,
+                          vfloat t, vfloat &tExit)
+{
+    vint cx, cy, cz;
+    vfloat tx = cellFaceDistance(vset1(o.x), dx, t, cells.scaleX, cells.cellsX, cx);
+    vfloat ty = cellFaceDistance(vset1(o.y), dy, t, cells.scaleY, cells.cellsY, cy);
+    vfloat tz = cellFaceDistance(vset1(o.z), dz, t, cells.scaleZ, cells.cellsZ, cz);
+    tExit = vmin(tx, vmin(ty, tz));
+
+    vint cell = vaddi(vmuli(vaddi(vmuli(cz, vset1i(cells.cellsY)), cy), vset1i(cells.cellsX)), cx);
+    vint mm = vgatherbytes(cells.minMax, vaddi(cell, cell));
+    vint lo = vset1i(0xff);
+
+    return vori(vslli(vandi(mm, lo), 8), vandi(vsrli(mm, 8), lo));
+}
+
+// the lanes whose cell at t is empty, see macrocellKeyV()
+inline vmask macrocellEmptyV(const CpuMacrocells &cells, const vec3 &o, vfloat dx, vfloat dy, vfloat dz,
+                             vfloat t, vfloat &tExit, vint &key)
+{
+    key = macrocellKeyV(cells, o, dx, dy, dz, t, tExit);
+    vint visible = vandi(vgatherbytes(cells.visible, key), vset1i(0xff));
+
+    return vlt(vtofloat(visible), vset1(0.5f));
+}
+
+// macrocellLowerBound() and macrocellUpperBound() for a whole packet
+inline vfloat macrocellLowerBoundV(const CpuMacrocells &cells, vint key)
+{
+    vfloat bin = vtofloat(vsrli(key, 8));
+    return vfmadd(bin, vset1(cells.binStep), vset1(cells.sampleMin)) - vset1(cells.binMargin);
+}
+
+inline vfloat macrocellUpperBoundV(const CpuMacrocells &cells, vint key)
+{
+    vfloat bin = vtofloat(vandi(key, vset1i(0xff)));
+    return vfmadd(bin, vset1(cells.binStep), vset1(cells.sampleMin)) + vset1(cells.binMargin);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// packet marcher
+////////////////////////////////////////////////////////////////////////////////
+
+// eye rays of the packet at (px, py); lanes outside the image or the pixel
+// mask, or whose ray misses the volume, are left out of the masks
+struct PacketRays
+{
+    vec3 o;
+    float tnear[SIMD_WIDTH], tfar[SIMD_WIDTH];
+    float dx[SIMD_WIDTH], dy[SIMD_WIDTH], dz[SIMD_WIDTH];
+    int laneBits;       // ray hits the volume
+    int imageBits;      // pixel inside the image and the pixel mask
+};
+
+// per-lane ray setup is done exactly as in the scalar path
+static void setupPacketRays(const CpuRenderArgs &args, uint px, uint py, uint xEnd, uint yEnd, PacketRays &rays)
+{
+    const vec3 boxMin = make_vec3(-1.0f, -1.0f, -1.0f);
+    const vec3 boxMax = make_vec3(1.0f, 1.0f, 1.0f);
+
+    rays.o = make_vec3(args.invViewMatrix[3], args.invViewMatrix[7], args.invViewMatrix[11]);
+    rays.laneBits = rays.imageBits = 0;
+
+    for (int l = 0; l < SIMD_WIDTH; l++)
+    {
+        uint x = px + (l % PACKET_W) * args.pixelStride;
+        uint y = py + (l / PACKET_W) * args.pixelStride;
+
+        rays.tnear[l] = rays.tfar[l] = 0.0f;
+        rays.dx[l] = rays.dy[l] = rays.dz[l] = 0.0f;
+
+        if (x >= xEnd || y >= yEnd) continue;
+
+        if (args.pixelMask && !args.pixelMask[y * args.imageW + x]) continue;
+
+        rays.imageBits |= 1 << l;
+
+        float u = (x / (float) args.imageW)*2.0f-1.0f;
+        float v = (y / (float) args.imageH)*2.0f-1.0f;
+        CpuRay eyeRay = eyeRayForPixel(args.invViewMatrix, u, v);
+        float tnear, tfar;
+
+        if (!intersectBoxCpu(eyeRay, boxMin, boxMax, &tnear, &tfar)) continue;
+
+        if (tnear < 0.0f) tnear = 0.0f;     // clamp to near plane
+
+        rays.laneBits |= 1 << l;
+        rays.tnear[l] = tnear;
+        rays.tfar[l] = tfar;
+        rays.dx[l] = eyeRay.d.x;
+        rays.dy[l] = eyeRay.d.y;
+        rays.dz[l] = eyeRay.d.z;
+    }
+}
+
+// image offset of a lane's pixel
+static size_t packetPixel(const CpuRenderArgs &args, uint px, uint py, int l)
+{
+    uint x = px + (l % PACKET_W) * args.pixelStride;
+    uint y = py + (l / PACKET_W) * args.pixelStride;
+    return (size_t)y * args.imageW + x;
+}
+
+// writes the packet's pixels that lie inside the image
+static void storePacket(const CpuRenderArgs &args, uint px, uint py, const PacketRays &rays, vint rgbaV)
+{
+    int rgba[SIMD_WIDTH];
+    vstorei(rgba, rgbaV);
+
+    for (int l = 0; l < SIMD_WIDTH; l++)
+    {
+        if (rays.imageBits & (1 << l))
+        {
+            args.output[packetPixel(args, px, py, l)] = (uint)rgba[l];
+        }
+    }
+}
+
+template <typename Voxel, bool linearFilter, bool adaptive, bool preint, bool fixedPoint>
+static void renderPacket(const CpuRenderArgs &args, uint px, uint py, uint xEnd, uint yEnd, CpuFrameStats &stats)
+{
+    PacketRays rays;
+    setupPacketRays(args, px, py, xEnd, yEnd, rays);
+    const vec3 &o = rays.o;
+
+    unsigned long long samples = 0;
+    vfloat sr = vset1(0.0f), sg = vset1(0.0f), sb = vset1(0.0f), sa = vset1(0.0f);
+    vfloat error = vset1(0.0f);
+
+    // opacity weighted sums of t and t^2 for the reprojection depth
+    const bool trackDepth = args.depth != 0;
+    vfloat tSum = vset1(0.0f), tSqSum = vset1(0.0f);
+
+    if (rays.laneBits)
+    {
+        // each lane keeps its own sample index, so lanes can skip empty
+        // macrocells independently; sample i of a lane is at tnear + i*tstep
+        vmask active = vmaskfrombits(rays.laneBits);
+        vfloat tnear = vload(rays.tnear), tfar = vload(rays.tfar);
+        vfloat dx = vload(rays.dx), dy = vload(rays.dy), dz = vload(rays.dz);
+        vfloat idx = vset1(0.0f);
+        vfloat tCellEnd = vset1(-INFINITY);
+        vfloat cellStep = vset1(1.0f), cellRange = vset1(0.0f);
+        const float step = preint ? cpuTstep * PREINT_STEP_SCALE : cpuTstep;
+        vfloat tstep = vset1(step), invTstep = vset1(1.0f / step);
+        vfloat maxSteps = vset1(adaptive ? INFINITY :
+                                preint ? (float)((cpuMaxSteps + PREINT_STEP_SCALE - 1) / PREINT_STEP_SCALE) :
+                                (float)cpuMaxSteps);
+        vfloat front = vset1(0.0f);
+        vmask haveFront = vmaskfrombits(0);
+        vmask rewind = vmaskfrombits(0);
+        CpuLodWalker lod;
+        lod.init(args.lod, *args.volume);
+        vfloat half = vset1(0.5f);
+        vfloat threshold = vset1(cpuOpacityThreshold);
+        vfloat zero = vset1(0.0f), one = vset1(1.0f);
+
+        for (;;)
+        {
+            vfloat t = vfmadd(idx, tstep, tnear);
+
+            // done when past the far intersection or out of steps; with
+            // pre-integration a lane first closes its ray with a shorter
+            // segment ending at tfar, see renderPixel()
+            vmask past = vmand(vgt(idx, zero), vgt(t, tfar));
+            vmask last = preint ? vmand(vmand(active, past), haveFront) : vmaskfrombits(0);
+            active = vmandnot(active, vmandnot(past, last));
+            active = vmandnot(active, vge(idx, maxSteps));
+            last = vmand(last, active);
+
+            if (!vany(active)) break;
+
+            vfloat partial = one;
+
+            if (preint && vany(last))
+            {
+                partial = vmin(vmax((tfar - (t - tstep)) * invTstep, zero), one);
+                t = vselect(last, tfar, t);
+            }
+
+            vmask sampling = active;
+
+            if (args.macrocells)
+            {
+                vmask lookup = vmandnot(vmand(active, vge(t, tCellEnd)), last);
+
+                if (vany(lookup))
+                {
+                    vfloat tExit;
+                    vint key;
+                    vmask empty = vmand(lookup, macrocellEmptyV(*args.macrocells, o, dx, dy, dz, t, tExit, key));
+
+                    // lanes in an empty cell jump to the first sample past it
+                    vfloat next = vmax(vceil((tExit - tnear) * invTstep), idx + one);
+                    idx = vselect(empty, next, idx);
+                    tCellEnd = vselect(vmandnot(lookup, empty), tExit, tCellEnd);
+                    sampling = vmandnot(active, empty);
+
+                    if (preint)
+                    {
+                        // a lane that jumped restarts one sample before the
+                        // visible cell, where the segment entering it begins
+                        haveFront = vmandnot(haveFront, empty);
+                        rewind = vmor(rewind, empty);
+                        vmask back = vmand(rewind, sampling);
+                        idx = vselect(back, idx - one, idx);
+                        rewind = vmandnot(rewind, back);
+                        t = vselect(back, vfmadd(idx, tstep, tnear), t);
+                    }
+
+                    if (adaptive)
+                    {
+                        vmask entered = vmandnot(lookup, empty);
+                        vint stepBytes = vandi(vgatherbytes(args.macrocells->stepScale, key), vset1i(0xff));
+                        vfloat stepFloor = vset1((float)args.stepScale);    // coarse refinement passes
+                        cellStep = vselect(entered, vmax(vtofloat(stepBytes), stepFloor), cellStep);
+                        cellRange = vselect(entered, vgatherf(args.macrocells->alphaRange, key), cellRange);
+                    }
+
+                    if (!vany(sampling)) continue;
+                }
+            }
+
+            // index of each lane's next sample, see renderPixel()
+            vfloat next = idx + one;
+
+            if (adaptive)
+            {
+                vfloat cellLast = vceil((tCellEnd - tnear) * invTstep);
+                next = vmax(vmin(idx + cellStep, cellLast), next);
+            }
+
+            // the packet samples the level of its nearest lane
+            while (lod.tNext < INFINITY && !vany(vmand(sampling, vlt(t, vset1(lod.tNext)))))
+            {
+                lod.advance(lod.tNext);
+            }
+
+            if (!preint && lod.stepScale > 1)
+            {
+                next = vmax(next, idx + vset1((float)lod.stepScale));
+            }
+
+            const CpuVolume &vol = *lod.volume;
+
+            // remap position to [0, 1] coordinates
+            vfloat u = vfmadd(vfmadd(dx, t, vset1(o.x)), half, half);
+            vfloat v = vfmadd(vfmadd(dy, t, vset1(o.y)), half, half);
+            vfloat w = vfmadd(vfmadd(dz, t, vset1(o.z)), half, half);
+
+            samples += vcount(sampling);
+
+            if (preint)
+            {
+                vfloat sample = sampleVolumeV<Voxel, linearFilter>(vol, u, v, w);
+
+                // the first sample of a run only opens a segment
+                vmask composite = vmand(sampling, haveFront);
+                vfloat pr, pg, pb, pa;
+                samplePreintV(*args.preint, front, sample, pr, pg, pb, pa);
+                front = vselect(sampling, sample, front);
+                haveFront = vmor(haveFront, sampling);
+
+                if (vany(last))
+                {
+                    // once per ray, so the length correction is done per lane
+                    float aL[SIMD_WIDTH], pL[SIMD_WIDTH], sL[SIMD_WIDTH];
+                    vstore(aL, pa);
+                    vstore(pL, partial);
+
+                    for (int l = 0; l < SIMD_WIDTH; l++)
+                    {
+                        float a = 1.0f - powf(1.0f - aL[l], pL[l]);
+                        sL[l] = aL[l] > 0.0f ? a / aL[l] : 0.0f;
+                        aL[l] = a;
+                    }
+
+                    vfloat s = vload(sL);
+                    pr = vselect(last, pr * s, pr);
+                    pg = vselect(last, pg * s, pg);
+                    pb = vselect(last, pb * s, pb);
+                    pa = vselect(last, vload(aL), pa);
+                }
+
+                // segment colour comes premultiplied
+                vfloat f = one - sa;
+                sr = vselect(composite, vfmadd(pr, f, sr), sr);
+                sg = vselect(composite, vfmadd(pg, f, sg), sg);
+                sb = vselect(composite, vfmadd(pb, f, sb), sb);
+                sa = vselect(composite, vfmadd(pa, f, sa), sa);
+
+                if (trackDepth)
+                {
+                    vfloat wt = t * pa * f;
+                    tSum = vselect(composite, tSum + wt, tSum);
+                    tSqSum = vselect(composite, vfmadd(t, wt, tSqSum), tSqSum);
+                }
+
+                active = vmandnot(vmandnot(active, vgt(sa, threshold)), last);
+                idx = vselect(sampling, next, idx);
+                continue;
+            }
+
+            vfloat cr, cg, cb, ca;
+            classifyV<Voxel, linearFilter>(args, vol, u, v, w, cr, cg, cb, ca, std::integral_constant<bool, fixedPoint>());
+
+            if (adaptive || lod.stepScale > 1)
+            {
+                // opacity correction for the longer steps
+                vfloat ratio = next - idx;
+                vmask longStep = vmand(sampling, vgt(ratio, one));
+
+                if (vany(longStep))
+                {
+                    error = vselect(longStep, vfmadd((one - sa) * cellRange, ratio - one, error), error);
+                    vfloat corrected = one - vpowi(one - vmin(vmax(ca, zero), one), vtoint(ratio));
+                    ca = vselect(longStep, corrected, ca);
+                }
+            }
+
+            // pre-multiply alpha and blend "over" in the sampling lanes only
+            vfloat f = (one - sa) * ca;
+            sr = vselect(sampling, vfmadd(cr, f, sr), sr);
+            sg = vselect(sampling, vfmadd(cg, f, sg), sg);
+            sb = vselect(sampling, vfmadd(cb, f, sb), sb);
+            sa = vselect(sampling, vfmadd(one - sa, ca, sa), sa);
+
+            if (trackDepth)
+            {
+                vfloat wt = t * f;
+                tSum = vselect(sampling, tSum + wt, tSum);
+                tSqSum = vselect(sampling, vfmadd(t, wt, tSqSum), tSqSum);
+            }
+
+            // exit early if opaque
+            active = vmandnot(active, vgt(sa, threshold));
+            idx = vselect(sampling, next, idx);
+        }
+    }
+
+    if (trackDepth)
+    {
+        float aL[SIMD_WIDTH], sumL[SIMD_WIDTH], sqL[SIMD_WIDTH];
+        vstore(aL, sa);
+        vstore(sumL, tSum);
+        vstore(sqL, tSqSum);
+
+        for (int l = 0; l < SIMD_WIDTH; l++)
+        {
+            if (rays.laneBits & (1 << l))
+            {
+                storeRayDepth(args, packetPixel(args, px, py, l), aL[l], sumL[l], sqL[l]);
+            }
+        }
+    }
+
+    vfloat brightness = vset1(args.brightness);
+    storePacket(args, px, py, rays, rgbaFloatToIntV(sr * brightness, sg * brightness, sb * brightness, sa * brightness));
+
+    float errorL[SIMD_WIDTH];
+    vstore(errorL, error);
+
+    for (int l = 0; l < SIMD_WIDTH; l++)
+    {
+        stats.error += errorL[l];
+    }
+
+    stats.rays += __builtin_popcount(rays.laneBits);
+    stats.samples += samples;
+}
+
+// projectPixel() for a packet of rays
+template <typename Voxel, bool linearFilter, int mode>
+static void projectPacket(const CpuRenderArgs &args, uint px, uint py, uint xEnd, uint yEnd, CpuFrameStats &stats)
+{
+    const CpuVolume &vol = *args.volume;
+    PacketRays rays;
+    setupPacketRays(args, px, py, xEnd, yEnd, rays);
+    const vec3 &o = rays.o;
+
+    const CpuMacrocells *cells = mode == RENDER_AVERAGE ? 0 : args.macrocells;
+    vfloat result = vset1(mode == RENDER_MIP ? -INFINITY : mode == RENDER_MINIP ? INFINITY : 0.0f);
+    vfloat count = vset1(0.0f);
+    vfloat tResult = vset1(NAN);
+    unsigned long long samples = 0;
+
+    if (rays.laneBits)
+    {
+        vmask active = vmaskfrombits(rays.laneBits);
+        vfloat tnear = vload(rays.tnear), tfar = vload(rays.tfar);
+        vfloat dx = vload(rays.dx), dy = vload(rays.dy), dz = vload(rays.dz);
+        vfloat idx = vset1(0.0f);
+        vfloat tCellEnd = vset1(-INFINITY);
+        vfloat tstep = vset1(cpuTstep * args.stepScale), invTstep = vset1(1.0f / (cpuTstep * args.stepScale));
+        vfloat maxSteps = vset1((float)((cpuMaxSteps + args.stepScale - 1) / args.stepScale));
+        vfloat valueMin = vset1(vol.rawMin * voxelScale<Voxel>());
+        vfloat valueMax = vset1(vol.rawMax * voxelScale<Voxel>());
+        vfloat half = vset1(0.5f), zero = vset1(0.0f), one = vset1(1.0f);
+        CpuLodWalker lod;
+        lod.init(args.lod, vol);
+
+        for (;;)
+        {
+            vfloat t = vfmadd(idx, tstep, tnear);
+
+            active = vmandnot(active, vmand(vgt(idx, zero), vgt(t, tfar)));
+            active = vmandnot(active, vge(idx, maxSteps));
+
+            if (!vany(active)) break;
+
+            vmask sampling = active;
+
+            if (cells)
+            {
+                vmask lookup = vmand(active, vge(t, tCellEnd));
+
+                if (vany(lookup))
+                {
+                    // lanes whose cell cannot change the result jump to the
+                    // first sample past it
+                    vfloat tExit;
+                    vint key = macrocellKeyV(*cells, o, dx, dy, dz, t, tExit);
+                    vmask skip = mode == RENDER_MIP ? vge(result, macrocellUpperBoundV(*cells, key)) :
+                                                      vge(macrocellLowerBoundV(*cells, key), result);
+                    skip = vmand(lookup, skip);
+
+                    vfloat next = vmax(vceil((tExit - tnear) * invTstep), idx + one);
+                    idx = vselect(skip, next, idx);
+                    tCellEnd = vselect(vmandnot(lookup, skip), tExit, tCellEnd);
+                    sampling = vmandnot(active, skip);
+
+                    if (!vany(sampling)) continue;
+                }
+            }
+
+            while (lod.tNext < INFINITY && !vany(vmand(sampling, vlt(t, vset1(lod.tNext)))))
+            {
+                lod.advance(lod.tNext);
+            }
+
+            // steps of the level, counted in steps of this pass
+            vfloat step = vset1(lod.stepScale > args.stepScale ? (float)(lod.stepScale / args.stepScale) : 1.0f);
+
+            // remap position to [0, 1] coordinates
+            vfloat u = vfmadd(vfmadd(dx, t, vset1(o.x)), half, half);
+            vfloat v = vfmadd(vfmadd(dy, t, vset1(o.y)), half, half);
+            vfloat w = vfmadd(vfmadd(dz, t, vset1(o.z)), half, half);
+            vfloat sample = sampleVolumeV<Voxel, linearFilter>(*lod.volume, u, v, w);
+
+            samples += vcount(sampling);
+
+            if (mode == RENDER_MIP)
+            {
+                tResult = vselect(vmand(sampling, vgt(sample, result)), t, tResult);
+                result = vselect(sampling, vmax(result, sample), result);
+                active = vmandnot(active, vge(result, valueMax));
+            }
+            else if (mode == RENDER_MINIP)
+            {
+                tResult = vselect(vmand(sampling, vgt(result, sample)), t, tResult);
+                result = vselect(sampling, vmin(result, sample), result);
+                active = vmandnot(active, vge(valueMin, result));
+            }
+            else
+            {
+                result = vselect(sampling, vfmadd(sample, step, result), result);
+                count = vselect(sampling, count + step, count);
+            }
+
+            idx = vselect(sampling, idx + step, idx);
+        }
+    }
+
+    if (mode == RENDER_AVERAGE)
+    {
+        result = result / vmax(count, vset1(1.0f));
+    }
+
+    if (args.depth)
+    {
+        float depth[SIMD_WIDTH];
+        vstore(depth, tResult);
+
+        for (int l = 0; l < SIMD_WIDTH; l++)
+        {
+            if (rays.laneBits & (1 << l))
+            {
+                args.depth[packetPixel(args, px, py, l)] = depth[l];
+                args.spread[packetPixel(args, px, py, l)] = 0.0f;
+            }
+        }
+    }
+
+    // pixels the ray misses stay black
+    vfloat grey = vmin(vmax((result - vset1(args.transferOffset)) * vset1(args.transferScale), vset1(0.0f)), vset1(1.0f));
+    grey = vselect(vmaskfrombits(rays.laneBits), grey * vset1(args.brightness), vset1(0.0f));
+    storePacket(args, px, py, rays, rgbaFloatToIntV(grey, grey, grey, grey));
+
+    stats.rays += __builtin_popcount(rays.laneBits);
+    stats.samples += samples;
+}
+
+template <typename Voxel, bool linearFilter, bool adaptive, bool preint, bool fixedPoint>
+struct PacketEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        for (uint y = y0; y < y1; y += PACKET_H * args.pixelStride)
+        {
+            for (uint x = x0; x < x1; x += PACKET_W * args.pixelStride)
+            {
+                renderPacket<Voxel, linearFilter, adaptive, preint, fixedPoint>(args, x, y, x1, y1, stats);
+            }
+        }
+    }
+};
+
+template <typename Voxel, bool linearFilter, int mode>
+struct PacketProjectionEngine
+{
+    static void renderTile(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+    {
+        for (uint y = y0; y < y1; y += PACKET_H * args.pixelStride)
+        {
+            for (uint x = x0; x < x1; x += PACKET_W * args.pixelStride)
+            {
+                projectPacket<Voxel, linearFilter, mode>(args, x, y, x1, y1, stats);
+            }
+        }
+    }
+};
+
+} // namespace
+
+void SIMD_TILE_FUNC(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    CpuTileFunc renderTile = args.mode == RENDER_COMPOSITE ? selectEngine<PacketEngine>(args) :
+                                                              selectProjection<PacketProjectionEngine>(args);
+    renderTile(args, x0, y0, x1, y1, stats);
+}
+
+#else
+
+// instruction set not available to this compiler, never selected at runtime
+void SIMD_TILE_FUNC(const CpuRenderArgs &args, uint x0, uint y0, uint x1, uint y1, CpuFrameStats &stats)
+{
+    renderTileScalar(args, x0, y0, x1, y1, stats);
+}
+
+#endif
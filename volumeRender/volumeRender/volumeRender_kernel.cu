@@ -17,12 +17,17 @@
 #include <helper_cuda.h>
 #include <helper_math.h>
 
+#include "volumeRender_mode.h"
+
 typedef unsigned int  uint;
 typedef unsigned char uchar;
 
 cudaArray *d_volumeArray = 0;
 cudaArray *d_transferFuncArray;
 
+static RenderMode renderMode = RENDER_COMPOSITE;
+static RenderPass renderPass = fullRenderPass;
+
 typedef unsigned char VolumeType;
 //typedef unsigned short VolumeType;
 
@@ -99,21 +104,35 @@ __device__ uint rgbaFloatToInt(float4 rgba)
     return (uint(rgba.w*255)<<24) | (uint(rgba.z*255)<<16) | (uint(rgba.y*255)<<8) | uint(rgba.x*255);
 }
 
+// write the colour of the ray at (x, y) to its block of the pass
+__device__ void writeBlock(uint *d_output, uint imageW, uint rowEnd, uint x, uint y,
+                           uint pixelStride, uint rgba)
+{
+    for (uint by = y; by < y + pixelStride && by < rowEnd; by++)
+    {
+        for (uint bx = x; bx < x + pixelStride && bx < imageW; bx++)
+        {
+            d_output[by*imageW + bx] = rgba;
+        }
+    }
+}
+
 __global__ void
 d_render(uint *d_output, uint imageW, uint imageH,
          float density, float brightness,
-         float transferOffset, float transferScale)
+         float transferOffset, float transferScale, RenderPass pass)
 {
-    const int maxSteps = 500;
-    const float tstep = 0.01f;
+    const int maxSteps = (500 + pass.stepScale - 1) / pass.stepScale;
+    const float tstep = 0.01f*pass.stepScale;
     const float opacityThreshold = 0.95f;
     const float3 boxMin = make_float3(-1.0f, -1.0f, -1.0f);
     const float3 boxMax = make_float3(1.0f, 1.0f, 1.0f);
 
-    uint x = blockIdx.x*blockDim.x + threadIdx.x;
-    uint y = blockIdx.y*blockDim.y + threadIdx.y;
+    uint x = (blockIdx.x*blockDim.x + threadIdx.x)*pass.pixelStride;
+    uint y = pass.rowBegin + (blockIdx.y*blockDim.y + threadIdx.y)*pass.pixelStride;
+    uint rowEnd = min(pass.rowEnd, imageH);
 
-    if ((x >= imageW) || (y >= imageH)) return;
+    if ((x >= imageW) || (y >= rowEnd)) return;
 
     float u = (x / (float) imageW)*2.0f-1.0f;
     float v = (y / (float) imageH)*2.0f-1.0f;
@@ -128,7 +147,12 @@ d_render(uint *d_output, uint imageW, uint imageH,
     float tnear, tfar;
     int hit = intersectBox(eyeRay, boxMin, boxMax, &tnear, &tfar);
 
-    if (!hit) return;
+    if (!hit)
+    {
+        // a refinement pass may not clear the image first
+        writeBlock(d_output, imageW, rowEnd, x, y, pass.pixelStride, 0);
+        return;
+    }
 
     if (tnear < 0.0f) tnear = 0.0f;     // clamp to near plane
 
@@ -148,6 +172,10 @@ d_render(uint *d_output, uint imageW, uint imageH,
         float4 col = tex1D(transferTex, (sample-transferOffset)*transferScale);
         col.w *= density;
 
+        // opacity of a stepScale times longer segment
+        if (pass.stepScale > 1)
+            col.w = 1.0f - __powf(1.0f - __saturatef(col.w), (float)pass.stepScale);
+
         // "under" operator for back-to-front blending
         //sum = lerp(sum, col, col.w);
 
@@ -172,7 +200,94 @@ d_render(uint *d_output, uint imageW, uint imageH,
     sum *= brightness;
 
     // write output color
-    d_output[y*imageW + x] = rgbaFloatToInt(sum);
+    writeBlock(d_output, imageW, rowEnd, x, y, pass.pixelStride, rgbaFloatToInt(sum));
+}
+
+// reduce each ray to its maximum, minimum or mean sample, windowed by the
+// transfer offset and scale and written as a grey level
+template <int mode>
+__global__ void
+d_project(uint *d_output, uint imageW, uint imageH, float brightness,
+          float transferOffset, float transferScale, RenderPass pass)
+{
+    const int maxSteps = (500 + pass.stepScale - 1) / pass.stepScale;
+    const float tstep = 0.01f*pass.stepScale;
+    const float3 boxMin = make_float3(-1.0f, -1.0f, -1.0f);
+    const float3 boxMax = make_float3(1.0f, 1.0f, 1.0f);
+
+    uint x = (blockIdx.x*blockDim.x + threadIdx.x)*pass.pixelStride;
+    uint y = pass.rowBegin + (blockIdx.y*blockDim.y + threadIdx.y)*pass.pixelStride;
+    uint rowEnd = min(pass.rowEnd, imageH);
+
+    if ((x >= imageW) || (y >= rowEnd)) return;
+
+    float u = (x / (float) imageW)*2.0f-1.0f;
+    float v = (y / (float) imageH)*2.0f-1.0f;
+
+    // calculate eye ray in world space
+    Ray eyeRay;
+    eyeRay.o = make_float3(mul(c_invViewMatrix, make_float4(0.0f, 0.0f, 0.0f, 1.0f)));
+    eyeRay.d = normalize(make_float3(u, v, -2.0f));
+    eyeRay.d = mul(c_invViewMatrix, eyeRay.d);
+
+    // find intersection with box
+    float tnear, tfar;
+    int hit = intersectBox(eyeRay, boxMin, boxMax, &tnear, &tfar);
+
+    if (!hit)
+    {
+        writeBlock(d_output, imageW, rowEnd, x, y, pass.pixelStride, 0);
+        return;
+    }
+
+    if (tnear < 0.0f) tnear = 0.0f;     // clamp to near plane
+
+    // same samples as d_render takes
+    float result = mode == RENDER_MIP ? -1e30f : mode == RENDER_MINIP ? 1e30f : 0.0f;
+    int count = 0;
+    float t = tnear;
+    float3 pos = eyeRay.o + eyeRay.d*tnear;
+    float3 step = eyeRay.d*tstep;
+
+    for (int i=0; i<maxSteps; i++)
+    {
+        float sample = tex3D(tex, pos.x*0.5f+0.5f, pos.y*0.5f+0.5f, pos.z*0.5f+0.5f);
+
+        if (mode == RENDER_MIP)
+            result = fmaxf(result, sample);
+        else if (mode == RENDER_MINIP)
+            result = fminf(result, sample);
+        else
+            result += sample;
+
+        count++;
+        t += tstep;
+
+        if (t > tfar) break;
+
+        pos += step;
+    }
+
+    if (mode == RENDER_AVERAGE) result /= count;
+
+    float grey = __saturatef((result - transferOffset)*transferScale) * brightness;
+
+    // write output color
+    writeBlock(d_output, imageW, rowEnd, x, y, pass.pixelStride, rgbaFloatToInt(make_float4(grey)));
+}
+
+extern "C"
+void setRenderMode(RenderMode mode)
+{
+    renderMode = mode;
+}
+
+// pass for the following render_kernel() calls; the grid must cover
+// the pass's rays, see render() in volumeRender.cpp
+extern "C"
+void setRenderPass(RenderPass pass)
+{
+    renderPass = pass;
 }
 
 extern "C"
@@ -244,8 +359,28 @@ extern "C"
 void render_kernel(dim3 gridSize, dim3 blockSize, uint *d_output, uint imageW, uint imageH,
                    float density, float brightness, float transferOffset, float transferScale)
 {
-    d_render<<<gridSize, blockSize>>>(d_output, imageW, imageH, density,
-                                      brightness, transferOffset, transferScale);
+    switch (renderMode)
+    {
+        case RENDER_MIP:
+            d_project<RENDER_MIP><<<gridSize, blockSize>>>(d_output, imageW, imageH, brightness,
+                                                            transferOffset, transferScale, renderPass);
+            break;
+
+        case RENDER_MINIP:
+            d_project<RENDER_MINIP><<<gridSize, blockSize>>>(d_output, imageW, imageH, brightness,
+                                                              transferOffset, transferScale, renderPass);
+            break;
+
+        case RENDER_AVERAGE:
+            d_project<RENDER_AVERAGE><<<gridSize, blockSize>>>(d_output, imageW, imageH, brightness,
+                                                                transferOffset, transferScale, renderPass);
+            break;
+
+        default:
+            d_render<<<gridSize, blockSize>>>(d_output, imageW, imageH, density,
+                                              brightness, transferOffset, transferScale, renderPass);
+            break;
+    }
 }
 
 extern "C"
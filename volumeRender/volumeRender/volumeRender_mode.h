@@ -0,0 +1,53 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Render modes and passes shared by the CUDA and the CPU backend
+//
+// Besides the emission-absorption compositing of d_render, a ray can be
+// reduced to a single value: its maximum, minimum or mean sample.  The
+// projected value is windowed by the transfer offset and scale and shown
+// as a grey level.
+
+#ifndef _VOLUMERENDER_MODE_H_
+#define _VOLUMERENDER_MODE_H_
+
+enum RenderMode
+{
+    RENDER_COMPOSITE,       // transfer function, front to back "over"
+    RENDER_MIP,             // maximum intensity projection
+    RENDER_MINIP,           // minimum intensity projection
+    RENDER_AVERAGE,         // mean sample along the ray
+    RENDER_MODE_COUNT
+};
+
+// names as accepted by -mode=
+static const char *const renderModeNames[RENDER_MODE_COUNT] =
+{
+    "composite", "mip", "minip", "average"
+};
+
+// One pass of progressive refinement.  A ray is cast for every pixelStride-th
+// pixel of every pixelStride-th row, counted from rowBegin, and its colour
+// fills the pixelStride x pixelStride block below and right of it; rays
+// march stepScale reference steps at a time (opacity is corrected for the
+// longer steps).  Only rows [rowBegin, rowEnd) are written.  pixelStride is
+// a power of two up to 16.
+struct RenderPass
+{
+    unsigned int pixelStride;
+    unsigned int stepScale;
+    unsigned int rowBegin, rowEnd;
+};
+
+// the whole image at full quality
+static const RenderPass fullRenderPass = { 1, 1, 0, ~0u };
+
+#endif // #ifndef _VOLUMERENDER_MODE_H_
@@ -0,0 +1,332 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Octree volume files (.boc), shared by the octree tool and the CPU backend
+//
+// The octree tool reads a text listing of the tree, one node per line in
+// depth first order: "2" opens a parent whose eight children follow, any
+// other number is the density of a leaf.  The children of a parent split
+// its cube in half along every axis and come in x, y, z order, x fastest:
+// child i is the upper half in x if (i & 1), in y if (i & 2) and in z if
+// (i & 4).  The root covers the whole volume, [-1, 1]^3 in world space.
+//
+// A version 2 .boc file is laid out to be mapped and used as it is, with
+// no pointers and nothing to parse: the header, the parents as an array
+// of OctreeFileNode, then the densities of the leaves as an array of
+// floats.  Both arrays are in breadth first order, level by level and
+// within a level in the child order above, so the children of a parent
+// that are parents themselves are consecutive in the node array, and
+// those that are leaves consecutive in the leaf array; childMask tells
+// which is which.  The root is node 0, or leaf 0 if the tree is a single
+// leaf.  Every parent has eight children, so there are always 7n + 1
+// leaves for n parents.  Numbers are in the byte order of the machine
+// that wrote the file.
+//
+// A version 1 file is the text listing in binary: the header, then one
+// 32 bit float per node in depth first order, with parents stored as a
+// quiet NaN (which unlike the 2 of the text form cannot be mistaken for a
+// density).  The renderer still reads these, converting them on load.
+
+#ifndef _VOLUMERENDER_OCTREE_H_
+#define _VOLUMERENDER_OCTREE_H_
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+struct OctreeFileHeaderV1
+{
+    char magic[4];                  // "BOC" and a NUL
+    unsigned int version;           // 1
+    unsigned long long nodeCount;   // floats following the header
+};
+
+// 64 bytes, so that the node array starts on a cache line
+struct OctreeFileHeader
+{
+    char magic[4];                  // "BOC" and a NUL
+    unsigned int version;           // 2
+    unsigned long long nodeCount;   // parents
+    unsigned long long leafCount;   // leaves, 7 * nodeCount + 1
+    unsigned long long nodeOffset;  // of the node array in the file, a multiple of 64
+    unsigned long long leafOffset;  // of the leaf array, a multiple of 64
+    unsigned int depth;             // levels below the root
+    unsigned int reserved[5];       // 0
+};
+
+// 32 bytes, two to a cache line
+struct OctreeFileNode
+{
+    unsigned long long childBase;   // node index of the first child that is a parent
+    unsigned long long leafBase;    // leaf index of the first child that is a leaf
+    float minValue, maxValue;       // over all leaves below
+    unsigned int childMask;         // bit i set if child i is a parent
+    unsigned int reserved;          // 0
+};
+
+static const char octreeFileMagic[4] = { 'B', 'O', 'C', 0 };
+
+#define OCTREE_FILE_VERSION 2
+#define OCTREE_FILE_ALIGN   64
+
+// deepest tree the renderer accepts; below this a cell is smaller than
+// the float precision of a ray through the unit cube
+#define OCTREE_MAX_DEPTH 24
+
+// bit pattern of a parent node in a .boc file
+#define OCTREE_PARENT_BITS 0x7fc00002u
+
+inline float octreeParentMarker()
+{
+    unsigned int bits = OCTREE_PARENT_BITS;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline bool octreeIsParent(float f)
+{
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits == OCTREE_PARENT_BITS;
+}
+
+inline bool octreeChildIsParent(const OctreeFileNode &node, int child)
+{
+    return (node.childMask >> child) & 1;
+}
+
+// bits set in the low byte; the builtin is a library call without -mpopcnt
+inline unsigned int octreeBitCount(unsigned int bits)
+{
+    bits &= 0xff;
+    bits -= (bits >> 1) & 0x55;
+    bits = (bits & 0x33) + ((bits >> 2) & 0x33);
+    return (bits + (bits >> 4)) & 0x0f;
+}
+
+// index of a child in the node array if it is a parent, else in the leaf array
+inline unsigned long long octreeChildIndex(const OctreeFileNode &node, int child)
+{
+    bool parent = octreeChildIsParent(node, child);
+    unsigned int siblings = parent ? node.childMask : ~node.childMask;
+
+    return (parent ? node.childBase : node.leafBase) + octreeBitCount(siblings & ((1u << child) - 1));
+}
+
+inline unsigned long long octreeAlign(unsigned long long offset)
+{
+    return (offset + OCTREE_FILE_ALIGN - 1) / OCTREE_FILE_ALIGN * OCTREE_FILE_ALIGN;
+}
+
+// true if a version 2 header describes a tree that fits into its file
+inline bool octreeHeaderValid(const OctreeFileHeader &h, unsigned long long fileSize)
+{
+    return fileSize >= sizeof(h) &&
+           h.leafCount == 7 * h.nodeCount + 1 &&
+           h.depth <= OCTREE_MAX_DEPTH &&
+           h.nodeOffset >= sizeof(h) && h.leafOffset >= h.nodeOffset && h.leafOffset <= fileSize &&
+           h.nodeOffset % OCTREE_FILE_ALIGN == 0 && h.leafOffset % OCTREE_FILE_ALIGN == 0 &&
+           h.nodeCount <= (h.leafOffset - h.nodeOffset) / sizeof(OctreeFileNode) &&
+           h.leafCount <= (fileSize - h.leafOffset) / sizeof(float);
+}
+
+// true if the node array under a valid header is the breadth first listing
+// of one tree: the children of each node follow those of the nodes before
+// it, none lies outside the arrays, and there are no more levels than the
+// header says.  This reads every node, so loading does it only on request.
+inline bool octreeNodesValid(const OctreeFileHeader &h, const OctreeFileNode *nodes)
+{
+    unsigned long long nextNode = 1, nextLeaf = 0, levelEnd = 0;
+    unsigned int levels = 0;
+
+    for (unsigned long long i = 0; i < h.nodeCount; i++)
+    {
+        const OctreeFileNode &node = nodes[i];
+        unsigned int parents = octreeBitCount(node.childMask);
+
+        // every node but the root is a child of one before it
+        if (i >= nextNode || node.childMask > 0xff ||
+            (parents > 0 && node.childBase != nextNode) || (parents < 8 && node.leafBase != nextLeaf))
+        {
+            return false;
+        }
+
+        // the first node of a level; the nodes before it have listed the next
+        if (i == levelEnd)
+        {
+            levels++;
+            levelEnd = nextNode;
+        }
+
+        nextNode += parents;
+        nextLeaf += 8 - parents;
+    }
+
+    return (h.nodeCount == 0 || nextNode == h.nodeCount) && levels <= h.depth;
+}
+
+// Rearranges a depth first listing into the breadth first arrays of a
+// version 2 file, one node at a time.  A depth first walk meets the nodes
+// of any one level in breadth first order, so it is enough to keep one
+// list per level and join them at the end; a parent is appended to its
+// level's list when its last child is done, which happens in the same
+// order.  Until the lists are joined, childBase and leafBase count from
+// the start of the children's level.  The lists may be taken away (and
+// cleared) at any time to bound memory, as the octree tool does; the
+// counts keep running.
+struct OctreeLevelBuilder
+{
+    std::vector<OctreeFileNode> nodes[OCTREE_MAX_DEPTH + 1];
+    std::vector<float> leaves[OCTREE_MAX_DEPTH + 1];
+    unsigned long long nodeCount[OCTREE_MAX_DEPTH + 1];    // per level, taken or not
+    unsigned long long leafCount[OCTREE_MAX_DEPTH + 1];
+
+    struct OpenParent
+    {
+        OctreeFileNode node;
+        int child;                  // the next one to come
+    };
+
+    OpenParent open[OCTREE_MAX_DEPTH];
+    int openCount;
+    int depth;                      // levels below the root so far
+    bool started;
+
+    OctreeLevelBuilder()
+    {
+        memset(nodeCount, 0, sizeof(nodeCount));
+        memset(leafCount, 0, sizeof(leafCount));
+        openCount = 0;
+        depth = 0;
+        started = false;
+    }
+
+    // adds the next node of the listing, a parent if octreeIsParent(value);
+    // false if that parent would go deeper than OCTREE_MAX_DEPTH
+    bool add(float value)
+    {
+        int level = openCount;
+
+        if (octreeIsParent(value))
+        {
+            if (level == OCTREE_MAX_DEPTH)
+            {
+                return false;
+            }
+
+            mark(true);
+
+            OpenParent &parent = open[openCount++];
+            memset(&parent, 0, sizeof(parent));
+            parent.node.childBase = nodeCount[level + 1];
+            parent.node.leafBase = leafCount[level + 1];
+            parent.node.minValue = INFINITY;
+            parent.node.maxValue = -INFINITY;
+            depth = openCount > depth ? openCount : depth;
+            return true;
+        }
+
+        mark(false);
+        leaves[level].push_back(value);
+        leafCount[level]++;
+        include(value, value);
+
+        // close the parents this was the last child of
+        while (openCount > 0 && open[openCount - 1].child == 8)
+        {
+            const OctreeFileNode &node = open[--openCount].node;
+            nodes[openCount].push_back(node);
+            nodeCount[openCount]++;
+            include(node.minValue, node.maxValue);
+        }
+
+        return true;
+    }
+
+    // true once the root and all of its descendants have been added
+    bool complete() const
+    {
+        return started && openCount == 0;
+    }
+
+    // where the levels start in the joined arrays
+    void levelStarts(unsigned long long *nodeStart, unsigned long long *leafStart) const
+    {
+        unsigned long long n = 0, l = 0;
+
+        for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+        {
+            nodeStart[level] = n;
+            leafStart[level] = l;
+            n += nodeCount[level];
+            l += leafCount[level];
+        }
+    }
+
+    // the header of the joined file, once complete()
+    void header(OctreeFileHeader &h) const
+    {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, octreeFileMagic, sizeof(h.magic));
+        h.version = OCTREE_FILE_VERSION;
+
+        for (int level = 0; level <= OCTREE_MAX_DEPTH; level++)
+        {
+            h.nodeCount += nodeCount[level];
+            h.leafCount += leafCount[level];
+        }
+
+        h.nodeOffset = octreeAlign(sizeof(h));
+        h.leafOffset = octreeAlign(h.nodeOffset + h.nodeCount * sizeof(OctreeFileNode));
+        h.depth = depth;
+    }
+
+    // turns the node counts of a level's list from level relative to
+    // absolute, given levelStarts()
+    static void relocate(OctreeFileNode *node, size_t count, int level,
+                         const unsigned long long *nodeStart, const unsigned long long *leafStart)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            node[i].childBase += nodeStart[level + 1];
+            node[i].leafBase += leafStart[level + 1];
+        }
+    }
+
+private:
+    // the new node is the next child of the innermost open parent
+    void mark(bool parent)
+    {
+        started = true;
+
+        if (openCount > 0)
+        {
+            OpenParent &p = open[openCount - 1];
+            p.node.childMask |= parent ? 1u << p.child : 0;
+            p.child++;
+        }
+    }
+
+    // widens the innermost open parent's range
+    void include(float minValue, float maxValue)
+    {
+        if (openCount > 0)
+        {
+            OctreeFileNode &node = open[openCount - 1].node;
+            node.minValue = minValue < node.minValue ? minValue : node.minValue;
+            node.maxValue = maxValue > node.maxValue ? maxValue : node.maxValue;
+        }
+    }
+};
+
+#endif // #ifndef _VOLUMERENDER_OCTREE_H_
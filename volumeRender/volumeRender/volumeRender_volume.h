@@ -0,0 +1,144 @@
+/*
+ * Copyright 1993-2013 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// Volume files (.bvol), shared by the volume tool, the CPU backend and the
+// sample itself
+//
+// A raw file says nothing about itself: its size, voxel type and value
+// range come from the command line, and the CPU backend scans the whole
+// volume for the range and converts it to its layout on every start.  A
+// .bvol file holds the volume already in one of the CPU backend's layouts
+// (see CpuVolumeLayout), with a header that describes it, so loading it
+// is reading the header and mapping the file.
+//
+// The file holds the header, a table of checksums (volumeFileChecksum(),
+// one per block of blockBytes bytes of the payload, the last block maybe
+// shorter), then from payloadOffset, a multiple of VOLUME_FILE_ALIGN, the
+// payload: the voxels in the layout, payloadBytes of them, followed by
+// VOLUME_FILE_TAIL zero bytes so that a reader mapping the file can look
+// a little past the volume.  A bricked payload has a checksum per brick,
+// the others one per VOLUME_FILE_BLOCK bytes, so a damaged file can be
+// told where it is damaged.  Numbers are in the byte order of the machine
+// that wrote the file.
+
+#ifndef _VOLUMERENDER_VOLUME_H_
+#define _VOLUMERENDER_VOLUME_H_
+
+#include <stdio.h>
+#include <string.h>
+
+// 128 bytes
+struct VolumeFileHeader
+{
+    char magic[4];                      // "BVL" and a NUL
+    unsigned int version;               // 1
+    unsigned int width, height, depth;
+    unsigned int voxelType;             // a CpuVoxelType
+    unsigned int voxelSize;             // bytes per voxel
+    unsigned int layout;                // a CpuVolumeLayout
+    unsigned int brickSize;             // voxels along a brick of the bricked layout, else 0
+    float spacing[3];                   // distance between voxels along x, y and z
+    float rawMin, rawMax;               // range of voxelValue() over the volume
+    unsigned int checksumCount;         // blocks of the payload
+    unsigned int reserved0;             // 0
+    unsigned long long blockBytes;      // payload bytes per checksum
+    unsigned long long checksumOffset;  // of the checksum table in the file
+    unsigned long long payloadOffset;   // of the voxels, a multiple of VOLUME_FILE_ALIGN
+    unsigned long long payloadBytes;    // of the voxels, not counting the tail
+    unsigned int reserved[8];           // 0
+};
+
+static const char volumeFileMagic[4] = { 'B', 'V', 'L', 0 };
+
+#define VOLUME_FILE_VERSION 1
+#define VOLUME_FILE_ALIGN   4096
+#define VOLUME_FILE_BLOCK   (1 << 20)
+#define VOLUME_FILE_TAIL    64
+
+// bytes per voxel of each CpuVoxelType: uint8, uint16, float, half
+static const unsigned int volumeFileVoxelSize[4] = { 1, 2, 4, 2 };
+
+// FNV-1a over 64 bit words, folded after every word so that the high bits
+// reach the low ones; several GB/s, and it is only there to catch damage
+inline unsigned long long volumeFileChecksum(const void *data, size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned long long hash = 14695981039346656037ull ^ bytes;
+    size_t i = 0;
+
+    for (; i + 8 <= bytes; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+
+    for (; i < bytes; i++)
+    {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// fills in the offsets of a header whose volume, layout, payloadBytes and
+// blockBytes are set
+inline void volumeFileOffsets(VolumeFileHeader &h)
+{
+    h.checksumCount = (unsigned int)((h.payloadBytes + h.blockBytes - 1) / h.blockBytes);
+    h.checksumOffset = sizeof(h);
+    h.payloadOffset = (h.checksumOffset + (unsigned long long)h.checksumCount * 8 + VOLUME_FILE_ALIGN - 1) /
+                      VOLUME_FILE_ALIGN * VOLUME_FILE_ALIGN;
+}
+
+// true if a header is a version this code reads, and the file is long
+// enough for what it describes; whether the payload matches the layout is
+// for the CPU backend to tell
+inline bool volumeFileHeaderValid(const VolumeFileHeader &h, unsigned long long fileSize)
+{
+    if (fileSize < sizeof(h) || memcmp(h.magic, volumeFileMagic, sizeof(h.magic)) ||
+        h.version != VOLUME_FILE_VERSION || h.width == 0 || h.height == 0 || h.depth == 0 ||
+        h.width > 1u << 30 || h.height > 1u << 30 || h.depth > 1u << 30 ||
+        h.voxelType > 3 || h.voxelSize != volumeFileVoxelSize[h.voxelType] || h.layout > 2 ||
+        h.payloadBytes == 0 || h.payloadBytes > fileSize || h.blockBytes == 0 ||
+        (h.payloadBytes - 1) / h.blockBytes >= 0xffffffffull)
+    {
+        return false;
+    }
+
+    VolumeFileHeader expected = h;
+    volumeFileOffsets(expected);
+
+    return h.checksumCount == expected.checksumCount && h.checksumOffset == expected.checksumOffset &&
+           h.payloadOffset == expected.payloadOffset && h.payloadOffset <= fileSize &&
+           h.payloadBytes <= fileSize - h.payloadOffset &&
+           VOLUME_FILE_TAIL <= fileSize - h.payloadOffset - h.payloadBytes;
+}
+
+// reads the header of a file; false if it cannot be read or is not a
+// volume file (a raw volume, say)
+inline bool readVolumeFileHeader(const char *path, VolumeFileHeader &h)
+{
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+    {
+        return false;
+    }
+
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && !memcmp(h.magic, volumeFileMagic, sizeof(h.magic));
+    fclose(fp);
+
+    return ok;
+}
+
+#endif // #ifndef _VOLUMERENDER_VOLUME_H_